@@ -134,7 +134,7 @@ float3 calculateNormalDifferentialTriangle(__global TTriangle* _tr, __global TMe
 // me -> buffer of all meshes
 // ra_me -> range of mesh buffer
 // @return -> computed reflect ray
-TRay getReflectedRay(TRay* _ray, TIntersect* is, __global TSphere* sp, __global TTriangle* tr,
+TRay getReflectedRay(TRay* _ray, TIntersect* is, __global TSphereData* spd, __global TTriangle* tr,
 	__global TMesh* me, __global unsigned int* ra_me)
 {
 	float3 D = is->ray.dir;
@@ -150,7 +150,7 @@ TRay getReflectedRay(TRay* _ray, TIntersect* is, __global TSphere* sp, __global
 	float dDotN = dotVector3D(D, N);
 	
 	if (is->isSphere) {
-		dn = calculateNormalDifferentialSphere(sp[is->obj_index].radius, &(dp.dx), is->frontFacing);
+		dn = calculateNormalDifferentialSphere(spd[is->obj_index].radius, &(dp.dx), is->frontFacing);
 	}
 	else {
 		dn = calculateNormalDifferentialTriangle(tr, me, is, &(dp.dx));
@@ -160,7 +160,7 @@ TRay getReflectedRay(TRay* _ray, TIntersect* is, __global TSphere* sp, __global
 			+ dotVector3D(D, dn)) * N);
 	
 	if (is->isSphere) {
-		dn = calculateNormalDifferentialSphere(sp[is->obj_index].radius, &(dp.dy), is->frontFacing);
+		dn = calculateNormalDifferentialSphere(spd[is->obj_index].radius, &(dp.dy), is->frontFacing);
 	}
 	else {
 		dn = calculateNormalDifferentialTriangle(tr, me, is, &(dp.dy));
@@ -184,12 +184,12 @@ TRay getReflectedRay(TRay* _ray, TIntersect* is, __global TSphere* sp, __global
 // Compute ray refracted from intersected point.
 // ray -> incoming ray
 // is -> information about intersection
-// sp -> buffer of all spheres
+// spd -> transforms and materials of all spheres
 // tr -> buffer of all triangles
 // me -> buffer of all meshes
 // ra_me -> range of mesh buffer
 // @return -> computed refract ray
-TRay getRefractedRay(TRay* _ray, TIntersect* is, __global TSphere* sp, __global TTriangle* tr,
+TRay getRefractedRay(TRay* _ray, TIntersect* is, __global TSphereData* spd, __global TTriangle* tr,
 	__global TMesh* me, __global unsigned int* ra_me)
 {
 	TVector3D D = _ray->dir;
@@ -206,7 +206,7 @@ TRay getRefractedRay(TRay* _ray, TIntersect* is, __global TSphere* sp, __global
 	float r = dotVector3D(minusVector3D(D), N);
 	float c = 1 - eta*eta * (1 - r*r);
 	if (c < 0) {
-		return getReflectedRay(_ray, is, sp, tr, me, ra_me);
+		return getReflectedRay(_ray, is, spd, tr, me, ra_me);
 	}
 
 	TVector3D T = floatMultVector3D(eta, D) + floatMultVector3D((eta * r - sqrt(c)), N);
@@ -221,7 +221,7 @@ TRay getRefractedRay(TRay* _ray, TIntersect* is, __global TSphere* sp, __global
 	float dmu0 = (eta - eta*eta* dotVector3D(D, N) / dotVector3D(T, N));
 
 	if (is->isSphere) {
-		dn = calculateNormalDifferentialSphere(sp[is->obj_index].radius, &(dp.dx), is->frontFacing);
+		dn = calculateNormalDifferentialSphere(spd[is->obj_index].radius, &(dp.dx), is->frontFacing);
 	}
 	else {
 		dn = calculateNormalDifferentialTriangle(tr, me, is, &(dp.dx));
@@ -230,7 +230,7 @@ TRay getRefractedRay(TRay* _ray, TIntersect* is, __global TSphere* sp, __global
 	dd.dx = eta*_ray->dd.dx - (floatMultVector3D(mu, dn) + floatMultVector3D(dmu, N));
 
 	if (is->isSphere) {
-		dn = calculateNormalDifferentialSphere(sp[is->obj_index].radius, &(dp.dy), is->frontFacing);
+		dn = calculateNormalDifferentialSphere(spd[is->obj_index].radius, &(dp.dy), is->frontFacing);
 	}
 	else {
 		dn = calculateNormalDifferentialTriangle(tr, me, is, &(dp.dy));
@@ -251,17 +251,28 @@ TRay getRefractedRay(TRay* _ray, TIntersect* is, __global TSphere* sp, __global
 }
 
 // Compute if ray intersect sphere without information about it.
-// sp -> information about sphere
+// sp -> center and squared radius of sphere
+// spd -> transforms of sphere, used only for ellipsoid
 // ray -> information about ray
 // @return -> successful of intersect sphere
-bool sphereIntersect(TSphere* sp, TRay* ray) 
+bool sphereIntersect(TSphere* sp, __global TSphereData* spd, TRay* ray) 
 {
-	float3 o = matrix_mul_point3D(&(sp->InvWorldTransform), ray->orig);
-	float3 d = matrix_mul_vector3D(&(sp->InvWorldTransform), ray->dir);
+	float3 o, d;
+	float radius2 = sp->centerRadius2.w;
+	if (radius2 >= 0.0f) {
+		o = ray->orig - sp->centerRadius2.xyz;
+		d = ray->dir;
+	}
+	else {
+		TMatrix invWorldTransform = spd->InvWorldTransform;
+		o = matrix_mul_point3D(&invWorldTransform, ray->orig);
+		d = matrix_mul_vector3D(&invWorldTransform, ray->dir);
+		radius2 = spd->radius*spd->radius;
+	}
 
 	float A = d.x*d.x + d.y*d.y + d.z*d.z;
 	float B = 2.0f * (d.x*o.x + d.y*o.y + d.z*o.z);
-	float C = o.x*o.x + o.y*o.y + o.z*o.z - sp->radius*sp->radius;
+	float C = o.x*o.x + o.y*o.y + o.z*o.z - radius2;
 
 	float t0, t1;
 	if (!solveQuadratic(A, B, C, &t0, &t1)) return false;
@@ -273,19 +284,34 @@ bool sphereIntersect(TSphere* sp, TRay* ray)
 }
 
 // Compute if ray intersect sphere within information about it.
-// sp -> information about sphere
+// sp -> center and squared radius of sphere
+// spd -> transforms and material of sphere
 // ray -> information about ray
 // is -> information about intersect
 // @return -> successful of intersect sphere
-bool sphereIntersectIs(const TSphere* sp, const TRay* ray, TIntersect* is) 
+bool sphereIntersectIs(const TSphere* sp, __global TSphereData* spd, const TRay* ray, TIntersect* is) 
 {
 	float M_PI2 = 3.14159265358f;
-	float3 o = matrix_mul_point3D(&(sp->InvWorldTransform), ray->orig);
-	float3 d = matrix_mul_vector3D(&(sp->InvWorldTransform), ray->dir);
+	bool simple = sp->centerRadius2.w >= 0.0f;
+	float3 o, d;
+	float radius;
+	TMatrix worldTransform;
+	if (simple) {
+		o = ray->orig - sp->centerRadius2.xyz;
+		d = ray->dir;
+		radius = sqrt(sp->centerRadius2.w);
+	}
+	else {
+		TMatrix invWorldTransform = spd->InvWorldTransform;
+		worldTransform = spd->WorldTransform;
+		o = matrix_mul_point3D(&invWorldTransform, ray->orig);
+		d = matrix_mul_vector3D(&invWorldTransform, ray->dir);
+		radius = spd->radius;
+	}
 
 	float A = d.x*d.x + d.y*d.y + d.z*d.z;
 	float B = 2.0f * (d.x*o.x + d.y*o.y + d.z*o.z);
-	float C = o.x*o.x + o.y*o.y + o.z*o.z - sp->radius*sp->radius;
+	float C = o.x*o.x + o.y*o.y + o.z*o.z - radius*radius;
 
 	float t0, t1;
 	if (!solveQuadratic(A, B, C, &t0, &t1)) return false;
@@ -296,20 +322,25 @@ bool sphereIntersectIs(const TSphere* sp, const TRay* ray, TIntersect* is)
 	float t = t0 < ray->minT ? t1 : t0;
 	float3 p = o + t*d;
 	float3 n = p;
-	n /= sp->radius;
+	n /= radius;
 
 	float u = atan2(-p.z, p.x) / (2.0f * M_PI2);
 	if (u < 0.0f) u += 1.0f;
-	float v = acos(p.y / sp->radius) / M_PI2;
+	float v = acos(p.y / radius) / M_PI2;
 	if (v != v)
 		v = p.y > 0.0f ? 0.0f : 1.0f;
 
 	is->ray = *ray;
-	is->material = sp->material;
+	is->material = spd->material;
 	is->hitTime = t;
-	is->position = matrix_mul_point3D(&(sp->WorldTransform), p);
-
-	is->normal = matrix_mul_vector3D(&(sp->WorldTransform), n);
+	if (simple) {
+		is->position = sp->centerRadius2.xyz + p;
+		is->normal = n;
+	}
+	else {
+		is->position = matrix_mul_point3D(&worldTransform, p);
+		is->normal = matrix_mul_vector3D(&worldTransform, n);
+	}
 	normalizeVector3D(&(is->normal));
 	is->view = -ray->dir;
 	is->frontFacing = dotVector3D(is->view, is->normal) > 0.0f;
@@ -321,6 +352,81 @@ bool sphereIntersectIs(const TSphere* sp, const TRay* ray, TIntersect* is)
 	return true;
 }
 
+float getItemFloat3(float3* vec, unsigned int i) 
+{
+	if (i == 0) {
+		return (*vec).x;
+	}
+	else if (i == 1) {
+		return (*vec).y;
+	}
+	else {
+		return (*vec).z;
+	}
+}
+
+// Watertight ray-triangle test (Woop, Benthin, Wald 2013), same as on CPU.
+// Vertices are sheared to space where ray goes along +z, shared edge of two
+// triangles gives same edge function with opposite sign for both of them.
+// ray -> information about ray
+// v0, v1, v2 -> vertices of triangle
+// t -> distance of hit, range of ray is not checked
+// b0, b1, b2 -> barycentric coordinates of vertices v0, v1, v2
+// @return -> successful of intersect triangle
+bool watertightIntersect(TRay* ray, float3 v0, float3 v1, float3 v2,
+	float* t, float* b0, float* b1, float* b2)
+{
+	float3 absDir = fabs(ray->dir);
+	unsigned int kz = (absDir.y > absDir.x) ? 1 : 0;
+	if (absDir.z > getItemFloat3(&absDir, kz))
+		kz = 2;
+	unsigned int kx = (kz + 1) % 3;
+	unsigned int ky = (kx + 1) % 3;
+	float dirZ = getItemFloat3(&(ray->dir), kz);
+	if (dirZ < 0.0f) {
+		unsigned int k = kx;
+		kx = ky;
+		ky = k;
+	}
+
+	float Sx = getItemFloat3(&(ray->dir), kx) / dirZ;
+	float Sy = getItemFloat3(&(ray->dir), ky) / dirZ;
+	float Sz = 1.0f / dirZ;
+
+	float3 A = v0 - ray->orig;
+	float3 B = v1 - ray->orig;
+	float3 C = v2 - ray->orig;
+
+	float az = getItemFloat3(&A, kz);
+	float bz = getItemFloat3(&B, kz);
+	float cz = getItemFloat3(&C, kz);
+	float ax = getItemFloat3(&A, kx) - Sx * az;
+	float ay = getItemFloat3(&A, ky) - Sy * az;
+	float bx = getItemFloat3(&B, kx) - Sx * bz;
+	float by = getItemFloat3(&B, ky) - Sy * bz;
+	float cx = getItemFloat3(&C, kx) - Sx * cz;
+	float cy = getItemFloat3(&C, ky) - Sy * cz;
+
+	float U = cx * by - cy * bx;
+	float V = ax * cy - ay * cx;
+	float W = bx * ay - by * ax;
+
+	if ((U < 0.0f || V < 0.0f || W < 0.0f) && (U > 0.0f || V > 0.0f || W > 0.0f))
+		return false;
+
+	float det = U + V + W;
+	if (det == 0.0f)
+		return false;
+
+	float T = U * Sz * az + V * Sz * bz + W * Sz * cz;
+	float rcpDet = 1.0f / det;
+	*t = T * rcpDet;
+	*b0 = U * rcpDet;
+	*b1 = V * rcpDet;
+	*b2 = W * rcpDet;
+	return true;
+}
+
 // Compute if ray intersect triangle without information about it.
 // tr -> information about triangle
 // ray -> information about ray
@@ -331,45 +437,19 @@ bool sphereIntersectIs(const TSphere* sp, const TRay* ray, TIntersect* is)
 bool triangleIntersect(TTriangle* tr, TRay* ray, __global TMesh* me,
 	__global unsigned int* ra_me, uint _cnt_meshes) 
 {
-	float t, v, w;
-	float eps = 0.001f;
-	float3 P = ray->orig;
-	float3 D = ray->dir;
+	float t, u, v, w;
 
 	uint index = getBeginMesh(ra_me, _cnt_meshes, tr->mesh);
 	float3 v0 = getVtxPosition(me, index + tr->vtx[0].p);
 	float3 v1 = getVtxPosition(me, index + tr->vtx[1].p);
 	float3 v2 = getVtxPosition(me, index + tr->vtx[2].p);
 
-	float3 e1 = v1 - v0;
-	float3 e2 = v2 - v0;
-
-	float3 N = crossProductVector3D(e1, e2);
-	float s = -dotVector3D(D, N);
-
-	if (abs(convert_long(s)) < eps)
+	if (!watertightIntersect(ray, v0, v1, v2, &t, &u, &v, &w))
 		return false;
 
-	float s_inv = 1 / s;
-
-	float3 R = P - v0;
-	t = dotVector3D(R, N) * s_inv;
-
 	if ((t <= ray->minT) || (t >= ray->maxT))
 		return false;
 
-	float3 Q = -crossProductVector3D(D, R);
-	v = dotVector3D(Q, e2) * s_inv;
-
-	if (v < 0)
-		return false;
-
-	float3 minus_e1 = minusVector3D(e1);
-	w = dotVector3D(minus_e1, Q) * s_inv;
-
-	if ((w < 0) || (v + w) > 1)
-		return false;
-
 	return true;
 }
 
@@ -386,46 +466,18 @@ bool triangleIntersectIs(TTriangle* tr, TRay* ray, TIntersect* is,
 {
 	
 	float t, u, v, w;
-	float eps = 0.001f;
-	float3 P = ray->orig;
-	float3 D = ray->dir;
 
 	uint index = getBeginMesh(ra_me, _cnt_meshes, tr->mesh);
 	float3 v0 = getVtxPosition(me, index + tr->vtx[0].p);
 	float3 v1 = getVtxPosition(me, index + tr->vtx[1].p);
 	float3 v2 = getVtxPosition(me, index + tr->vtx[2].p);
 
-	float3 e1 = v1 - v0;
-	float3 e2 = v2 - v0;
-
-	float3 N = crossProductVector3D(e1, e2); 
-	float s = -dotVector3D(D, N);
-
-	if (abs(convert_long(s)) < eps)
+	if (!watertightIntersect(ray, v0, v1, v2, &t, &u, &v, &w))
 		return false;
 
-	float s_inv = 1 / s;
-
-	float3 R = P - v0;
-	t = dotVector3D(R, N) * s_inv;
-
 	if ((t <= ray->minT) || (t >= ray->maxT))
 		return false;
 
-	float3 Q = -crossProductVector3D(D, R);
-	v = dotVector3D(Q, e2) * s_inv;
-	
-	if (v < 0)
-		return false;
-
-	float3 minus_e1 = minusVector3D(e1);
-	w = dotVector3D(minus_e1, Q) * s_inv;
-
-	if ((w < 0) || (v + w) > 1)
-		return false;
-
-	u = 1 - v - w;
-
 	is->ray = *ray;
 	is->material = tr->material;
 	if (!is->material.isMat) {
@@ -477,19 +529,6 @@ TColor evalBRDFdiffuse(TMaterial* material)
 	return floatDivVector3D(material->color, M_PI2);
 }
 
-float getItemFloat3(float3* vec, unsigned int i) 
-{
-	if (i == 0) {
-		return (*vec).x;
-	}
-	else if (i == 1) {
-		return (*vec).y;
-	}
-	else {
-		return (*vec).z;
-	}
-}
-
 void swap(float* t1, float* t2)
 {
 	float t = *t1;
@@ -524,4 +563,41 @@ bool boxIntersect(TRay* ray, TPoint3D mMin, TPoint3D mMax, float* tMin, float* t
 	return true;
 }
 
+// Add counters of one ray to statistics of all rays and reset them.
+// stats -> statistics in global memory, NULL if counting is disabled
+// counters -> counters of ray
+void addTraversalStats(__global TTraversalStats* stats, TCounters* counters)
+{
+	if (stats) {
+		uint nodeBin = min((uint)(32 - clz(counters->nodes)), (uint)(TRAVERSAL_HISTOGRAM_BINS - 1));
+		uint primitiveBin = min((uint)(32 - clz(counters->primitives)), (uint)(TRAVERSAL_HISTOGRAM_BINS - 1));
+		atom_inc(&stats->rays);
+		atom_add(&stats->nodes, (ulong)counters->nodes);
+		atom_add(&stats->primitives, (ulong)counters->primitives);
+		atomic_max(&stats->maxNodes, counters->nodes);
+		atomic_max(&stats->maxPrimitives, counters->primitives);
+		atomic_inc(&stats->nodeHistogram[nodeBin]);
+		atomic_inc(&stats->primitiveHistogram[primitiveBin]);
+	}
+	counters->nodes = 0;
+	counters->primitives = 0;
+}
+
+// False colour of traversal cost of ray for heatmap mode. Cost is sum of
+// visited nodes and tested objects in log scale, from blue over cyan, green
+// and yellow to red for HEATMAP_MAX_COST and more.
+// counters -> counters of ray
+// @return -> color of cost
+TColor heatColor(TCounters* counters)
+{
+	float cost = counters->nodes + counters->primitives;
+	float t = 4.f * clamp(log2(1.f + cost) / log2(1.f + HEATMAP_MAX_COST), 0.f, 1.f);
+
+	TColor color;
+	color.x = clamp(t - 2.f, 0.f, 1.f);
+	color.y = clamp(t, 0.f, 1.f) - clamp(t - 3.f, 0.f, 1.f);
+	color.z = 1.f - clamp(t - 1.f, 0.f, 1.f);
+	return color;
+}
+
 #endif // _KERNEL_FUNCTION_H_
\ No newline at end of file
@@ -13,13 +13,15 @@
 // Intersect object without information about it.
 // ray -> information about ray
 // sp -> buffer of all spheres
+// spd -> transforms and materials of all spheres
 // tr -> buffer of all triangles
 // me -> buffer of all meshes
 // ra_me -> buffer of size every mesh
+// counters -> counters of traversal
 // @return -> successful of intersect 
-bool intersect_list(TRay* ray, __global TSphere* sp, unsigned int cnt_sp,
+bool intersect_list(TRay* ray, __global TSphere* sp, __global TSphereData* spd, unsigned int cnt_sp,
 	__global TTriangle* tr, unsigned int cnt_tr, __global TMesh* me,
-	__global unsigned int* ra_me, unsigned int cnt_ra_me)
+	__global unsigned int* ra_me, unsigned int cnt_ra_me, TCounters* counters)
 {
 	TSphere sphere;
 	TTriangle triangle;
@@ -27,7 +29,8 @@ bool intersect_list(TRay* ray, __global TSphere* sp, unsigned int cnt_sp,
 	// Try intersect every sphere.
 	for (int i = 0; i < cnt_sp; i++) {
 		sphere = sp[i];
-		if (sphereIntersect(&sphere, ray)) {
+		counters->primitives++;
+		if (sphereIntersect(&sphere, spd + i, ray)) {
 			return true;
 		}
 	}
@@ -35,6 +38,7 @@ bool intersect_list(TRay* ray, __global TSphere* sp, unsigned int cnt_sp,
 	// Try intersect every triangle.
 	for (int i = 0; i < cnt_tr; i++) {
 		triangle = tr[i];
+		counters->primitives++;
 		if (triangleIntersect(&triangle, ray, me, ra_me, cnt_ra_me)) {
 			return true;
 		}
@@ -47,13 +51,15 @@ bool intersect_list(TRay* ray, __global TSphere* sp, unsigned int cnt_sp,
 // ray -> information about ray
 // is -> information about intersection
 // sp -> buffer of all spheres
+// spd -> transforms and materials of all spheres
 // tr -> buffer of all triangles
 // me -> buffer of all meshes
 // ra_me -> buffer of size every mesh
+// counters -> counters of traversal
 // @return -> successful of intersect 
-bool intersectIs_list(TRay* ray, TIntersect* is, __global TSphere* sp, unsigned int cnt_sp,
+bool intersectIs_list(TRay* ray, TIntersect* is, __global TSphere* sp, __global TSphereData* spd, unsigned int cnt_sp,
 	__global TTriangle* tr, unsigned int cnt_tr, __global TMesh* me,
-	__global unsigned int* ra_me, unsigned int cnt_ra_me)
+	__global unsigned int* ra_me, unsigned int cnt_ra_me, TCounters* counters)
 {
 	is->hitTime = INFINITY;
 
@@ -64,7 +70,8 @@ bool intersectIs_list(TRay* ray, TIntersect* is, __global TSphere* sp, unsigned
 	// Try intersect every sphere.
 	for (int i = 0; i < cnt_sp; i++) {
 		sphere = sp[i];
-		if (sphereIntersectIs(&sphere, ray, &currentIs)) {
+		counters->primitives++;
+		if (sphereIntersectIs(&sphere, spd + i, ray, &currentIs)) {
 			// Is object near than previous intersected object.
 			if (currentIs.hitTime < is->hitTime) {
 				*is = currentIs;
@@ -76,6 +83,7 @@ bool intersectIs_list(TRay* ray, TIntersect* is, __global TSphere* sp, unsigned
 	// Try intersect every triangle.
 	for (int i = 0; i < cnt_tr; i++) {
 		triangle = tr[i];
+		counters->primitives++;
 		if (triangleIntersectIs(&triangle, ray, &currentIs, me, ra_me, cnt_ra_me)) {
 			// Is object near than previous intersected object.
 			if (currentIs.hitTime < (is->hitTime - 0.001f)) { // Caution ... values are very small different
@@ -93,14 +101,17 @@ bool intersectIs_list(TRay* ray, TIntersect* is, __global TSphere* sp, unsigned
 // ray -> information about ray
 // depth -> maximum depth of computation
 // sp -> buffer of all spheres
+// spd -> transforms and materials of all spheres
 // tr -> buffer of all triangles
 // me -> buffer of all meshes
 // ra_me -> buffer of size every mesh
+// stats -> traversal statistics, NULL if counting is disabled
 // @return -> result color for pixel
-TColor trace_list(TRay ray, uint depth, uint2 seed, __global TSphere* sp, unsigned int cnt_sp,
+TColor trace_list(TRay ray, uint depth, uint2 seed, __global TSphere* sp, __global TSphereData* spd, unsigned int cnt_sp,
 	__global TTriangle* tr, unsigned int cnt_tr, __global TMesh* me,
 	__global unsigned int* ra_me, unsigned int cnt_ra_me,
-	__global TLight* lights, unsigned int cnt_li)
+	__global TLight* lights, unsigned int cnt_li,
+	__global TTraversalStats* stats)
 {
 	TColor stack[500];
 	unsigned int stack_id = 0;
@@ -112,6 +123,8 @@ TColor trace_list(TRay ray, uint depth, uint2 seed, __global TSphere* sp, unsign
 	float absorption_factor = 1 / (1 - p_absorption);
 
 	TIntersect is;
+	TCounters counters;
+	counters.nodes = 0; counters.primitives = 0;
 
 	TColor directLight, indirectLight;
 
@@ -120,7 +133,9 @@ TColor trace_list(TRay ray, uint depth, uint2 seed, __global TSphere* sp, unsign
 		indirectLight.x = 0.0f; indirectLight.y = 0.0f; indirectLight.z = 0.0f;
 		isEnd = true;
 		// Try to intersect any object.
-		if (intersectIs_list(&ray, &is, sp, cnt_sp, tr, cnt_tr, me, ra_me, cnt_ra_me)) { // OK
+		bool hit = intersectIs_list(&ray, &is, sp, spd, cnt_sp, tr, cnt_tr, me, ra_me, cnt_ra_me, &counters);
+		addTraversalStats(stats, &counters);
+		if (hit) { // OK
 			// Found intersection -> compute color.
 			TMaterial material = is.material;
 
@@ -134,11 +149,11 @@ TColor trace_list(TRay ray, uint depth, uint2 seed, __global TSphere* sp, unsign
 			// Next ray will be?
 			if (light_type <= reflectivity) {
 				// Reflected ray.
-				ray = getReflectedRay(&ray, &is, sp, tr, me, ra_me); // OK
+				ray = getReflectedRay(&ray, &is, spd, tr, me, ra_me); // OK
 			}
 			else if ((light_type - reflectivity) <= transparency) {
 				// Refracted ray.
-				ray = getRefractedRay(&ray, &is, sp, tr, me, ra_me); // OK
+				ray = getRefractedRay(&ray, &is, spd, tr, me, ra_me); // OK
 			}
 			else {
 				// Compute color.
@@ -148,8 +163,10 @@ TColor trace_list(TRay ray, uint depth, uint2 seed, __global TSphere* sp, unsign
 					TLight light = lights[i]; // OK
 					TRay shadowRay = getShadowRay(&light, &is); // OK
 
+					bool shadowHit = intersect_list(&shadowRay, sp, spd, cnt_sp, tr, cnt_tr, me, ra_me, cnt_ra_me, &counters);
+					addTraversalStats(stats, &counters);
 					// Is point visible by light?
-					if (!intersect_list(&shadowRay, sp, cnt_sp, tr, cnt_tr, me, ra_me, cnt_ra_me)) { // OK
+					if (!shadowHit) { // OK
 						float intensity = pow(shadowRay.maxT, -2);
 						TColor incomingRadiance = light.radiance * intensity;
 						TVector3D lightVec = light.worldPos - is.position;
@@ -239,4 +256,29 @@ TColor trace_list(TRay ray, uint depth, uint2 seed, __global TSphere* sp, unsign
 } // End of function
 
 
+// Compute traversal cost of ray as false colour for heatmap mode.
+// Only ray from camera is traced, without bounces and shadow rays.
+// sp -> buffer of all spheres
+// spd -> transforms and materials of all spheres
+// tr -> buffer of all triangles
+// me -> buffer of all meshes
+// ra_me -> buffer of size every mesh
+// stats -> traversal statistics, NULL if counting is disabled
+// @return -> result color for pixel
+TColor heatmap_list(TRay ray, __global TSphere* sp, __global TSphereData* spd, unsigned int cnt_sp,
+	__global TTriangle* tr, unsigned int cnt_tr, __global TMesh* me,
+	__global unsigned int* ra_me, unsigned int cnt_ra_me,
+	__global TTraversalStats* stats)
+{
+	TIntersect is;
+	TCounters counters;
+	counters.nodes = 0; counters.primitives = 0;
+
+	intersectIs_list(&ray, &is, sp, spd, cnt_sp, tr, cnt_tr, me, ra_me, cnt_ra_me, &counters);
+	TColor color = heatColor(&counters);
+	addTraversalStats(stats, &counters);
+
+	return color;
+}
+
 #endif // _KERNEL_TRACE_LIST_H_
\ No newline at end of file
@@ -10,866 +10,237 @@
 #include "kernel_types.h"
 #include "kernel_functions.h"
 
-unsigned char GetFirstNode(float tx0, float ty0, float tz0, float txm, float tym, float tzm, unsigned char rayFlags)
-{
-	unsigned int entryPlane = 0;
-	//Get entry plane
-
-	if (tx0 > ty0){
-		if (tx0 > tz0)
-		{
-			if (tym < tx0) entryPlane |= 2;
-			if (tzm < tx0) entryPlane |= 1;
-			return entryPlane;
-		}
-	}
-	else if (ty0 > tz0){
-		if (txm < ty0) entryPlane |= 4;
-		if (tzm < ty0) entryPlane |= 1;
-		return entryPlane;
-	}
-
-	if (txm < tz0) entryPlane |= 4;
-	if (tym < tz0) entryPlane |= 2;
+// Traversal is stackless. Ray enters leaf found by descent from root and then
+// goes from leaf to leaf by neighbour links (ropes) of exit face.
 
-	return entryPlane; //returns the first node
+// Point of octree grid given by cell coordinates and size of cell.
+// All planes are computed by same expression, so shared faces match exactly.
+TPoint3D getOctreeGridPoint(TOctree octree_info, TPoint3D cell, float scale)
+{
+	return octree_info.boxMin + (octree_info.boxMax - octree_info.boxMin) * (cell * scale);
 }
 
-unsigned char GetNextNode(unsigned char currentNode, float tx1, float ty1, float tz1, unsigned char* nextNodeTable)
+// Cell coordinates of node in grid of its level.
+// scale -> size of cell relative to octree box
+TPoint3D getOctreeCell(TOctreeLink link, float* scale)
 {
-	//Get exit plane
-	float min;
-	int minIndex = 0;
-	if (tx1 < ty1){
-		min = tx1;
-		minIndex = 0;
-	}
-	else {
-		minIndex = 1;
-		min = ty1;
-	}
-	if (tz1 < min){
-		minIndex = 2;
-	}
-
-	//look up next node 
-	return nextNodeTable[(currentNode * 3) + minIndex];
+	TPoint3D cell;
+	cell.x = link.cell[0] & 0xFFFF;
+	cell.y = link.cell[0] >> 16;
+	cell.z = link.cell[1] & 0xFFFF;
+	*scale = 1.0f / (float)(1 << (link.cell[1] >> 16));
+	return cell;
 }
 
-bool ProcessSubNode(TRay* ray, __global TSphere* sp, unsigned int cnt_sp,
-	__global TTriangle* tr, unsigned int cnt_tr, __global TMesh* me,
-	__global unsigned int* ra_me, unsigned int cnt_ra_me,
-	__global TOctreeBox* octree, unsigned int octree_size, __global TObject* objects,
-	unsigned int actualOctree, 
-	unsigned char flag, float tx0, float ty0, float tz0, float tx1, float ty1, float tz1,
-	unsigned char* nextNodeTable)
+// Parametric range of ray inside octree box.
+// @return -> ray hits octree box
+bool getOctreeRange(TRay* ray, TVector3D invDir, TOctree octree_info, float* tMin, float* tMax)
 {
-	unsigned char currentNode = 0;
-	float txM, tyM, tzM;
-	OctreeState savedState;
-	bool isNodeInit = false;
-	OctreeState stackStates[100];
-	int stackID = 0;
-
-	do
-	{
-		if (tx1 < 0 || ty1 < 0 || tz1 < 0) {
-			stackID -= 1;
-			if (stackID < 0) {
-				break;
-			}
-			savedState = stackStates[stackID];
-			tx0 = savedState.tx0;
-			ty0 = savedState.ty0;
-			tz0 = savedState.tz0;
-			txM = savedState.txM;
-			tyM = savedState.tyM;
-			tzM = savedState.tzM;
-			tx1 = savedState.tx1;
-			ty1 = savedState.ty1;
-			tz1 = savedState.tz1;
-			currentNode = savedState.currentNode;
-			actualOctree = savedState.actualOctree;
-			isNodeInit = savedState.isNodeInit;
-		}
-
-		if (octree[actualOctree].leaf) {
-			TSphere sphere;
-			TTriangle triangle;
-
-			for (int i = octree[actualOctree].boxLink.objStartIndex; i < octree[actualOctree].boxLink.objSize; i++) {
-
-				if (objects[i].type == SPHERE_INDEX) {
-					sphere = sp[objects[i].index];
+	TVector3D t0 = (octree_info.boxMin - ray->orig) * invDir;
+	TVector3D t1 = (octree_info.boxMax - ray->orig) * invDir;
 
-					if (sphereIntersect(&sphere, ray)) {
-						return true;
-					}
-				}
-				else {
-					triangle = tr[objects[i].index];
-
-					if (triangleIntersect(&triangle, ray, me, ra_me, cnt_ra_me)) {
-						return true;
-					}
-				}
-			}
-			stackID -= 1;
-			if (stackID < 0) {
-				break;
-			}
-			savedState = stackStates[stackID];
-			tx0 = savedState.tx0;
-			ty0 = savedState.ty0;
-			tz0 = savedState.tz0;
-			txM = savedState.txM;
-			tyM = savedState.tyM;
-			tzM = savedState.tzM;
-			tx1 = savedState.tx1;
-			ty1 = savedState.ty1;
-			tz1 = savedState.tz1;
-			currentNode = savedState.currentNode;
-			actualOctree = savedState.actualOctree;
-			isNodeInit = savedState.isNodeInit;
-		}
-
-		txM = 0.5f * (tx0 + tx1);
-		tyM = 0.5f * (ty0 + ty1);
-		tzM = 0.5f * (tz0 + tz1);
-
-		if (!isNodeInit) {
-			currentNode = GetFirstNode(tx0, ty0, tz0, txM, tyM, tzM, flag);
-			isNodeInit = true;
-		}
-
-		savedState.tx0 = tx0;
-		savedState.ty0 = ty0;
-		savedState.tz0 = tz0;
-		savedState.txM = txM;
-		savedState.tyM = tyM;
-		savedState.tzM = tzM;
-		savedState.tx1 = tx1;
-		savedState.ty1 = ty1;
-		savedState.tz1 = tz1;
-		savedState.actualOctree = actualOctree;
-		savedState.isNodeInit = isNodeInit;
-		isNodeInit = false;
-
-		switch (currentNode)
-		{
-		case 0:
-			actualOctree = octree[actualOctree].children[flag];
-			savedState.currentNode = GetNextNode(currentNode, txM, tyM, tzM, nextNodeTable);
-			tx1 = txM;
-			ty1 = tyM;
-			tz1 = tzM;
-			break;
-
-		case 1:
-			actualOctree = octree[actualOctree].children[flag ^ 1];
-			savedState.currentNode = GetNextNode(currentNode, txM, tyM, tz1, nextNodeTable);
-			tz0 = tzM;
-			tx1 = txM;
-			ty1 = tyM;
-			break;
-
-		case 2:
-			actualOctree = octree[actualOctree].children[flag ^ 2];
-			savedState.currentNode = GetNextNode(currentNode, txM, ty1, tzM, nextNodeTable);
-			ty0 = tyM;
-			tx1 = txM;
-			tz1 = tzM;
-			break;
-
-		case 3:
-			actualOctree = octree[actualOctree].children[flag ^ 3];
-			savedState.currentNode = GetNextNode(currentNode, txM, ty1, tz1, nextNodeTable);
-			ty0 = tyM;
-			tz0 = tzM;
-			tx1 = txM;
-			break;
-
-		case 4:
-			actualOctree = octree[actualOctree].children[flag ^ 4];
-			savedState.currentNode = GetNextNode(currentNode, tx1, tyM, tzM, nextNodeTable);
-			tx0 = txM;
-			ty1 = tyM;
-			tz1 = tzM;
-			break;
-
-		case 5:
-			actualOctree = octree[actualOctree].children[flag ^ 5];
-			savedState.currentNode = GetNextNode(currentNode, tx1, tyM, tz1, nextNodeTable);
-			tx0 = txM;
-			tz0 = tzM;
-			ty1 = tyM;
-			break;
-
-		case 6:
-			actualOctree = octree[actualOctree].children[flag ^ 6];
-			savedState.currentNode = GetNextNode(currentNode, tx1, ty1, tzM, nextNodeTable);
-			tx0 = txM;
-			ty0 = tyM;
-			tz1 = tzM;
-			break;
-
-		case 7:
-			actualOctree = octree[actualOctree].children[flag ^ 7];
-			savedState.currentNode = 8;        // if we reach the far top right node then there are    
-			tx0 = txM;                        // no nodes we can reach from here, given that our ray 
-			ty0 = tyM;                       // is always travelling in a positive direction.
-			tz0 = tzM;
-			break;
-
-		case 8:
-			do {
-				stackID -= 1;
-				if (stackID < 0) {
-					return false;
-				}
-				savedState = stackStates[stackID];
-				tx0 = savedState.tx0;
-				ty0 = savedState.ty0;
-				tz0 = savedState.tz0;
-				txM = savedState.txM;
-				tyM = savedState.tyM;
-				tzM = savedState.tzM;
-				tx1 = savedState.tx1;
-				ty1 = savedState.ty1;
-				tz1 = savedState.tz1;
-				currentNode = savedState.currentNode;
-				actualOctree = savedState.actualOctree;
-
-				switch (currentNode) {
-				case 0:
-					actualOctree = octree[actualOctree].children[flag];
-					savedState.currentNode = GetNextNode(currentNode, txM, tyM, tzM, nextNodeTable);
-					tx1 = txM;
-					ty1 = tyM;
-					tz1 = tzM;
-					break;
-
-				case 1:
-					actualOctree = octree[actualOctree].children[flag ^ 1];
-					savedState.currentNode = GetNextNode(currentNode, txM, tyM, tz1, nextNodeTable);
-					tz0 = tzM;
-					tx1 = txM;
-					ty1 = tyM;
-					break;
-
-				case 2:
-					actualOctree = octree[actualOctree].children[flag ^ 2];
-					savedState.currentNode = GetNextNode(currentNode, txM, ty1, tzM, nextNodeTable);
-					ty0 = tyM;
-					tx1 = txM;
-					tz1 = tzM;
-					break;
-
-				case 3:
-					actualOctree = octree[actualOctree].children[flag ^ 3];
-					savedState.currentNode = GetNextNode(currentNode, txM, ty1, tz1, nextNodeTable);
-					ty0 = tyM;
-					tz0 = tzM;
-					tx1 = txM;
-					break;
-
-				case 4:
-					actualOctree = octree[actualOctree].children[flag ^ 4];
-					savedState.currentNode = GetNextNode(currentNode, tx1, tyM, tzM, nextNodeTable);
-					tx0 = txM;
-					ty1 = tyM;
-					tz1 = tzM;
-					break;
-
-				case 5:
-					actualOctree = octree[actualOctree].children[flag ^ 5];
-					savedState.currentNode = GetNextNode(currentNode, tx1, tyM, tz1, nextNodeTable);
-					tx0 = txM;
-					tz0 = tzM;
-					ty1 = tyM;
-					break;
-
-				case 6:
-					actualOctree = octree[actualOctree].children[flag ^ 6];
-					savedState.currentNode = GetNextNode(currentNode, tx1, ty1, tzM, nextNodeTable);
-					tx0 = txM;
-					ty0 = tyM;
-					tz1 = tzM;
-					break;
-
-				case 7:
-					actualOctree = octree[actualOctree].children[flag ^ 7];
-					savedState.currentNode = 8;        // if we reach the far top right node then there are    
-					tx0 = txM;                        // no nodes we can reach from here, given that our ray 
-					ty0 = tyM;                       // is always travelling in a positive direction.
-					tz0 = tzM;
-					break;
-				}
-			} while (currentNode == 8);
-
-			break;
-		}
+	*tMin = fmax(fmax(ray->minT, fmin(t0.x, t1.x)), fmax(fmin(t0.y, t1.y), fmin(t0.z, t1.z)));
+	*tMax = fmin(fmin(ray->maxT, fmax(t0.x, t1.x)), fmin(fmax(t0.y, t1.y), fmax(t0.z, t1.z)));
+	return *tMin <= *tMax;
+}
 
-		stackStates[stackID] = savedState;
-		stackID++;
-	} while (stackID >= 0);
+// Descend from node to leaf where ray is at time t. Child is chosen by time
+// when ray crosses middle plane, so ray lying on plane goes in its direction.
+// @return -> index of leaf
+unsigned int findOctreeLeaf(TRay* ray, TVector3D invDir, float t, __global TOctreeNode* octree,
+	__global TOctreeLink* links, TOctree octree_info, unsigned int node, TCounters* counters)
+{
+	while (octree[node].children != 0) {
+		counters->nodes++;
+		float scale;
+		TPoint3D cell = getOctreeCell(links[node], &scale);
+		TPoint3D middle = getOctreeGridPoint(octree_info, cell * 2.0f + 1.0f, scale * 0.5f);
+		TVector3D tMiddle = (middle - ray->orig) * invDir;
+
+		unsigned int child = 0;
+		if ((invDir.x >= 0.0f) == (tMiddle.x <= t)) child |= 4;
+		if ((invDir.y >= 0.0f) == (tMiddle.y <= t)) child |= 2;
+		if ((invDir.z >= 0.0f) == (tMiddle.z <= t)) child |= 1;
+		node = octree[node].children + child;
+	}
+	return node;
+}
 
-	return false;
+// Time when ray leaves leaf.
+// rope -> neighbour behind exit face, 0 if ray leaves octree
+float getOctreeExit(TRay* ray, TVector3D invDir, __global TOctreeLink* links,
+	TOctree octree_info, unsigned int node, unsigned int* rope)
+{
+	float scale;
+	TOctreeLink link = links[node];
+	TPoint3D cell = getOctreeCell(link, &scale);
+	TPoint3D boxMin = getOctreeGridPoint(octree_info, cell, scale);
+	TPoint3D boxMax = getOctreeGridPoint(octree_info, cell + 1.0f, scale);
+
+	TPoint3D exitPlanes;
+	exitPlanes.x = (invDir.x >= 0.0f) ? boxMax.x : boxMin.x;
+	exitPlanes.y = (invDir.y >= 0.0f) ? boxMax.y : boxMin.y;
+	exitPlanes.z = (invDir.z >= 0.0f) ? boxMax.z : boxMin.z;
+	TVector3D tExit = (exitPlanes - ray->orig) * invDir;
+
+	float t = INFINITY;
+	*rope = 0;
+	if (tExit.x < t) { t = tExit.x; *rope = link.ropes[(invDir.x >= 0.0f) ? 1 : 0]; }
+	if (tExit.y < t) { t = tExit.y; *rope = link.ropes[(invDir.y >= 0.0f) ? 3 : 2]; }
+	if (tExit.z < t) { t = tExit.z; *rope = link.ropes[(invDir.z >= 0.0f) ? 5 : 4]; }
+	return t;
 }
 
 // Intersect object without information about it.
 // ray -> information about ray
 // sp -> buffer of all spheres
+// spd -> transforms and materials of all spheres
 // tr -> buffer of all triangles
 // me -> buffer of all meshes
 // ra_me -> buffer of size every mesh
+// octree -> buffer of all octree nodes
+// links -> neighbour links of octree nodes
+// octree_info -> bounding box of octree
+// objects -> indexes of objects belong to octree
+// counters -> counters of traversal
 // @return -> successful of intersect 
-bool intersect_octree(TRay* ray, __global TSphere* sp, unsigned int cnt_sp,
+bool intersect_octree(TRay* ray, __global TSphere* sp, __global TSphereData* spd, unsigned int cnt_sp,
 	__global TTriangle* tr, unsigned int cnt_tr, __global TMesh* me,
 	__global unsigned int* ra_me, unsigned int cnt_ra_me,
-	__global TOctreeBox* octree, unsigned int octree_size, __global TObject* objects,
-	unsigned int actualOctree, unsigned char* nextNodeTable)
+	__global TOctreeNode* octree, __global TOctreeLink* links, TOctree octree_info, 
+	__global TObject* objects, TCounters* counters)
 {
-	unsigned char flag = 0;
-	TPoint3D halfSize = PointMinusPoint(octree[actualOctree].boxMax, octree[actualOctree].middlePoint);
-	TVector3D dir = ray->dir;
-	TPoint3D origin = PointPlusPoint(PointMinusPoint(ray->orig, octree[actualOctree].middlePoint), halfSize);
-	TPoint3D boxSize = PointMinusPoint(octree[actualOctree].boxMax, octree[actualOctree].boxMin);
-
-	if (dir.x < 0.0f) {
-		origin.x = boxSize.x - origin.x;
-		dir.x *= -1.0f;
-		flag |= 4;
-	}
-
-	if (dir.y < 0.0f) {
-		origin.y = boxSize.y - origin.y;
-		dir.y *= -1.0f;
-		flag |= 2;
-	}
-
-	if (dir.z < 0.0f) {
-		origin.z = boxSize.z - origin.z;
-		dir.z *= -1.0f;
-		//flag |= 1;
-	}
-	else {
-		flag |= 1;
-	}
-
-	float invDirx = 1.0f / dir.x;
-	float invDiry = 1.0f / dir.y;
-	float invDirz = 1.0f / dir.z;
-
-	float tx0 = -origin.x * invDirx;
-	float tx1 = (boxSize.x - origin.x) * invDirx;
+	TVector3D invDir = 1.0f / ray->dir;
+	float t, tMax;
+	if (!getOctreeRange(ray, invDir, octree_info, &t, &tMax))
+		return false;
 
-	float ty0 = -origin.y * invDiry;
-	float ty1 = (boxSize.y - origin.y) * invDiry;
-
-	float tz0 = -origin.z * invDirz;
-	float tz1 = (boxSize.z - origin.z) * invDirz;
-
-	float maxOf0 = 0.f;
-	float minOf1 = 0.f;
-	// Compute max for maxOf0
-	if (tx0 > ty0) {
-		if (tx0 > tz0) {
-			maxOf0 = tx0;
-		}
-		else {
-			maxOf0 = tz0;
-		}
-	}
-	else {
-		if (ty0 > tz0) {
-			maxOf0 = ty0;
-		}
-		else {
-			maxOf0 = tz0;
-		}
-	}
-	// Compute min for minOf1
-	if (tx1 < ty1) {
-		if (tx1 < tz1) {
-			minOf1 = tx1;
-		}
-		else {
-			minOf1 = tz1;
-		}
-	}
-	else {
-		if (ty1 < tz1) {
-			minOf1 = ty1;
-		}
-		else {
-			minOf1 = tz1;
-		}
-	}
+	unsigned int node = findOctreeLeaf(ray, invDir, t, octree, links, octree_info, 0, counters);
+	while (true) {
+		counters->nodes++;
+		TSphere sphere;
+		TTriangle triangle;
 
-	if (maxOf0 < minOf1) {
-		return ProcessSubNode(ray, sp, cnt_sp, tr, cnt_tr, me, ra_me, cnt_ra_me,
-			octree, octree_size, objects, 0,
-			flag, tx0, ty0, tz0, tx1, ty1, tz1, nextNodeTable);
-	}
-	return false;
-}
+		for (int i = octree[node].boxLink.objStartIndex; i < octree[node].boxLink.objSize; i++) {
+			if (objects[i].type == SPHERE_INDEX) {
+				sphere = sp[objects[i].index];
 
-bool ProcessSubNodeIs(TRay* ray, TIntersect* is, __global TSphere* sp, unsigned int cnt_sp,
-	__global TTriangle* tr, unsigned int cnt_tr, __global TMesh* me,
-	__global unsigned int* ra_me, unsigned int cnt_ra_me,
-	__global TOctreeBox* octree, unsigned int octree_size, __global TObject* objects,
-	unsigned int actualOctree,
-	unsigned char flag, float tx0, float ty0, float tz0, float tx1, float ty1, float tz1,
-	unsigned char* nextNodeTable)
-{
-	unsigned char currentNode = 0;
-	float txM, tyM, tzM;
-	OctreeState savedState;
-	bool isNodeInit = false;
-	OctreeState stackStates[100];
-	int stackID = 0;
-	char znak = 0;
-
-	do
-	{
-		//printf("\n=========================Aktualni uzel je: %d\n", currentNode);
-		if (tx1 < 0 || ty1 < 0 || tz1 < 0) {
-			//printf(">> Prunik neni mozny. Aktualni uzel je: %d\n", currentNode);
-			stackID -= 1;
-			if (stackID < 0) {
-				//printf(">> Koncim. Aktualni uzel je: %d\n", currentNode);
-				break;
+				counters->primitives++;
+				if (sphereIntersect(&sphere, spd + objects[i].index, ray)) {
+					return true;
+				}
 			}
-			savedState = stackStates[stackID];
-			tx0 = savedState.tx0;
-			ty0 = savedState.ty0;
-			tz0 = savedState.tz0;
-			txM = savedState.txM;
-			tyM = savedState.tyM;
-			tzM = savedState.tzM;
-			tx1 = savedState.tx1;
-			ty1 = savedState.ty1;
-			tz1 = savedState.tz1;
-			currentNode = savedState.currentNode;
-			actualOctree = savedState.actualOctree;
-			isNodeInit = savedState.isNodeInit;
-			//printf(">> Nacetl jsem data ze zasobniku. Aktualni uzel je: %d StackID je: %d\n", currentNode, stackID);
-		}
+			else {
+				triangle = tr[objects[i].index];
 
-		if (octree[actualOctree].leaf) {
-			//printf(">> Jde se testovat. Aktualni uzel je: %d StackID je: %d\n", currentNode, stackID);
-			TIntersect currentIs;
-			TSphere sphere;
-			TTriangle triangle;
-
-			for (int i = octree[actualOctree].boxLink.objStartIndex; i < octree[actualOctree].boxLink.objSize; i++) {
-
-				if (objects[i].type == SPHERE_INDEX) {
-					sphere = sp[objects[i].index];
-					
-					if (sphereIntersectIs(&sphere, ray, &currentIs)) {
-						// Is object near than previous intersected object.
-						if (currentIs.hitTime < is->hitTime) {
-							*is = currentIs;
-							is->obj_index = objects[i].index;
-							//printf(">> Trefil jsem kouli. Index koule je: %d\n", is->obj_index);
-						}
-					}
+				counters->primitives++;
+				if (triangleIntersect(&triangle, ray, me, ra_me, cnt_ra_me)) {
+					return true;
 				}
-				else {
-					triangle = tr[objects[i].index];
-
-					if (triangleIntersectIs(&triangle, ray, &currentIs, me, ra_me, cnt_ra_me)) {
-						// Is object near than previous intersected object.
-						if (currentIs.hitTime < is->hitTime) {
-							*is = currentIs;
-							is->obj_index = objects[i].index;
-							//printf(">> Trefil jsem trojuhelnik. Index trojuhelniku je: %d\n", is->obj_index);
-						}
-					}
-				}
-			}
-			//printf(">> Budu nacitat data ze zasobniku. Aktualni uzel je: %d\n", currentNode);
-			stackID -= 1;
-			if (stackID < 0) {
-				//printf(">> Koncim. Aktualni uzel je: %d\n", currentNode);
-				break;
 			}
-			savedState = stackStates[stackID];
-			tx0 = savedState.tx0;
-			ty0 = savedState.ty0;
-			tz0 = savedState.tz0;
-			txM = savedState.txM;
-			tyM = savedState.tyM;
-			tzM = savedState.tzM;
-			tx1 = savedState.tx1;
-			ty1 = savedState.ty1;
-			tz1 = savedState.tz1;
-			currentNode = savedState.currentNode;
-			actualOctree = savedState.actualOctree;
-			isNodeInit = savedState.isNodeInit;
-			//printf(">> Nacetl jsem data ze zasobniku. Aktualni uzel je: %d StackID je: %d\n", currentNode, stackID);
 		}
 
-		txM = 0.5f * (tx0 + tx1);
-		tyM = 0.5f * (ty0 + ty1);
-		tzM = 0.5f * (tz0 + tz1);
-
-		if (!isNodeInit) {
-			/*printf(">> Budu inicializovat. Aktualni uzel je: %d StackID je: %d\n", currentNode, stackID);
-			if (stackID > 4) {
-				printf("tx0: %f, ty0: %f, tz0: %f, txM: %f, tyM: %f, tzM: %f\n", tx0, ty0, tz0, txM, tyM, tzM);
-				printf("tx1: %f, ty1: %f, tz1: %f\n", tx1, ty1, tz1);
-			}*/
-			currentNode = GetFirstNode(tx0, ty0, tz0, txM, tyM, tzM, flag);
-			isNodeInit = true;
-		}
-
-		savedState.tx0 = tx0;
-		savedState.ty0 = ty0;
-		savedState.tz0 = tz0;
-		savedState.txM = txM;
-		savedState.tyM = tyM;
-		savedState.tzM = tzM;
-		savedState.tx1 = tx1;
-		savedState.ty1 = ty1;
-		savedState.tz1 = tz1;
-		savedState.actualOctree = actualOctree;
-		savedState.isNodeInit = isNodeInit;
-		isNodeInit = false;
-
-		//if (stackID > 4) {
-			//printf("tx0: %f, ty0: %f, tz0: %f, txM: %f, tyM: %f, tzM: %f\n", tx0, ty0, tz0, txM, tyM, tzM);
-			//printf("tx1: %f, ty1: %f, tz1: %f\n", tx1, ty1, tz1);
-		//}
-		switch (currentNode)
-		{
-		case 0:
-			znak = flag;
-			//printf(">>>> CASE 0. Jdu do kostky %d. StackID je: %d\n", znak, stackID);
-			actualOctree = octree[actualOctree].children[flag];
-			savedState.currentNode = GetNextNode(currentNode, txM, tyM, tzM, nextNodeTable);
-			tx1 = txM;
-			ty1 = tyM;
-			tz1 = tzM;
-			break;
-
-		case 1:
-			znak = flag ^ 1;
-			//printf(">>>> CASE 1. Jdu do kostky %d. StackID je: %d\n", znak, stackID);
-			actualOctree = octree[actualOctree].children[flag ^ 1];
-			savedState.currentNode = GetNextNode(currentNode, txM, tyM, tz1, nextNodeTable);
-			tz0 = tzM;
-			tx1 = txM;
-			ty1 = tyM;
-			break;
-
-		case 2:
-			znak = flag ^ 2;
-			//printf(">>>> CASE 2. Jdu do kostky %d. StackID je: %d\n", znak, stackID);
-			actualOctree = octree[actualOctree].children[flag ^ 2];
-			savedState.currentNode = GetNextNode(currentNode, txM, ty1, tzM, nextNodeTable);
-			ty0 = tyM;
-			tx1 = txM;
-			tz1 = tzM;
-			break;
-
-		case 3:
-			znak = flag ^ 3;
-			//printf(">>>> CASE 3. Jdu do kostky %d. StackID je: %d\n", znak, stackID);
-			actualOctree = octree[actualOctree].children[flag ^ 3];
-			savedState.currentNode = GetNextNode(currentNode, txM, ty1, tz1, nextNodeTable);
-			ty0 = tyM;
-			tz0 = tzM;
-			tx1 = txM;
-			break;
-
-		case 4:
-			znak = flag ^ 4;
-			//printf(">>>> CASE 4. Jdu do kostky %d. StackID je: %d\n", znak, stackID);
-			actualOctree = octree[actualOctree].children[flag ^ 4];
-			savedState.currentNode = GetNextNode(currentNode, tx1, tyM, tzM, nextNodeTable);
-			tx0 = txM;
-			ty1 = tyM;
-			tz1 = tzM;
-			break;
-
-		case 5:
-			znak = flag ^ 5;
-			//printf(">>>> CASE 5. Jdu do kostky %d. StackID je: %d\n", znak, stackID);
-			actualOctree = octree[actualOctree].children[flag ^ 5];
-			savedState.currentNode = GetNextNode(currentNode, tx1, tyM, tz1, nextNodeTable);
-			tx0 = txM;
-			tz0 = tzM;
-			ty1 = tyM;
-			break;
-
-		case 6:
-			znak = flag ^ 6;
-			//printf(">>>> CASE 6. Jdu do kostky %d. StackID je: %d\n", znak, stackID);
-			actualOctree = octree[actualOctree].children[flag ^ 6];
-			savedState.currentNode = GetNextNode(currentNode, tx1, ty1, tzM, nextNodeTable);
-			tx0 = txM;
-			ty0 = tyM;
-			tz1 = tzM;
-			break;
-
-		case 7:
-			znak = flag ^ 7;
-			//printf(">>>> CASE 7. Jdu do kostky %d. StackID je: %d\n", znak, stackID);
-			actualOctree = octree[actualOctree].children[flag ^ 7];
-			savedState.currentNode = 8;        // if we reach the far top right node then there are    
-			tx0 = txM;                        // no nodes we can reach from here, given that our ray 
-			ty0 = tyM;                       // is always travelling in a positive direction.
-			tz0 = tzM;
-			break;
-
-		case 8:
-			do {
-				//printf(">>>> CASE 8. Aktualni uzel je: %d StackID je: %d\n", currentNode, stackID);
-				stackID -= 1;
-				if (stackID < 0) {
-					//printf(">> Koncim. Aktualni uzel je: %d StackID je: %d\n", currentNode, stackID);
-					return is->hitTime != INFINITY;
-				}
-				savedState = stackStates[stackID];
-				tx0 = savedState.tx0;
-				ty0 = savedState.ty0;
-				tz0 = savedState.tz0;
-				txM = savedState.txM;
-				tyM = savedState.tyM;
-				tzM = savedState.tzM;
-				tx1 = savedState.tx1;
-				ty1 = savedState.ty1;
-				tz1 = savedState.tz1;
-				currentNode = savedState.currentNode;
-				actualOctree = savedState.actualOctree;
-				//printf(">> Nacetl jsem data ze zasobniku. Aktualni uzel je: %d StackID je: %d\n", currentNode, stackID);
-				//printf(">> Jdu do druheho CASE. Aktualni uzel je: %d StackID je: %d\n", currentNode, stackID);
-
-				switch (currentNode) {
-				case 0:
-					znak = flag ^ 0;
-					//printf(">>>> CASE 0. Jdu do kostky %d. StackID je: %d\n", znak, stackID);
-					actualOctree = octree[actualOctree].children[flag];
-					savedState.currentNode = GetNextNode(currentNode, txM, tyM, tzM, nextNodeTable);
-					tx1 = txM;
-					ty1 = tyM;
-					tz1 = tzM;
-					break;
-
-				case 1:
-					znak = flag ^ 1;
-					//printf(">>>> CASE 1. Jdu do kostky %d. StackID je: %d\n", znak, stackID);
-					actualOctree = octree[actualOctree].children[flag ^ 1];
-					savedState.currentNode = GetNextNode(currentNode, txM, tyM, tz1, nextNodeTable);
-					tz0 = tzM;
-					tx1 = txM;
-					ty1 = tyM;
-					break;
-
-				case 2:
-					znak = flag ^ 2;
-					//printf(">>>> CASE 2. Jdu do kostky %d. StackID je: %d\n", znak, stackID);
-					actualOctree = octree[actualOctree].children[flag ^ 2];
-					savedState.currentNode = GetNextNode(currentNode, txM, ty1, tzM, nextNodeTable);
-					ty0 = tyM;
-					tx1 = txM;
-					tz1 = tzM;
-					break;
-
-				case 3:
-					znak = flag ^ 3;
-					//printf(">>>> CASE 3. Jdu do kostky %d. StackID je: %d\n", znak, stackID);
-					actualOctree = octree[actualOctree].children[flag ^ 3];
-					savedState.currentNode = GetNextNode(currentNode, txM, ty1, tz1, nextNodeTable);
-					ty0 = tyM;
-					tz0 = tzM;
-					tx1 = txM;
-					break;
-
-				case 4:
-					znak = flag ^ 4;
-					//printf(">>>> CASE 4. Jdu do kostky %d. StackID je: %d\n", znak, stackID);
-					actualOctree = octree[actualOctree].children[flag ^ 4];
-					savedState.currentNode = GetNextNode(currentNode, tx1, tyM, tzM, nextNodeTable);
-					tx0 = txM;
-					ty1 = tyM;
-					tz1 = tzM;
-					break;
-
-				case 5:
-					znak = flag ^ 5;
-					//printf(">>>> CASE 5. Jdu do kostky %d. StackID je: %d\n", znak, stackID);
-					actualOctree = octree[actualOctree].children[flag ^ 5];
-					savedState.currentNode = GetNextNode(currentNode, tx1, tyM, tz1, nextNodeTable);
-					tx0 = txM;
-					tz0 = tzM;
-					ty1 = tyM;
-					break;
-
-				case 6:
-					znak = flag ^ 6;
-					//printf(">>>> CASE 6. Jdu do kostky %d. StackID je: %d\n", znak, stackID);
-					actualOctree = octree[actualOctree].children[flag ^ 6];
-					savedState.currentNode = GetNextNode(currentNode, tx1, ty1, tzM, nextNodeTable);
-					tx0 = txM;
-					ty0 = tyM;
-					tz1 = tzM;
-					break;
-
-				case 7:
-					znak = flag ^ 7;
-					//printf(">>>> CASE 7. Jdu do kostky %d. StackID je: %d\n", znak, stackID);
-					actualOctree = octree[actualOctree].children[flag ^ 7];
-					savedState.currentNode = 8;        // if we reach the far top right node then there are    
-					tx0 = txM;                        // no nodes we can reach from here, given that our ray 
-					ty0 = tyM;                       // is always travelling in a positive direction.
-					tz0 = tzM;
-					break;
-				}
-			} while (currentNode == 8);
-			//printf(">>>> Vyskakuji z CASE 8. Aktualni uzel je: %d StackID je: %d\n", currentNode, stackID);
-			break;
+		unsigned int rope;
+		t = getOctreeExit(ray, invDir, links, octree_info, node, &rope);
+		if (rope == 0 || t >= tMax) {
+			return false;
 		}
-
-		stackStates[stackID] = savedState;
-		stackID++;
-		//printf(">> Ulozil jsem na stack. Aktualni uzel je: %d StackID je: %d\n", currentNode, stackID);
-	} while (stackID >= 0);
-
-	return is->hitTime != INFINITY;
+		node = findOctreeLeaf(ray, invDir, t, octree, links, octree_info, rope, counters);
+	}
 }
 
 // Intersect object within information about it.
 // ray -> information about ray
 // is -> information about intersection
 // sp -> buffer of all spheres
+// spd -> transforms and materials of all spheres
 // tr -> buffer of all triangles
 // me -> buffer of all meshes
 // ra_me -> buffer of size every mesh
+// octree -> buffer of all octree nodes
+// links -> neighbour links of octree nodes
+// octree_info -> bounding box of octree
+// objects -> indexes of objects belong to octree
+// counters -> counters of traversal
 // @return -> successful of intersect 
-bool intersectIs_octree(TRay* ray, TIntersect* is, __global TSphere* sp, unsigned int cnt_sp,
+bool intersectIs_octree(TRay* ray, TIntersect* is, __global TSphere* sp, __global TSphereData* spd, unsigned int cnt_sp,
 	__global TTriangle* tr, unsigned int cnt_tr, __global TMesh* me,
 	__global unsigned int* ra_me, unsigned int cnt_ra_me,
-	__global TOctreeBox* octree, unsigned int octree_size, __global TObject* objects,
-	unsigned int actualOctree, unsigned char* nextNodeTable)
+	__global TOctreeNode* octree, __global TOctreeLink* links, TOctree octree_info, 
+	__global TObject* objects, TCounters* counters)
 {
 	is->hitTime = INFINITY;
-	unsigned char flag = 0;
-	TPoint3D halfSize = PointMinusPoint(octree[actualOctree].boxMax, octree[actualOctree].middlePoint);
-	TVector3D dir = ray->dir;
-	TPoint3D origin = PointPlusPoint(PointMinusPoint(ray->orig, octree[actualOctree].middlePoint), halfSize);
-	TPoint3D boxSize = PointMinusPoint(octree[actualOctree].boxMax, octree[actualOctree].boxMin);
-
-	if (dir.x < 0.0f) {
-		origin.x = boxSize.x - origin.x;
-		dir.x *= -1.0f;
-		flag |= 4;
-	}
-
-	if (dir.y < 0.0f) {
-		origin.y = boxSize.y - origin.y;
-		dir.y *= -1.0f;
-		flag |= 2;
-	}
-
-	if (dir.z < 0.0f) {
-		origin.z = boxSize.z - origin.z;
-		dir.z *= -1.0f;
-		//flag |= 1;
-	}
-	else {
-		flag |= 1;
-	}
+	TVector3D invDir = 1.0f / ray->dir;
+	float t, tMax;
+	if (!getOctreeRange(ray, invDir, octree_info, &t, &tMax))
+		return false;
 
-	float invDirx = 1.0f / dir.x;
-	float invDiry = 1.0f / dir.y;
-	float invDirz = 1.0f / dir.z;
-
-	float tx0 = -origin.x * invDirx;
-	float tx1 = (boxSize.x - origin.x) * invDirx;
-
-	float ty0 = -origin.y * invDiry;
-	float ty1 = (boxSize.y - origin.y) * invDiry;
-
-	float tz0 = -origin.z * invDirz;
-	float tz1 = (boxSize.z - origin.z) * invDirz;
-
-	float maxOf0 = 0.f;
-	float minOf1 = 0.f;
-	// Compute max for maxOf0
-	if (tx0 > ty0) {
-		if (tx0 > tz0) {
-			maxOf0 = tx0;
-		}
-		else {
-			maxOf0 = tz0;
-		}
-	}
-	else {
-		if (ty0 > tz0) {
-			maxOf0 = ty0;
-		}
-		else {
-			maxOf0 = tz0;
-		}
-	}
-	// Compute min for minOf1
-	if (tx1 < ty1) {
-		if (tx1 < tz1) {
-			minOf1 = tx1;
-		}
-		else {
-			minOf1 = tz1;
-		}
-	}
-	else {
-		if (ty1 < tz1) {
-			minOf1 = ty1;
+	unsigned int node = findOctreeLeaf(ray, invDir, t, octree, links, octree_info, 0, counters);
+	while (true) {
+		counters->nodes++;
+		TIntersect currentIs;
+		TSphere sphere;
+		TTriangle triangle;
+
+		for (int i = octree[node].boxLink.objStartIndex; i < octree[node].boxLink.objSize; i++) {
+			if (objects[i].type == SPHERE_INDEX) {
+				sphere = sp[objects[i].index];
+
+				counters->primitives++;
+				if (sphereIntersectIs(&sphere, spd + objects[i].index, ray, &currentIs)) {
+					// Is object near than previous intersected object.
+					if (currentIs.hitTime < is->hitTime) {
+						*is = currentIs;
+						is->obj_index = objects[i].index;
+					}
+				}
+			}
+			else {
+				triangle = tr[objects[i].index];
+
+				counters->primitives++;
+				if (triangleIntersectIs(&triangle, ray, &currentIs, me, ra_me, cnt_ra_me)) {
+					// Is object near than previous intersected object.
+					if (currentIs.hitTime < is->hitTime) {
+						*is = currentIs;
+						is->obj_index = objects[i].index;
+					}
+				}
+			}
 		}
-		else {
-			minOf1 = tz1;
+
+		unsigned int rope;
+		t = getOctreeExit(ray, invDir, links, octree_info, node, &rope);
+		// Hit inside this leaf is the nearest, other leafs are behind it.
+		if (is->hitTime <= t || rope == 0 || t >= tMax) {
+			break;
 		}
+		node = findOctreeLeaf(ray, invDir, t, octree, links, octree_info, rope, counters);
 	}
 
-	//printf("Flag je: %d %f %f\n", flag, dir.x, dir.y);
-	if (maxOf0 < minOf1) {
-		return ProcessSubNodeIs(ray, is, sp, cnt_sp, tr, cnt_tr, me, ra_me, cnt_ra_me,
-			octree, octree_size, objects, 0,
-			flag, tx0, ty0, tz0, tx1, ty1, tz1, nextNodeTable);
-	}
-	return false;
+	return is->hitTime != INFINITY;
 }
 
 // Compute color for pixel (start pathtracing).
 // ray -> information about ray
 // depth -> maximum depth of computation
 // sp -> buffer of all spheres
+// spd -> transforms and materials of all spheres
 // tr -> buffer of all triangles
 // me -> buffer of all meshes
 // ra_me -> buffer of size every mesh
+// stats -> traversal statistics, NULL if counting is disabled
 // @return -> result color for pixel
-TColor trace_octree(TRay ray, uint depth, uint2 seed, __global TSphere* sp, unsigned int cnt_sp,
+TColor trace_octree(TRay ray, uint depth, uint2 seed, __global TSphere* sp, __global TSphereData* spd, unsigned int cnt_sp,
 	__global TTriangle* tr, unsigned int cnt_tr, __global TMesh* me,
 	__global unsigned int* ra_me, unsigned int cnt_ra_me,
 	__global TLight* lights, unsigned int cnt_li,
-	__global TOctreeBox* octree, unsigned int octree_size, __global TObject* objects)
+	__global TOctreeNode* octree, __global TOctreeLink* links, TOctree octree_info, 
+	__global TObject* objects,
+	__global TTraversalStats* stats)
 {
 	TColor stack[500];
 	unsigned int stack_id = 0;
-	unsigned char nextNodeTable[24] =
-	{
-		4, 2, 1,
-		5, 3, 8,
-		6, 8, 3,
-		7, 8, 8,
-		8, 6, 5,
-		8, 7, 8,
-		8, 8, 7,
-		8, 8, 8
-	};
 
 	bool isEnd = true;
 	int MINIMUM_DEPTH = 4;
@@ -878,6 +249,8 @@ TColor trace_octree(TRay ray, uint depth, uint2 seed, __global TSphere* sp, unsi
 	float absorption_factor = 1 / (1 - p_absorption);
 
 	TIntersect is;
+	TCounters counters;
+	counters.nodes = 0; counters.primitives = 0;
 	TColor directLight, indirectLight;
 
 	while (true) {
@@ -885,9 +258,10 @@ TColor trace_octree(TRay ray, uint depth, uint2 seed, __global TSphere* sp, unsi
 		indirectLight.x = 0.0f; indirectLight.y = 0.0f; indirectLight.z = 0.0f;
 		isEnd = true;
 		// Try to intersect any object.
-		if (intersectIs_octree(&ray, &is, sp, cnt_sp, tr, cnt_tr, me, ra_me, cnt_ra_me, 
-							   octree, octree_size, objects, 0, 
-							   nextNodeTable)) 
+		bool hit = intersectIs_octree(&ray, &is, sp, spd, cnt_sp, tr, cnt_tr, me, ra_me, cnt_ra_me, 
+							   octree, links, octree_info, objects, &counters);
+		addTraversalStats(stats, &counters);
+		if (hit) 
 		{ 
 			//printf("Skoncil test.%d\n", stack_id);
 			// Found intersection -> compute color.
@@ -903,11 +277,11 @@ TColor trace_octree(TRay ray, uint depth, uint2 seed, __global TSphere* sp, unsi
 			// Next ray will be?
 			if (light_type <= reflectivity) {
 				// Reflected ray.
-				ray = getReflectedRay(&ray, &is, sp, tr, me, ra_me); // OK
+				ray = getReflectedRay(&ray, &is, spd, tr, me, ra_me); // OK
 			}
 			else if ((light_type - reflectivity) <= transparency) {
 				// Refracted ray.
-				ray = getRefractedRay(&ray, &is, sp, tr, me, ra_me); // OK
+				ray = getRefractedRay(&ray, &is, spd, tr, me, ra_me); // OK
 			}
 			else {
 				// Compute color.
@@ -917,10 +291,11 @@ TColor trace_octree(TRay ray, uint depth, uint2 seed, __global TSphere* sp, unsi
 					TLight light = lights[i]; // OK
 					TRay shadowRay = getShadowRay(&light, &is); // OK
 
+					bool shadowHit = intersect_octree(&shadowRay, sp, spd, cnt_sp, tr, cnt_tr, me, ra_me, cnt_ra_me,
+										  octree, links, octree_info, objects, &counters);
+					addTraversalStats(stats, &counters);
 					// Is point visible by light?
-					if (!intersect_octree(&shadowRay, sp, cnt_sp, tr, cnt_tr, me, ra_me, cnt_ra_me,
-										  octree, octree_size, objects, 0,
-										  nextNodeTable))
+					if (!shadowHit)
 					{ 
 						float intensity = pow(shadowRay.maxT, -2);
 						TColor incomingRadiance = light.radiance * intensity;
@@ -1010,4 +385,32 @@ TColor trace_octree(TRay ray, uint depth, uint2 seed, __global TSphere* sp, unsi
 	} // End of while loop
 } // End of function
 
+// Compute traversal cost of ray as false colour for heatmap mode.
+// Only ray from camera is traced, without bounces and shadow rays.
+// sp -> buffer of all spheres
+// spd -> transforms and materials of all spheres
+// tr -> buffer of all triangles
+// me -> buffer of all meshes
+// ra_me -> buffer of size every mesh
+// stats -> traversal statistics, NULL if counting is disabled
+// @return -> result color for pixel
+TColor heatmap_octree(TRay ray, __global TSphere* sp, __global TSphereData* spd, unsigned int cnt_sp,
+	__global TTriangle* tr, unsigned int cnt_tr, __global TMesh* me,
+	__global unsigned int* ra_me, unsigned int cnt_ra_me,
+	__global TOctreeNode* octree, __global TOctreeLink* links, TOctree octree_info, 
+	__global TObject* objects,
+	__global TTraversalStats* stats)
+{
+	TIntersect is;
+	TCounters counters;
+	counters.nodes = 0; counters.primitives = 0;
+
+	intersectIs_octree(&ray, &is, sp, spd, cnt_sp, tr, cnt_tr, me, ra_me, cnt_ra_me,
+		octree, links, octree_info, objects, &counters);
+	TColor color = heatColor(&counters);
+	addTraversalStats(stats, &counters);
+
+	return color;
+}
+
 #endif // _KERNEL_TRACE_OCTREE_H_
\ No newline at end of file
@@ -13,14 +13,16 @@
 // Intersect object without information about it.
 // ray -> information about ray
 // sp -> buffer of all spheres
+// spd -> transforms and materials of all spheres
 // tr -> buffer of all triangles
 // me -> buffer of all meshes
 // ra_me -> buffer of size every mesh
+// counters -> counters of traversal
 // @return -> successful of intersect 
-bool intersect_unigrid(TRay* ray, __global TSphere* sp, unsigned int cnt_sp,
+bool intersect_unigrid(TRay* ray, __global TSphere* sp, __global TSphereData* spd, unsigned int cnt_sp,
 	__global TTriangle* tr, unsigned int cnt_tr, __global TMesh* me,
 	__global unsigned int* ra_me, unsigned int cnt_ra_me,
-	__global TUniGrid* infoUniGrid, __global TBoxLink* uniGrid, __global TObject* objects)
+	__global TUniGrid* infoUniGrid, __global TBoxLink* uniGrid, __global TObject* objects, TCounters* counters)
 {
 	float xAxis, yAxis, zAxis;
 	TVector3D dir = ray->dir;
@@ -77,18 +79,21 @@ bool intersect_unigrid(TRay* ray, __global TSphere* sp, unsigned int cnt_sp,
 		(Z < grid_size) && (Z >= 0)) {
 
 		id = (int)(X + Y * grid_size + Z * grid_size * grid_size);
+		counters->nodes++;
 		for (int i = uniGrid[id].objStartIndex; i < uniGrid[id].objSize; i++) {
 
 			if (objects[i].type == SPHERE_INDEX) {
 				sphere = sp[objects[i].index];
 
-				if (sphereIntersect(&sphere, ray)) {
+				counters->primitives++;
+				if (sphereIntersect(&sphere, spd + objects[i].index, ray)) {
 					return true;
 				}
 			}
 			else {
 				triangle = tr[objects[i].index];
 
+				counters->primitives++;
 				if (triangleIntersect(&triangle, ray, me, ra_me, cnt_ra_me)) {
 					return true;
 				}
@@ -128,14 +133,16 @@ bool intersect_unigrid(TRay* ray, __global TSphere* sp, unsigned int cnt_sp,
 // ray -> information about ray
 // is -> information about intersection
 // sp -> buffer of all spheres
+// spd -> transforms and materials of all spheres
 // tr -> buffer of all triangles
 // me -> buffer of all meshes
 // ra_me -> buffer of size every mesh
+// counters -> counters of traversal
 // @return -> successful of intersect 
-bool intersectIs_unigrid(TRay* ray, TIntersect* is, __global TSphere* sp, unsigned int cnt_sp,
+bool intersectIs_unigrid(TRay* ray, TIntersect* is, __global TSphere* sp, __global TSphereData* spd, unsigned int cnt_sp,
 	__global TTriangle* tr, unsigned int cnt_tr, __global TMesh* me,
 	__global unsigned int* ra_me, unsigned int cnt_ra_me,
-	__global TUniGrid* infoUniGrid, __global TBoxLink* uniGrid, __global TObject* objects)
+	__global TUniGrid* infoUniGrid, __global TBoxLink* uniGrid, __global TObject* objects, TCounters* counters)
 {
 	float xAxis, yAxis, zAxis;
 	TVector3D dir = ray->dir;
@@ -195,12 +202,14 @@ bool intersectIs_unigrid(TRay* ray, TIntersect* is, __global TSphere* sp, unsign
 		(Z < grid_size) && (Z >= 0)) {
 
 		id = (int)(X + Y * grid_size + Z * grid_size * grid_size);
+		counters->nodes++;
 		for (int i = uniGrid[id].objStartIndex; i < uniGrid[id].objSize; i++) {
 
 			if (objects[i].type == SPHERE_INDEX) {
 				sphere = sp[objects[i].index];
 
-				if (sphereIntersectIs(&sphere, ray, &currentIs)) {
+				counters->primitives++;
+				if (sphereIntersectIs(&sphere, spd + objects[i].index, ray, &currentIs)) {
 					if (currentIs.hitTime < is->hitTime) {
 						*is = currentIs;
 						is->obj_index = objects[i].index;
@@ -210,6 +219,7 @@ bool intersectIs_unigrid(TRay* ray, TIntersect* is, __global TSphere* sp, unsign
 			else {
 				triangle = tr[objects[i].index];
 
+				counters->primitives++;
 				if (triangleIntersectIs(&triangle, ray, &currentIs, me, ra_me, cnt_ra_me)) {
 					if (currentIs.hitTime < is->hitTime) {
 						*is = currentIs;
@@ -252,15 +262,18 @@ bool intersectIs_unigrid(TRay* ray, TIntersect* is, __global TSphere* sp, unsign
 // ray -> information about ray
 // depth -> maximum depth of computation
 // sp -> buffer of all spheres
+// spd -> transforms and materials of all spheres
 // tr -> buffer of all triangles
 // me -> buffer of all meshes
 // ra_me -> buffer of size every mesh
+// stats -> traversal statistics, NULL if counting is disabled
 // @return -> result color for pixel
-TColor trace_unigrid(TRay ray, uint depth, uint2 seed, __global TSphere* sp, unsigned int cnt_sp,
+TColor trace_unigrid(TRay ray, uint depth, uint2 seed, __global TSphere* sp, __global TSphereData* spd, unsigned int cnt_sp,
 	__global TTriangle* tr, unsigned int cnt_tr, __global TMesh* me,
 	__global unsigned int* ra_me, unsigned int cnt_ra_me,
 	__global TLight* lights, unsigned int cnt_li,
-	__global TUniGrid* infoUniGrid, __global TBoxLink* uniGrid, __global TObject* objects)
+	__global TUniGrid* infoUniGrid, __global TBoxLink* uniGrid, __global TObject* objects,
+	__global TTraversalStats* stats)
 {
 	TColor stack[500];
 	unsigned int stack_id = 0;
@@ -272,6 +285,8 @@ TColor trace_unigrid(TRay ray, uint depth, uint2 seed, __global TSphere* sp, uns
 	float absorption_factor = 1 / (1 - p_absorption);
 
 	TIntersect is;
+	TCounters counters;
+	counters.nodes = 0; counters.primitives = 0;
 	TColor directLight, indirectLight;
 
 	while (true) {
@@ -279,8 +294,10 @@ TColor trace_unigrid(TRay ray, uint depth, uint2 seed, __global TSphere* sp, uns
 		indirectLight.x = 0.0f; indirectLight.y = 0.0f; indirectLight.z = 0.0f;
 		isEnd = true;
 		// Try to intersect any object.
-		if (intersectIs_unigrid(&ray, &is, sp, cnt_sp, tr, cnt_tr, me, ra_me, cnt_ra_me,
-			infoUniGrid, uniGrid, objects)) { // OK
+		bool hit = intersectIs_unigrid(&ray, &is, sp, spd, cnt_sp, tr, cnt_tr, me, ra_me, cnt_ra_me,
+			infoUniGrid, uniGrid, objects, &counters);
+		addTraversalStats(stats, &counters);
+		if (hit) { // OK
 
 			// Found intersection -> compute color.
 			TMaterial material = is.material;
@@ -294,11 +311,11 @@ TColor trace_unigrid(TRay ray, uint depth, uint2 seed, __global TSphere* sp, uns
 			// Next ray will be?
 			if (light_type <= reflectivity) {
 				// Reflected ray.
-				ray = getReflectedRay(&ray, &is, sp, tr, me, ra_me); // OK
+				ray = getReflectedRay(&ray, &is, spd, tr, me, ra_me); // OK
 			}
 			else if ((light_type - reflectivity) <= transparency) {
 				// Refracted ray.
-				ray = getRefractedRay(&ray, &is, sp, tr, me, ra_me); // OK
+				ray = getRefractedRay(&ray, &is, spd, tr, me, ra_me); // OK
 			}
 			else {
 				// Compute color.
@@ -308,9 +325,11 @@ TColor trace_unigrid(TRay ray, uint depth, uint2 seed, __global TSphere* sp, uns
 					TLight light = lights[i]; // OK
 					TRay shadowRay = getShadowRay(&light, &is); // OK
 
+					bool shadowHit = intersect_unigrid(&shadowRay, sp, spd, cnt_sp, tr, cnt_tr, me, ra_me, cnt_ra_me, 
+						infoUniGrid, uniGrid, objects, &counters);
+					addTraversalStats(stats, &counters);
 					// Is point visible by light?
-					if (!intersect_unigrid(&shadowRay, sp, cnt_sp, tr, cnt_tr, me, ra_me, cnt_ra_me, 
-						infoUniGrid, uniGrid, objects)) 
+					if (!shadowHit) 
 					{ // OK
 						float intensity = pow(shadowRay.maxT, -2);
 						TColor incomingRadiance = light.radiance * intensity;
@@ -400,4 +419,31 @@ TColor trace_unigrid(TRay ray, uint depth, uint2 seed, __global TSphere* sp, uns
 	} // End of while loop
 } // End of function
 
+// Compute traversal cost of ray as false colour for heatmap mode.
+// Only ray from camera is traced, without bounces and shadow rays.
+// sp -> buffer of all spheres
+// spd -> transforms and materials of all spheres
+// tr -> buffer of all triangles
+// me -> buffer of all meshes
+// ra_me -> buffer of size every mesh
+// stats -> traversal statistics, NULL if counting is disabled
+// @return -> result color for pixel
+TColor heatmap_unigrid(TRay ray, __global TSphere* sp, __global TSphereData* spd, unsigned int cnt_sp,
+	__global TTriangle* tr, unsigned int cnt_tr, __global TMesh* me,
+	__global unsigned int* ra_me, unsigned int cnt_ra_me,
+	__global TUniGrid* infoUniGrid, __global TBoxLink* uniGrid, __global TObject* objects,
+	__global TTraversalStats* stats)
+{
+	TIntersect is;
+	TCounters counters;
+	counters.nodes = 0; counters.primitives = 0;
+
+	intersectIs_unigrid(&ray, &is, sp, spd, cnt_sp, tr, cnt_tr, me, ra_me, cnt_ra_me,
+		infoUniGrid, uniGrid, objects, &counters);
+	TColor color = heatColor(&counters);
+	addTraversalStats(stats, &counters);
+
+	return color;
+}
+
 #endif // _KERNEL_TRACE_UNIGRID_H_
\ No newline at end of file
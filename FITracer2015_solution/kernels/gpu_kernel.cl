@@ -9,6 +9,7 @@
 #include "kernel_trace_octree.h"
 #include "kernel_trace_unigrid.h"
 #include "kernel_trace_bvh.h"
+#include "kernel_trace_kdtree.h"
 
 // Enable printf on AMD's OpenCL platform.
 //#pragma OPENCL EXTENSION cl_amd_printf : enable
@@ -35,6 +36,9 @@
 // size_li -> count of light's buffer
 // seed -> seed for random number generator
 // samples -> number of samples in texture
+// stats -> traversal statistics, NULL if counting is disabled
+// heatmap -> 1 for false colour of traversal cost instead of pathtracing
+// sphereData -> transforms and materials of all spheres
 __kernel void gpu_pt_list(
 	__read_only image2d_t inPixelColor, // 0
 	__write_only image2d_t outPixelColor, // 1
@@ -51,7 +55,10 @@ __kernel void gpu_pt_list(
 	__global TLight* lights, // 12
 	__global unsigned int* size_li, // 13
 	unsigned int seed, // 14
-	unsigned int samples // 15
+	unsigned int samples, // 15
+	__global TTraversalStats* stats, // 16
+	__global unsigned int* heatmap, // 17
+	__global TSphereData* sphereData // 18
 	) 
 {
 	// Get index of pixel's width.
@@ -75,8 +82,13 @@ __kernel void gpu_pt_list(
 	unsigned int cnt_LightsLoc = size_li[0];
 
 	// Compute color of pixel.
-	TColor res = trace_list(ray, DEPTH, nums, spheres, cnt_SpheresLoc, triangles, cnt_TrianglesLoc,
-		meshes, range_meshes, cnt_RangeMeshesLoc, lights, cnt_LightsLoc);
+	TColor res;
+	if (heatmap[0])
+		res = heatmap_list(ray, spheres, sphereData, cnt_SpheresLoc, triangles, cnt_TrianglesLoc,
+			meshes, range_meshes, cnt_RangeMeshesLoc, stats);
+	else
+		res = trace_list(ray, DEPTH, nums, spheres, sphereData, cnt_SpheresLoc, triangles, cnt_TrianglesLoc,
+			meshes, range_meshes, cnt_RangeMeshesLoc, lights, cnt_LightsLoc, stats);
 
 	// Computed color.
 	float4 computeColor; computeColor.xyz = res.xyz; computeColor.w = 1.f;
@@ -108,6 +120,9 @@ __kernel void gpu_pt_list(
 // light -> buffer of all lights
 // size_li -> count of light's buffer
 // seed -> seed for random number generator
+// stats -> traversal statistics, NULL if counting is disabled
+// heatmap -> 1 for false colour of traversal cost instead of pathtracing
+// sphereData -> transforms and materials of all spheres
 __kernel void gpu_pt_list_first(
 	__write_only image2d_t outPixelColor, // 0
 	__global TCamera* cam, // 1
@@ -122,7 +137,10 @@ __kernel void gpu_pt_list_first(
 	__global unsigned int* size_ra_me, // 10
 	__global TLight* lights, // 11
 	__global unsigned int* size_li, // 12
-	unsigned int seed // 13
+	unsigned int seed, // 13
+	__global TTraversalStats* stats, // 14
+	__global unsigned int* heatmap, // 15
+	__global TSphereData* sphereData // 16
 	)
 {
 	// Get index of pixel's width.
@@ -146,8 +164,13 @@ __kernel void gpu_pt_list_first(
 	unsigned int cnt_LightsLoc = size_li[0];
 
 	// Compute color of pixel.
-	TColor res = trace_list(ray, DEPTH, nums, spheres, cnt_SpheresLoc, triangles, cnt_TrianglesLoc,
-		meshes, range_meshes, cnt_RangeMeshesLoc, lights, cnt_LightsLoc);
+	TColor res;
+	if (heatmap[0])
+		res = heatmap_list(ray, spheres, sphereData, cnt_SpheresLoc, triangles, cnt_TrianglesLoc,
+			meshes, range_meshes, cnt_RangeMeshesLoc, stats);
+	else
+		res = trace_list(ray, DEPTH, nums, spheres, sphereData, cnt_SpheresLoc, triangles, cnt_TrianglesLoc,
+			meshes, range_meshes, cnt_RangeMeshesLoc, lights, cnt_LightsLoc, stats);
 
 	// Computed color.
 	float4 computeColor; computeColor.xyz = res.xyz; computeColor.w = 1.f;
@@ -175,9 +198,13 @@ __kernel void gpu_pt_list_first(
 // size_li -> count of light's buffer
 // seed -> seed for random number generator
 // samples -> number of samples in texture
-// octree -> buffer of all octree data structures
-// octree_size -> count of octree's buffer
+// octree -> buffer of all octree nodes
+// octree_links -> neighbour links of octree nodes
+// octree_info -> bounding box of octree
 // objects -> indexes of objects belong to octree
+// stats -> traversal statistics, NULL if counting is disabled
+// heatmap -> 1 for false colour of traversal cost instead of pathtracing
+// sphereData -> transforms and materials of all spheres
 __kernel void gpu_pt_octree(
 	__read_only image2d_t inPixelColor, // 0
 	__write_only image2d_t outPixelColor, // 1
@@ -195,9 +222,13 @@ __kernel void gpu_pt_octree(
 	__global unsigned int* size_li, // 13
 	unsigned int seed, // 14
 	unsigned int samples, // 15
-	__global TOctreeBox* octree, // 16
-	__global unsigned int* octree_size, // 17
-	__global TObject* objects // 18
+	__global TOctreeNode* octree, // 16
+	__global TOctreeLink* octree_links, // 17
+	__global TOctree* octree_info, // 18
+	__global TObject* objects, // 19
+	__global TTraversalStats* stats, // 20
+	__global unsigned int* heatmap, // 21
+	__global TSphereData* sphereData // 22
 	)
 {
 	// Get index of pixel's width.
@@ -209,7 +240,7 @@ __kernel void gpu_pt_octree(
 	unsigned int cnt_TrianglesLoc = cnt_triangles[0];
 	unsigned int cnt_RangeMeshesLoc = size_ra_me[0];
 	unsigned int cnt_LightsLoc = size_li[0];
-	unsigned int cnt_OctreeLoc = octree_size[0];
+	TOctree octreeInfoLoc = octree_info[0];
 
 	// Set camera as local var.
 	TCamera cam2 = cam[0];
@@ -223,8 +254,13 @@ __kernel void gpu_pt_octree(
 	TRay ray = getRay(cam2, sx, sy);
 
 	// Compute pixel.
-	TColor res = trace_octree(ray, DEPTH, nums, spheres, cnt_SpheresLoc, triangles, cnt_TrianglesLoc,
-		meshes, range_meshes, cnt_RangeMeshesLoc, lights, cnt_LightsLoc, octree, cnt_OctreeLoc, objects);
+	TColor res;
+	if (heatmap[0])
+		res = heatmap_octree(ray, spheres, sphereData, cnt_SpheresLoc, triangles, cnt_TrianglesLoc,
+			meshes, range_meshes, cnt_RangeMeshesLoc, octree, octree_links, octreeInfoLoc, objects, stats);
+	else
+		res = trace_octree(ray, DEPTH, nums, spheres, sphereData, cnt_SpheresLoc, triangles, cnt_TrianglesLoc,
+			meshes, range_meshes, cnt_RangeMeshesLoc, lights, cnt_LightsLoc, octree, octree_links, octreeInfoLoc, objects, stats);
 
 	// Computed color.
 	float4 computeColor; computeColor.xyz = res.xyz; computeColor.w = 1.f;
@@ -256,9 +292,13 @@ __kernel void gpu_pt_octree(
 // light -> buffer of all lights
 // size_li -> count of light's buffer
 // seed -> seed for random number generator
-// octree -> buffer of all octree data structures
-// octree_size -> count of octree's buffer
+// octree -> buffer of all octree nodes
+// octree_links -> neighbour links of octree nodes
+// octree_info -> bounding box of octree
 // objects -> indexes of objects belong to octree
+// stats -> traversal statistics, NULL if counting is disabled
+// heatmap -> 1 for false colour of traversal cost instead of pathtracing
+// sphereData -> transforms and materials of all spheres
 __kernel void gpu_pt_octree_first(
 	__write_only image2d_t outPixelColor, // 0
 	__global TCamera* cam, // 1
@@ -274,9 +314,13 @@ __kernel void gpu_pt_octree_first(
 	__global TLight* lights, // 11
 	__global unsigned int* size_li, // 12
 	unsigned int seed, // 13
-	__global TOctreeBox* octree, // 14
-	__global unsigned int* octree_size, // 15
-	__global TObject* objects // 16
+	__global TOctreeNode* octree, // 14
+	__global TOctreeLink* octree_links, // 15
+	__global TOctree* octree_info, // 16
+	__global TObject* objects, // 17
+	__global TTraversalStats* stats, // 18
+	__global unsigned int* heatmap, // 19
+	__global TSphereData* sphereData // 20
 	)
 {
 	// Get index of pixel's width.
@@ -288,7 +332,7 @@ __kernel void gpu_pt_octree_first(
 	unsigned int cnt_TrianglesLoc = cnt_triangles[0];
 	unsigned int cnt_RangeMeshesLoc = size_ra_me[0];
 	unsigned int cnt_LightsLoc = size_li[0];
-	unsigned int cnt_OctreeLoc = octree_size[0];
+	TOctree octreeInfoLoc = octree_info[0];
 
 	// Set camera as local var.
 	TCamera cam2 = cam[0];
@@ -302,8 +346,13 @@ __kernel void gpu_pt_octree_first(
 	TRay ray = getRay(cam2, sx, sy);
 
 	// Compute pixel.
-	TColor res = trace_octree(ray, DEPTH, nums, spheres, cnt_SpheresLoc, triangles, cnt_TrianglesLoc,
-		meshes, range_meshes, cnt_RangeMeshesLoc, lights, cnt_LightsLoc, octree, cnt_OctreeLoc, objects);
+	TColor res;
+	if (heatmap[0])
+		res = heatmap_octree(ray, spheres, sphereData, cnt_SpheresLoc, triangles, cnt_TrianglesLoc,
+			meshes, range_meshes, cnt_RangeMeshesLoc, octree, octree_links, octreeInfoLoc, objects, stats);
+	else
+		res = trace_octree(ray, DEPTH, nums, spheres, sphereData, cnt_SpheresLoc, triangles, cnt_TrianglesLoc,
+			meshes, range_meshes, cnt_RangeMeshesLoc, lights, cnt_LightsLoc, octree, octree_links, octreeInfoLoc, objects, stats);
 
 	// Computed color.
 	float4 computeColor; computeColor.xyz = res.xyz; computeColor.w = 1.f;
@@ -334,6 +383,9 @@ __kernel void gpu_pt_octree_first(
 // infoUniGrid -> control infos about Uniform grid data structure
 // uniGrid -> buffer of all uniform grid data structure
 // objects -> indexes of objects in uniform grid
+// stats -> traversal statistics, NULL if counting is disabled
+// heatmap -> 1 for false colour of traversal cost instead of pathtracing
+// sphereData -> transforms and materials of all spheres
 __kernel void gpu_pt_unigrid(
 	__read_only image2d_t inPixelColor, // 0
 	__write_only image2d_t outPixelColor, // 1
@@ -353,7 +405,10 @@ __kernel void gpu_pt_unigrid(
 	unsigned int samples, // 15
 	__global TUniGrid* infoUniGrid, // 16
 	__global TBoxLink* uniGrid, // 17
-	__global TObject* objects // 18
+	__global TObject* objects, // 18
+	__global TTraversalStats* stats, // 19
+	__global unsigned int* heatmap, // 20
+	__global TSphereData* sphereData // 21
 	)
 {
 	// Get index of pixel's width.
@@ -379,8 +434,13 @@ __kernel void gpu_pt_unigrid(
 	ray.rayID = true;
 
 	// Compute pixel.
-	TColor res = trace_unigrid(ray, DEPTH, nums, spheres, cnt_SpheresLoc, triangles, cnt_TrianglesLoc,
-		meshes, range_meshes, cnt_RangeMeshesLoc, lights, cnt_LightsLoc, infoUniGrid, uniGrid, objects);
+	TColor res;
+	if (heatmap[0])
+		res = heatmap_unigrid(ray, spheres, sphereData, cnt_SpheresLoc, triangles, cnt_TrianglesLoc,
+			meshes, range_meshes, cnt_RangeMeshesLoc, infoUniGrid, uniGrid, objects, stats);
+	else
+		res = trace_unigrid(ray, DEPTH, nums, spheres, sphereData, cnt_SpheresLoc, triangles, cnt_TrianglesLoc,
+			meshes, range_meshes, cnt_RangeMeshesLoc, lights, cnt_LightsLoc, infoUniGrid, uniGrid, objects, stats);
 
 	// Computed color.
 	float4 computeColor; computeColor.xyz = res.xyz; computeColor.w = 1.f;
@@ -416,6 +476,9 @@ __kernel void gpu_pt_unigrid(
 // infoUniGrid -> control infos about Uniform grid data structure
 // uniGrid -> buffer of all uniform grid data structure
 // objects -> indexes of objects in uniform grid
+// stats -> traversal statistics, NULL if counting is disabled
+// heatmap -> 1 for false colour of traversal cost instead of pathtracing
+// sphereData -> transforms and materials of all spheres
 __kernel void gpu_pt_unigrid_first(
 	__write_only image2d_t outPixelColor, // 0
 	__global TCamera* cam, // 1
@@ -433,7 +496,10 @@ __kernel void gpu_pt_unigrid_first(
 	unsigned int seed, // 13
 	__global TUniGrid* infoUniGrid, // 14
 	__global TBoxLink* uniGrid, // 15
-	__global TObject* objects // 16
+	__global TObject* objects, // 16
+	__global TTraversalStats* stats, // 17
+	__global unsigned int* heatmap, // 18
+	__global TSphereData* sphereData // 19
 	)
 {
 	// Get index of pixel's width.
@@ -458,8 +524,13 @@ __kernel void gpu_pt_unigrid_first(
 	TRay ray = getRay(cam2, sx, sy);
 
 	// Compute pixel.
-	TColor res = trace_unigrid(ray, DEPTH, nums, spheres, cnt_SpheresLoc, triangles, cnt_TrianglesLoc,
-		meshes, range_meshes, cnt_RangeMeshesLoc, lights, cnt_LightsLoc, infoUniGrid, uniGrid, objects);
+	TColor res;
+	if (heatmap[0])
+		res = heatmap_unigrid(ray, spheres, sphereData, cnt_SpheresLoc, triangles, cnt_TrianglesLoc,
+			meshes, range_meshes, cnt_RangeMeshesLoc, infoUniGrid, uniGrid, objects, stats);
+	else
+		res = trace_unigrid(ray, DEPTH, nums, spheres, sphereData, cnt_SpheresLoc, triangles, cnt_TrianglesLoc,
+			meshes, range_meshes, cnt_RangeMeshesLoc, lights, cnt_LightsLoc, infoUniGrid, uniGrid, objects, stats);
 
 	// Computed color.
 	float4 computeColor; computeColor.xyz = res.xyz; computeColor.w = 1.f;
@@ -489,6 +560,9 @@ __kernel void gpu_pt_unigrid_first(
 // samples -> number of samples in texture
 // bvhNodes -> buffer of all BVH data structures
 // objects -> indexes of objects in bvh 
+// stats -> traversal statistics, NULL if counting is disabled
+// heatmap -> 1 for false colour of traversal cost instead of pathtracing
+// sphereData -> transforms and materials of all spheres
 __kernel void gpu_pt_bvh(
 	__read_only image2d_t inPixelColor, // 0
 	__write_only image2d_t outPixelColor, // 1
@@ -507,7 +581,10 @@ __kernel void gpu_pt_bvh(
 	unsigned int seed, // 14
 	unsigned int samples, // 15
 	__global TBVHNode* bvhNodes, // 16
-	__global TObject* objects // 17
+	__global TObject* objects, // 17
+	__global TTraversalStats* stats, // 18
+	__global unsigned int* heatmap, // 19
+	__global TSphereData* sphereData // 20
 	)
 {
 	// Get index of pixel's width.
@@ -531,8 +608,13 @@ __kernel void gpu_pt_bvh(
 	unsigned int cnt_LightsLoc = size_li[0];
 
 	// Compute pixel.
-	TColor res = trace_bvh(ray, DEPTH, nums, spheres, cnt_SpheresLoc, triangles, cnt_TrianglesLoc,
-		meshes, range_meshes, cnt_RangeMeshesLoc, lights, cnt_LightsLoc, bvhNodes, objects);
+	TColor res;
+	if (heatmap[0])
+		res = heatmap_bvh(ray, spheres, sphereData, cnt_SpheresLoc, triangles, cnt_TrianglesLoc,
+			meshes, range_meshes, cnt_RangeMeshesLoc, bvhNodes, objects, stats);
+	else
+		res = trace_bvh(ray, DEPTH, nums, spheres, sphereData, cnt_SpheresLoc, triangles, cnt_TrianglesLoc,
+			meshes, range_meshes, cnt_RangeMeshesLoc, lights, cnt_LightsLoc, bvhNodes, objects, stats);
 
 	// Computed color.
 	float4 computeColor; computeColor.xyz = res.xyz; computeColor.w = 1.f;
@@ -566,6 +648,9 @@ __kernel void gpu_pt_bvh(
 // seed -> seed for random number generator
 // bvhNodes -> buffer of all BVH data structures
 // objects -> indexes of objects in bvh 
+// stats -> traversal statistics, NULL if counting is disabled
+// heatmap -> 1 for false colour of traversal cost instead of pathtracing
+// sphereData -> transforms and materials of all spheres
 __kernel void gpu_pt_bvh_first(
 	__write_only image2d_t outPixelColor, // 0
 	__global TCamera* cam, // 1
@@ -582,7 +667,180 @@ __kernel void gpu_pt_bvh_first(
 	__global unsigned int* size_li, // 12
 	unsigned int seed, // 13
 	__global TBVHNode* bvhNodes, // 14
-	__global TObject* objects // 15
+	__global TObject* objects, // 15
+	__global TTraversalStats* stats, // 16
+	__global unsigned int* heatmap, // 17
+	__global TSphereData* sphereData // 18
+	)
+{
+	// Get index of pixel's width.
+	unsigned int x = get_global_id(0);
+	// Get index of pixel's height.
+	unsigned int y = get_global_id(1);
+
+	// Set camera as local var.
+	TCamera cam2 = cam[0];
+
+	// Set random range <0,1) to pixel coordinate.
+	uint2 nums; nums.x = x + seed; nums.y = y + seed;
+	float sx = x + randomFloat(&nums, 1);
+	float sy = y + randomFloat(&nums, 1);
+
+	// Compute ray structure.
+	TRay ray = getRay(cam2, sx, sy);
+	unsigned int cnt_SpheresLoc = cnt_spheres[0];
+	unsigned int cnt_TrianglesLoc = cnt_triangles[0];
+	unsigned int cnt_RangeMeshesLoc = size_ra_me[0];
+	unsigned int cnt_LightsLoc = size_li[0];
+
+	// Compute pixel.
+	TColor res;
+	if (heatmap[0])
+		res = heatmap_bvh(ray, spheres, sphereData, cnt_SpheresLoc, triangles, cnt_TrianglesLoc,
+			meshes, range_meshes, cnt_RangeMeshesLoc, bvhNodes, objects, stats);
+	else
+		res = trace_bvh(ray, DEPTH, nums, spheres, sphereData, cnt_SpheresLoc, triangles, cnt_TrianglesLoc,
+			meshes, range_meshes, cnt_RangeMeshesLoc, lights, cnt_LightsLoc, bvhNodes, objects, stats);
+
+	// Computed color.
+	float4 computeColor; computeColor.xyz = res.xyz; computeColor.w = 1.f;
+	int2 pos; pos.x = x; pos.y = y;
+	// Write result color.
+	write_imagef(outPixelColor, pos, computeColor);
+}
+
+////////////////////
+// kD-tree kernels //
+///////////////////
+
+// Kernel for compute with kD-tree accelerated data structure.
+// inPixelColor -> texture with actual progress
+// outPixelColor -> texture for new result
+// cam -> set camera
+// spheres -> buffer of all spheres
+// cnt_spheres -> count of sphere's buffer
+// triangles -> buffer of all triangles
+// cnt_triangles -> count of triangle's buffer
+// meshes -> buffer of all meshes
+// range_meshes -> buffer with ranges of every mesh
+// size_ra_me -> count of range's buffer
+// light -> buffer of all lights
+// size_li -> count of light's buffer
+// seed -> seed for random number generator
+// samples -> number of samples in texture
+// kdNodes -> buffer of all kD-tree nodes with ropes
+// objects -> indexes of objects in kD-tree leafs
+// stats -> traversal statistics, NULL if counting is disabled
+// heatmap -> 1 for false colour of traversal cost instead of pathtracing
+// sphereData -> transforms and materials of all spheres
+__kernel void gpu_pt_kdtree(
+	__read_only image2d_t inPixelColor, // 0
+	__write_only image2d_t outPixelColor, // 1
+	__global TCamera* cam, // 2
+	__global TSphere* spheres, // 3
+	__local unsigned int* spheresMem, // 4
+	__global unsigned int* cnt_spheres, // 5
+	__global TTriangle* triangles, // 6
+	__local unsigned int* trianglesMem, // 7
+	__global unsigned int* cnt_triangles, // 8
+	__global TMesh* meshes, // 9
+	__global unsigned int* range_meshes, // 10
+	__global unsigned int* size_ra_me, // 11
+	__global TLight* lights, // 12
+	__global unsigned int* size_li, // 13
+	unsigned int seed, // 14
+	unsigned int samples, // 15
+	__global TKdNode* kdNodes, // 16
+	__global TObject* objects, // 17
+	__global TTraversalStats* stats, // 18
+	__global unsigned int* heatmap, // 19
+	__global TSphereData* sphereData // 20
+	)
+{
+	// Get index of pixel's width.
+	unsigned int x = get_global_id(0);
+	// Get index of pixel's height.
+	unsigned int y = get_global_id(1);
+
+	// Set camera as local var.
+	TCamera cam2 = cam[0];
+
+	// Set random range <0,1) to pixel coordinate.
+	uint2 nums; nums.x = x + seed; nums.y = y + seed;
+	float sx = x + randomFloat(&nums, 1);
+	float sy = y + randomFloat(&nums, 1);
+
+	// Compute ray structure.
+	TRay ray = getRay(cam2, sx, sy);
+	unsigned int cnt_SpheresLoc = cnt_spheres[0];
+	unsigned int cnt_TrianglesLoc = cnt_triangles[0];
+	unsigned int cnt_RangeMeshesLoc = size_ra_me[0];
+	unsigned int cnt_LightsLoc = size_li[0];
+
+	// Compute pixel.
+	TColor res;
+	if (heatmap[0])
+		res = heatmap_kdtree(ray, spheres, sphereData, cnt_SpheresLoc, triangles, cnt_TrianglesLoc,
+			meshes, range_meshes, cnt_RangeMeshesLoc, kdNodes, objects, stats);
+	else
+		res = trace_kdtree(ray, DEPTH, nums, spheres, sphereData, cnt_SpheresLoc, triangles, cnt_TrianglesLoc,
+			meshes, range_meshes, cnt_RangeMeshesLoc, lights, cnt_LightsLoc, kdNodes, objects, stats);
+
+	// Computed color.
+	float4 computeColor; computeColor.xyz = res.xyz; computeColor.w = 1.f;
+
+	// Set sampler.
+	const sampler_t samplerTex = CLK_NORMALIZED_COORDS_FALSE | CLK_ADDRESS_NONE | CLK_FILTER_NEAREST;
+	// Get actual color in texture.
+	int2 pos; pos.x = x; pos.y = y;
+	float4 actualColor = read_imagef(inPixelColor, samplerTex, pos);
+
+	// Mix both colors.
+	float4 majorColor = actualColor * (samples / (samples + 1.f));
+	actualColor = majorColor + (computeColor * (1.f / (samples + 1.f)));
+
+	// Write result color.
+	write_imagef(outPixelColor, pos, actualColor);
+}
+
+// Kernel for first compute with kD-tree accelerated data structure.
+// outPixelColor -> texture for new result
+// cam -> set camera
+// spheres -> buffer of all spheres
+// cnt_spheres -> count of sphere's buffer
+// triangles -> buffer of all triangles
+// cnt_triangles -> count of triangle's buffer
+// meshes -> buffer of all meshes
+// range_meshes -> buffer with ranges of every mesh
+// size_ra_me -> count of range's buffer
+// light -> buffer of all lights
+// size_li -> count of light's buffer
+// seed -> seed for random number generator
+// kdNodes -> buffer of all kD-tree nodes with ropes
+// objects -> indexes of objects in kD-tree leafs
+// stats -> traversal statistics, NULL if counting is disabled
+// heatmap -> 1 for false colour of traversal cost instead of pathtracing
+// sphereData -> transforms and materials of all spheres
+__kernel void gpu_pt_kdtree_first(
+	__write_only image2d_t outPixelColor, // 0
+	__global TCamera* cam, // 1
+	__global TSphere* spheres, // 2
+	__local unsigned int* spheresMem, // 3
+	__global unsigned int* cnt_spheres, // 4
+	__global TTriangle* triangles, // 5
+	__local unsigned int* trianglesMem, // 6
+	__global unsigned int* cnt_triangles, // 7
+	__global TMesh* meshes, // 8
+	__global unsigned int* range_meshes, // 9
+	__global unsigned int* size_ra_me, // 10
+	__global TLight* lights, // 11
+	__global unsigned int* size_li, // 12
+	unsigned int seed, // 13
+	__global TKdNode* kdNodes, // 14
+	__global TObject* objects, // 15
+	__global TTraversalStats* stats, // 16
+	__global unsigned int* heatmap, // 17
+	__global TSphereData* sphereData // 18
 	)
 {
 	// Get index of pixel's width.
@@ -606,8 +864,13 @@ __kernel void gpu_pt_bvh_first(
 	unsigned int cnt_LightsLoc = size_li[0];
 
 	// Compute pixel.
-	TColor res = trace_bvh(ray, DEPTH, nums, spheres, cnt_SpheresLoc, triangles, cnt_TrianglesLoc,
-		meshes, range_meshes, cnt_RangeMeshesLoc, lights, cnt_LightsLoc, bvhNodes, objects);
+	TColor res;
+	if (heatmap[0])
+		res = heatmap_kdtree(ray, spheres, sphereData, cnt_SpheresLoc, triangles, cnt_TrianglesLoc,
+			meshes, range_meshes, cnt_RangeMeshesLoc, kdNodes, objects, stats);
+	else
+		res = trace_kdtree(ray, DEPTH, nums, spheres, sphereData, cnt_SpheresLoc, triangles, cnt_TrianglesLoc,
+			meshes, range_meshes, cnt_RangeMeshesLoc, lights, cnt_LightsLoc, kdNodes, objects, stats);
 
 	// Computed color.
 	float4 computeColor; computeColor.xyz = res.xyz; computeColor.w = 1.f;
@@ -13,14 +13,16 @@
 // Intersect object without information about it.
 // ray -> information about ray
 // sp -> buffer of all spheres
+// spd -> transforms and materials of all spheres
 // tr -> buffer of all triangles
 // me -> buffer of all meshes
 // ra_me -> buffer of size every mesh
+// counters -> counters of traversal
 // @return -> successful of intersect 
-bool intersect_bvh(TRay* ray, __global TSphere* sp, unsigned int cnt_sp,
+bool intersect_bvh(TRay* ray, __global TSphere* sp, __global TSphereData* spd, unsigned int cnt_sp,
 	__global TTriangle* tr, unsigned int cnt_tr, __global TMesh* me,
 	__global unsigned int* ra_me, unsigned int cnt_ra_me,
-	__global TBVHNode* bvhNodes, __global TObject* objects)
+	__global TBVHNode* bvhNodes, __global TObject* objects, TCounters* counters)
 {
 	__global TBVHNode* currentNode = &bvhNodes[0];
 	float mMin, mMax;
@@ -34,16 +36,19 @@ bool intersect_bvh(TRay* ray, __global TSphere* sp, unsigned int cnt_sp,
 	unsigned int stackCnt = 0;
 
 	while (true) {
+		counters->nodes++;
 		if ((*currentNode).leaf) {
 			for (int i = (*currentNode).indexObj.objStartIndex; i < (*currentNode).indexObj.objSize; i++) {
 				if (objects[i].type == SPHERE_INDEX) {
 					sphere = sp[objects[i].index];
-					if (sphereIntersect(&sphere, ray)) {
+					counters->primitives++;
+					if (sphereIntersect(&sphere, spd + objects[i].index, ray)) {
 						return true;
 					}
 				}
 				else {
 					triangle = tr[objects[i].index];
+					counters->primitives++;
 					if (triangleIntersect(&triangle, ray, me, ra_me, cnt_ra_me)) {
 						return true;
 					}
@@ -86,14 +91,16 @@ bool intersect_bvh(TRay* ray, __global TSphere* sp, unsigned int cnt_sp,
 // ray -> information about ray
 // is -> information about intersection
 // sp -> buffer of all spheres
+// spd -> transforms and materials of all spheres
 // tr -> buffer of all triangles
 // me -> buffer of all meshes
 // ra_me -> buffer of size every mesh
+// counters -> counters of traversal
 // @return -> successful of intersect 
-bool intersectIs_bvh(TRay* ray, TIntersect* is, __global TSphere* sp, unsigned int cnt_sp,
+bool intersectIs_bvh(TRay* ray, TIntersect* is, __global TSphere* sp, __global TSphereData* spd, unsigned int cnt_sp,
 	__global TTriangle* tr, unsigned int cnt_tr, __global TMesh* me,
 	__global unsigned int* ra_me, unsigned int cnt_ra_me,
-	__global TBVHNode* bvhNodes, __global TObject* objects)
+	__global TBVHNode* bvhNodes, __global TObject* objects, TCounters* counters)
 {
 	__global TBVHNode* currentNode = &bvhNodes[0];
 	float mMin, mMax;
@@ -110,11 +117,13 @@ bool intersectIs_bvh(TRay* ray, TIntersect* is, __global TSphere* sp, unsigned i
 	bool hit = false;
 
 	while (true) {
+		counters->nodes++;
 		if ((*currentNode).leaf) {
 			for (int i = (*currentNode).indexObj.objStartIndex; i < (*currentNode).indexObj.objSize; i++) {
 				if (objects[i].type == SPHERE_INDEX) {
 					sphere = sp[objects[i].index];
-					if (sphereIntersectIs(&sphere, &localRay, is)) {
+					counters->primitives++;
+					if (sphereIntersectIs(&sphere, spd + objects[i].index, &localRay, is)) {
 						localRay.maxT = is->hitTime;
 						is->obj_index = objects[i].index;
 						hit = true;
@@ -122,6 +131,7 @@ bool intersectIs_bvh(TRay* ray, TIntersect* is, __global TSphere* sp, unsigned i
 				}
 				else {
 					triangle = tr[objects[i].index];
+					counters->primitives++;
 					if (triangleIntersectIs(&triangle, &localRay, is, me, ra_me, cnt_ra_me)) {
 						localRay.maxT = is->hitTime;
 						is->obj_index = objects[i].index;
@@ -185,15 +195,18 @@ bool intersectIs_bvh(TRay* ray, TIntersect* is, __global TSphere* sp, unsigned i
 // ray -> information about ray
 // depth -> maximum depth of computation
 // sp -> buffer of all spheres
+// spd -> transforms and materials of all spheres
 // tr -> buffer of all triangles
 // me -> buffer of all meshes
 // ra_me -> buffer of size every mesh
+// stats -> traversal statistics, NULL if counting is disabled
 // @return -> result color for pixel
-TColor trace_bvh(TRay ray, uint depth, uint2 seed, __global TSphere* sp, unsigned int cnt_sp,
+TColor trace_bvh(TRay ray, uint depth, uint2 seed, __global TSphere* sp, __global TSphereData* spd, unsigned int cnt_sp,
 	__global TTriangle* tr, unsigned int cnt_tr, __global TMesh* me,
 	__global unsigned int* ra_me, unsigned int cnt_ra_me,
 	__global TLight* lights, unsigned int cnt_li,
-	__global TBVHNode* bvhNodes, __global TObject* objects)
+	__global TBVHNode* bvhNodes, __global TObject* objects,
+	__global TTraversalStats* stats)
 {
 	TColor stack[500];
 	unsigned int stack_id = 0;
@@ -205,6 +218,8 @@ TColor trace_bvh(TRay ray, uint depth, uint2 seed, __global TSphere* sp, unsigne
 	float absorption_factor = 1 / (1 - p_absorption);
 
 	TIntersect is;
+	TCounters counters;
+	counters.nodes = 0; counters.primitives = 0;
 
 	TColor directLight, indirectLight;
 	while (true) {
@@ -212,7 +227,9 @@ TColor trace_bvh(TRay ray, uint depth, uint2 seed, __global TSphere* sp, unsigne
 		indirectLight.x = 0.0f; indirectLight.y = 0.0f; indirectLight.z = 0.0f;
 		isEnd = true;
 		// Try to intersect any object.
-		if (intersectIs_bvh(&ray, &is, sp, cnt_sp, tr, cnt_tr, me, ra_me, cnt_ra_me, bvhNodes, objects)) { // Not tested
+		bool hit = intersectIs_bvh(&ray, &is, sp, spd, cnt_sp, tr, cnt_tr, me, ra_me, cnt_ra_me, bvhNodes, objects, &counters);
+		addTraversalStats(stats, &counters);
+		if (hit) { // Not tested
 			// Found intersection -> compute color.
 			TMaterial material = is.material;
 
@@ -226,11 +243,11 @@ TColor trace_bvh(TRay ray, uint depth, uint2 seed, __global TSphere* sp, unsigne
 			// Next ray will be?
 			if (light_type <= reflectivity) {
 				// Reflected ray.
-				ray = getReflectedRay(&ray, &is, sp, tr, me, ra_me); // OK
+				ray = getReflectedRay(&ray, &is, spd, tr, me, ra_me); // OK
 			}
 			else if ((light_type - reflectivity) <= transparency) {
 				// Refracted ray.
-				ray = getRefractedRay(&ray, &is, sp, tr, me, ra_me); // OK
+				ray = getRefractedRay(&ray, &is, spd, tr, me, ra_me); // OK
 			}
 			else {
 				// Compute color.
@@ -240,9 +257,11 @@ TColor trace_bvh(TRay ray, uint depth, uint2 seed, __global TSphere* sp, unsigne
 					TLight light = lights[i]; // OK
 					TRay shadowRay = getShadowRay(&light, &is); // OK
 
+					bool shadowHit = intersect_bvh(&shadowRay, sp, spd, cnt_sp, tr, cnt_tr, me, ra_me, cnt_ra_me,
+						bvhNodes, objects, &counters);
+					addTraversalStats(stats, &counters);
 					// Is point visible by light?
-					if (!intersect_bvh(&shadowRay, sp, cnt_sp, tr, cnt_tr, me, ra_me, cnt_ra_me,
-						bvhNodes, objects)) { // Not tested
+					if (!shadowHit) { // Not tested
 						float intensity = pow(shadowRay.maxT, -2);
 						TColor incomingRadiance = light.radiance * intensity;
 						TVector3D lightVec = light.worldPos - is.position;
@@ -331,4 +350,31 @@ TColor trace_bvh(TRay ray, uint depth, uint2 seed, __global TSphere* sp, unsigne
 	} // End of while loop
 } // End of function
 
+// Compute traversal cost of ray as false colour for heatmap mode.
+// Only ray from camera is traced, without bounces and shadow rays.
+// sp -> buffer of all spheres
+// spd -> transforms and materials of all spheres
+// tr -> buffer of all triangles
+// me -> buffer of all meshes
+// ra_me -> buffer of size every mesh
+// stats -> traversal statistics, NULL if counting is disabled
+// @return -> result color for pixel
+TColor heatmap_bvh(TRay ray, __global TSphere* sp, __global TSphereData* spd, unsigned int cnt_sp,
+	__global TTriangle* tr, unsigned int cnt_tr, __global TMesh* me,
+	__global unsigned int* ra_me, unsigned int cnt_ra_me,
+	__global TBVHNode* bvhNodes, __global TObject* objects,
+	__global TTraversalStats* stats)
+{
+	TIntersect is;
+	TCounters counters;
+	counters.nodes = 0; counters.primitives = 0;
+
+	intersectIs_bvh(&ray, &is, sp, spd, cnt_sp, tr, cnt_tr, me, ra_me, cnt_ra_me,
+		bvhNodes, objects, &counters);
+	TColor color = heatColor(&counters);
+	addTraversalStats(stats, &counters);
+
+	return color;
+}
+
 #endif // _KERNEL_TRACE_BVH_H_
\ No newline at end of file
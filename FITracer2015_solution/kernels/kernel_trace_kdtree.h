@@ -0,0 +1,382 @@
+/*
+	Name: kernel_trace_kdtree.h
+	Desc: Trace and intersection functions for KDTREE PT.
+	Author: Karel Brezina (xbrezi13)
+*/
+
+#ifndef _KERNEL_TRACE_KDTREE_H_
+#define _KERNEL_TRACE_KDTREE_H_
+
+#include "kernel_types.h"
+#include "kernel_functions.h"
+
+// Axis of leaf node.
+#define KDTREE_LEAF 3
+
+// Traversal is stackless. Ray enters leaf found by descent from node and then
+// goes from leaf to leaf by ropes of exit face (Havran's rope trees).
+
+// Parametric range of ray inside box of root.
+// @return -> ray hits kD-tree box
+bool getKdTreeRange(TRay* ray, TVector3D invDir, __global TKdNode* kdNodes, float* tMin, float* tMax)
+{
+	TVector3D t0 = (kdNodes[0].boxMin - ray->orig) * invDir;
+	TVector3D t1 = (kdNodes[0].boxMax - ray->orig) * invDir;
+
+	*tMin = fmax(fmax(ray->minT, fmin(t0.x, t1.x)), fmax(fmin(t0.y, t1.y), fmin(t0.z, t1.z)));
+	*tMax = fmin(fmin(ray->maxT, fmax(t0.x, t1.x)), fmin(fmax(t0.y, t1.y), fmax(t0.z, t1.z)));
+	return *tMin <= *tMax;
+}
+
+// Descend from node to leaf where ray is at time t. Child is chosen by time
+// when ray crosses split plane, so ray lying on plane goes in its direction.
+// @return -> index of leaf
+unsigned int findKdTreeLeaf(TRay* ray, TVector3D invDir, float t, __global TKdNode* kdNodes, unsigned int node, TCounters* counters)
+{
+	while (kdNodes[node].axis != KDTREE_LEAF) {
+		counters->nodes++;
+		unsigned int axis = kdNodes[node].axis;
+		float axisInvDir = getItemFloat3(&invDir, axis);
+		float tSplit = (kdNodes[node].split - getItemFloat3(&(ray->orig), axis)) * axisInvDir;
+
+		if ((axisInvDir >= 0.0f) == (tSplit <= t))
+			node = kdNodes[node].index;
+		else
+			node++;
+	}
+	return node;
+}
+
+// Time when ray leaves leaf.
+// rope -> neighbour behind exit face, 0 if ray leaves kD-tree
+float getKdTreeExit(TRay* ray, TVector3D invDir, __global TKdNode* kdNodes, unsigned int node, unsigned int* rope)
+{
+	TPoint3D exitPlanes;
+	exitPlanes.x = (invDir.x >= 0.0f) ? kdNodes[node].boxMax.x : kdNodes[node].boxMin.x;
+	exitPlanes.y = (invDir.y >= 0.0f) ? kdNodes[node].boxMax.y : kdNodes[node].boxMin.y;
+	exitPlanes.z = (invDir.z >= 0.0f) ? kdNodes[node].boxMax.z : kdNodes[node].boxMin.z;
+	TVector3D tExit = (exitPlanes - ray->orig) * invDir;
+
+	float t = INFINITY;
+	*rope = 0;
+	if (tExit.x < t) { t = tExit.x; *rope = kdNodes[node].ropes[(invDir.x >= 0.0f) ? 1 : 0]; }
+	if (tExit.y < t) { t = tExit.y; *rope = kdNodes[node].ropes[(invDir.y >= 0.0f) ? 3 : 2]; }
+	if (tExit.z < t) { t = tExit.z; *rope = kdNodes[node].ropes[(invDir.z >= 0.0f) ? 5 : 4]; }
+	return t;
+}
+
+// Intersect object without information about it.
+// ray -> information about ray
+// sp -> buffer of all spheres
+// spd -> transforms and materials of all spheres
+// tr -> buffer of all triangles
+// me -> buffer of all meshes
+// ra_me -> buffer of size every mesh
+// kdNodes -> buffer of all kD-tree nodes with ropes
+// objects -> indexes of objects belong to kD-tree leafs
+// counters -> counters of traversal
+// @return -> successful of intersect 
+bool intersect_kdtree(TRay* ray, __global TSphere* sp, __global TSphereData* spd, unsigned int cnt_sp,
+	__global TTriangle* tr, unsigned int cnt_tr, __global TMesh* me,
+	__global unsigned int* ra_me, unsigned int cnt_ra_me,
+	__global TKdNode* kdNodes, __global TObject* objects, TCounters* counters)
+{
+	TVector3D invDir = 1.0f / ray->dir;
+	float t, tMax;
+	if (!getKdTreeRange(ray, invDir, kdNodes, &t, &tMax))
+		return false;
+
+	unsigned int node = findKdTreeLeaf(ray, invDir, t, kdNodes, 0, counters);
+	while (true) {
+		counters->nodes++;
+		TSphere sphere;
+		TTriangle triangle;
+
+		for (int i = kdNodes[node].indexObj.objStartIndex; i < kdNodes[node].indexObj.objSize; i++) {
+			if (objects[i].type == SPHERE_INDEX) {
+				sphere = sp[objects[i].index];
+
+				counters->primitives++;
+				if (sphereIntersect(&sphere, spd + objects[i].index, ray)) {
+					return true;
+				}
+			}
+			else {
+				triangle = tr[objects[i].index];
+
+				counters->primitives++;
+				if (triangleIntersect(&triangle, ray, me, ra_me, cnt_ra_me)) {
+					return true;
+				}
+			}
+		}
+
+		unsigned int rope;
+		t = getKdTreeExit(ray, invDir, kdNodes, node, &rope);
+		if (rope == 0 || t >= tMax) {
+			return false;
+		}
+		node = findKdTreeLeaf(ray, invDir, t, kdNodes, rope, counters);
+	}
+}
+
+// Intersect object within information about it.
+// ray -> information about ray
+// is -> information about intersection
+// sp -> buffer of all spheres
+// spd -> transforms and materials of all spheres
+// tr -> buffer of all triangles
+// me -> buffer of all meshes
+// ra_me -> buffer of size every mesh
+// kdNodes -> buffer of all kD-tree nodes with ropes
+// objects -> indexes of objects belong to kD-tree leafs
+// counters -> counters of traversal
+// @return -> successful of intersect 
+bool intersectIs_kdtree(TRay* ray, TIntersect* is, __global TSphere* sp, __global TSphereData* spd, unsigned int cnt_sp,
+	__global TTriangle* tr, unsigned int cnt_tr, __global TMesh* me,
+	__global unsigned int* ra_me, unsigned int cnt_ra_me,
+	__global TKdNode* kdNodes, __global TObject* objects, TCounters* counters)
+{
+	is->hitTime = INFINITY;
+	TVector3D invDir = 1.0f / ray->dir;
+	float t, tMax;
+	if (!getKdTreeRange(ray, invDir, kdNodes, &t, &tMax))
+		return false;
+
+	unsigned int node = findKdTreeLeaf(ray, invDir, t, kdNodes, 0, counters);
+	while (true) {
+		counters->nodes++;
+		TIntersect currentIs;
+		TSphere sphere;
+		TTriangle triangle;
+
+		for (int i = kdNodes[node].indexObj.objStartIndex; i < kdNodes[node].indexObj.objSize; i++) {
+			if (objects[i].type == SPHERE_INDEX) {
+				sphere = sp[objects[i].index];
+
+				counters->primitives++;
+				if (sphereIntersectIs(&sphere, spd + objects[i].index, ray, &currentIs)) {
+					// Is object near than previous intersected object.
+					if (currentIs.hitTime < is->hitTime) {
+						*is = currentIs;
+						is->obj_index = objects[i].index;
+					}
+				}
+			}
+			else {
+				triangle = tr[objects[i].index];
+
+				counters->primitives++;
+				if (triangleIntersectIs(&triangle, ray, &currentIs, me, ra_me, cnt_ra_me)) {
+					// Is object near than previous intersected object.
+					if (currentIs.hitTime < is->hitTime) {
+						*is = currentIs;
+						is->obj_index = objects[i].index;
+					}
+				}
+			}
+		}
+
+		unsigned int rope;
+		t = getKdTreeExit(ray, invDir, kdNodes, node, &rope);
+		// Hit inside this leaf is the nearest, other leafs are behind it.
+		if (is->hitTime <= t || rope == 0 || t >= tMax) {
+			break;
+		}
+		node = findKdTreeLeaf(ray, invDir, t, kdNodes, rope, counters);
+	}
+
+	return is->hitTime != INFINITY;
+}
+
+// Compute color for pixel (start pathtracing).
+// ray -> information about ray
+// depth -> maximum depth of computation
+// sp -> buffer of all spheres
+// spd -> transforms and materials of all spheres
+// tr -> buffer of all triangles
+// me -> buffer of all meshes
+// ra_me -> buffer of size every mesh
+// stats -> traversal statistics, NULL if counting is disabled
+// @return -> result color for pixel
+TColor trace_kdtree(TRay ray, uint depth, uint2 seed, __global TSphere* sp, __global TSphereData* spd, unsigned int cnt_sp,
+	__global TTriangle* tr, unsigned int cnt_tr, __global TMesh* me,
+	__global unsigned int* ra_me, unsigned int cnt_ra_me,
+	__global TLight* lights, unsigned int cnt_li,
+	__global TKdNode* kdNodes, __global TObject* objects,
+	__global TTraversalStats* stats)
+{
+	TColor stack[500];
+	unsigned int stack_id = 0;
+
+	bool isEnd = true;
+	int MINIMUM_DEPTH = 4;
+	float M_PI2 = 3.14159265358979323846f;
+	float p_absorption = 0.1f;
+	float absorption_factor = 1 / (1 - p_absorption);
+
+	TIntersect is;
+	TCounters counters;
+	counters.nodes = 0; counters.primitives = 0;
+	TColor directLight, indirectLight;
+
+	while (true) {
+		directLight.x = 0.0f; directLight.y = 0.0f; directLight.z = 0.0f;
+		indirectLight.x = 0.0f; indirectLight.y = 0.0f; indirectLight.z = 0.0f;
+		isEnd = true;
+		// Try to intersect any object.
+		bool hit = intersectIs_kdtree(&ray, &is, sp, spd, cnt_sp, tr, cnt_tr, me, ra_me, cnt_ra_me, 
+							   kdNodes, objects, &counters);
+		addTraversalStats(stats, &counters);
+		if (hit) 
+		{ 
+			//printf("Skoncil test.%d\n", stack_id);
+			// Found intersection -> compute color.
+			TMaterial material = is.material;
+
+			// Get info about object.
+			float reflectivity = material.reflectivity;
+			float transparency = material.transparency;
+
+			// Russian Roulette.
+			float light_type = randomFloat(&seed, 1);
+
+			// Next ray will be?
+			if (light_type <= reflectivity) {
+				// Reflected ray.
+				ray = getReflectedRay(&ray, &is, spd, tr, me, ra_me); // OK
+			}
+			else if ((light_type - reflectivity) <= transparency) {
+				// Refracted ray.
+				ray = getRefractedRay(&ray, &is, spd, tr, me, ra_me); // OK
+			}
+			else {
+				// Compute color.
+				// Research if intersected point is in shadow.
+				// Compute direct light.
+				for (int i = 0; i < cnt_li; ++i) { // instead 5 fill lights
+					TLight light = lights[i]; // OK
+					TRay shadowRay = getShadowRay(&light, &is); // OK
+
+					bool shadowHit = intersect_kdtree(&shadowRay, sp, spd, cnt_sp, tr, cnt_tr, me, ra_me, cnt_ra_me,
+										  kdNodes, objects, &counters);
+					addTraversalStats(stats, &counters);
+					// Is point visible by light?
+					if (!shadowHit)
+					{ 
+						float intensity = pow(shadowRay.maxT, -2);
+						TColor incomingRadiance = light.radiance * intensity;
+						TVector3D lightVec = light.worldPos - is.position;
+
+						normalizeVector3D(&lightVec);
+						TColor brdf = evalBRDFdiffuse(&material); // TO DO
+						float incidentAngle = max(dotVector3D(lightVec, is.normal), 0.0f);
+						directLight += incomingRadiance * brdf * incidentAngle;
+					}
+				}
+
+				// Compute indirect light.
+				if ((depth <= MINIMUM_DEPTH) || (randomFloat(&seed, 1) > p_absorption)) {
+					isEnd = false;
+					float theta, phi;
+					TVector3D n_x, n_y, n_z;
+					float x_b, y_b, z_b;
+					TVector3D dir;
+
+					// Generate random ray path.
+					theta = acos(sqrt(1.0f - randomFloat(&seed, 1)));
+					phi = 2.0f * M_PI2 * randomFloat(&seed, 1);
+
+					TVector3D up;
+					up.x = 1.0f; up.y = 0.0f; up.z = 0.0f;
+					if (fabs(is.normal.x) > 0.75f) {
+						up.x = 0.0f; up.y = 1.0f; up.z = 0.0f;
+					}
+
+					n_x = crossProductVector3D(up, is.normal);
+					normalizeVector3D(&n_x);
+					n_y = crossProductVector3D(n_x, is.normal);
+					n_z = is.normal;
+
+					x_b = cos(phi) * sin(theta);
+					y_b = sin(phi) * sin(theta);
+					z_b = cos(theta);
+					dir = x_b * n_x + y_b * n_y + z_b * n_z;
+
+					ray.orig = is.position;
+					ray.dir = dir;
+					ray.maxT = INFINITY;
+					ray.minT = 0.001f;
+					ray.dp.dx.x = 0.0f; ray.dp.dx.y = 0.0f; ray.dp.dx.z = 0.0f;
+					ray.dp.dy.x = 0.0f; ray.dp.dy.y = 0.0f; ray.dp.dy.z = 0.0f;
+					ray.dd.dx.x = 0.0f; ray.dd.dx.y = 0.0f; ray.dd.dx.z = 0.0f;
+					ray.dd.dy.x = 0.0f; ray.dd.dy.y = 0.0f; ray.dd.dy.z = 0.0f;
+
+					TColor brdf = evalBRDFdiffuse(&material);
+
+					indirectLight = M_PI2 * brdf; // missing trace atd.
+					if (depth > MINIMUM_DEPTH) {
+						indirectLight *= absorption_factor;
+					}
+				}
+
+				if (isEnd) {
+					TColor pixel = directLight;
+					for (int i = stack_id; i > 0; i -= 2) {
+						pixel = stack[i - 2] + stack[i - 1] * pixel;
+					}
+					return pixel;
+				}
+				else {
+					stack[stack_id] = directLight;
+					stack[stack_id + 1] = indirectLight;
+					stack_id += 2;
+				}
+
+			} // End of else branch
+		}
+		else {
+			if (stack_id != 0) {
+				TColor pixel = directLight;
+				for (int i = stack_id; i > 0; i -= 2) {
+					pixel = stack[i - 2] + stack[i - 1] * pixel;
+				}
+				return pixel;
+			}
+			else {
+				// Intersection wasn't successfully. Return black color.
+				return (TColor)(0.0f, 0.0f, 0.0f);
+			}
+		}
+		depth++;
+	} // End of while loop
+} // End of function
+
+// Compute traversal cost of ray as false colour for heatmap mode.
+// Only ray from camera is traced, without bounces and shadow rays.
+// sp -> buffer of all spheres
+// spd -> transforms and materials of all spheres
+// tr -> buffer of all triangles
+// me -> buffer of all meshes
+// ra_me -> buffer of size every mesh
+// stats -> traversal statistics, NULL if counting is disabled
+// @return -> result color for pixel
+TColor heatmap_kdtree(TRay ray, __global TSphere* sp, __global TSphereData* spd, unsigned int cnt_sp,
+	__global TTriangle* tr, unsigned int cnt_tr, __global TMesh* me,
+	__global unsigned int* ra_me, unsigned int cnt_ra_me,
+	__global TKdNode* kdNodes, __global TObject* objects,
+	__global TTraversalStats* stats)
+{
+	TIntersect is;
+	TCounters counters;
+	counters.nodes = 0; counters.primitives = 0;
+
+	intersectIs_kdtree(&ray, &is, sp, spd, cnt_sp, tr, cnt_tr, me, ra_me, cnt_ra_me,
+		kdNodes, objects, &counters);
+	TColor color = heatColor(&counters);
+	addTraversalStats(stats, &counters);
+
+	return color;
+}
+
+#endif // _KERNEL_TRACE_KDTREE_H_
\ No newline at end of file
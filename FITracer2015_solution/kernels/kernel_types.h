@@ -9,6 +9,10 @@
 
 #define SPHERE_INDEX 0
 #define TRIANGLE_INDEX 1
+// Bins of traversal histograms (same as on host).
+#define TRAVERSAL_HISTOGRAM_BINS 16
+// Traversal cost drawn as red in heatmap mode (same as on host).
+#define HEATMAP_MAX_COST 256
 
 // Basic structures.
 // Almost all structures are equialent of class's data part of 
@@ -97,7 +101,12 @@ typedef struct {
 	bool isSphere;
 	bool frontFacing;
 } TIntersect;
-// Store info about sphere.
+// Store info about sphere for intersection test. Center and squared
+// radius in world space, negative w marks ellipsoid tested by transforms.
+typedef struct {
+	float4 centerRadius2;
+} TSphere;
+// Store info about sphere needed for ellipsoids and hit points.
 typedef struct {
 	TMatrix InvWorldTransform;
 	TMatrix WorldTransform;
@@ -105,7 +114,7 @@ typedef struct {
 	float radius;
 	uint index;
 	uint rayID;
-} TSphere;
+} TSphereData;
 // Store info about triangle.
 typedef struct {
 	TMaterial material;
@@ -117,6 +126,16 @@ typedef struct {
 	uint rayID;
 } TTriangle;
 // Store info about mesh. Addition structure for triangle intersection.
+#ifdef MESH_COMPACT
+// Normal in octahedral mapping (2x 16 bits) and UV as two half floats.
+// Position is world space float.
+typedef struct {
+	TMaterial material;
+	TPoint3D vtxP;
+	uint vtxN;
+	uint vtxUV;
+} TMesh;
+#else
 typedef struct {
 	TMaterial material;
 	TPoint3D origVtxP;
@@ -125,6 +144,7 @@ typedef struct {
 	TVector3D vtxN;
 	TUV vtxUV;
 } TMesh;
+#endif
 // Store info about light.
 typedef struct {
 	TColor col;
@@ -143,24 +163,24 @@ typedef struct {
 	uint objStartIndex;
 	uint objSize;
 } TBoxLink;
-// Octree node.
+// Node of linear octree. Children of inner node are stored in block
+// of 8 nodes starting at index children, leaf has children == 0.
 typedef struct {
-	TPoint3D boxMin;
-	TPoint3D boxMax;
-	TPoint3D middlePoint;
+	uint children;
 	TBoxLink boxLink;
-	uint children[8];
-	uint leaf;
-} TOctreeBox;
-
+} TOctreeNode;
+// Neighbour links of octree node, ropes[2 * axis + side] leads through
+// min (side 0) or max (side 1) face, 0 is outside of octree.
+// cell is x | y << 16, z | level << 16.
 typedef struct {
-	float tx0, ty0, tz0;
-	float txM, tyM, tzM;
-	float tx1, ty1, tz1;
-	int currentNode;
-	unsigned int actualOctree;
-	bool isNodeInit;
-} OctreeState;
+	uint ropes[6];
+	uint cell[2];
+} TOctreeLink;
+// Bounding box of whole octree.
+typedef struct {
+	TPoint3D boxMin;
+	TPoint3D boxMax;
+} TOctree;
 
 typedef struct {
 	TPoint3D boxMin;
@@ -177,6 +197,36 @@ typedef struct {
 	uint leaf;
 	uint indexNode;
 } TBVHNode;
+// Node of kD-tree. Below child of inner node is right after it, above child
+// at index. ropes[2 * axis + side] leads through min (side 0) or max (side 1)
+// face of leaf, 0 is outside of kD-tree. Leaf has axis == 3.
+typedef struct {
+	TPoint3D boxMin;
+	TPoint3D boxMax;
+	TBoxLink indexObj;
+	uint ropes[6];
+	uint axis;
+	float split;
+	uint index;
+} TKdNode;
+// Counters of one ray traversal.
+typedef struct {
+	uint nodes;
+	uint primitives;
+} TCounters;
+// Totals of rendered image would overflow 32 bits, they are added by 64 bit atomics.
+#pragma OPENCL EXTENSION cl_khr_int64_base_atomics : enable
+// Traversal statistics of all rays, bin i of histograms counts values
+// with i significant bits, last bin counts all bigger values.
+typedef struct {
+	ulong rays;
+	ulong nodes;
+	ulong primitives;
+	uint maxNodes;
+	uint maxPrimitives;
+	uint nodeHistogram[TRAVERSAL_HISTOGRAM_BINS];
+	uint primitiveHistogram[TRAVERSAL_HISTOGRAM_BINS];
+} TTraversalStats;
 
 // Following functions are needed for compute pathtracing on OpenCL.
 
@@ -299,7 +349,19 @@ float3 getVtxPosition(__global TMesh* meshes, uint index)
 // @result -> normal position
 float3 getVtxNormal(__global TMesh* meshes, uint index) 
 {
+#ifdef MESH_COMPACT
+	uint packed = meshes[index].vtxN;
+	float u = (float)(packed & 0xffff) * (2.0f / 65535.0f) - 1.0f;
+	float v = (float)(packed >> 16) * (2.0f / 65535.0f) - 1.0f;
+	float3 n = (float3)(u, v, 1.0f - fabs(u) - fabs(v));
+	if (n.z < 0.0f) {
+		n.x = (1.0f - fabs(v)) * (u >= 0.0f ? 1.0f : -1.0f);
+		n.y = (1.0f - fabs(u)) * (v >= 0.0f ? 1.0f : -1.0f);
+	}
+	return normalize(n);
+#else
 	return meshes[index].vtxN;
+#endif
 }
 
 // Get texture position.
@@ -308,7 +370,13 @@ float3 getVtxNormal(__global TMesh* meshes, uint index)
 // @result -> texture position
 TUV getVtxTexture(__global TMesh* meshes, uint index) 
 {
+#ifdef MESH_COMPACT
+	TUV uv;
+	uv.uv = vload_half2(0, (__global half*)&meshes[index].vtxUV);
+	return uv;
+#else
 	return meshes[index].vtxUV;
+#endif
 }
 
 // Cross product of vectors
@@ -49,7 +49,7 @@ static CGL3Driver driver;
 // Program context.
 SDLGLContext context;
 
-// Arguments are not used.
+// Optional argument is scene description file, see SceneFile.
 int main(int n_arg_num, const char **p_arg_list)
 {
 	// Register window's class.
@@ -115,6 +115,8 @@ int main(int n_arg_num, const char **p_arg_list)
 	context.PrepareScene();
 	// Init of pathtracing context.
 	RenderEnginePT pt_engine; 
+	if (n_arg_num > 1)
+		pt_engine.SetSceneFile(p_arg_list[1]);
 	context.SeizeSem(1);
 	pt_engine.InitPT(&context);
 	// Begin compute of pathtracing.
@@ -248,12 +250,12 @@ void InitButtons(SDLGLContext* context)
 	unsigned int wpadding = 30;
 	unsigned int hpadding = 0;
 
-	GLButton* button1 = new GLButton(40 + wpadding, 510 + hpadding, 100, 30);
+	GLButton* button1 = new GLButton(40 + wpadding, 516 + hpadding, 100, 26);
 	button1->SetColor(0.7f, 0.7f, 1.0f, 1.0f);
 	button1->SetText("CPU rendering");
 	button1->SetID(0);
 
-	GLButton* button2 = new GLButton(40 + wpadding, 470 + hpadding, 100, 30);
+	GLButton* button2 = new GLButton(40 + wpadding, 486 + hpadding, 100, 26);
 	button2->SetColor(0.7f, 0.7f, 1.0f, 1.0f);
 	button2->SetText("GPU rendering");
 	button2->SetID(1);
@@ -261,50 +263,86 @@ void InitButtons(SDLGLContext* context)
 	button1->AddConnection(button2);
 	button2->AddConnection(button1);
 
-	GLButton* button3 = new GLButton(40 + wpadding, 360 + hpadding, 100, 30);
+	// Heatmap is switch for both renderers.
+	GLButton* button11 = new GLButton(40 + wpadding, 456 + hpadding, 100, 26);
+	button11->SetColor(0.7f, 0.7f, 1.0f, 1.0f);
+	button11->SetText("Heatmap");
+	button11->SetID(8);
+
+	GLButton* button3 = new GLButton(40 + wpadding, 366 + hpadding, 100, 26);
 	button3->SetColor(0.7f, 0.7f, 1.0f, 1.0f);
 	button3->SetText("List");
 	button3->SetID(2);
 
-	GLButton* button4 = new GLButton(40 + wpadding, 320 + hpadding, 100, 30);
+	GLButton* button4 = new GLButton(40 + wpadding, 336 + hpadding, 100, 26);
 	button4->SetColor(0.7f, 0.7f, 1.0f, 1.0f);
 	button4->SetText("Octree");
 	button4->SetID(3);
 
-	GLButton* button5 = new GLButton(40 + wpadding, 280 + hpadding, 100, 30);
+	GLButton* button5 = new GLButton(40 + wpadding, 306 + hpadding, 100, 26);
 	button5->SetColor(0.7f, 0.7f, 1.0f, 1.0f);
 	button5->SetText("Uniform grid");
 	button5->SetID(4);
 
-	GLButton* button6 = new GLButton(40 + wpadding, 240 + hpadding, 100, 30);
+	GLButton* button6 = new GLButton(40 + wpadding, 276 + hpadding, 100, 26);
 	button6->SetColor(0.7f, 0.7f, 1.0f, 1.0f);
 	button6->SetText("BVH");
 	button6->SetID(5);
 
+	GLButton* button7 = new GLButton(40 + wpadding, 246 + hpadding, 100, 26);
+	button7->SetColor(0.7f, 0.7f, 1.0f, 1.0f);
+	button7->SetText("kD-tree");
+	button7->SetID(6);
+
+	GLButton* button8 = new GLButton(40 + wpadding, 216 + hpadding, 100, 26);
+	button8->SetColor(0.7f, 0.7f, 1.0f, 1.0f);
+	button8->SetText("Auto");
+	button8->SetID(7);
+
 	button3->AddConnection(button4);
 	button3->AddConnection(button5);
 	button3->AddConnection(button6);
+	button3->AddConnection(button7);
+	button3->AddConnection(button8);
 
 	button4->AddConnection(button3);
 	button4->AddConnection(button5);
 	button4->AddConnection(button6);
+	button4->AddConnection(button7);
+	button4->AddConnection(button8);
 
 	button5->AddConnection(button3);
 	button5->AddConnection(button4);
 	button5->AddConnection(button6);
+	button5->AddConnection(button7);
+	button5->AddConnection(button8);
 
 	button6->AddConnection(button3);
 	button6->AddConnection(button4);
 	button6->AddConnection(button5);
-
-	GLButton* button7 = new GLButton(760, 560, 30, 30);
-	button7->SetColor(1.0f, 0.0f, 0.0f, 1.0f);
-	button7->Press();
-	button7->SetText("||");
-
-	GLButton* button8 = new GLButton(690, 560, 70, 30);
-	button8->SetColor(0.7f, 0.7f, 1.0f, 1.0f);
-	button8->SetText("Save");
+	button6->AddConnection(button7);
+	button6->AddConnection(button8);
+
+	button7->AddConnection(button3);
+	button7->AddConnection(button4);
+	button7->AddConnection(button5);
+	button7->AddConnection(button6);
+	button7->AddConnection(button8);
+
+	button8->AddConnection(button3);
+	button8->AddConnection(button4);
+	button8->AddConnection(button5);
+	button8->AddConnection(button6);
+	button8->AddConnection(button7);
+
+	GLButton* button9 = new GLButton(760, 560, 30, 30);
+	button9->SetColor(1.0f, 0.0f, 0.0f, 1.0f);
+	button9->Press();
+	button9->SetText("||");
+
+	GLButton* button10 = new GLButton(690, 560, 70, 30);
+	button10->SetColor(0.7f, 0.7f, 1.0f, 1.0f);
+	button10->SetText("Save");
 
 	context->AddButton(button1);
 	context->AddButton(button2);
@@ -314,6 +352,9 @@ void InitButtons(SDLGLContext* context)
 	context->AddButton(button6);
 	context->AddButton(button7);
 	context->AddButton(button8);
+	context->AddButton(button9);
+	context->AddButton(button10);
+	context->AddButton(button11);
 }
 
 // Create all texts.
@@ -10,6 +10,10 @@
 unsigned int usedRenderer = NO_OPTION;
 // Used accelerate structure.
 unsigned int usedAS = NO_OPTION;
+// Selected accelerate structure which is not built yet.
+unsigned int waitingAS = NO_OPTION;
+// Is used heatmap mode?
+bool usedHeatmap = false;
 
 void RenderEnginePT::InitPT(SDLGLContext* context)
 {
@@ -47,6 +51,8 @@ void RenderEnginePT::InitPT(SDLGLContext* context)
 	checkError(err);
 	err = gpu_pt.loadGPUkernel(AS_BVH, "gpu_pt_bvh");
 	checkError(err);
+	err = gpu_pt.loadGPUkernel(AS_KDTREE, "gpu_pt_kdtree");
+	checkError(err);
 	err = gpu_pt.loadGPUkernel(AS_LIST_FIRST, "gpu_pt_list_first");
 	checkError(err);
 	err = gpu_pt.loadGPUkernel(AS_OCTREE_FIRST, "gpu_pt_octree_first");
@@ -55,6 +61,23 @@ void RenderEnginePT::InitPT(SDLGLContext* context)
 	checkError(err);
 	err = gpu_pt.loadGPUkernel(AS_BVH_FIRST, "gpu_pt_bvh_first");
 	checkError(err);
+	err = gpu_pt.loadGPUkernel(AS_KDTREE_FIRST, "gpu_pt_kdtree_first");
+	checkError(err);
+
+	// Scene is read from description file if it is set, otherwise Cornell box
+	// is built. Whole file is read before any mesh is loaded, path of file is
+	// relative to current directory and paths of meshes to root directory.
+	SceneFile description;
+	bool described = false;
+	if (!sceneFile.empty()) {
+		try {
+			description.read(sceneFile);
+			described = true;
+		}
+		catch (const std::runtime_error& e) {
+			std::cout << e.what() << "\nCornell box is used instead." << std::endl;
+		}
+	}
 
 	// Set working directory.
 	changeToRootDirectory("data");
@@ -63,42 +86,88 @@ void RenderEnginePT::InitPT(SDLGLContext* context)
 	output = new Image(global_size[0], global_size[1]);
 	//output = new Image(100, 100);
 	camera = new Camera(output);
-	setupCornellCamera(camera);
-
-	// Build scene for no ADS.
-	sceneList = new Scene(new ListAccelerator());
-	buildCornellScene(sceneList);
-	sceneList->add(camera);
-	sceneList->prepare();
-	// Build scene for Octree.
-	sceneOctree = new Scene(new OctreeAccelerator());
-	buildCornellScene(sceneOctree);
-	sceneOctree->add(camera);
-	sceneOctree->prepare();
-	// Build scene for Uniform Grid.
-	sceneUniGrid = new Scene(new UniformAccelerator());
-	buildCornellScene(sceneUniGrid);
-	sceneUniGrid->add(camera);
-	sceneUniGrid->prepare();
-	// Build scene for BVH.
-	sceneBVH = new Scene(new BVHAccelerator());
-	buildCornellScene(sceneBVH);
-	sceneBVH->add(camera);
-	sceneBVH->prepare();
+	if (!described || !description.setupCamera(camera))
+		setupCornellCamera(camera);
+
+	// Build scene only once, meshes and textures are loaded once.
+	// Only list is built before first image.
+	accList = new ListAccelerator();
+	scene = new Scene(accList);
+	if (described)
+		description.build(scene);
+	else
+		buildCornellScene(scene);
+	scene->add(camera);
+	// Other structures are built over the same geometry on background thread,
+	// first selected structure as the next one. They are queued while meshes
+	// are still loading, builder starts when geometry is extracted.
+	// Built structures are cached in data directory under name of scene file,
+	// next start only loads them. Cache is keyed by stamps of mesh files and
+	// transforms, so it is checked without hashing loaded geometry. Cache of
+	// other geometry is rebuilt.
+	std::string cacheName = "cornell";
+	if (described) {
+		cacheName = sceneFile.substr(sceneFile.find_last_of("/\\") + 1);
+		cacheName = cacheName.substr(0, cacheName.rfind('.'));
+	}
+	unsigned long long cacheKey = scene->getGeometryKey();
+	builder = new AcceleratorBuilder(scene->getGeometry());
+	accOctree = new OctreeAccelerator();
+	accOctree->setCacheFile(cacheName + "_octree.cache", cacheKey);
+	scene->addAccelerator(accOctree, false);
+	builder->add(accOctree, "Octree");
+	accUniGrid = new UniformAccelerator();
+	scene->addAccelerator(accUniGrid, false);
+	builder->add(accUniGrid, "Uniform grid");
+	accBVH = new BVHAccelerator();
+	accBVH->setCacheFile(cacheName + "_bvh.cache", cacheKey);
+	scene->addAccelerator(accBVH, false);
+	builder->add(accBVH, "BVH");
+	accKdTree = new KdTreeAccelerator();
+	accKdTree->setCacheFile(cacheName + "_kdtree.cache", cacheKey);
+	scene->addAccelerator(accKdTree, false);
+	builder->add(accKdTree, "kD-tree");
+	// Auto mode measures one or two of the structures above, ones built by
+	// builder are reused and rejected ones are not built speculatively.
+	accAuto = new AutoAccelerator();
+	accAuto->setCandidate(AUTO_LIST, accList);
+	accAuto->setCandidate(AUTO_OCTREE, accOctree);
+	accAuto->setCandidate(AUTO_BVH, accBVH);
+	accAuto->setCandidate(AUTO_KDTREE, accKdTree);
+	accAuto->setBuilder(builder);
+	builder->markReady(accList);
+	scene->addAccelerator(accAuto, false);
+	builder->add(accAuto, "Auto");
+	// Structure chosen by scene file is built first.
+	if (described) {
+		std::string name = description.getAccelerator();
+		if (name == "octree")
+			builder->request(accOctree);
+		else if (name == "grid")
+			builder->request(accUniGrid);
+		else if (name == "bvh")
+			builder->request(accBVH);
+		else if (name == "kdtree")
+			builder->request(accKdTree);
+		else if (name == "auto")
+			builder->request(accAuto);
+	}
+	scene->prepare();
 	// Prepare data for exporting to OpenCL device.
 	// Get all cameras.
 	camera->getSettings(*cam);
 	// Get all spheres, triangles, meshes.
-	sceneList->getObjects(&spheres, &triangles, &meshes, &size_meshes);
+	scene->getObjects(&spheres, &sphereData, &triangles, &meshes, &size_meshes);
+	IndexObjects();
 	// Get all lights.
-	sceneList->getLights(&lights);
+	scene->getLights(&lights);
 
 	// Write exported data to buffers.
 	err = gpu_pt.createGPUimage2D(pt_col, context->GetResultTextures(), CL_MEM_WRITE_ONLY, global_size[0], global_size[1]);
 	checkError(err);
 	err = gpu_pt.createGPUbuffer(&pt_cam, CL_MEM_READ_ONLY, sizeof(TCamera));
 	checkError(err);
-	err = gpu_pt.writeGPUobjects(spheres, pt_sphere, triangles, pt_triangle, meshes,
+	err = gpu_pt.writeGPUobjects(spheres, pt_sphere, sphereData, pt_sphereData, triangles, pt_triangle, meshes,
 		pt_meshes, size_meshes, pt_range_meshes);
 	checkError(err);
 	err = gpu_pt.writeGPUlights(lights, pt_light);
@@ -106,51 +175,16 @@ void RenderEnginePT::InitPT(SDLGLContext* context)
 	err = gpu_pt.writeGPUdata(&pt_cam, 0, sizeof(TCamera), cam);
 	checkError(err);
 
-	unsigned int indexOctreeBuffer = 1;
-	CreateOctree(&octreeBuffer, &objectBufferOct, (OctreeAccelerator*)sceneOctree->getAccelerator(), 
-		indexOctreeBuffer);
-	TUniGrid infoUniGrid;
-	std::vector<TBoxLink> uniGridBuffer;
-	CreateUniGrid(&infoUniGrid, &uniGridBuffer, &objectBufferUniGrid, 
-				 (UniformAccelerator*)sceneUniGrid->getAccelerator());
-	CreateBVH(&bvhBuffer, &objectBufferBVH, (BVHAccelerator*)sceneBVH->getAccelerator());
-
 	cl_uint cnt_sphere = spheres.size();
 	cl_uint cnt_triangle = triangles.size();
 	cl_uint cnt_range_mesh = size_meshes.size();
 	cl_uint cnt_light = lights.size();
-	cl_uint cnt_octree = octreeBuffer.size();
 	
 	/*gpu_pt.createGPUbuffer(&pt_sphereLoc, CL_MEM_READ_WRITE, 
 		(((cnt_sphere/8)+1) * sizeof(cl_uchar)*global_size[0]*global_size[1]));
 	gpu_pt.createGPUbuffer(&pt_triangleLoc, CL_MEM_READ_WRITE, 
 		(((cnt_triangle/8)+1) * sizeof(cl_uchar)*global_size[0]*global_size[1]));*/
 
-	// Octree things.
-	gpu_pt.createGPUbuffer(&pt_octree, CL_MEM_READ_ONLY, cnt_octree*sizeof(TOctreeBox));
-	err = gpu_pt.writeGPUdata(&pt_octree, 0, cnt_octree*sizeof(TOctreeBox), octreeBuffer.data());
-	checkError(err);
-	gpu_pt.createGPUbuffer(&pt_objectsOct, CL_MEM_READ_ONLY, objectBufferOct.size()*sizeof(TObject));
-	err = gpu_pt.writeGPUdata(&pt_objectsOct, 0, objectBufferOct.size()*sizeof(TObject), objectBufferOct.data());
-	checkError(err);
-	// UniGrid things.
-	gpu_pt.createGPUbuffer(&pt_uniGrid, CL_MEM_READ_ONLY, sizeof(TUniGrid));
-	err = gpu_pt.writeGPUdata(&pt_uniGrid, 0, sizeof(TUniGrid), &infoUniGrid);
-	checkError(err);
-	gpu_pt.createGPUbuffer(&pt_uniGridBuffer, CL_MEM_READ_ONLY, uniGridBuffer.size()*sizeof(TBoxLink));
-	err = gpu_pt.writeGPUdata(&pt_uniGridBuffer, 0, uniGridBuffer.size()*sizeof(TBoxLink), uniGridBuffer.data());
-	checkError(err);
-	gpu_pt.createGPUbuffer(&pt_objectsUniGrid, CL_MEM_READ_ONLY, objectBufferUniGrid.size()*sizeof(TObject));
-	err = gpu_pt.writeGPUdata(&pt_objectsUniGrid, 0, objectBufferUniGrid.size()*sizeof(TObject), objectBufferUniGrid.data());
-	checkError(err);
-	// BVH things.
-	gpu_pt.createGPUbuffer(&pt_BVH, CL_MEM_READ_ONLY, bvhBuffer.size()*sizeof(TBVHNode));
-	err = gpu_pt.writeGPUdata(&pt_BVH, 0, bvhBuffer.size()*sizeof(TBVHNode), bvhBuffer.data());
-	checkError(err);
-	gpu_pt.createGPUbuffer(&pt_objectsBVH, CL_MEM_READ_ONLY, objectBufferBVH.size()*sizeof(TObject));
-	err = gpu_pt.writeGPUdata(&pt_objectsBVH, 0, objectBufferBVH.size()*sizeof(TObject), objectBufferBVH.data());
-	checkError(err);
-
 	// Counters.
 	gpu_pt.createGPUbuffer(&pt_cntSpheres, CL_MEM_READ_ONLY, sizeof(cl_uint));
 	err = gpu_pt.writeGPUdata(&pt_cntSpheres, 0, sizeof(cl_uint), &cnt_sphere);
@@ -164,8 +198,19 @@ void RenderEnginePT::InitPT(SDLGLContext* context)
 	gpu_pt.createGPUbuffer(&pt_cntLights, CL_MEM_READ_ONLY, sizeof(cl_uint));
 	err = gpu_pt.writeGPUdata(&pt_cntLights, 0, sizeof(cl_uint), &cnt_light);
 	checkError(err);
-	gpu_pt.createGPUbuffer(&pt_cntOctree, CL_MEM_READ_ONLY, sizeof(cl_uint));
-	err = gpu_pt.writeGPUdata(&pt_cntOctree, 0, sizeof(cl_uint), &cnt_octree);
+
+	// Traversal statistics, NULL buffer disables counting in kernels.
+	pt_stats = NULL;
+#if TRAVERSAL_STATS
+	TTraversalStats zeroStats = {};
+	gpu_pt.createGPUbuffer(&pt_stats, CL_MEM_READ_WRITE, sizeof(TTraversalStats));
+	err = gpu_pt.writeGPUdata(&pt_stats, 0, sizeof(TTraversalStats), &zeroStats);
+	checkError(err);
+#endif // TRAVERSAL_STATS
+	// Heatmap mode is off on start.
+	cl_uint heatmap = 0;
+	gpu_pt.createGPUbuffer(&pt_heatmap, CL_MEM_READ_ONLY, sizeof(cl_uint));
+	err = gpu_pt.writeGPUdata(&pt_heatmap, 0, sizeof(cl_uint), &heatmap);
 	checkError(err);
 
 	// Set arguments for kernel with no ADS.
@@ -182,6 +227,9 @@ void RenderEnginePT::InitPT(SDLGLContext* context)
 	gpu_pt.setGPUargs(11, sizeof(cl_mem), &pt_cntRangeMeshes);
 	gpu_pt.setGPUargs(12, sizeof(cl_mem), &pt_light);
 	gpu_pt.setGPUargs(13, sizeof(cl_mem), &pt_cntLights);
+	gpu_pt.setGPUargs(16, sizeof(cl_mem), &pt_stats);
+	gpu_pt.setGPUargs(17, sizeof(cl_mem), &pt_heatmap);
+	gpu_pt.setGPUargs(18, sizeof(cl_mem), &pt_sphereData);
 
 	gpu_pt.changeKernel(AS_LIST_FIRST);
 	gpu_pt.setGPUargs(1, sizeof(cl_mem), &pt_cam);
@@ -196,6 +244,9 @@ void RenderEnginePT::InitPT(SDLGLContext* context)
 	gpu_pt.setGPUargs(10, sizeof(cl_mem), &pt_cntRangeMeshes);
 	gpu_pt.setGPUargs(11, sizeof(cl_mem), &pt_light);
 	gpu_pt.setGPUargs(12, sizeof(cl_mem), &pt_cntLights);
+	gpu_pt.setGPUargs(14, sizeof(cl_mem), &pt_stats);
+	gpu_pt.setGPUargs(15, sizeof(cl_mem), &pt_heatmap);
+	gpu_pt.setGPUargs(16, sizeof(cl_mem), &pt_sphereData);
 	
 	// Set arguments for kernel with Octree.
 	gpu_pt.changeKernel(AS_OCTREE);
@@ -215,9 +266,9 @@ void RenderEnginePT::InitPT(SDLGLContext* context)
 	gpu_pt.setGPUargs(11, sizeof(cl_mem), &pt_cntRangeMeshes);
 	gpu_pt.setGPUargs(12, sizeof(cl_mem), &pt_light);
 	gpu_pt.setGPUargs(13, sizeof(cl_mem), &pt_cntLights);
-	gpu_pt.setGPUargs(16, sizeof(cl_mem), &pt_octree);
-	gpu_pt.setGPUargs(17, sizeof(cl_mem), &pt_cntOctree);
-	gpu_pt.setGPUargs(18, sizeof(cl_mem), &pt_objectsOct);
+	gpu_pt.setGPUargs(20, sizeof(cl_mem), &pt_stats);
+	gpu_pt.setGPUargs(21, sizeof(cl_mem), &pt_heatmap);
+	gpu_pt.setGPUargs(22, sizeof(cl_mem), &pt_sphereData);
 
 	gpu_pt.changeKernel(AS_OCTREE_FIRST);
 	gpu_pt.setGPUargs(1, sizeof(cl_mem), &pt_cam);
@@ -236,9 +287,9 @@ void RenderEnginePT::InitPT(SDLGLContext* context)
 	gpu_pt.setGPUargs(10, sizeof(cl_mem), &pt_cntRangeMeshes);
 	gpu_pt.setGPUargs(11, sizeof(cl_mem), &pt_light);
 	gpu_pt.setGPUargs(12, sizeof(cl_mem), &pt_cntLights);
-	gpu_pt.setGPUargs(14, sizeof(cl_mem), &pt_octree);
-	gpu_pt.setGPUargs(15, sizeof(cl_mem), &pt_cntOctree);
-	gpu_pt.setGPUargs(16, sizeof(cl_mem), &pt_objectsOct);
+	gpu_pt.setGPUargs(18, sizeof(cl_mem), &pt_stats);
+	gpu_pt.setGPUargs(19, sizeof(cl_mem), &pt_heatmap);
+	gpu_pt.setGPUargs(20, sizeof(cl_mem), &pt_sphereData);
 	
 	// Set arguments for kernel with Uniform grid.
 	gpu_pt.changeKernel(AS_UNIFORM_GRID);
@@ -258,9 +309,9 @@ void RenderEnginePT::InitPT(SDLGLContext* context)
 	gpu_pt.setGPUargs(11, sizeof(cl_mem), &pt_cntRangeMeshes);
 	gpu_pt.setGPUargs(12, sizeof(cl_mem), &pt_light);
 	gpu_pt.setGPUargs(13, sizeof(cl_mem), &pt_cntLights);
-	gpu_pt.setGPUargs(16, sizeof(cl_mem), &pt_uniGrid);
-	gpu_pt.setGPUargs(17, sizeof(cl_mem), &pt_uniGridBuffer);
-	gpu_pt.setGPUargs(18, sizeof(cl_mem), &pt_objectsUniGrid);
+	gpu_pt.setGPUargs(19, sizeof(cl_mem), &pt_stats);
+	gpu_pt.setGPUargs(20, sizeof(cl_mem), &pt_heatmap);
+	gpu_pt.setGPUargs(21, sizeof(cl_mem), &pt_sphereData);
 
 	gpu_pt.changeKernel(AS_UNIFORM_GRID_FIRST);
 	gpu_pt.setGPUargs(1, sizeof(cl_mem), &pt_cam);
@@ -279,9 +330,9 @@ void RenderEnginePT::InitPT(SDLGLContext* context)
 	gpu_pt.setGPUargs(10, sizeof(cl_mem), &pt_cntRangeMeshes);
 	gpu_pt.setGPUargs(11, sizeof(cl_mem), &pt_light);
 	gpu_pt.setGPUargs(12, sizeof(cl_mem), &pt_cntLights);
-	gpu_pt.setGPUargs(14, sizeof(cl_mem), &pt_uniGrid);
-	gpu_pt.setGPUargs(15, sizeof(cl_mem), &pt_uniGridBuffer);
-	gpu_pt.setGPUargs(16, sizeof(cl_mem), &pt_objectsUniGrid);
+	gpu_pt.setGPUargs(17, sizeof(cl_mem), &pt_stats);
+	gpu_pt.setGPUargs(18, sizeof(cl_mem), &pt_heatmap);
+	gpu_pt.setGPUargs(19, sizeof(cl_mem), &pt_sphereData);
 	
 	// Set arguments for kernel with BVH.
 	gpu_pt.changeKernel(AS_BVH);
@@ -297,8 +348,9 @@ void RenderEnginePT::InitPT(SDLGLContext* context)
 	gpu_pt.setGPUargs(11, sizeof(cl_mem), &pt_cntRangeMeshes);
 	gpu_pt.setGPUargs(12, sizeof(cl_mem), &pt_light);
 	gpu_pt.setGPUargs(13, sizeof(cl_mem), &pt_cntLights);
-	gpu_pt.setGPUargs(16, sizeof(cl_mem), &pt_BVH);
-	gpu_pt.setGPUargs(17, sizeof(cl_mem), &pt_objectsBVH);
+	gpu_pt.setGPUargs(18, sizeof(cl_mem), &pt_stats);
+	gpu_pt.setGPUargs(19, sizeof(cl_mem), &pt_heatmap);
+	gpu_pt.setGPUargs(20, sizeof(cl_mem), &pt_sphereData);
 
 	gpu_pt.changeKernel(AS_BVH_FIRST);
 	gpu_pt.setGPUargs(1, sizeof(cl_mem), &pt_cam);
@@ -313,10 +365,48 @@ void RenderEnginePT::InitPT(SDLGLContext* context)
 	gpu_pt.setGPUargs(10, sizeof(cl_mem), &pt_cntRangeMeshes);
 	gpu_pt.setGPUargs(11, sizeof(cl_mem), &pt_light);
 	gpu_pt.setGPUargs(12, sizeof(cl_mem), &pt_cntLights);
-	gpu_pt.setGPUargs(14, sizeof(cl_mem), &pt_BVH);
-	gpu_pt.setGPUargs(15, sizeof(cl_mem), &pt_objectsBVH);
+	gpu_pt.setGPUargs(16, sizeof(cl_mem), &pt_stats);
+	gpu_pt.setGPUargs(17, sizeof(cl_mem), &pt_heatmap);
+	gpu_pt.setGPUargs(18, sizeof(cl_mem), &pt_sphereData);
+
+	// Set arguments for kernel with kD-tree.
+	gpu_pt.changeKernel(AS_KDTREE);
+	gpu_pt.setGPUargs(2, sizeof(cl_mem), &pt_cam);
+	gpu_pt.setGPUargs(3, sizeof(cl_mem), &pt_sphere);
+	gpu_pt.setGPUargs(4, 1, NULL);
+	gpu_pt.setGPUargs(5, sizeof(cl_mem), &pt_cntSpheres);
+	gpu_pt.setGPUargs(6, sizeof(cl_mem), &pt_triangle);
+	gpu_pt.setGPUargs(7, 1, NULL);
+	gpu_pt.setGPUargs(8, sizeof(cl_mem), &pt_cntTriangles);
+	gpu_pt.setGPUargs(9, sizeof(cl_mem), &pt_meshes);
+	gpu_pt.setGPUargs(10, sizeof(cl_mem), &pt_range_meshes);
+	gpu_pt.setGPUargs(11, sizeof(cl_mem), &pt_cntRangeMeshes);
+	gpu_pt.setGPUargs(12, sizeof(cl_mem), &pt_light);
+	gpu_pt.setGPUargs(13, sizeof(cl_mem), &pt_cntLights);
+	gpu_pt.setGPUargs(18, sizeof(cl_mem), &pt_stats);
+	gpu_pt.setGPUargs(19, sizeof(cl_mem), &pt_heatmap);
+	gpu_pt.setGPUargs(20, sizeof(cl_mem), &pt_sphereData);
+
+	gpu_pt.changeKernel(AS_KDTREE_FIRST);
+	gpu_pt.setGPUargs(1, sizeof(cl_mem), &pt_cam);
+	gpu_pt.setGPUargs(2, sizeof(cl_mem), &pt_sphere);
+	gpu_pt.setGPUargs(3, 1, NULL);
+	gpu_pt.setGPUargs(4, sizeof(cl_mem), &pt_cntSpheres);
+	gpu_pt.setGPUargs(5, sizeof(cl_mem), &pt_triangle);
+	gpu_pt.setGPUargs(6, 1, NULL);
+	gpu_pt.setGPUargs(7, sizeof(cl_mem), &pt_cntTriangles);
+	gpu_pt.setGPUargs(8, sizeof(cl_mem), &pt_meshes);
+	gpu_pt.setGPUargs(9, sizeof(cl_mem), &pt_range_meshes);
+	gpu_pt.setGPUargs(10, sizeof(cl_mem), &pt_cntRangeMeshes);
+	gpu_pt.setGPUargs(11, sizeof(cl_mem), &pt_light);
+	gpu_pt.setGPUargs(12, sizeof(cl_mem), &pt_cntLights);
+	gpu_pt.setGPUargs(16, sizeof(cl_mem), &pt_stats);
+	gpu_pt.setGPUargs(17, sizeof(cl_mem), &pt_heatmap);
+	gpu_pt.setGPUargs(18, sizeof(cl_mem), &pt_sphereData);
 
 	gpu_pt.changeKernel(AS_LIST);
+
+	builder->start();
 }
 
 void RenderEnginePT::ComputePT()
@@ -325,7 +415,7 @@ void RenderEnginePT::ComputePT()
 	Color c;
 	cl_uint seed_gpu;
 	long seed_cpu = 11111;
-	PathTracer rt1(sceneList, output);
+	PathTracer rt1(scene, output);
 	Uint32 timer = SDL_GetTicks();
 	GLfloat* pixels;
 	bool isNeedUpdate = false;
@@ -342,7 +432,11 @@ void RenderEnginePT::ComputePT()
 		return;
 	}
 
-	CheckSettingsFirst(&rt1, &gpu_pt, contextAPI->GetActiveAS(), contextAPI->GetActiveRenderer());
+	int firstAS = CheckSettingsFirst(&rt1, &gpu_pt, contextAPI->GetActiveAS(), contextAPI->GetActiveRenderer());
+	CheckHeatmap(&rt1);
+#if TRAVERSAL_STATS
+	rt1.setTraversalStats(&cpuStats);
+#endif // TRAVERSAL_STATS
 	
 	if (contextAPI->GetActiveRenderer() == CPU_RENDER) {
 		// Compute first image on CPU.
@@ -362,6 +456,9 @@ void RenderEnginePT::ComputePT()
 		checkError(error);
 		contextAPI->ReloadTexturePixels();
 	}
+#if TRAVERSAL_STATS
+	WriteStats(contextAPI->GetActiveRenderer(), firstAS);
+#endif // TRAVERSAL_STATS
 	
 	while (1) {
 		contextAPI->AddSample();
@@ -378,6 +475,7 @@ void RenderEnginePT::ComputePT()
 
 		isNeedUpdate = CheckSettings(&rt1, &gpu_pt, contextAPI->GetActiveAS(), 
 									 contextAPI->GetActiveRenderer());
+		CheckHeatmap(&rt1);
 
 		if (usedRenderer == CPU_RENDER) {
 			// Get pixels of texture.
@@ -385,12 +483,17 @@ void RenderEnginePT::ComputePT()
 				contextAPI->SeizeSem(0);
 				contextAPI->LeaveSem(0);
 			}
+			// Secondary rays switch to proxies once their structure is built.
+			scene->updateLod();
 			timer = SDL_GetTicks();
 			// Compute image on CPU.
 			rt1.computeImage(contextAPI, pixels);
 			contextAPI->SnapTime(timer);
 			// Set flag that pixels was updated.
 			contextAPI->UpdateActualResult();
+#if TRAVERSAL_STATS
+			WriteStats(usedRenderer, usedAS);
+#endif // TRAVERSAL_STATS
 			contextAPI->SeizeSem(2);
 		}
 		else {
@@ -414,6 +517,9 @@ void RenderEnginePT::ComputePT()
 				break;
 			}
 			checkError(error);
+#if TRAVERSAL_STATS
+			WriteStats(usedRenderer, usedAS);
+#endif // TRAVERSAL_STATS
 			// Set flag that pixels was updated.
 			contextAPI->Swap();
 			contextAPI->ReloadTexturePixels();
@@ -428,17 +534,85 @@ void RenderEnginePT::SwapImages(GPUPathtracer* gpu_pt, unsigned int indexImg)
 	gpu_pt->setGPUargs(indexImg?0:1, sizeof(cl_mem), &pt_col[1]);
 }
 
+// Write statistics of used structure and traversal of last image to STATS_FILE
+// and reset traversal counters for next image.
+void RenderEnginePT::WriteStats(unsigned int renderer, unsigned int as)
+{
+	RayAccelerator* accelerator;
+	std::string structure;
+	switch (as) {
+	case AS_AUTO:
+		accelerator = accAuto;
+		structure = std::string("Auto (") + AutoAccelerator::getKindName(accAuto->getKind()) + ")";
+		break;
+	case AS_KDTREE:
+		accelerator = accKdTree;
+		structure = "kD-tree";
+		break;
+	case AS_BVH:
+		accelerator = accBVH;
+		structure = "BVH";
+		break;
+	case AS_UNIFORM_GRID:
+		accelerator = accUniGrid;
+		structure = "Uniform grid";
+		break;
+	case AS_OCTREE:
+		accelerator = accOctree;
+		structure = "Octree";
+		break;
+	default:
+		accelerator = accList;
+		structure = "List";
+		break;
+	}
+
+	TraversalStats traversal;
+	if (renderer == CPU_RENDER) {
+		traversal = cpuStats;
+		cpuStats.reset();
+	}
+	else {
+		TTraversalStats gpuStats;
+		int err = gpu_pt.readGPUbuffer(&pt_stats, 0, sizeof(TTraversalStats), &gpuStats, 0);
+		checkError(err);
+		traversal.rays = gpuStats.rays;
+		traversal.nodes = gpuStats.nodes;
+		traversal.primitives = gpuStats.primitives;
+		traversal.maxNodes = gpuStats.maxNodes;
+		traversal.maxPrimitives = gpuStats.maxPrimitives;
+		for (int i = 0; i < TRAVERSAL_HISTOGRAM_BINS; i++) {
+			traversal.nodeHistogram[i] = gpuStats.nodeHistogram[i];
+			traversal.primitiveHistogram[i] = gpuStats.primitiveHistogram[i];
+		}
+		TTraversalStats zeroStats = {};
+		err = gpu_pt.writeGPUdata(&pt_stats, 0, sizeof(TTraversalStats), &zeroStats);
+		checkError(err);
+	}
+
+	if (!writeStatsJSON(STATS_FILE, (renderer == CPU_RENDER) ? "CPU" : "GPU", structure,
+		contextAPI->GetSamples(), accelerator->getStats(), traversal)) {
+		cout << "Cannot write statistics to " << STATS_FILE << ".\n";
+	}
+}
+
 void RenderEnginePT::Destroy() 
 {
+	// Wait for running build, queued structures are not built.
+	builder->stop();
 	//clReleaseKernel(pt_kernel);
 	clReleaseMemObject(pt_col[0]);
 	clReleaseMemObject(pt_col[1]);
 	clReleaseMemObject(pt_cam);
 	clReleaseMemObject(pt_sphere);
+	clReleaseMemObject(pt_sphereData);
 	clReleaseMemObject(pt_triangle);
 	clReleaseMemObject(pt_meshes);
 	clReleaseMemObject(pt_range_meshes);
 	clReleaseMemObject(pt_light);
+	if (pt_stats)
+		clReleaseMemObject(pt_stats);
+	clReleaseMemObject(pt_heatmap);
 }
 
 #define IA 16807
@@ -531,15 +705,45 @@ bool RenderEnginePT::CheckSettings(PathTracer* pt, GPUPathtracer* gpu_pt,
 		wasChangedRender = true;
 	usedRenderer = pressedRenderer;
 
+	// Keep rendering with current structure until selected one is built.
+	if (usedAS != pressedAS && !IsReadyAS(pressedAS)) {
+		if (waitingAS != pressedAS)
+			cout << "Accelerate structure is being built, rendering continues with current one.\n";
+		waitingAS = pressedAS;
+		// Nothing is rendered yet, start with list.
+		if (usedAS != NO_OPTION)
+			return wasChangedRender;
+		pressedAS = AS_LIST;
+	}
+
 	if (usedAS != pressedAS) {
 		switch (pressedAS) {
+		case AS_AUTO:
+			cout << "Accelerate structure change to Auto ("
+				<< AutoAccelerator::getKindName(accAuto->getKind()) << ").\n";
+			if (usedRenderer == GPU_RENDER) {
+				gpu_pt->changeKernel(autoAS);
+			}
+			else {
+				scene->useAccelerator(accAuto);
+			}
+			break;
+		case AS_KDTREE:
+			cout << "Accelerate structure change to kD-tree.\n";
+			if (usedRenderer == GPU_RENDER) {
+				gpu_pt->changeKernel(AS_KDTREE);
+			}
+			else {
+				scene->useAccelerator(accKdTree);
+			}
+			break;
 		case AS_BVH:
 			cout << "Accelerate structure change to BVH.\n";
 			if (usedRenderer == GPU_RENDER) {
 				gpu_pt->changeKernel(AS_BVH);
 			}
 			else {
-				pt->setScene(sceneBVH);
+				scene->useAccelerator(accBVH);
 			}
 			break;
 		case AS_UNIFORM_GRID:
@@ -548,7 +752,7 @@ bool RenderEnginePT::CheckSettings(PathTracer* pt, GPUPathtracer* gpu_pt,
 				gpu_pt->changeKernel(AS_UNIFORM_GRID);
 			}
 			else {
-				pt->setScene(sceneUniGrid);
+				scene->useAccelerator(accUniGrid);
 			}
 			break;
 		case AS_OCTREE:
@@ -557,7 +761,7 @@ bool RenderEnginePT::CheckSettings(PathTracer* pt, GPUPathtracer* gpu_pt,
 				gpu_pt->changeKernel(AS_OCTREE);
 			}
 			else {
-				pt->setScene(sceneOctree);
+				scene->useAccelerator(accOctree);
 			}
 			break;
 		case AS_LIST:
@@ -566,7 +770,7 @@ bool RenderEnginePT::CheckSettings(PathTracer* pt, GPUPathtracer* gpu_pt,
 				gpu_pt->changeKernel(AS_LIST);
 			}
 			else {
-				pt->setScene(sceneList);
+				scene->useAccelerator(accList);
 			}
 			break;
 		}
@@ -576,16 +780,51 @@ bool RenderEnginePT::CheckSettings(PathTracer* pt, GPUPathtracer* gpu_pt,
 	return wasChangedRender;
 }
 
-void RenderEnginePT::CheckSettingsFirst(PathTracer* pt, GPUPathtracer* gpu_pt,
+// Switch heatmap mode of both renderers, samples are computed again from zero.
+void RenderEnginePT::CheckHeatmap(PathTracer* pt)
+{
+	if (usedHeatmap == contextAPI->IsHeatmap())
+		return;
+
+	usedHeatmap = contextAPI->IsHeatmap();
+	cout << "Heatmap mode " << (usedHeatmap ? "on" : "off") << ".\n";
+	pt->setHeatmap(usedHeatmap);
+	cl_uint heatmap = usedHeatmap;
+	int err = gpu_pt.writeGPUdata(&pt_heatmap, 0, sizeof(cl_uint), &heatmap);
+	checkError(err);
+	contextAPI->ResetSamples();
+}
+
+// Returns structure of first image, list until selected structure is built.
+int RenderEnginePT::CheckSettingsFirst(PathTracer* pt, GPUPathtracer* gpu_pt,
 	int pressedAS, int pressedRenderer)
 {
+	if (!IsReadyAS(pressedAS))
+		pressedAS = AS_LIST;
+
 	switch (pressedAS) {
+	case AS_AUTO:
+		if (pressedRenderer == GPU_RENDER) {
+			gpu_pt->changeKernel(autoASFirst);
+		}
+		else {
+			scene->useAccelerator(accAuto);
+		}
+		break;
+	case AS_KDTREE:
+		if (pressedRenderer == GPU_RENDER) {
+			gpu_pt->changeKernel(AS_KDTREE_FIRST);
+		}
+		else {
+			scene->useAccelerator(accKdTree);
+		}
+		break;
 	case AS_BVH:
 		if (pressedRenderer == GPU_RENDER) {
 			gpu_pt->changeKernel(AS_BVH_FIRST);
 		}
 		else {
-			pt->setScene(sceneBVH);
+			scene->useAccelerator(accBVH);
 		}
 		break;
 	case AS_UNIFORM_GRID:
@@ -593,7 +832,7 @@ void RenderEnginePT::CheckSettingsFirst(PathTracer* pt, GPUPathtracer* gpu_pt,
 			gpu_pt->changeKernel(AS_UNIFORM_GRID_FIRST);
 		}
 		else {
-			pt->setScene(sceneUniGrid);
+			scene->useAccelerator(accUniGrid);
 		}
 		break;
 	case AS_OCTREE:
@@ -601,7 +840,7 @@ void RenderEnginePT::CheckSettingsFirst(PathTracer* pt, GPUPathtracer* gpu_pt,
 			gpu_pt->changeKernel(AS_OCTREE_FIRST);
 		}
 		else {
-			pt->setScene(sceneOctree);
+			scene->useAccelerator(accOctree);
 		}
 		break;
 	case AS_LIST:
@@ -609,91 +848,232 @@ void RenderEnginePT::CheckSettingsFirst(PathTracer* pt, GPUPathtracer* gpu_pt,
 			gpu_pt->changeKernel(AS_LIST_FIRST);
 		}
 		else {
-			pt->setScene(sceneList);
+			scene->useAccelerator(accList);
 		}
 		break;
 	}
+	return pressedAS;
 }
 
-unsigned int RenderEnginePT::CreateOctree(std::vector<TOctreeBox>* octreeBuffer, std::vector<TObject>* objectBuffer,
-	OctreeAccelerator* octADS, unsigned int& indexOctreeBuffer)
+// Is structure built and uploaded to device? Structure which is not built yet
+// is built as the next one and rendering goes on with current structure.
+bool RenderEnginePT::IsReadyAS(int as)
 {
-	unsigned int objBufferStart = objectBuffer->size();
-	unsigned int objBufferCnt = objBufferStart;
-	unsigned int index = octreeBuffer->size();
-
-	AABB box;
-	box = octADS->getBox();
+	RayAccelerator* accelerator;
+	switch (as) {
+	case AS_AUTO:
+		accelerator = accAuto;
+		break;
+	case AS_KDTREE:
+		accelerator = accKdTree;
+		break;
+	case AS_BVH:
+		accelerator = accBVH;
+		break;
+	case AS_UNIFORM_GRID:
+		accelerator = accUniGrid;
+		break;
+	case AS_OCTREE:
+		accelerator = accOctree;
+		break;
+	default:
+		// List is built in InitPT.
+		return true;
+	}
 
-	TObject obj;
-	TOctreeBox node;
+	if (!builder->isReady(accelerator)) {
+		builder->request(accelerator);
+		return false;
+	}
+	if (uploadedAS.insert(as).second)
+		UploadAS(as);
+	// On GPU auto mode uses kernel of chosen structure, it must be ready too.
+	if (as == AS_AUTO)
+		return IsReadyAS(autoAS);
+	return true;
+}
 
-	Point3DtoFloat3(box.mMin, node.boxMin);
-	Point3DtoFloat3(box.mMax, node.boxMax);
-	Point3DtoFloat3(octADS->getMiddlePoint(), node.middlePoint);
-	node.leaf = octADS->isLeaf();
-	
-	if (node.leaf) {
-		std::vector<Intersectable*> objects = octADS->getObjects();
-		for (std::vector<Intersectable*>::iterator it = objects.begin(); it != objects.end(); it++) {
-			if ((*it)->isSphere()) {
-				obj.index = GetIndexSphere((Sphere*)*it);
-				obj.type = SPHERE_INDEX;
-			}
-			else {
-				obj.index = GetIndexTriangle((Triangle*)*it);
-				obj.type = TRIANGLE_INDEX;
-			}
-			objectBuffer->push_back(obj);
-			objBufferCnt++;
+// Upload built structure to device and set its arguments of both kernels.
+// Auto mode only chooses kernels of its structure.
+void RenderEnginePT::UploadAS(int as)
+{
+	int err;
+	unsigned int kernel = gpu_pt.getKernel();
+
+	switch (as) {
+	case AS_AUTO:
+		switch (accAuto->getKind()) {
+		case AUTO_LIST:
+			autoAS = AS_LIST;
+			autoASFirst = AS_LIST_FIRST;
+			break;
+		case AUTO_OCTREE:
+			autoAS = AS_OCTREE;
+			autoASFirst = AS_OCTREE_FIRST;
+			break;
+		case AUTO_BVH:
+			autoAS = AS_BVH;
+			autoASFirst = AS_BVH_FIRST;
+			break;
+		default:
+			autoAS = AS_KDTREE;
+			autoASFirst = AS_KDTREE_FIRST;
+			break;
 		}
+		break;
+	case AS_OCTREE: {
+		TOctree infoOctree;
+		std::vector<TOctreeLink> octreeLinks;
+		CreateOctree(&infoOctree, &octreeLinks, &objectBufferOct, accOctree);
+		cl_uint cnt_octree = accOctree->getNodes().size();
+
+		// Node array of linear octree has same layout on device, upload it as it is.
+		gpu_pt.createGPUbuffer(&pt_octree, CL_MEM_READ_ONLY, cnt_octree*sizeof(TOctreeNode));
+		err = gpu_pt.writeGPUdata(&pt_octree, 0, cnt_octree*sizeof(TOctreeNode), (void*)accOctree->getNodes().data());
+		checkError(err);
+		gpu_pt.createGPUbuffer(&pt_octreeLinks, CL_MEM_READ_ONLY, cnt_octree*sizeof(TOctreeLink));
+		err = gpu_pt.writeGPUdata(&pt_octreeLinks, 0, cnt_octree*sizeof(TOctreeLink), octreeLinks.data());
+		checkError(err);
+		gpu_pt.createGPUbuffer(&pt_infoOctree, CL_MEM_READ_ONLY, sizeof(TOctree));
+		err = gpu_pt.writeGPUdata(&pt_infoOctree, 0, sizeof(TOctree), &infoOctree);
+		checkError(err);
+		gpu_pt.createGPUbuffer(&pt_objectsOct, CL_MEM_READ_ONLY, objectBufferOct.size()*sizeof(TObject));
+		err = gpu_pt.writeGPUdata(&pt_objectsOct, 0, objectBufferOct.size()*sizeof(TObject), objectBufferOct.data());
+		checkError(err);
+
+		gpu_pt.changeKernel(AS_OCTREE);
+		gpu_pt.setGPUargs(16, sizeof(cl_mem), &pt_octree);
+		gpu_pt.setGPUargs(17, sizeof(cl_mem), &pt_octreeLinks);
+		gpu_pt.setGPUargs(18, sizeof(cl_mem), &pt_infoOctree);
+		gpu_pt.setGPUargs(19, sizeof(cl_mem), &pt_objectsOct);
+		gpu_pt.changeKernel(AS_OCTREE_FIRST);
+		gpu_pt.setGPUargs(14, sizeof(cl_mem), &pt_octree);
+		gpu_pt.setGPUargs(15, sizeof(cl_mem), &pt_octreeLinks);
+		gpu_pt.setGPUargs(16, sizeof(cl_mem), &pt_infoOctree);
+		gpu_pt.setGPUargs(17, sizeof(cl_mem), &pt_objectsOct);
+		break;
+	}
+	case AS_UNIFORM_GRID: {
+		TUniGrid infoUniGrid;
+		std::vector<TBoxLink> uniGridBuffer;
+		CreateUniGrid(&infoUniGrid, &uniGridBuffer, &objectBufferUniGrid, accUniGrid);
+
+		gpu_pt.createGPUbuffer(&pt_uniGrid, CL_MEM_READ_ONLY, sizeof(TUniGrid));
+		err = gpu_pt.writeGPUdata(&pt_uniGrid, 0, sizeof(TUniGrid), &infoUniGrid);
+		checkError(err);
+		gpu_pt.createGPUbuffer(&pt_uniGridBuffer, CL_MEM_READ_ONLY, uniGridBuffer.size()*sizeof(TBoxLink));
+		err = gpu_pt.writeGPUdata(&pt_uniGridBuffer, 0, uniGridBuffer.size()*sizeof(TBoxLink), uniGridBuffer.data());
+		checkError(err);
+		gpu_pt.createGPUbuffer(&pt_objectsUniGrid, CL_MEM_READ_ONLY, objectBufferUniGrid.size()*sizeof(TObject));
+		err = gpu_pt.writeGPUdata(&pt_objectsUniGrid, 0, objectBufferUniGrid.size()*sizeof(TObject), objectBufferUniGrid.data());
+		checkError(err);
+
+		gpu_pt.changeKernel(AS_UNIFORM_GRID);
+		gpu_pt.setGPUargs(16, sizeof(cl_mem), &pt_uniGrid);
+		gpu_pt.setGPUargs(17, sizeof(cl_mem), &pt_uniGridBuffer);
+		gpu_pt.setGPUargs(18, sizeof(cl_mem), &pt_objectsUniGrid);
+		gpu_pt.changeKernel(AS_UNIFORM_GRID_FIRST);
+		gpu_pt.setGPUargs(14, sizeof(cl_mem), &pt_uniGrid);
+		gpu_pt.setGPUargs(15, sizeof(cl_mem), &pt_uniGridBuffer);
+		gpu_pt.setGPUargs(16, sizeof(cl_mem), &pt_objectsUniGrid);
+		break;
+	}
+	case AS_BVH:
+		CreateBVH(&bvhBuffer, &objectBufferBVH, accBVH);
+
+		gpu_pt.createGPUbuffer(&pt_BVH, CL_MEM_READ_ONLY, bvhBuffer.size()*sizeof(TBVHNode));
+		err = gpu_pt.writeGPUdata(&pt_BVH, 0, bvhBuffer.size()*sizeof(TBVHNode), bvhBuffer.data());
+		checkError(err);
+		gpu_pt.createGPUbuffer(&pt_objectsBVH, CL_MEM_READ_ONLY, objectBufferBVH.size()*sizeof(TObject));
+		err = gpu_pt.writeGPUdata(&pt_objectsBVH, 0, objectBufferBVH.size()*sizeof(TObject), objectBufferBVH.data());
+		checkError(err);
+
+		gpu_pt.changeKernel(AS_BVH);
+		gpu_pt.setGPUargs(16, sizeof(cl_mem), &pt_BVH);
+		gpu_pt.setGPUargs(17, sizeof(cl_mem), &pt_objectsBVH);
+		gpu_pt.changeKernel(AS_BVH_FIRST);
+		gpu_pt.setGPUargs(14, sizeof(cl_mem), &pt_BVH);
+		gpu_pt.setGPUargs(15, sizeof(cl_mem), &pt_objectsBVH);
+		break;
+	case AS_KDTREE:
+		CreateKdTree(&kdBuffer, &objectBufferKd, accKdTree);
+
+		gpu_pt.createGPUbuffer(&pt_kdTree, CL_MEM_READ_ONLY, kdBuffer.size()*sizeof(TKdNode));
+		err = gpu_pt.writeGPUdata(&pt_kdTree, 0, kdBuffer.size()*sizeof(TKdNode), kdBuffer.data());
+		checkError(err);
+		gpu_pt.createGPUbuffer(&pt_objectsKd, CL_MEM_READ_ONLY, objectBufferKd.size()*sizeof(TObject));
+		err = gpu_pt.writeGPUdata(&pt_objectsKd, 0, objectBufferKd.size()*sizeof(TObject), objectBufferKd.data());
+		checkError(err);
+
+		gpu_pt.changeKernel(AS_KDTREE);
+		gpu_pt.setGPUargs(16, sizeof(cl_mem), &pt_kdTree);
+		gpu_pt.setGPUargs(17, sizeof(cl_mem), &pt_objectsKd);
+		gpu_pt.changeKernel(AS_KDTREE_FIRST);
+		gpu_pt.setGPUargs(14, sizeof(cl_mem), &pt_kdTree);
+		gpu_pt.setGPUargs(15, sizeof(cl_mem), &pt_objectsKd);
+		break;
+	}
 
-		node.boxLink.objStartIndex = objBufferStart;
-		node.boxLink.objSize = objBufferCnt;
+	gpu_pt.changeKernel(kernel);
+}
 
-		for (int i = 0; i < 8; i++) {
-			node.children[i] = 0;
+void RenderEnginePT::CreateOctree(TOctree* infoOctree, std::vector<TOctreeLink>* links, std::vector<TObject>* objectBuffer, 
+								  OctreeAccelerator* octADS)
+{
+	AABB box = octADS->getBox();
+	Point3DtoFloat3(box.mMin, infoOctree->boxMin);
+	Point3DtoFloat3(box.mMax, infoOctree->boxMax);
+	// Ropes for stackless traversal on device.
+	octADS->getLinks(*links);
+
+	// Convert every object only once, leafs share the index array.
+	std::vector<Intersectable*> objects = octADS->getObjects();
+	std::vector<TObject> converted(objects.size());
+	for (unsigned int i = 0; i < objects.size(); i++) {
+		if (objects[i]->isSphere()) {
+			converted[i].index = GetIndexSphere((Sphere*)objects[i]);
+			converted[i].type = SPHERE_INDEX;
+		}
+		else {
+			converted[i].index = GetIndexTriangle((Triangle*)objects[i]);
+			converted[i].type = TRIANGLE_INDEX;
 		}
-		octreeBuffer->push_back(node);
 	}
-	else {
-		/*for (int i = 0; i < 8; i++) {
-			node.children[i] = indexOctreeBuffer;
-			indexOctreeBuffer++;
-		}*/
-
-		octreeBuffer->push_back(node);
 
-		for (int i = 0; i < 8; i++) {
-			node.children[i] = CreateOctree(octreeBuffer, objectBuffer, octADS->getChild(i), indexOctreeBuffer);
-		}
-		octreeBuffer->at(index) = node;
+	const CachedArray<unsigned int>& indexes = octADS->getObjIndexes();
+	objectBuffer->resize(indexes.size());
+	for (unsigned int i = 0; i < indexes.size(); i++) {
+		objectBuffer->at(i) = converted[indexes[i]];
 	}
-	return index;
+}
+
+void RenderEnginePT::IndexObjects()
+{
+	// Spheres and triangles are numbered together by setIndex()/setIndexes(),
+	// so one table maps the number to position in sphereData or triangles.
+	unsigned int count = 0;
+	for (unsigned int i = 0; i < sphereData.size(); i++)
+		count = std::max(count, sphereData[i].index + 1);
+	for (unsigned int i = 0; i < triangles.size(); i++)
+		count = std::max(count, triangles[i].index + 1);
+
+	objectSlots.assign(count, 100000);
+	for (unsigned int i = 0; i < sphereData.size(); i++)
+		objectSlots[sphereData[i].index] = i;
+	for (unsigned int i = 0; i < triangles.size(); i++)
+		objectSlots[triangles[i].index] = i;
 }
 
 unsigned int RenderEnginePT::GetIndexSphere(Sphere* sp)
 {
-	unsigned int i = 0; 
-	for (std::vector<TSphere>::iterator it = spheres.begin(); it != spheres.end(); it++) {
-		if (sp->getIndex() == (*it).index) {
-			return i;
-		}
-		i++;
-	}
-	return 100000;
+	unsigned int index = sp->getIndex();
+	return index < objectSlots.size() ? objectSlots[index] : 100000;
 }
 
 unsigned int RenderEnginePT::GetIndexTriangle(Triangle* tr)
 {
-	unsigned int i = 0;
-	for (std::vector<TTriangle>::iterator it = triangles.begin(); it != triangles.end(); it++) {
-		if (tr->getIndex() == (*it).index) {
-			return i;
-		}
-		i++;
-	}
-	return 100000;
+	unsigned int index = tr->getIndex();
+	return index < objectSlots.size() ? objectSlots[index] : 100000;
 }
 
 void RenderEnginePT::CreateUniGrid(TUniGrid* infoUniGrid, std::vector<TBoxLink>* uniGridBuffer,
@@ -778,4 +1158,29 @@ void RenderEnginePT::CreateBVH(std::vector<TBVHNode>* nodes, std::vector<TObject
 		index++;
 		objBufferStart = objBufferCnt;
 	}
+}
+void RenderEnginePT::CreateKdTree(std::vector<TKdNode>* nodes, std::vector<TObject>* objBufferKd, KdTreeAccelerator* kdADS)
+{
+	// Boxes and ropes for stackless traversal on device.
+	kdADS->getRopeNodes(*nodes);
+
+	// Convert every object only once, leafs share the index array.
+	std::vector<Intersectable*> objects = kdADS->getObjects();
+	std::vector<TObject> converted(objects.size());
+	for (unsigned int i = 0; i < objects.size(); i++) {
+		if (objects[i]->isSphere()) {
+			converted[i].index = GetIndexSphere((Sphere*)objects[i]);
+			converted[i].type = SPHERE_INDEX;
+		}
+		else {
+			converted[i].index = GetIndexTriangle((Triangle*)objects[i]);
+			converted[i].type = TRIANGLE_INDEX;
+		}
+	}
+
+	const CachedArray<unsigned int>& indexes = kdADS->getObjIndexes();
+	objBufferKd->resize(indexes.size());
+	for (unsigned int i = 0; i < indexes.size(); i++) {
+		objBufferKd->at(i) = converted[indexes[i]];
+	}
 }
\ No newline at end of file
@@ -22,16 +22,27 @@
 #include "texture.h"
 #include "bvhaccelerator.h"
 #include "cornellscene.h"
+#include "scenefile.h"
 #include "pathtracer.h"
 #include <string>
 #include "octreeaccelerator.h"
 #include "uniformaccelerator.h"
+#include "kdtreeaccelerator.h"
+#include "autoaccelerator.h"
+#include "acceleratorbuilder.h"
+#include <set>
+#include <algorithm>
 #include "SDLGLContext.h"
 #include "gpu_pathtracer.h"
 #include "gpu_types.h"
 
 using namespace std;
 
+// Count visited nodes and tested objects of every ray and write statistics
+// of structure and traversal to STATS_FILE after every computed image.
+#define TRAVERSAL_STATS 0
+#define STATS_FILE "stats.json"
+
 float ran1(long *idum);
 static bool changeDirectory(const char* directory);
 static void changeToRootDirectory(string directory);
@@ -39,19 +50,28 @@ void checkError(int err);
 
 class RenderEnginePT {
 public:
+	// Scene description file used instead of Cornell box, call before InitPT().
+	void SetSceneFile(const std::string& file) { sceneFile = file; }
 	void InitPT(SDLGLContext* context);
 	void ComputePT();
 	void Destroy();
 private:
 	void SwapImages(GPUPathtracer* gpu_pt, unsigned int indexImg);
 	bool CheckSettings(PathTracer* pt, GPUPathtracer* gpu_pt, int pressedAS, int pressedRenderer);
-	void CheckSettingsFirst(PathTracer* pt, GPUPathtracer* gpu_pt, int pressedAS, int pressedRenderer);
-	unsigned int CreateOctree(std::vector<TOctreeBox>* octreeBuffer, std::vector<TObject>* objectBuffer,
-		OctreeAccelerator* octADS, unsigned int& indexOctreeBuffer);
+	int CheckSettingsFirst(PathTracer* pt, GPUPathtracer* gpu_pt, int pressedAS, int pressedRenderer);
+	bool IsReadyAS(int as);
+	void UploadAS(int as);
+	void CreateOctree(TOctree* infoOctree, std::vector<TOctreeLink>* links, std::vector<TObject>* objectBuffer, 
+					  OctreeAccelerator* octADS);
 	void CreateUniGrid(TUniGrid* infoUniGrid, std::vector<TBoxLink>* uniGridBuffer, 
 					   std::vector<TObject>* objBufferUniGrid, UniformAccelerator* uniADS);
 	void CreateBVH(std::vector<TBVHNode>* nodes,std::vector<TObject>* objBufferBVH, BVHAccelerator* bvhADS);
+	void CreateKdTree(std::vector<TKdNode>* nodes, std::vector<TObject>* objBufferKd, KdTreeAccelerator* kdADS);
+	void WriteStats(unsigned int renderer, unsigned int as);
+	void CheckHeatmap(PathTracer* pt);
 
+	// Fill objectSlots after the scene objects are exported.
+	void IndexObjects();
 	unsigned int GetIndexSphere(Sphere* sp);
 	unsigned int GetIndexTriangle(Triangle* tr);
 private:
@@ -60,10 +80,24 @@ private:
 	size_t local_size[2];
 	size_t global_size[2];
 
-	Scene* sceneList;
-	Scene* sceneOctree;
-	Scene* sceneUniGrid;
-	Scene* sceneBVH;
+	// One scene, all structures are built over its geometry and owned by it.
+	Scene* scene;
+	std::string sceneFile;
+	ListAccelerator* accList;
+	OctreeAccelerator* accOctree;
+	UniformAccelerator* accUniGrid;
+	BVHAccelerator* accBVH;
+	KdTreeAccelerator* accKdTree;
+	AutoAccelerator* accAuto;
+	// Structures except list are built on background thread.
+	AcceleratorBuilder* builder;
+	// Structures uploaded to device.
+	std::set<int> uploadedAS;
+	// Kernels of structure chosen by auto mode.
+	unsigned int autoAS;
+	unsigned int autoASFirst;
+	// Traversal statistics of CPU renderer.
+	TraversalStats cpuStats;
 	Image* output;
 	Camera* camera;
 
@@ -71,19 +105,24 @@ private:
 	cl_kernel pt_kernel;
 
 	std::vector<TSphere> spheres;
+	std::vector<TSphereData> sphereData;
 	std::vector<TTriangle> triangles;
+	// Position of object in sphereData or triangles by its index.
+	std::vector<unsigned int> objectSlots;
 	std::vector<TMesh> meshes;
 	std::vector<unsigned int> size_meshes;
 	std::vector<TLight> lights;
-	std::vector<TOctreeBox> octreeBuffer;
 	std::vector<TObject> objectBufferOct;
 	std::vector<TObject> objectBufferUniGrid;
 	std::vector<TBVHNode> bvhBuffer;
 	std::vector<TObject> objectBufferBVH;
+	std::vector<TKdNode> kdBuffer;
+	std::vector<TObject> objectBufferKd;
 
 	cl_mem pt_col[2];
 	cl_mem pt_cam;
 	cl_mem pt_sphere;
+	cl_mem pt_sphereData;
 	cl_mem pt_sphereLoc;
 	cl_mem pt_triangle;
 	cl_mem pt_triangleLoc;
@@ -91,18 +130,23 @@ private:
 	cl_mem pt_range_meshes;
 	cl_mem pt_light;
 	cl_mem pt_octree;
+	cl_mem pt_octreeLinks;
 	cl_mem pt_objectsOct;
 	cl_mem pt_uniGrid;
 	cl_mem pt_uniGridBuffer;
 	cl_mem pt_objectsUniGrid;
 	cl_mem pt_BVH;
 	cl_mem pt_objectsBVH;
+	cl_mem pt_kdTree;
+	cl_mem pt_objectsKd;
 
 	cl_mem pt_cntSpheres;
 	cl_mem pt_cntTriangles;
 	cl_mem pt_cntRangeMeshes;
 	cl_mem pt_cntLights;
-	cl_mem pt_cntOctree;
+	cl_mem pt_infoOctree;
+	cl_mem pt_stats;
+	cl_mem pt_heatmap;
 };
 
 #endif // _RENDER_ENGINE_H_
\ No newline at end of file
@@ -159,17 +159,20 @@ void SDLGLContext::PrepareButtons()
 		12, 13, 14, 14, 15, 12, // Button Octree
 		16, 17, 18, 18, 19, 16, // Button Uniform grid
 		20, 21, 22, 22, 23, 20, // Button BVH
-		24, 25, 26, 26, 27, 24, // Button Pause
-		28, 29, 30, 30, 31, 28, // Button Save
+		24, 25, 26, 26, 27, 24, // Button kD-tree
+		28, 29, 30, 30, 31, 28, // Button Auto
+		32, 33, 34, 34, 35, 32, // Button Pause
+		36, 37, 38, 38, 39, 36, // Button Save
+		40, 41, 42, 42, 43, 40, // Button Heatmap
 		
-		32, 33, 34, 34, 35, 32, // Samples
-		36, 37, 38, 38, 39, 36, // Choose rendering mode
-		40, 41, 42, 42, 43, 40, // Choose accelerate structure
-		44, 45, 46, 46, 47, 44, // Rendering time 
-		48, 49, 50, 50, 51, 48, // Progress of computation
+		44, 45, 46, 46, 47, 44, // Samples
+		48, 49, 50, 50, 51, 48, // Choose rendering mode
+		52, 53, 54, 54, 55, 52, // Choose accelerate structure
+		56, 57, 58, 58, 59, 56, // Rendering time 
+		60, 61, 62, 62, 63, 60, // Progress of computation
 		
-		52, 53, 54, 54, 55, 52, // time of render
-		56, 57, 58, 58, 59, 56  // samples 
+		64, 65, 66, 66, 67, 64, // time of render
+		68, 69, 70, 70, 71, 68  // samples 
 	};
 
 	GLuint IBO_lines[] = {
@@ -179,8 +182,11 @@ void SDLGLContext::PrepareButtons()
 		12, 13, 13, 14, 14, 15, 15, 12, // Button Octree
 		16, 17, 17, 18, 18, 19, 19, 16, // Button Uniform grid
 		20, 21, 21, 22, 22, 23, 23, 20, // Button BVH
-		24, 25, 25, 26, 26, 27, 27, 24, // Button Pause
-		28, 29, 29, 30, 30, 31, 31, 28  // Button Save
+		24, 25, 25, 26, 26, 27, 27, 24, // Button kD-tree
+		28, 29, 29, 30, 30, 31, 31, 28, // Button Auto
+		32, 33, 33, 34, 34, 35, 35, 32, // Button Pause
+		36, 37, 37, 38, 38, 39, 39, 36, // Button Save
+		40, 41, 41, 42, 42, 43, 43, 40  // Button Heatmap
 	};
 
 	// Buttons Vtx.
@@ -224,10 +230,10 @@ void SDLGLContext::PrepareButtons()
 	glBufferData(GL_ARRAY_BUFFER, VBO_text_vtx.size() * sizeof(GLVertexData), VBO_text_vtx.data(), GL_STATIC_DRAW);
 	// Indices for buttons Vtx.
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, IBO[1]);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, 8 * 8 * sizeof(GLuint), IBO_lines, GL_STATIC_DRAW);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, 8 * 11 * sizeof(GLuint), IBO_lines, GL_STATIC_DRAW);
 	// Indices for button's texts Vtx.
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, IBO[0]);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, 6 * 15 * sizeof(GLuint), IBO_triangles, GL_STATIC_DRAW);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, 6 * 18 * sizeof(GLuint), IBO_triangles, GL_STATIC_DRAW);
 
 	// Set VAOs routine.
 	glBindVertexArray(VAO[0]);
@@ -335,12 +341,12 @@ void SDLGLContext::PrepareLines()
 	{
 		80 + wpadding, screenHeight - 50 + hpadding,
 		30 + wpadding, screenHeight - 50 + hpadding,
-		30 + wpadding, screenHeight - 140 + hpadding,
-		80 + wpadding, screenHeight - 140 + hpadding,
+		30 + wpadding, screenHeight - 150 + hpadding,
+		80 + wpadding, screenHeight - 150 + hpadding,
 		100 + wpadding, screenHeight - 50 + hpadding,
 		150 + wpadding, screenHeight - 50 + hpadding,
-		150 + wpadding, screenHeight - 140 + hpadding,
-		100 + wpadding, screenHeight - 140 + hpadding
+		150 + wpadding, screenHeight - 150 + hpadding,
+		100 + wpadding, screenHeight - 150 + hpadding
 	};
 
 	// Left middle lines. Choose accele...
@@ -348,12 +354,12 @@ void SDLGLContext::PrepareLines()
 	{
 		80 + wpadding, screenHeight - 200 + hpadding,
 		30 + wpadding, screenHeight - 200 + hpadding,
-		30 + wpadding, screenHeight - 370 + hpadding,
-		80 + wpadding, screenHeight - 370 + hpadding,
+		30 + wpadding, screenHeight - 390 + hpadding,
+		80 + wpadding, screenHeight - 390 + hpadding,
 		100 + wpadding, screenHeight - 200 + hpadding,
 		150 + wpadding, screenHeight - 200 + hpadding,
-		150 + wpadding, screenHeight - 370 + hpadding,
-		100 + wpadding, screenHeight - 370 + hpadding
+		150 + wpadding, screenHeight - 390 + hpadding,
+		100 + wpadding, screenHeight - 390 + hpadding
 	};
 
 	// Animation window.
@@ -378,13 +384,13 @@ void SDLGLContext::PrepareLines()
 	GLfloat points[] =
 	{
 		80 + wpadding, screenHeight - 50 + hpadding,
-		80 + wpadding, screenHeight - 140 + hpadding,
+		80 + wpadding, screenHeight - 150 + hpadding,
 		100 + wpadding, screenHeight - 50 + hpadding,
-		100 + wpadding, screenHeight - 140 + hpadding,
+		100 + wpadding, screenHeight - 150 + hpadding,
 		80 + wpadding, screenHeight - 200 + hpadding,
-		80 + wpadding, screenHeight - 370 + hpadding,
+		80 + wpadding, screenHeight - 390 + hpadding,
 		100 + wpadding, screenHeight - 200 + hpadding,
-		100 + wpadding, screenHeight - 370 + hpadding
+		100 + wpadding, screenHeight - 390 + hpadding
 	};
 
 	// Map Vtx to OpenGL viewport.
@@ -556,22 +562,26 @@ void SDLGLContext::CheckButtons(long xPos, long yPos, bool isClick)
 			}
 			else {
 				// Other buttons.
-				if (((*it) != listButtons[6]) && ((*it) != listButtons[7])) {
+				if (((*it) != listButtons[8]) && ((*it) != listButtons[9]) && ((*it) != listButtons[10])) {
 					(*it)->Press();
 					CheckButtonSettings((*it)->GetID());
 				}
+				// Heatmap button.
+				else if ((*it) == listButtons[10]) {
+					SwitchHeatmap();
+				}
 				// Pause button.
-				else if ((*it) != listButtons[7]) {
+				else if ((*it) != listButtons[9]) {
 					if ((*it)->isPressed()) {
 						if (IsActiveButtons()) {
-							listButtons[6]->SetColor(0.f, 1.f, 0.f, 1.f);
-							listButtons[6]->SetPressed(false);
+							listButtons[8]->SetColor(0.f, 1.f, 0.f, 1.f);
+							listButtons[8]->SetPressed(false);
 							LeaveSem(1);
 						}
 					}
 					else {
-						listButtons[6]->SetColor(1.f, 0.f, 0.f, 1.f);
-						listButtons[6]->Press();
+						listButtons[8]->SetColor(1.f, 0.f, 0.f, 1.f);
+						listButtons[8]->Press();
 						SeizeSem(1);
 					}
 				}
@@ -621,6 +631,12 @@ void SDLGLContext::CheckButtonSettings(unsigned int ID)
 	case 5:
 		activeAS = AS_BVH;
 		break;
+	case 6:
+		activeAS = AS_KDTREE;
+		break;
+	case 7:
+		activeAS = AS_AUTO;
+		break;
 	}
 }
 
@@ -661,6 +677,20 @@ void SDLGLContext::CheckHotkeys(int pressedButton)
 		listButtons[5]->Press();
 		SetActiveAS(AS_BVH);
 		break;
+	// Press kD-tree.
+	case 'K':
+		listButtons[6]->Press();
+		SetActiveAS(AS_KDTREE);
+		break;
+	// Press Auto.
+	case 'A':
+		listButtons[7]->Press();
+		SetActiveAS(AS_AUTO);
+		break;
+	// Press Heatmap.
+	case 'H':
+		SwitchHeatmap();
+		break;
 	// Press Save
 	case 'S':
 		index = 0;
@@ -677,16 +707,16 @@ void SDLGLContext::CheckHotkeys(int pressedButton)
 		break;
 	// Press Pause
 	case 'P':
-		if (listButtons[6]->isPressed()) {
+		if (listButtons[8]->isPressed()) {
 			if (IsActiveButtons()) {
-				listButtons[6]->SetColor(0.f, 1.f, 0.f, 1.f);
-				listButtons[6]->SetPressed(false);
+				listButtons[8]->SetColor(0.f, 1.f, 0.f, 1.f);
+				listButtons[8]->SetPressed(false);
 				LeaveSem(1);
 			}
 		}
 		else {
-			listButtons[6]->SetColor(1.f, 0.f, 0.f, 1.f);
-			listButtons[6]->Press();
+			listButtons[8]->SetColor(1.f, 0.f, 0.f, 1.f);
+			listButtons[8]->Press();
 			SeizeSem(1);
 		}
 		break;
@@ -697,11 +727,23 @@ void SDLGLContext::CheckHotkeys(int pressedButton)
 	}
 }
 
+// Heatmap button works as switch, renderer restarts samples on change.
+void SDLGLContext::SwitchHeatmap()
+{
+	if (listButtons[10]->isPressed()) {
+		listButtons[10]->SetPressed(false);
+	}
+	else {
+		listButtons[10]->Press();
+	}
+	heatmap = listButtons[10]->isPressed();
+}
+
 bool SDLGLContext::IsActiveButtons()
 {
 	int flag = 0;
 
-	for (int i = 0; i < 6; i++) {
+	for (int i = 0; i < 8; i++) {
 		flag += listButtons[i]->isPressed();
 	}
 
@@ -749,7 +791,7 @@ void SDLGLContext::Draw()
 		
 		SDL_Color black; black.r = 0x00; black.g = 0x00; black.b = 0x00; black.a = 0xFF;
 		SDL_Surface* surfaceMsg = TTF_RenderText_Blended(mainFont, text.c_str(), black);
-		glBindTexture(GL_TEXTURE_2D, textures[14]);
+		glBindTexture(GL_TEXTURE_2D, textures[listButtons.size() + 6]);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, surfaceMsg->w, surfaceMsg->h, 0,
@@ -758,7 +800,7 @@ void SDLGLContext::Draw()
 
 		sprintf_s(buffer, "%.3f sec", sampleRenderTime);
 		surfaceMsg = TTF_RenderText_Blended(mainFont, buffer, black);
-		glBindTexture(GL_TEXTURE_2D, textures[13]);
+		glBindTexture(GL_TEXTURE_2D, textures[listButtons.size() + 5]);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, surfaceMsg->w, surfaceMsg->h, 0,
@@ -806,7 +848,7 @@ void SDLGLContext::DrawButtonsTexts()
 			glBindTexture(GL_TEXTURE_2D, 0);
 			glUniform1i(isBorderUniform, true);
 			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, IBO[1]);
-			glDrawElements(GL_LINES, 64, GL_UNSIGNED_INT, 0);
+			glDrawElements(GL_LINES, 88, GL_UNSIGNED_INT, 0);
 		}
 
 		glEnable(GL_BLEND);
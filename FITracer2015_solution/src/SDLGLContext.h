@@ -28,7 +28,10 @@
 #define AS_UNIFORM_GRID_FIRST 7
 #define AS_OCTREE_FIRST 8
 #define AS_LIST_FIRST 9
-#define NO_OPTION 10
+#define AS_KDTREE 10
+#define AS_KDTREE_FIRST 11
+#define AS_AUTO 12
+#define NO_OPTION 13
 
 class SDLGLContext {
 public:
@@ -44,6 +47,7 @@ public:
 		objectsCnt = 0;
 		activeAS = NO_OPTION; 
 		activeRenderer = NO_OPTION; 
+		heatmap = false;
 	}
 	~SDLGLContext() {}
 
@@ -81,10 +85,14 @@ public:
 	// Get activated accelerate structure.
 	int GetActiveAS() { return activeAS; }
 	int GetActiveRenderer() { return activeRenderer; }
+	// Is heatmap of traversal cost drawn instead of pathtracing?
+	bool IsHeatmap() { return heatmap; }
 	//GLuint GetResultTexture() { return resultTexture; }
 	void AddSample() { samplesCnt++; wasSampleUpdated = true; }
 	unsigned int GetSamples() { return samplesCnt; }
 	unsigned int* GetSamplesPtr() { return &samplesCnt; }
+	// Next image overwrites result instead of mixing with previous samples.
+	void ResetSamples() { samplesCnt = 0; wasSampleUpdated = true; }
 	// Get handle to result texture.
 	GLuint* GetResultTextures() { return resultTexture; }
 	// Get pixels from texture.
@@ -138,6 +146,8 @@ private:
 	void CheckButtonSettings(unsigned int ID);
 	void SetActiveAS(int _activeAS) { activeAS = _activeAS; }
 	void SetActiveRenderer(int _activeRenderer) { activeRenderer = _activeRenderer; }
+	// Turn on/off heatmap mode.
+	void SwitchHeatmap();
 	void DrawButtonsTexts();
 	// Draw result of pathtracing.
 	void DrawImage();
@@ -191,6 +201,8 @@ private:
 	// Active accelerate structure.
 	int activeAS;
 	int activeRenderer;
+	// Heatmap mode.
+	bool heatmap;
 	// Will be end of program?
 	bool quit;
 
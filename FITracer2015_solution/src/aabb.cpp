@@ -117,6 +117,18 @@ int AABB::getLargestAxis() const
 	return (d.x>d.y && d.x>d.z) ? 0 : ((d.y>d.z) ? 1 : 2);
 }
 
+/**
+ * Returns true if the box overlaps the box b (touching counts as overlap).
+ */
+bool AABB::overlap(const AABB& b) const
+{
+	for (int i = 0; i < 3; i++) {
+		if (mMin(i) > b.mMax(i) || mMax(i) < b.mMin(i))
+			return false;
+	}
+	return true;
+}
+
 /**
  * Performs ray/box intersection. Returns true if the ray
  * intersects the box, and the hit time for the entry/exit
@@ -28,7 +28,6 @@ public:
 	AABB(const Point3D& p);
 	AABB(const Point3D& p1, const Point3D& p2);
 	AABB(const Point3D& p1, const Point3D& p2, const Point3D& p3);
-	virtual ~AABB() {}
 
 	void init(const Point3D& p);
 	void include(const Point3D& p);
@@ -37,6 +36,7 @@ public:
 	float getVolume() const;
 	float getArea() const;
 	int getLargestAxis() const;
+	bool overlap(const AABB& b) const;
 	bool intersect(const Ray& r, float& tmin, float& tmax) const;
 };
 
@@ -0,0 +1,107 @@
+/*
+	Name: acceleratorbuilder.cpp
+	Desc: Building of accelerated data structures on background thread.
+	Author: Karel Brezina (xbrezi13)
+*/
+
+#include "acceleratorbuilder.h"
+#include "Timer.h"
+#include <iostream>
+
+void AcceleratorBuilder::add(RayAccelerator* accelerator, const std::string& name)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	queue.push_back(std::make_pair(accelerator, name));
+	names[accelerator] = name;
+}
+
+void AcceleratorBuilder::start()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	if (!worker.joinable()) {
+		running = true;
+		worker = std::thread(&AcceleratorBuilder::run, this);
+	}
+}
+
+void AcceleratorBuilder::stop()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopped = true;
+		queue.clear();
+	}
+	if (worker.joinable())
+		worker.join();
+}
+
+void AcceleratorBuilder::request(RayAccelerator* accelerator)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	if (ready.count(accelerator) || accelerator == building || names.count(accelerator) == 0)
+		return;
+	remove(accelerator);
+	queue.push_front(std::make_pair(accelerator, names[accelerator]));
+	// Worker finished the queue before, e.g. after drop().
+	if (!stopped && !running && worker.joinable()) {
+		worker.join();
+		running = true;
+		worker = std::thread(&AcceleratorBuilder::run, this);
+	}
+}
+
+void AcceleratorBuilder::markReady(RayAccelerator* accelerator)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	remove(accelerator);
+	ready.insert(accelerator);
+}
+
+void AcceleratorBuilder::drop(RayAccelerator* accelerator)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	remove(accelerator);
+}
+
+// Remove structure from queue, mutex is locked by caller.
+bool AcceleratorBuilder::remove(RayAccelerator* accelerator)
+{
+	for (unsigned int i = 0; i < queue.size(); i++) {
+		if (queue[i].first == accelerator) {
+			queue.erase(queue.begin() + i);
+			return true;
+		}
+	}
+	return false;
+}
+
+bool AcceleratorBuilder::isReady(RayAccelerator* accelerator)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return ready.count(accelerator) != 0;
+}
+
+void AcceleratorBuilder::run()
+{
+	while (1) {
+		std::pair<RayAccelerator*, std::string> item;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (stopped || queue.empty()) {
+				running = false;
+				return;
+			}
+			item = queue.front();
+			queue.pop_front();
+			building = item.first;
+		}
+
+		CTimer timer;
+		item.first->build(geometry);
+		std::cout << item.second << " built in background in " << timer.f_Time() << " s." << std::endl;
+
+		std::lock_guard<std::mutex> lock(mutex);
+		ready.insert(item.first);
+		building = NULL;
+	}
+}
@@ -0,0 +1,59 @@
+/*
+	Name: acceleratorbuilder.h
+	Desc: Building of accelerated data structures on background thread.
+	Author: Karel Brezina (xbrezi13)
+*/
+
+#ifndef _ACCELERATOR_BUILDER_H_
+#define _ACCELERATOR_BUILDER_H_
+
+#include "rayaccelerator.h"
+#include <vector>
+#include <deque>
+#include <map>
+#include <set>
+#include <string>
+#include <thread>
+#include <mutex>
+
+// Worker thread which builds queued structures one by one over the same
+// geometry. Structure needed at once is moved to front of queue by request(),
+// others are built speculatively in order of adding. Geometry is only read
+// by build, so rendering with other structures goes on meanwhile.
+// Structure dropped from queue is queued again when it is requested.
+class AcceleratorBuilder {
+public:
+	AcceleratorBuilder(const std::vector<Intersectable*>& geometry) : geometry(geometry) { stopped = false; running = false; building = NULL; }
+	~AcceleratorBuilder() { stop(); }
+
+	// Queue structure for build. Structure added after start() is built
+	// once it is requested.
+	void add(RayAccelerator* accelerator, const std::string& name);
+	void start();
+	// Finish running build and drop the rest of queue.
+	void stop();
+
+	// Build structure as the next one.
+	void request(RayAccelerator* accelerator);
+	bool isReady(RayAccelerator* accelerator);
+	// Structure built by other code, e.g. candidate built by AutoAccelerator.
+	void markReady(RayAccelerator* accelerator);
+	// Do not build structure speculatively.
+	void drop(RayAccelerator* accelerator);
+
+private:
+	void run();
+	bool remove(RayAccelerator* accelerator);
+
+	const std::vector<Intersectable*>& geometry;
+	std::deque<std::pair<RayAccelerator*, std::string> > queue;
+	std::set<RayAccelerator*> ready;
+	std::map<RayAccelerator*, std::string> names;
+	RayAccelerator* building;
+	std::mutex mutex;
+	std::thread worker;
+	bool stopped;
+	bool running;			// Worker thread runs, it ends with empty queue.
+};
+
+#endif // _ACCELERATOR_BUILDER_H_
@@ -0,0 +1,130 @@
+/*
+	Name: acceleratorcache.cpp
+	Desc: Binary cache of built accelerated data structures and of loaded meshes.
+	Author: Karel Brezina (xbrezi13)
+*/
+
+#include "acceleratorcache.h"
+#include <fstream>
+#include <cstdio>
+
+#if defined(_WIN32) || defined (_WIN64)
+#include <windows.h>
+#endif // _WIN32, _WIN64
+
+// Sections are aligned to 8 bytes.
+static size_t alignSection(size_t size)
+{
+	return (size + 7) & ~(size_t)7;
+}
+
+static void hashBytes(unsigned long long& hash, const void* data, size_t size)
+{
+	const unsigned char* bytes = (const unsigned char*)data;
+	for (size_t i = 0; i < size; i++) {
+		hash ^= bytes[i];
+		hash *= 1099511628211ULL;
+	}
+}
+
+unsigned long long AcceleratorCache::hashData(const void* data, size_t size)
+{
+	unsigned long long hash = 14695981039346656037ULL;
+	hashBytes(hash, data, size);
+	return hash;
+}
+
+// Replace file by temporary one. Windows can not replace file which is
+// still mapped, then the old cache stays and is rebuilt next time.
+static bool replaceFile(const std::string& tmpFile, const std::string& file)
+{
+#if defined(_WIN32) || defined (_WIN64)
+	return MoveFileExA(tmpFile.c_str(), file.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else // _WIN32, _WIN64
+	return std::rename(tmpFile.c_str(), file.c_str()) == 0;
+#endif // _WIN32, _WIN64
+}
+
+bool AcceleratorCache::write(const std::string& file, unsigned int kind, unsigned long long key,
+	unsigned int objects, const std::vector<CacheSection>& sections)
+{
+	// Old cache may be mapped by this object.
+	close();
+
+	// Written to temporary file first, interrupted write does not leave broken cache.
+	std::string tmpFile = file + ".tmp";
+	std::ofstream out(tmpFile.c_str(), std::ios::binary | std::ios::trunc);
+	if (!out)
+		return false;
+
+	CacheHeader header;
+	header.magic = CACHE_MAGIC;
+	header.version = CACHE_VERSION;
+	header.kind = kind;
+	header.objects = objects;
+	header.key = key;
+	header.sections = sections.size();
+	header.reserved = 0;
+	out.write((const char*)&header, sizeof(header));
+
+	for (unsigned int i = 0; i < sections.size(); i++) {
+		unsigned long long sectionSize = sections[i].size;
+		out.write((const char*)&sectionSize, sizeof(sectionSize));
+	}
+
+	const char padding[8] = { 0 };
+	for (unsigned int i = 0; i < sections.size(); i++) {
+		if (sections[i].size)
+			out.write((const char*)sections[i].data, sections[i].size);
+		out.write(padding, alignSection(sections[i].size) - sections[i].size);
+	}
+
+	out.close();
+	if (!out || !replaceFile(tmpFile, file)) {
+		std::remove(tmpFile.c_str());
+		return false;
+	}
+	return true;
+}
+
+bool AcceleratorCache::open(const std::string& fileName, unsigned int kind, unsigned long long key, unsigned int objects)
+{
+	close();
+
+	if (!mapped.open(fileName) || mapped.getSize() < sizeof(CacheHeader)) {
+		close();
+		return false;
+	}
+	const unsigned char* data = mapped.getData();
+	size_t size = mapped.getSize();
+
+	const CacheHeader* header = (const CacheHeader*)data;
+	if (header->magic != CACHE_MAGIC || header->version != CACHE_VERSION || header->kind != kind
+		|| header->key != key || header->objects != objects) {
+		close();
+		return false;
+	}
+
+	// Table of section sizes and sections must fit in file.
+	size_t offset = sizeof(CacheHeader) + header->sections * sizeof(unsigned long long);
+	if (offset > size) {
+		close();
+		return false;
+	}
+	const unsigned long long* sizes = (const unsigned long long*)(data + sizeof(CacheHeader));
+	for (unsigned int i = 0; i < header->sections; i++) {
+		if (offset > size || sizes[i] > size - offset) {
+			close();
+			return false;
+		}
+		sections.push_back(CacheSection(data + offset, (size_t)sizes[i]));
+		offset += alignSection((size_t)sizes[i]);
+	}
+	return true;
+}
+
+void AcceleratorCache::close()
+{
+	sections.clear();
+	mapped.close();
+}
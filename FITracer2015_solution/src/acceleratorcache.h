@@ -0,0 +1,118 @@
+/*
+	Name: acceleratorcache.h
+	Desc: Binary cache of built accelerated data structures and of loaded meshes.
+	Author: Karel Brezina (xbrezi13)
+*/
+
+#ifndef _ACCELERATOR_CACHE_H_
+#define _ACCELERATOR_CACHE_H_
+
+#include "intersectable.h"
+#include "mappedfile.h"
+#include <vector>
+#include <string>
+#include <cstring>
+
+// "FITC" in file.
+#define CACHE_MAGIC 0x43544946
+// Increase when layout of any cached section changes.
+#define CACHE_VERSION 3
+
+// Kinds of cached structures.
+#define CACHE_OCTREE 1
+#define CACHE_BVH 2
+#define CACHE_KDTREE 3
+#define CACHE_MESH 4
+
+// Header of cache file. It is followed by sizes of all sections (64 bit)
+// and sections themselves, each aligned to 8 bytes.
+struct CacheHeader {
+	unsigned int magic;
+	unsigned int version;
+	unsigned int kind;
+	unsigned int objects;
+	unsigned long long key;		// Key of cached geometry, see Scene::getGeometryKey().
+	unsigned int sections;
+	unsigned int reserved;
+};
+
+// Raw data of one section.
+struct CacheSection {
+	const void* data;
+	size_t size;
+
+	CacheSection() { data = NULL; size = 0; }
+	CacheSection(const void* data_, size_t size_) { data = data_; size = size_; }
+};
+
+// Cache file is memory mapped on load, sections are read straight from
+// mapped pages. Cache is valid only for same kind, version and key of
+// geometry, otherwise structure is built again and cache is rewritten.
+// Key is given by caller, it is known before geometry is loaded.
+class AcceleratorCache {
+public:
+	~AcceleratorCache() { close(); }
+
+	// Hash of raw data (FNV-1a).
+	static unsigned long long hashData(const void* data, size_t size);
+
+	// Map file and check its header, return false if file is missing or invalid.
+	bool open(const std::string& file, unsigned int kind, unsigned long long key, unsigned int objects);
+	void close();
+	// Write header and sections to file, return false on error. Mapped file
+	// is closed first, so sections must not point to it.
+	bool write(const std::string& file, unsigned int kind, unsigned long long key,
+		unsigned int objects, const std::vector<CacheSection>& sections);
+
+	unsigned int getSectionsCnt() { return sections.size(); }
+	CacheSection getSection(unsigned int i) { return (i < sections.size()) ? sections[i] : CacheSection(); }
+	// Copy section to array, return false if its size does not fit type.
+	template <class T> bool getSection(unsigned int i, std::vector<T>& dst) {
+		CacheSection section = getSection(i);
+		if (section.data == NULL || section.size % sizeof(T) != 0)
+			return false;
+		dst.resize(section.size / sizeof(T));
+		if (!dst.empty())
+			memcpy(&dst[0], section.data, section.size);
+		return true;
+	}
+
+private:
+	MappedFile mapped;
+	std::vector<CacheSection> sections;
+};
+
+// Array of built structure. It takes array filled by build or it points
+// straight to section of mapped cache, which has to stay open while array is
+// used. Both are only read through it.
+template <class T> class CachedArray {
+public:
+	CachedArray() { mapped = NULL; mappedSize = 0; }
+
+	// Point to section, return false if its size does not fit type.
+	bool map(const CacheSection& section) {
+		if (section.data == NULL || section.size % sizeof(T) != 0)
+			return false;
+		built.clear();
+		mapped = (const T*)section.data;
+		mappedSize = section.size / sizeof(T);
+		return true;
+	}
+	bool isMapped() const { return mapped != NULL; }
+
+	void clear() { built.clear(); mapped = NULL; mappedSize = 0; }
+	// Take array filled by build.
+	void swap(std::vector<T>& v) { clear(); built.swap(v); }
+
+	size_t size() const { return mapped ? mappedSize : built.size(); }
+	bool empty() const { return size() == 0; }
+	const T* data() const { return mapped ? mapped : built.data(); }
+	const T& operator[](size_t i) const { return data()[i]; }
+
+private:
+	std::vector<T> built;
+	const T* mapped;
+	size_t mappedSize;
+};
+
+#endif // _ACCELERATOR_CACHE_H_
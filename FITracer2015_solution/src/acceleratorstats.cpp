@@ -0,0 +1,100 @@
+/*
+	Name: acceleratorstats.cpp
+	Desc: Statistics of accelerated data structures and of ray traversal.
+	Author: Karel Brezina (xbrezi13)
+*/
+
+#include "acceleratorstats.h"
+#include <fstream>
+#include <algorithm>
+
+void TraversalStats::reset()
+{
+	rays = 0;
+	nodes = 0;
+	primitives = 0;
+	maxNodes = 0;
+	maxPrimitives = 0;
+	for (int i = 0; i < TRAVERSAL_HISTOGRAM_BINS; i++) {
+		nodeHistogram[i] = 0;
+		primitiveHistogram[i] = 0;
+	}
+}
+
+void TraversalStats::add(const TraversalCounters& counters)
+{
+	rays++;
+	nodes += counters.nodes;
+	primitives += counters.primitives;
+	maxNodes = std::max(maxNodes, counters.nodes);
+	maxPrimitives = std::max(maxPrimitives, counters.primitives);
+	nodeHistogram[getBin(counters.nodes)]++;
+	primitiveHistogram[getBin(counters.primitives)]++;
+}
+
+// Number of significant bits, same as on OpenCL device.
+unsigned int TraversalStats::getBin(unsigned int value)
+{
+	unsigned int bin = 0;
+	while (value) {
+		value >>= 1;
+		bin++;
+	}
+	return std::min(bin, (unsigned int)TRAVERSAL_HISTOGRAM_BINS - 1);
+}
+
+static void writeHistogram(std::ofstream& out, const char* name, const unsigned int* histogram)
+{
+	out << "\t\t\"" << name << "\": [";
+	for (int i = 0; i < TRAVERSAL_HISTOGRAM_BINS; i++)
+		out << (i ? ", " : "") << histogram[i];
+	out << "]";
+}
+
+bool writeStatsJSON(const std::string& file, const std::string& renderer, const std::string& structure,
+	unsigned int samples, const AcceleratorStats& stats, const TraversalStats& traversal)
+{
+	std::ofstream out(file.c_str(), std::ios::trunc);
+	if (!out)
+		return false;
+
+	double rays = (double)std::max(traversal.rays, 1ULL);
+
+	out << "{" << std::endl;
+	out << "\t\"renderer\": \"" << renderer << "\"," << std::endl;
+	out << "\t\"structure\": \"" << structure << "\"," << std::endl;
+	out << "\t\"samples\": " << samples << "," << std::endl;
+	out << "\t\"build\": {" << std::endl;
+	out << "\t\t\"nodes\": " << stats.nodes << "," << std::endl;
+	out << "\t\t\"leaves\": " << stats.leaves << "," << std::endl;
+	out << "\t\t\"emptyLeaves\": " << stats.emptyLeaves << "," << std::endl;
+	out << "\t\t\"maxDepth\": " << stats.maxDepth << "," << std::endl;
+	out << "\t\t\"avgDepth\": " << stats.avgDepth << "," << std::endl;
+	out << "\t\t\"references\": " << stats.references << "," << std::endl;
+	out << "\t\t\"maxLeafObjects\": " << stats.maxLeafObjects << "," << std::endl;
+	out << "\t\t\"avgLeafObjects\": " << stats.avgLeafObjects << "," << std::endl;
+	out << "\t\t\"duplication\": " << stats.duplication << "," << std::endl;
+	out << "\t\t\"sahCost\": " << stats.cost << "," << std::endl;
+	out << "\t\t\"memory\": " << stats.memory << std::endl;
+	out << "\t}," << std::endl;
+	out << "\t\"traversal\": {" << std::endl;
+	out << "\t\t\"rays\": " << traversal.rays << "," << std::endl;
+	out << "\t\t\"nodes\": " << traversal.nodes << "," << std::endl;
+	out << "\t\t\"primitives\": " << traversal.primitives << "," << std::endl;
+	out << "\t\t\"avgNodes\": " << traversal.nodes / rays << "," << std::endl;
+	out << "\t\t\"avgPrimitives\": " << traversal.primitives / rays << "," << std::endl;
+	out << "\t\t\"maxNodes\": " << traversal.maxNodes << "," << std::endl;
+	out << "\t\t\"maxPrimitives\": " << traversal.maxPrimitives << "," << std::endl;
+	// Lower bounds of histogram bins.
+	out << "\t\t\"bins\": [0";
+	for (int i = 1; i < TRAVERSAL_HISTOGRAM_BINS; i++)
+		out << ", " << (1u << (i - 1));
+	out << "]," << std::endl;
+	writeHistogram(out, "nodeHistogram", traversal.nodeHistogram);
+	out << "," << std::endl;
+	writeHistogram(out, "primitiveHistogram", traversal.primitiveHistogram);
+	out << std::endl << "\t}" << std::endl;
+	out << "}" << std::endl;
+
+	return (bool)out;
+}
@@ -0,0 +1,67 @@
+/*
+	Name: acceleratorstats.h
+	Desc: Statistics of accelerated data structures and of ray traversal.
+	Author: Karel Brezina (xbrezi13)
+*/
+
+#ifndef _ACCELERATOR_STATS_H_
+#define _ACCELERATOR_STATS_H_
+
+#include <string>
+
+// Bins of histograms, bin 0 counts zero, bin i counts values <2^(i-1), 2^i),
+// last bin counts all bigger values. Same number is in kernel_types.h.
+#define TRAVERSAL_HISTOGRAM_BINS 16
+// Traversal cost drawn as red in heatmap mode. Same number is in kernel_types.h.
+#define HEATMAP_MAX_COST 256
+
+// Statistics of built structure.
+struct AcceleratorStats {
+	unsigned int nodes;			// All nodes including leafs.
+	unsigned int leaves;
+	unsigned int emptyLeaves;
+	unsigned int maxDepth;
+	float avgDepth;				// Average depth of leaf.
+	unsigned int references;	// Object references in leafs.
+	unsigned int maxLeafObjects;
+	float avgLeafObjects;		// Average objects in non empty leaf.
+	float duplication;			// References per object.
+	float cost;					// Expected cost of ray traversal (SAH).
+	size_t memory;				// Bytes of nodes and index arrays.
+
+	AcceleratorStats() {
+		nodes = leaves = emptyLeaves = maxDepth = references = maxLeafObjects = 0;
+		avgDepth = avgLeafObjects = duplication = cost = 0.0f;
+		memory = 0;
+	}
+};
+
+// Counters of one ray traversal.
+struct TraversalCounters {
+	unsigned int nodes;			// Visited nodes (cells of grid).
+	unsigned int primitives;	// Tested objects.
+
+	TraversalCounters() { nodes = 0; primitives = 0; }
+};
+
+// Sums, maximums and histograms of counters of many rays.
+struct TraversalStats {
+	unsigned long long rays;
+	unsigned long long nodes;
+	unsigned long long primitives;
+	unsigned int maxNodes;
+	unsigned int maxPrimitives;
+	unsigned int nodeHistogram[TRAVERSAL_HISTOGRAM_BINS];
+	unsigned int primitiveHistogram[TRAVERSAL_HISTOGRAM_BINS];
+
+	TraversalStats() { reset(); }
+	void reset();
+	void add(const TraversalCounters& counters);
+	static unsigned int getBin(unsigned int value);
+};
+
+// Write statistics of structure and traversal of rendered image to JSON file.
+bool writeStatsJSON(const std::string& file, const std::string& renderer, const std::string& structure,
+	unsigned int samples, const AcceleratorStats& stats, const TraversalStats& traversal);
+
+#endif // _ACCELERATOR_STATS_H_
@@ -0,0 +1,54 @@
+/*
+	Name: assetloader.cpp
+	Desc: Parallel loading of meshes and textures of scene.
+	Author: Karel Brezina (xbrezi13)
+*/
+
+#include "assetloader.h"
+#include "triangle.h"
+#include "image.h"
+
+static std::shared_ptr<Mesh> loadMeshFile(std::string filename)
+{
+	return std::make_shared<Mesh>(filename);
+}
+
+static std::shared_ptr<Texture> loadTextureFile(std::string filename)
+{
+	Image image;
+	image.load(filename);
+	return std::make_shared<Texture>(image);
+}
+
+MeshFuture AssetLoader::loadMesh(const std::string& filename)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	std::map<std::string, MeshFuture>::iterator it = meshes.find(filename);
+	if (it != meshes.end())
+		return it->second;
+	MeshFuture mesh;
+	mesh.future = std::async(std::launch::async, loadMeshFile, filename).share();
+	Mesh::getFileStamp(filename, mesh.stamp);
+	meshes[filename] = mesh;
+	return mesh;
+}
+
+TextureFuture AssetLoader::loadTexture(const std::string& filename)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	std::map<std::string, TextureFuture>::iterator it = textures.find(filename);
+	if (it != textures.end())
+		return it->second;
+	TextureFuture texture = std::async(std::launch::async, loadTextureFile, filename).share();
+	textures[filename] = texture;
+	return texture;
+}
+
+void AssetLoader::wait()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	for (std::map<std::string, MeshFuture>::iterator it = meshes.begin(); it != meshes.end(); it++)
+		it->second.wait();
+	for (std::map<std::string, TextureFuture>::iterator it = textures.begin(); it != textures.end(); it++)
+		it->second.wait();
+}
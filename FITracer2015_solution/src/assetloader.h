@@ -0,0 +1,39 @@
+/*
+	Name: assetloader.h
+	Desc: Parallel loading of meshes and textures of scene.
+	Author: Karel Brezina (xbrezi13)
+*/
+
+#ifndef _ASSET_LOADER_H_
+#define _ASSET_LOADER_H_
+
+#include "mesh.h"
+#include "texture.h"
+#include <map>
+#include <string>
+#include <mutex>
+
+typedef std::shared_future<std::shared_ptr<Texture> > TextureFuture;
+
+// Every file is loaded on its own thread as soon as it is requested, so
+// independent assets load in parallel. Same file is loaded only once and
+// all requests share its future, e.g. all walls of Cornell box share one
+// plane. Loading errors are thrown by get() of the future.
+class AssetLoader {
+public:
+	~AssetLoader() { wait(); }
+
+	// Mesh loaded by future is shared by Mesh(MeshFuture, Material*) nodes.
+	MeshFuture loadMesh(const std::string& filename);
+	TextureFuture loadTexture(const std::string& filename);
+
+	// Wait until all requested files are loaded.
+	void wait();
+
+private:
+	std::map<std::string, MeshFuture> meshes;
+	std::map<std::string, TextureFuture> textures;
+	std::mutex mutex;
+};
+
+#endif // _ASSET_LOADER_H_
@@ -0,0 +1,250 @@
+/*
+	Name: autoaccelerator.cpp
+	Desc: Accelerated data structure chosen by measured cost.
+	Author: Karel Brezina (xbrezi13)
+*/
+
+#include "autoaccelerator.h"
+#include "listaccelerator.h"
+#include "octreeaccelerator.h"
+#include "bvhaccelerator.h"
+#include "kdtreeaccelerator.h"
+#include "acceleratorbuilder.h"
+#include "intersection.h"
+#include "Timer.h"
+#include <algorithm>
+#include <random>
+#include <iostream>
+
+AutoAccelerator::AutoAccelerator()
+{
+	selected = NULL;
+	kind = AUTO_LIST;
+	probeRays = AUTO_PROBE_RAYS;
+	builder = NULL;
+	for (int i = 0; i < AUTO_KINDS; i++) {
+		shared[i] = NULL;
+		owned[i] = NULL;
+	}
+}
+
+AutoAccelerator::~AutoAccelerator()
+{
+	for (int i = 0; i < AUTO_KINDS; i++)
+		delete owned[i];
+}
+
+void AutoAccelerator::build(const std::vector<Intersectable*>& objects)
+{
+	selected = NULL;
+	for (int i = 0; i < AUTO_KINDS; i++) {
+		delete owned[i];
+		owned[i] = NULL;
+	}
+	collectStats(objects);
+
+	std::cout << "Auto accelerator: " << stats.objects << " objects, size " << stats.sizeMean
+		<< " (variance " << stats.sizeVariance << "), density variance " << stats.densityVariance
+		<< ", occupied " << stats.occupied * 100.0f << " %" << std::endl;
+
+	// Without probe rays the first candidate is used.
+	std::vector<int> kinds;
+	shortlist(kinds);
+	if (probeRays == 0 || objects.empty())
+		kinds.resize(1);
+
+	std::vector<Ray> rays;
+	if (kinds.size() > 1)
+		generateProbes(rays);
+
+	double bestTime = 0.0;
+	for (unsigned int i = 0; i < kinds.size(); i++) {
+		RayAccelerator* accelerator = getCandidate(kinds[i]);
+		CTimer timer;
+		bool reused = (builder && shared[kinds[i]] && builder->isReady(accelerator));
+		if (!reused) {
+			accelerator->build(objects);
+			if (builder && shared[kinds[i]])
+				builder->markReady(accelerator);
+		}
+		double buildTime = timer.f_Time();
+
+		timer.ResetTimer();
+		unsigned int hits = 0;
+		for (unsigned int r = 0; r < rays.size(); r++) {
+			Intersection is;
+			hits += accelerator->intersect(rays[r], is);
+		}
+		double traceTime = timer.f_Time();
+
+		std::cout << "  " << getKindName(kinds[i]) << ": ";
+		if (reused)
+			std::cout << "built before";
+		else
+			std::cout << "build " << buildTime << " s";
+		std::cout << ", " << rays.size() << " probes " << traceTime << " s (" << rays.size() / std::max(traceTime, 1e-9) / 1e6
+			<< " Mrays/s), hits " << hits << std::endl;
+
+		if (selected == NULL || traceTime < bestTime) {
+			selected = accelerator;
+			kind = kinds[i];
+			bestTime = traceTime;
+		}
+	}
+
+	// Only the fastest structure is kept, rejected ones are not built speculatively.
+	for (int i = 0; i < AUTO_KINDS; i++) {
+		if (i == kind)
+			continue;
+		delete owned[i];
+		owned[i] = NULL;
+		if (builder && shared[i])
+			builder->drop(shared[i]);
+	}
+
+	std::cout << "Auto accelerator: chosen " << getKindName(kind) << std::endl;
+}
+
+// Candidates by statistics, the most probable one first. List is worth only
+// for few objects, octree for evenly spread objects of similar size, kD-tree
+// and BVH adapt to any scene.
+void AutoAccelerator::shortlist(std::vector<int>& kinds)
+{
+	if (stats.objects <= AUTO_LIST_MAX_OBJECTS) {
+		kinds.push_back(AUTO_LIST);
+		kinds.push_back(AUTO_BVH);
+	}
+	else if (stats.densityVariance <= AUTO_OCTREE_MAX_VARIANCE && stats.sizeVariance <= AUTO_OCTREE_MAX_VARIANCE) {
+		kinds.push_back(AUTO_OCTREE);
+		kinds.push_back(AUTO_KDTREE);
+	}
+	else {
+		kinds.push_back(AUTO_KDTREE);
+		kinds.push_back(AUTO_BVH);
+	}
+}
+
+const char* AutoAccelerator::getKindName(int kind)
+{
+	switch (kind) {
+	case AUTO_LIST: return "List";
+	case AUTO_OCTREE: return "Octree";
+	case AUTO_BVH: return "BVH";
+	case AUTO_KDTREE: return "kD-tree";
+	}
+	return "Unknown";
+}
+
+RayAccelerator* AutoAccelerator::createEmpty() const
+{
+	AutoAccelerator* accelerator = new AutoAccelerator();
+	accelerator->setProbeRays(probeRays);
+	return accelerator;
+}
+
+RayAccelerator* AutoAccelerator::createAccelerator(int kind)
+{
+	switch (kind) {
+	case AUTO_LIST: return new ListAccelerator();
+	case AUTO_OCTREE: return new OctreeAccelerator();
+	case AUTO_KDTREE: return new KdTreeAccelerator();
+	}
+	return new BVHAccelerator();
+}
+
+// Shared candidate of kind, otherwise owned one created on first use.
+RayAccelerator* AutoAccelerator::getCandidate(int kind)
+{
+	if (shared[kind])
+		return shared[kind];
+	if (owned[kind] == NULL)
+		owned[kind] = createAccelerator(kind);
+	return owned[kind];
+}
+
+// Size of objects relative to scene and variance of their density in coarse grid.
+void AutoAccelerator::collectStats(const std::vector<Intersectable*>& objects)
+{
+	box = AABB();
+	for (unsigned int i = 0; i < objects.size(); i++) {
+		AABB aabb;
+		objects[i]->getAABB(aabb);
+		box.include(aabb);
+	}
+
+	stats.objects = objects.size();
+	stats.sizeMean = 0.0f;
+	stats.sizeVariance = 0.0f;
+	stats.densityVariance = 0.0f;
+	stats.occupied = 0.0f;
+	if (objects.empty())
+		return;
+
+	Point3D extent = box.mMax - box.mMin;
+	float diagonal = std::sqrt(extent.x * extent.x + extent.y * extent.y + extent.z * extent.z);
+	if (diagonal <= 0.0f)
+		diagonal = 1.0f;
+
+	const int cells = AUTO_DENSITY_GRID * AUTO_DENSITY_GRID * AUTO_DENSITY_GRID;
+	std::vector<unsigned int> density(cells, 0);
+	double sum = 0.0, sum2 = 0.0;
+
+	for (unsigned int i = 0; i < objects.size(); i++) {
+		AABB aabb;
+		objects[i]->getAABB(aabb);
+		Point3D size = aabb.mMax - aabb.mMin;
+		double d = std::sqrt(size.x * size.x + size.y * size.y + size.z * size.z) / diagonal;
+		sum += d;
+		sum2 += d * d;
+
+		// Cell of object centre.
+		int cell[3];
+		for (int axis = 0; axis < 3; axis++) {
+			float centre = 0.5f * (aabb.mMin(axis) + aabb.mMax(axis));
+			float rel = (extent(axis) > 0.0f) ? (centre - box.mMin(axis)) / extent(axis) : 0.0f;
+			cell[axis] = std::min(std::max((int)(rel * AUTO_DENSITY_GRID), 0), AUTO_DENSITY_GRID - 1);
+		}
+		density[(cell[0] * AUTO_DENSITY_GRID + cell[1]) * AUTO_DENSITY_GRID + cell[2]]++;
+	}
+
+	double mean = sum / objects.size();
+	stats.sizeMean = (float)mean;
+	stats.sizeVariance = (mean > 0.0) ? (float)(std::sqrt(std::max(sum2 / objects.size() - mean * mean, 0.0)) / mean) : 0.0f;
+
+	// Only occupied cells, empty space is skipped by every structure.
+	unsigned int occupied = 0;
+	sum = 0.0; sum2 = 0.0;
+	for (int i = 0; i < cells; i++) {
+		if (density[i] == 0)
+			continue;
+		occupied++;
+		sum += density[i];
+		sum2 += (double)density[i] * density[i];
+	}
+	mean = sum / occupied;
+	stats.densityVariance = (float)(std::sqrt(std::max(sum2 / occupied - mean * mean, 0.0)) / mean);
+	stats.occupied = (float)occupied / cells;
+}
+
+// Rays from sphere around scene to random points inside scene box,
+// same for all candidates (fixed seed).
+void AutoAccelerator::generateProbes(std::vector<Ray>& rays)
+{
+	std::mt19937 generator(1234);
+	std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+
+	Point3D extent = box.mMax - box.mMin;
+	Point3D centre = box.mMin + Point3D(0.5f * extent.x, 0.5f * extent.y, 0.5f * extent.z);
+	float radius = std::sqrt(extent.x * extent.x + extent.y * extent.y + extent.z * extent.z);
+
+	rays.reserve(probeRays);
+	for (unsigned int i = 0; i < probeRays; i++) {
+		float z = 2.0f * uniform(generator) - 1.0f;
+		float phi = 2.0f * 3.14159265f * uniform(generator);
+		float r = std::sqrt(std::max(1.0f - z * z, 0.0f));
+		Point3D orig = centre + Point3D(radius * r * std::cos(phi), radius * r * std::sin(phi), radius * z);
+		Point3D target = box.mMin + Point3D(extent.x * uniform(generator), extent.y * uniform(generator), extent.z * uniform(generator));
+		Point3D dir = target - orig;
+		rays.push_back(Ray(orig, Vector3D(dir.x, dir.y, dir.z), 0.001f, INF));
+	}
+}
@@ -0,0 +1,95 @@
+/*
+	Name: autoaccelerator.h
+	Desc: Accelerated data structure chosen by measured cost.
+	Author: Karel Brezina (xbrezi13)
+*/
+
+#ifndef _AUTO_ACCELERATOR_H_
+#define _AUTO_ACCELERATOR_H_
+
+#include "rayaccelerator.h"
+#include "aabb.h"
+
+// Kinds of accelerated data structures.
+#define AUTO_LIST 0
+#define AUTO_OCTREE 1
+#define AUTO_BVH 2
+#define AUTO_KDTREE 3
+#define AUTO_KINDS 4
+
+// Number of probe rays traced by every candidate (0 builds only the first one).
+#define AUTO_PROBE_RAYS 4096
+// List is candidate only for scenes with few objects.
+#define AUTO_LIST_MAX_OBJECTS 16
+// Resolution of grid used for measure density of objects.
+#define AUTO_DENSITY_GRID 8
+// Octree is shortlisted for evenly spread objects of similar size (coefficient
+// of variation of objects per occupied cell and of object sizes).
+#define AUTO_OCTREE_MAX_VARIANCE 1.0f
+
+// Statistics of scene used for choose candidates.
+struct AutoStats {
+	unsigned int objects;
+	float sizeMean;			// Mean diagonal of object bounds relative to scene diagonal.
+	float sizeVariance;		// Coefficient of variation of object diagonals.
+	float densityVariance;	// Coefficient of variation of objects per occupied cell.
+	float occupied;			// Fraction of occupied cells.
+};
+
+class AcceleratorBuilder;
+
+// Accelerator which shortlists one or two candidates by statistics of scene,
+// traces same probe rays by them and keeps only the fastest one. Candidates
+// can be shared with other users by setCandidate(), e.g. structures selectable
+// in UI. With builder set, shared candidates built by it are only measured,
+// the ones built here are marked ready and rejected ones are dropped from its
+// queue. Other candidates are owned, rejected ones are deleted. Uniform grid
+// is not candidate, its traversal starts in cell of ray origin and its build
+// expects layout of Cornell box.
+class AutoAccelerator : public RayAccelerator {
+public:
+	AutoAccelerator();
+	~AutoAccelerator();
+
+	// Set number of probe rays, call before build.
+	void setProbeRays(unsigned int rays) { probeRays = rays; }
+	// Use structure of other owner as candidate, call before build.
+	void setCandidate(int kind, RayAccelerator* accelerator) { shared[kind] = accelerator; }
+	void setBuilder(AcceleratorBuilder* builder) { this->builder = builder; }
+
+	int getKind() { return kind; }
+	RayAccelerator* getSelected() { return selected; }
+	AutoStats getSceneStats() { return stats; }
+	static const char* getKindName(int kind);
+
+	virtual void build(const std::vector<Intersectable*>& objects);
+	// Nothing is selected before build.
+	virtual bool intersect(const Ray& ray, TraversalCounters* counters = NULL) {
+		return selected ? selected->intersect(ray, counters) : false;
+	}
+	virtual bool intersect(const Ray& ray, Intersection& is, TraversalCounters* counters = NULL) {
+		return selected ? selected->intersect(ray, is, counters) : false;
+	}
+	virtual std::vector<Intersectable*> getObjects() { return selected ? selected->getObjects() : std::vector<Intersectable*>(); }
+	virtual AcceleratorStats getStats() { return selected ? selected->getStats() : AcceleratorStats(); }
+	// Selection runs again over geometry of new structure.
+	virtual RayAccelerator* createEmpty() const;
+
+private:
+	void collectStats(const std::vector<Intersectable*>& objects);
+	void shortlist(std::vector<int>& kinds);
+	void generateProbes(std::vector<Ray>& rays);
+	RayAccelerator* createAccelerator(int kind);
+	RayAccelerator* getCandidate(int kind);
+
+	AABB box;
+	AutoStats stats;
+	RayAccelerator* selected;
+	RayAccelerator* shared[AUTO_KINDS];
+	RayAccelerator* owned[AUTO_KINDS];
+	AcceleratorBuilder* builder;
+	int kind;
+	unsigned int probeRays;
+};
+
+#endif // _AUTO_ACCELERATOR_H_
@@ -5,13 +5,27 @@
 */
 
 #include "bvhaccelerator.h"
+#include "acceleratorcache.h"
+#include "triangle.h"
 #include <algorithm>
 #include <iomanip>
+#include <iostream>
+#include <unordered_map>
 
 void BVHAccelerator::build(const std::vector<Intersectable*>& objects) {
 
 	c_objects = objects;
-	nodes.reserve(2 * objects.size() - 1);
+	nodes.clear();
+	cache.close();
+
+	if (!cacheFile.empty() && loadCache(objects)) {
+		buildBatches(NULL);
+		return;
+	}
+
+	// Reserved for all nodes, so pointers to them stay valid during build.
+	std::vector<BVHNode> built;
+	built.reserve(2 * objects.size() - 1);
 	BVHNode root;
 	AABB& worldBox = root.getAABB();
 
@@ -20,12 +34,52 @@ void BVHAccelerator::build(const std::vector<Intersectable*>& objects) {
 		obj->getAABB(aabb);
 		worldBox.include(aabb);
 	});
-	nodes.push_back(root);
-	build_recursive(0, c_objects.size(), &nodes[0], 0);
+	built.push_back(root);
+	build_recursive(built, 0, c_objects.size(), &built[0], 0);
+	buildBatches(&built);
+	nodes.swap(built);
+
+	if (!cacheFile.empty())
+		saveCache(objects);
+}
 
+// Sections are nodes with batch ranges and order of objects (build sorts
+// them). Nodes are not copied, they point to mapped cache until next build.
+bool BVHAccelerator::loadCache(const std::vector<Intersectable*>& objects)
+{
+	std::vector<unsigned int> order;
+	bool valid = cache.open(cacheFile, CACHE_BVH, cacheKey, objects.size()) && cache.getSectionsCnt() == 2
+		&& nodes.map(cache.getSection(0)) && cache.getSection(1, order) && order.size() == objects.size();
+	for (unsigned int i = 0; valid && i < order.size(); i++)
+		valid = order[i] < objects.size();
+	if (!valid) {
+		nodes.clear();
+		cache.close();
+		return false;
+	}
+
+	for (unsigned int i = 0; i < order.size(); i++)
+		c_objects[i] = objects[order[i]];
+	return true;
 }
 
-void BVHAccelerator::build_recursive(int left_index, int right_index, BVHNode *node, int depth) {
+void BVHAccelerator::saveCache(const std::vector<Intersectable*>& objects)
+{
+	std::unordered_map<Intersectable*, unsigned int> original;
+	for (unsigned int i = 0; i < objects.size(); i++)
+		original[objects[i]] = i;
+	std::vector<unsigned int> order(c_objects.size());
+	for (unsigned int i = 0; i < c_objects.size(); i++)
+		order[i] = original[c_objects[i]];
+
+	std::vector<CacheSection> sections;
+	sections.push_back(CacheSection(nodes.data(), nodes.size() * sizeof(BVHNode)));
+	sections.push_back(CacheSection(order.data(), order.size() * sizeof(unsigned int)));
+	if (!cache.write(cacheFile, CACHE_BVH, cacheKey, objects.size(), sections))
+		std::cout << "BVH cache " << cacheFile << " can not be written." << std::endl;
+}
+
+void BVHAccelerator::build_recursive(std::vector<BVHNode>& built, int left_index, int right_index, BVHNode *node, int depth) {
 	static int MAX_NUM_PRIMITIVES_IN_LEAF = 4;
 	static int MAX_DEPTH = 20;
 
@@ -75,40 +129,121 @@ void BVHAccelerator::build_recursive(int left_index, int right_index, BVHNode *n
 			obj->getAABB(aabb);
 			right_box.include(aabb);
 		});
-		int n_nodes = nodes.size();
-		nodes.push_back(left_node);
-		nodes.push_back(right_node);
+		int n_nodes = built.size();
+		built.push_back(left_node);
+		built.push_back(right_node);
 
 		// Initiate current node as interior node
 		node->makeNode(n_nodes, right_index - left_index);
 
 		// Recurse
-		build_recursive(left_index, split_index, &nodes[n_nodes], depth + 1);
-		build_recursive(split_index, right_index, &nodes[n_nodes + 1], depth + 1);
+		build_recursive(built, left_index, split_index, &built[n_nodes], depth + 1);
+		build_recursive(built, split_index, right_index, &built[n_nodes + 1], depth + 1);
+	}
+}
+
+// Triangles of every leaf are moved before other objects and packed
+// to batches, which are tested by one SSE watertight test. Batch ranges are
+// stored to built nodes. Cached order is already partitioned and cached
+// nodes already have their batch ranges, then built is NULL.
+void BVHAccelerator::buildBatches(std::vector<BVHNode>* built)
+{
+	batches.clear();
+	unsigned int count = built ? built->size() : nodes.size();
+	for (unsigned int n = 0; n < count; n++) {
+		const BVHNode& node = built ? (*built)[n] : nodes[n];
+		if (!node.isLeaf())
+			continue;
+		std::vector<Intersectable*>::iterator first = c_objects.begin() + node.getIndex();
+		std::vector<Intersectable*>::iterator last = first + node.getNObjs();
+		std::vector<Intersectable*>::iterator spheres = std::stable_partition(first, last, [](Intersectable* obj) {
+			return !obj->isSphere();
+		});
+
+		unsigned int batch = batches.size();
+		for (std::vector<Intersectable*>::iterator it = first; it != spheres; ++it) {
+			if (batches.size() == batch || !batches.back().add((Triangle*)*it)) {
+				batches.push_back(TriangleBatch());
+				batches.back().add((Triangle*)*it);
+			}
+		}
+		if (built)
+			(*built)[n].setBatches(batch, batches.size() - batch, spheres - first);
 	}
 }
 
-bool BVHAccelerator::intersect(const Ray& ray)
+AcceleratorStats BVHAccelerator::getStats()
+{
+	AcceleratorStats stats;
+	stats.nodes = nodes.size();
+	stats.memory = nodes.size() * sizeof(BVHNode) + c_objects.size() * sizeof(Intersectable*)
+		+ batches.size() * sizeof(TriangleBatch);
+	stats.cost = nodes.empty() ? 0.0f : collectStats(stats, 0, 0);
+
+	unsigned int filled = stats.leaves - stats.emptyLeaves;
+	stats.avgDepth = stats.leaves ? stats.avgDepth / stats.leaves : 0.0f;
+	stats.avgLeafObjects = filled ? (float)stats.references / filled : 0.0f;
+	stats.duplication = c_objects.empty() ? 0.0f : (float)stats.references / c_objects.size();
+	return stats;
+}
+
+// Walks the hierarchy, fills counters and returns SAH cost of subtree
+// relative to its box. Sum of leaf depths is stored in avgDepth.
+float BVHAccelerator::collectStats(AcceleratorStats& stats, unsigned int node, unsigned int depth)
 {
-	BVHNode* currentNode = &nodes[0];
-	AABB& box = currentNode->getAABB();
+	const BVHNode& n = nodes[node];
+	stats.maxDepth = std::max(stats.maxDepth, depth);
+
+	if (n.isLeaf()) {
+		stats.leaves++;
+		stats.avgDepth += depth;
+		stats.references += n.getNObjs();
+		if (n.getNObjs() == 0)
+			stats.emptyLeaves++;
+		stats.maxLeafObjects = std::max(stats.maxLeafObjects, n.getNObjs());
+		return BVH_COST_INTERSECT * n.getNObjs();
+	}
+
+	float area = n.getAABB().getArea();
+	float invArea = (area > 0.0f) ? 1.0f / area : 0.0f;
+	float cost = BVH_COST_TRAVERSAL;
+	for (unsigned int i = 0; i < 2; i++) {
+		unsigned int child = n.getIndex() + i;
+		cost += nodes[child].getAABB().getArea() * invArea * collectStats(stats, child, depth + 1);
+	}
+	return cost;
+}
+
+bool BVHAccelerator::intersect(const Ray& ray, TraversalCounters* counters)
+{
+	const BVHNode* currentNode = &nodes[0];
+	const AABB& box = currentNode->getAABB();
 	float minT, maxT;
 	if (!box.intersect(ray, minT, maxT))
 		return false;
 	std::stack<BVHNode> intersect_stack;
+	WatertightRay wray(ray);
 	while (true) {
+		countNode(counters);
 		if (currentNode->isLeaf()) {
-			for (unsigned int i = currentNode->getIndex(); i < currentNode->getIndex() + currentNode->getNObjs(); ++i) {
+			for (unsigned int b = currentNode->getBatch(); b < currentNode->getBatch() + currentNode->getNBatches(); ++b) {
+				countPrimitives(counters, batches[b].getSize());
+				if (batches[b].intersect(wray, ray)) {
+					return true;
+				}
+			}
+			for (unsigned int i = currentNode->getIndex() + currentNode->getNTriangles(); i < currentNode->getIndex() + currentNode->getNObjs(); ++i) {
+				countPrimitive(counters);
 				if (c_objects[i]->intersect(ray)) {
 					return true;
 				}
 			}
 		}
 		else {
-			BVHNode& left_node = nodes[currentNode->getIndex()];
-			BVHNode& right_node = nodes[currentNode->getIndex() + 1];
-			AABB& left_box = left_node.getAABB();
-			AABB& right_box = right_node.getAABB();
+			const BVHNode& left_node = nodes[currentNode->getIndex()];
+			const BVHNode& right_node = nodes[currentNode->getIndex() + 1];
+			const AABB& left_box = left_node.getAABB();
+			const AABB& right_box = right_node.getAABB();
 
 			bool leftHit, rightHit;
 			leftHit = left_box.intersect(ray, minT, maxT);
@@ -134,19 +269,32 @@ bool BVHAccelerator::intersect(const Ray& ray)
 	}
 }
 
-bool BVHAccelerator::intersect(const Ray& ray, Intersection& is)
+bool BVHAccelerator::intersect(const Ray& ray, Intersection& is, TraversalCounters* counters)
 {
-	BVHNode* currentNode = &nodes[0];
-	AABB& box = currentNode->getAABB();
+	const BVHNode* currentNode = &nodes[0];
+	const AABB& box = currentNode->getAABB();
 	float minT, maxT;
 	if (!box.intersect(ray, minT, maxT))
 		return false;
 	bool hit = false;
 	Ray localRay = ray;
-	std::stack<std::pair<float, BVHNode*>> intersect_stack;
+	std::stack<std::pair<float, const BVHNode*>> intersect_stack;
+	WatertightRay wray(ray);
 	for (;;) {
+		countNode(counters);
 		if (currentNode->isLeaf()) {
-			for (unsigned int i = currentNode->getIndex(); i < currentNode->getIndex() + currentNode->getNObjs(); ++i) {
+			for (unsigned int b = currentNode->getBatch(); b < currentNode->getBatch() + currentNode->getNBatches(); ++b) {
+				countPrimitives(counters, batches[b].getSize());
+				float t, u, v, w;
+				int lane = batches[b].intersect(wray, localRay, t, u, v, w);
+				if (lane >= 0) {
+					batches[b].getTriangle(lane)->setHit(localRay, t, u, v, w, is);
+					localRay.maxT = t;
+					hit = true;
+				}
+			}
+			for (unsigned int i = currentNode->getIndex() + currentNode->getNTriangles(); i < currentNode->getIndex() + currentNode->getNObjs(); ++i) {
+				countPrimitive(counters);
 				if (c_objects[i]->intersect(localRay, is)) {
 					localRay.maxT = is.mHitTime;
 					hit = true;
@@ -154,10 +302,10 @@ bool BVHAccelerator::intersect(const Ray& ray, Intersection& is)
 			}
 		}
 		else {
-			BVHNode& left_node = nodes[currentNode->getIndex()];
-			BVHNode& right_node = nodes[currentNode->getIndex() + 1];
-			AABB& left_box = left_node.getAABB();
-			AABB& right_box = right_node.getAABB();
+			const BVHNode& left_node = nodes[currentNode->getIndex()];
+			const BVHNode& right_node = nodes[currentNode->getIndex() + 1];
+			const AABB& left_box = left_node.getAABB();
+			const AABB& right_box = right_node.getAABB();
 
 			bool leftHit, rightHit;
 			float leftT, rightT;
@@ -187,7 +335,7 @@ bool BVHAccelerator::intersect(const Ray& ray, Intersection& is)
 		}
 
 		currentNode = 0;
-		std::pair<float, BVHNode*> p;
+		std::pair<float, const BVHNode*> p;
 		while (!intersect_stack.empty()) {
 			p = intersect_stack.top();
 			intersect_stack.pop();
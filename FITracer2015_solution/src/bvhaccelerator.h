@@ -8,17 +8,28 @@
 #define BVHACCELERATOR_H
 
 #include "rayaccelerator.h"
+#include "trianglebatch.h"
+#include "acceleratorcache.h"
 #include <stack>
+#include <string>
+
+// Costs used by SAH statistics.
+#define BVH_COST_TRAVERSAL 1.0f
+#define BVH_COST_INTERSECT 1.0f
 
 class BVHAccelerator : public RayAccelerator
 {
 private:
+	// Node has no pointers, so it is stored in cache as it is.
 	class BVHNode {
 	private:
 		AABB bbox;
 		bool leaf;
 		unsigned int n_objs;
 		unsigned int index;
+		unsigned int batch;			// First batch of triangles of leaf.
+		unsigned int n_batches;
+		unsigned int n_triangles;	// Triangles are first objects of leaf.
 
 	public:
 		void setAABB(AABB &bbox_) { bbox = bbox_; }
@@ -33,25 +44,51 @@ private:
 			n_objs = n_objs_;
 		}
 
-		bool isLeaf() { return leaf; }
-		unsigned int getIndex() { return index; }
-		unsigned int getNObjs() { return n_objs; }
+		void setBatches(unsigned int batch_, unsigned int n_batches_, unsigned int n_triangles_) {
+			batch = batch_;
+			n_batches = n_batches_;
+			n_triangles = n_triangles_;
+		}
+
+		bool isLeaf() const { return leaf; }
+		unsigned int getIndex() const { return index; }
+		unsigned int getNObjs() const { return n_objs; }
+		unsigned int getBatch() const { return batch; }
+		unsigned int getNBatches() const { return n_batches; }
+		unsigned int getNTriangles() const { return n_triangles; }
 		AABB& getAABB() { return bbox; }
+		const AABB& getAABB() const { return bbox; }
 	};
 
 	std::vector<Intersectable*> c_objects;
-	std::vector<BVHNode> nodes;
-	void build_recursive(int left_index, int right_index, BVHNode *node, int depth);
+	CachedArray<BVHNode> nodes;			// Built or in mapped cache.
+	std::vector<TriangleBatch> batches;
+	AcceleratorCache cache;
+	std::string cacheFile;
+	unsigned long long cacheKey;
+	void build_recursive(std::vector<BVHNode>& built, int left_index, int right_index, BVHNode *node, int depth);
+	void buildBatches(std::vector<BVHNode>* built);
+	bool loadCache(const std::vector<Intersectable*>& objects);
+	float collectStats(AcceleratorStats& stats, unsigned int node, unsigned int depth);
+	void saveCache(const std::vector<Intersectable*>& objects);
 
 public:
+	BVHAccelerator() { cacheKey = 0; }
+
+	// Load built hierarchy from file instead of build if it was built for the same key of
+	// geometry, see Scene::getGeometryKey(), write it there after build.
+	void setCacheFile(const std::string& file, unsigned long long key) { cacheFile = file; cacheKey = key; }
+
 	virtual void build(const std::vector<Intersectable*>& objects);
-	virtual bool intersect(const Ray& ray);
-	virtual bool intersect(const Ray& ray, Intersection& is);
+	virtual bool intersect(const Ray& ray, TraversalCounters* counters = NULL);
+	virtual bool intersect(const Ray& ray, Intersection& is, TraversalCounters* counters = NULL);
 
 	virtual std::vector<Intersectable*> getObjects() { return c_objects; }
+	virtual AcceleratorStats getStats();
+	virtual RayAccelerator* createEmpty() const { return new BVHAccelerator(); }
 	void getNodes(TBVHNode& node, unsigned int index, unsigned int& leftID, unsigned int& rightID) { 
 		if (index < nodes.size()) {
-			AABB box = nodes[index].getAABB();
+			const AABB& box = nodes[index].getAABB();
 			Point3DtoFloat3(box.mMin, node.boxMin);
 			Point3DtoFloat3(box.mMax, node.boxMax);
 			node.leaf = nodes[index].isLeaf();
@@ -23,29 +23,33 @@ void buildCornellScene(Scene* scene)
 	Diffuse* greenX = new Diffuse(Color(0.2f, 0.4f, 0.3f), 0.5f, 0.0f);
 	Diffuse* whiteDiff = new Diffuse(Color(1.f, 1.f, 1.f));
 
-	Mesh* ground = new Mesh("data/plane.obj", white);
+	// Start loading of all meshes, walls share one plane.
+	MeshFuture plane = scene->getLoader().loadMesh("data/plane.obj");
+	MeshFuture f16 = scene->getLoader().loadMesh("data/f-16.obj");
+
+	Mesh* ground = new Mesh(plane, white);
 	ground->setScale(150.0f);
 	index = ground->setIndexes(index);
 
-	Mesh* side1 = new Mesh("data/plane.obj", red); // left wall
+	Mesh* side1 = new Mesh(plane, red); // left wall
 	side1->setScale(150.0f);
 	side1->setRotation(180.0f, 0.0f, 90.0f);
 	side1->setTranslation(-60, 60, 0.0f);
 	index = side1->setIndexes(index);
 
-	Mesh* side2 = new Mesh("data/plane.obj", blue); // right wall
+	Mesh* side2 = new Mesh(plane, blue); // right wall
 	side2->setScale(150.0f);
 	side2->setRotation(0.0f, 0.0f, 90.0f);
 	side2->setTranslation(60, 60, 0.0f);
 	index = side2->setIndexes(index);
 
-	Mesh* side3 = new Mesh("data/plane.obj", white); // far wall
+	Mesh* side3 = new Mesh(plane, white); // far wall
 	side3->setScale(150.0f);
 	side3->setRotation(90.0f, 0.0f, 0.0f);
 	side3->setTranslation(0.0f, 60, -60);
 	index = side3->setIndexes(index);
 
-	Mesh* roof = new Mesh("data/plane.obj", white);
+	Mesh* roof = new Mesh(plane, white);
 	roof->setScale(150.0f);
 	roof->setRotation(180.0f, 0.0f, 0.0f);
 	roof->setTranslation(0.0f, 120, 0.0f);
@@ -86,7 +90,7 @@ void buildCornellScene(Scene* scene)
 
 	scene->add(ball6); // index 11
 
-	Mesh* elephant = new Mesh("data/f-16.obj", white);
+	Mesh* elephant = new Mesh(f16, white);
 	elephant->setScale(45.0f);
 	elephant->setRotation(20.0f, 15.0f, 20.0f);
 	elephant->setTranslation(0.0f, 50.0f, 30.f);
@@ -10,6 +10,8 @@ GPUPathtracer::GPUPathtracer()
 	kernelOctree = NULL;
 	kernelUniGrid = NULL;
 	kernelBVH = NULL;
+	kernelKdTree = NULL;
+	actualKernelType = AS_LIST;
 	cl_device_cnt = MAX_DEVICES;
 }
 
@@ -150,6 +152,7 @@ void GPUPathtracer::loadGPUprogram(cl_program* program)
 //
 void GPUPathtracer::changeKernel(unsigned int kernel_type)
 {
+	actualKernelType = kernel_type;
 	switch (kernel_type) {
 	case AS_LIST:
 		actualKernel = kernelList;
@@ -175,6 +178,12 @@ void GPUPathtracer::changeKernel(unsigned int kernel_type)
 	case AS_BVH_FIRST:
 		actualKernel = kernelBVHFirst;
 		break;
+	case AS_KDTREE:
+		actualKernel = kernelKdTree;
+		break;
+	case AS_KDTREE_FIRST:
+		actualKernel = kernelKdTreeFirst;
+		break;
 	}
 }
 
@@ -230,8 +239,13 @@ int GPUPathtracer::createGPUprogram(cl_program* program, char* file_name)
 	}
 
 	// Build OpenCL program.
+#if MESH_COMPACT
+	const char* options = "-I ./kernels/ -D MESH_COMPACT";
+#else
+	const char* options = "-I ./kernels/";
+#endif // MESH_COMPACT
 	n_result = clBuildProgram(*program, 1,
-	&h_device, "-I ./kernels/", 0, 0); // #define the UNUSED decorator
+	&h_device, options, 0, 0); // #define the UNUSED decorator
 	if (n_result != CL_SUCCESS) {
 		fprintf(stderr, "OpenCL error: clBuildProgram() failed\n");
 		delete[] p_s_program;
@@ -327,6 +341,12 @@ int GPUPathtracer::loadGPUkernel(unsigned int kernel_type, char* kernel_name)
 	case AS_BVH_FIRST:
 		kernelBVHFirst = kernel;
 		return 0;
+	case AS_KDTREE:
+		kernelKdTree = kernel;
+		return 0;
+	case AS_KDTREE_FIRST:
+		kernelKdTreeFirst = kernel;
+		return 0;
 	}
 
 	fprintf(stderr, "loadGPUkernel error: Cannot load kernel. Wrong type of accelerate data structure?\n");
@@ -534,6 +554,8 @@ int GPUPathtracer::writeGPUdata(cl_mem* buffer, size_t offset, size_t size, void
 // Write spheres, triangles, meshes to GPU buffers.
 // sp -> list of spheres
 // pt_sphere -> buffer for spheres
+// spd -> list of transforms and materials of spheres
+// pt_sphereData -> buffer for transforms and materials of spheres
 // tr -> list of triangles
 // pt_triangle -> buffer for triangles
 // me -> list of meshes
@@ -544,6 +566,7 @@ int GPUPathtracer::writeGPUdata(cl_mem* buffer, size_t offset, size_t size, void
 // @return -> return error code
 int GPUPathtracer::writeGPUobjects(
 	std::vector<TSphere>& sp, cl_mem& pt_sphere,
+	std::vector<TSphereData>& spd, cl_mem& pt_sphereData,
 	std::vector<TTriangle>& tr, cl_mem& pt_triangle, 
 	std::vector<TMesh>& me, cl_mem& pt_meshes,
 	std::vector<unsigned int>& ra_me, cl_mem& pt_range_meshes, 
@@ -560,6 +583,13 @@ int GPUPathtracer::writeGPUobjects(
 		return -1;
 	}
 
+	pt_sphereData = clCreateBuffer(h_context,
+		flag, spd.size() * sizeof(TSphereData), 0, &n_result);
+	if (n_result != CL_SUCCESS) {
+		fprintf(stderr, "OpenCL error: clCreateBuffer() cannot create buffer.\n");
+		return -1;
+	}
+
 	pt_triangle = clCreateBuffer(h_context,
 		flag, tr.size() * sizeof(TTriangle), 0, &n_result);
 	if (n_result != CL_SUCCESS) {
@@ -582,7 +612,7 @@ int GPUPathtracer::writeGPUobjects(
 	}
 
 	// Sizes of kernel structures.
-	size_t size_sp = sizeof(TSphere), size_tr = sizeof(TTriangle);
+	size_t size_sp = sizeof(TSphere), size_spd = sizeof(TSphereData), size_tr = sizeof(TTriangle);
 	size_t size_me = sizeof(TMesh), size_ra_me = sizeof(unsigned int);
 
 	// Write all spheres to buffer.
@@ -595,6 +625,14 @@ int GPUPathtracer::writeGPUobjects(
 			fprintf(stderr, "OpenCL error: cannot read data from clEnqueueReadBuffer.\n");
 			return -2;
 		}
+
+		n_result = clEnqueueWriteBuffer(h_cmd_queue, pt_sphereData,
+			true, size_spd * i, size_spd, &(spd[i]), 0, 0, 0);
+
+		if (n_result != CL_SUCCESS) {
+			fprintf(stderr, "OpenCL error: cannot read data from clEnqueueReadBuffer.\n");
+			return -2;
+		}
 	}
 
 	// Write all triangles to buffer.
@@ -650,7 +688,7 @@ int GPUPathtracer::writeGPUlights(std::vector<TLight>& li, cl_mem& pt_light, cl_
 
 	// Allocate memory for GPU buffer.
 	pt_light = clCreateBuffer(h_context,
-		flag, max * sizeof(TSphere), 0, &n_result);
+		flag, max * sizeof(TLight), 0, &n_result);
 	if (n_result != CL_SUCCESS) {
 		fprintf(stderr, "OpenCL error: clCreateBuffer() cannot create buffer.\n");
 		return -1;
@@ -27,6 +27,8 @@ public:
 	void loadGPUprogram(cl_program* program);
 	// Change kernel to computation.
 	void changeKernel(unsigned int kernel_type);
+	// Type of kernel to computation.
+	unsigned int getKernel() const { return actualKernelType; }
 	// Set argument of kernel.
 	void setGPUargs(unsigned int index, size_t size, void* data);
 	// Create OpenCL program from string.
@@ -48,6 +50,7 @@ public:
 	// Write objects to buffers.
 	int writeGPUobjects(
 		std::vector<TSphere>& sp, cl_mem& pt_sphere,
+		std::vector<TSphereData>& spd, cl_mem& pt_sphereData,
 		std::vector<TTriangle>& tr, cl_mem& pt_triangle,
 		std::vector<TMesh>& me, cl_mem& pt_meshes,
 		std::vector<unsigned int>& ra_me, cl_mem& pt_range_meshes,
@@ -74,6 +77,7 @@ private:
 
 	cl_build_status n_build_status; // Is important???
 	cl_kernel* actualKernel;
+	unsigned int actualKernelType;
 	cl_kernel* kernelList; // Compute pt with no accelerate data structures.
 	cl_kernel* kernelListFirst; // Only for first compute ...
 	cl_kernel* kernelOctree; // Compute pt with Octree structures.
@@ -82,6 +86,8 @@ private:
 	cl_kernel* kernelUniGridFirst; // Only for first compute ...
 	cl_kernel* kernelBVH; // Compute pt with BVH structures.
 	cl_kernel* kernelBVHFirst; // Only for first compute ...
+	cl_kernel* kernelKdTree; // Compute pt with kD-tree structures.
+	cl_kernel* kernelKdTreeFirst; // Only for first compute ...
 
 	// Choose device for compute.
 	cl_device_id ChooseDevice(cl_device_id *h_device, cl_uint size);
@@ -9,10 +9,15 @@
 
 #include "../include/cl_platform.h"
 #include "matrix.h"
+#include "acceleratorstats.h"
 
 #define SPHERE_INDEX 0
 #define TRIANGLE_INDEX 1
 
+// Meshes keep octahedral normals and half float UVs, decoded on use,
+// positions stay floats. Kernels are built with the same define.
+#define MESH_COMPACT 0
+
 // Basic structures.
 // Almost all structures are equialent of class's data part of 
 // CPU version pathtracing. Here they are marked as T... 
@@ -85,7 +90,12 @@ typedef struct {
 	cl_float mImageExtentY;		///< Extent of image plane in positive y direction.
 	cl_char padding[4];
 } TCamera;
-// Store info about sphere.
+// Store info about sphere for intersection test. Center and squared
+// radius in world space, negative w marks ellipsoid tested by transforms.
+typedef struct {
+	cl_float4 centerRadius2;
+} TSphere;
+// Store info about sphere needed for ellipsoids and hit points.
 typedef struct {
 	TMatrix InvWorldTransform;
 	TMatrix WorldTransform;
@@ -94,7 +104,7 @@ typedef struct {
 	cl_uint index;
 	cl_uint rayID;
 	cl_char padding[4];
-} TSphere;
+} TSphereData;
 // Store info about triangle.
 typedef struct {
 	TMaterial material;
@@ -107,6 +117,17 @@ typedef struct {
 	//cl_char padding[4];
 } TTriangle;
 // Store info about mesh. Addition structure for triangle intersection.
+#if MESH_COMPACT
+// Normal in octahedral mapping and UV as half floats, see vertexpacking.h.
+// Position is world space float.
+typedef struct {
+	TMaterial material;
+	TPoint3D vtxP;
+	cl_uint vtxN;
+	cl_uint vtxUV;
+	cl_char padding[8];
+} TMesh;
+#else
 typedef struct {
 	TMaterial material;
 	TPoint3D origVtxP;
@@ -116,6 +137,7 @@ typedef struct {
 	TUV vtxUV;
 	cl_char padding[8];
 } TMesh;
+#endif // MESH_COMPACT
 // Store info about light.
 typedef struct {
 	TColor col;
@@ -127,13 +149,13 @@ typedef struct {
 } TLight;
 
 // Help functions for exporting data.
-static inline void Vector3DToFloat3(Vector3D& src, cl_float3& dest) {
+static inline void Vector3DToFloat3(const Vector3D& src, cl_float3& dest) {
 	dest.s[0] = src.x;
 	dest.s[1] = src.y;
 	dest.s[2] = src.z;
 }
 
-static inline void Point3DtoFloat3(Point3D& src, cl_float3& dest) {
+static inline void Point3DtoFloat3(const Point3D& src, cl_float3& dest) {
 	dest.s[0] = src.x;
 	dest.s[1] = src.y;
 	dest.s[2] = src.z;
@@ -155,14 +177,26 @@ struct TBoxLink {
 	cl_uint objSize;
 };
 
-struct TOctreeBox {
+// Node of linear octree. Inner node has its 8 children stored in one block
+// starting at index children, leaf has children == 0 and range of objects.
+struct TOctreeNode {
+	cl_uint children;
+	TBoxLink boxLink;
+};
+
+// Neighbour links (ropes) of octree node for stackless traversal.
+// ropes[2 * axis] leads through min face, ropes[2 * axis + 1] through max face
+// to neighbour of same or bigger size, 0 means outside (root is never neighbour).
+// cell is position of node in grid of its level: x | y << 16, z | level << 16.
+struct TOctreeLink {
+	cl_uint ropes[6];
+	cl_uint cell[2];
+};
+
+// Bounding box of whole octree.
+struct TOctree {
 	TPoint3D boxMin;
 	TPoint3D boxMax;
-	TPoint3D middlePoint;
-	TBoxLink boxLink;
-	cl_uint children[8];
-	cl_uint leaf;
-	cl_char padding2[1];
 };
 
 struct TUniGrid {
@@ -182,4 +216,30 @@ struct TBVHNode {
 	cl_uint indexNode;
 };
 
+// Node of kD-tree with ropes for stackless traversal. Below child of inner
+// node is stored right after it, above child at index. Leaf has range of
+// objects in indexObj. ropes[2 * axis] leads through min face, ropes[2 * axis + 1]
+// through max face, 0 means outside (root is never neighbour).
+struct TKdNode {
+	TPoint3D boxMin;
+	TPoint3D boxMax;
+	TBoxLink indexObj;
+	cl_uint ropes[6];
+	cl_uint axis;
+	cl_float split;
+	cl_uint index;
+	cl_char padding[4];
+};
+
+// Traversal statistics of all rays of one image, summed by atomics on device.
+struct TTraversalStats {
+	cl_ulong rays;
+	cl_ulong nodes;
+	cl_ulong primitives;
+	cl_uint maxNodes;
+	cl_uint maxPrimitives;
+	cl_uint nodeHistogram[TRAVERSAL_HISTOGRAM_BINS];
+	cl_uint primitiveHistogram[TRAVERSAL_HISTOGRAM_BINS];
+};
+
 #endif // _GPU_TYPES_H_
\ No newline at end of file
@@ -31,13 +31,14 @@ public:
 	virtual bool intersect(const Ray& ray) const = 0;
 	virtual bool intersect(const Ray& ray, Intersection& is) const = 0;
 	virtual void getAABB(AABB& bb) const = 0;
+	virtual bool overlapAABB(const AABB& bb) const = 0;
+	virtual bool clipAABB(const AABB& bb, AABB& clipped) const = 0;
 	virtual UV calculateTextureDifferential(const Point3D& p, const Vector3D& dp) const = 0;
 	virtual Vector3D calculateNormalDifferential(const Point3D& p, const Vector3D& dp, bool isFrontFacing) const = 0;
  
 	virtual bool isSphere() const = 0;
 	virtual void setObj(void* obj) = 0;
 	virtual unsigned int getIndex() = 0;
-	int rayID = 0;
 	unsigned int index;
 };
 
@@ -0,0 +1,515 @@
+/*
+	Name: kdtreeaccelerator.cpp
+	Desc: kD-tree accelerated data structure.
+	Author: Karel Brezina (xbrezi13)
+*/
+
+#include "kdtreeaccelerator.h"
+#include "acceleratorcache.h"
+#include "Timer.h"
+#include <algorithm>
+
+void KdTreeAccelerator::build(const std::vector<Intersectable*>& objects)
+{
+	CTimer timer;
+	c_objects = objects;
+	nodes.clear();
+	objIndexes.clear();
+	cache.close();
+	box = AABB();
+
+	if (!cacheFile.empty() && loadCache()) {
+		if (verbose)
+			std::cout << "kD-tree loaded from " << cacheFile << ": " << timer.f_Time() << " s" << std::endl;
+		return;
+	}
+
+	std::for_each(c_objects.begin(), c_objects.end(), [&](Intersectable* obj) {
+		AABB aabb;
+		obj->getAABB(aabb);
+		box.include(aabb);
+	});
+	// Flat scene would have box with zero size.
+	box.grow(1e-3f);
+
+	// Events are sorted only once, children get them sorted by split.
+	std::vector<KdEvent> events;
+	events.reserve(6 * c_objects.size());
+	for (unsigned int i = 0; i < c_objects.size(); i++) {
+		AABB aabb;
+		c_objects[i]->getAABB(aabb);
+		addEvents(events, i, aabb);
+	}
+	std::sort(events.begin(), events.end());
+
+	sides.assign(c_objects.size(), SIDE_BOTH);
+	maxDepth = 8 + (int)(1.3f * std::log((float)std::max<size_t>(c_objects.size(), 1)) / std::log(2.0f));
+	maxDepth = std::min(maxDepth, KDTREE_STACK_SIZE - 1);
+
+	buildNode(events, box, c_objects.size(), 0);
+	std::vector<unsigned char>().swap(sides);
+	nodes.swap(builtNodes);
+	objIndexes.swap(builtIndexes);
+
+	if (verbose) {
+		unsigned int leaves = 0;
+		for (unsigned int i = 0; i < nodes.size(); i++)
+			leaves += nodes[i].axis == KDTREE_LEAF;
+		std::cout << "kD-tree build: " << timer.f_Time() << " s" << std::endl;
+		std::cout << "  nodes " << nodes.size() << ", leaves " << leaves << ", max depth " << maxDepth << std::endl;
+		std::cout << "  references " << objIndexes.size() << " (" << (float)objIndexes.size() / std::max<size_t>(c_objects.size(), 1)
+			<< " per object), memory " << (nodes.size() * sizeof(KdNode) + objIndexes.size() * sizeof(unsigned int)) / 1024 << " kB" << std::endl;
+	}
+
+	if (!cacheFile.empty())
+		saveCache();
+}
+
+// Sections are box, nodes and object indexes. Nodes and indexes are not
+// copied, they point to mapped cache until next build.
+bool KdTreeAccelerator::loadCache()
+{
+	std::vector<float> bounds;
+	if (!cache.open(cacheFile, CACHE_KDTREE, cacheKey, c_objects.size()) || cache.getSectionsCnt() != 3
+		|| !cache.getSection(0, bounds) || bounds.size() != 6
+		|| !nodes.map(cache.getSection(1)) || !objIndexes.map(cache.getSection(2))) {
+		nodes.clear();
+		objIndexes.clear();
+		cache.close();
+		return false;
+	}
+	box = AABB(Point3D(bounds[0], bounds[1], bounds[2]), Point3D(bounds[3], bounds[4], bounds[5]));
+	return true;
+}
+
+void KdTreeAccelerator::saveCache()
+{
+	float bounds[6] = { box.mMin.x, box.mMin.y, box.mMin.z, box.mMax.x, box.mMax.y, box.mMax.z };
+	std::vector<CacheSection> sections;
+	sections.push_back(CacheSection(bounds, sizeof(bounds)));
+	sections.push_back(CacheSection(nodes.data(), nodes.size() * sizeof(KdNode)));
+	sections.push_back(CacheSection(objIndexes.data(), objIndexes.size() * sizeof(unsigned int)));
+	if (!cache.write(cacheFile, CACHE_KDTREE, cacheKey, c_objects.size(), sections))
+		std::cout << "kD-tree cache " << cacheFile << " can not be written." << std::endl;
+}
+
+AcceleratorStats KdTreeAccelerator::getStats()
+{
+	AcceleratorStats stats;
+	stats.nodes = nodes.size();
+	stats.references = objIndexes.size();
+	stats.memory = nodes.size() * sizeof(KdNode) + objIndexes.size() * sizeof(unsigned int);
+	stats.cost = nodes.empty() ? 0.0f : collectStats(stats, 0, box, 0);
+
+	unsigned int filled = stats.leaves - stats.emptyLeaves;
+	stats.avgDepth = stats.leaves ? stats.avgDepth / stats.leaves : 0.0f;
+	stats.avgLeafObjects = filled ? (float)stats.references / filled : 0.0f;
+	stats.duplication = c_objects.empty() ? 0.0f : (float)stats.references / c_objects.size();
+	return stats;
+}
+
+// Walks the tree, fills counters and returns SAH cost of subtree relative to its box.
+// Sum of leaf depths is stored in avgDepth.
+float KdTreeAccelerator::collectStats(AcceleratorStats& stats, unsigned int node, const AABB& nodeBox, unsigned int depth)
+{
+	const KdNode& n = nodes[node];
+	stats.maxDepth = std::max(stats.maxDepth, depth);
+
+	if (n.axis == KDTREE_LEAF) {
+		stats.leaves++;
+		stats.avgDepth += depth;
+		if (n.count == 0)
+			stats.emptyLeaves++;
+		stats.maxLeafObjects = std::max(stats.maxLeafObjects, n.count);
+		return KDTREE_COST_INTERSECT * n.count;
+	}
+
+	AABB below = nodeBox, above = nodeBox;
+	below.mMax(n.axis) = n.split;
+	above.mMin(n.axis) = n.split;
+	float invArea = 1.0f / nodeBox.getArea();
+	return KDTREE_COST_TRAVERSAL
+		+ below.getArea() * invArea * collectStats(stats, node + 1, below, depth + 1)
+		+ above.getArea() * invArea * collectStats(stats, n.index, above, depth + 1);
+}
+
+void KdTreeAccelerator::addEvents(std::vector<KdEvent>& events, unsigned int obj, const AABB& bb)
+{
+	for (unsigned char axis = 0; axis < 3; axis++) {
+		KdEvent e;
+		e.obj = obj;
+		e.axis = axis;
+		if (bb.mMin(axis) == bb.mMax(axis)) {
+			e.pos = bb.mMin(axis);
+			e.type = EVENT_PLANAR;
+			events.push_back(e);
+		}
+		else {
+			e.pos = bb.mMin(axis);
+			e.type = EVENT_START;
+			events.push_back(e);
+			e.pos = bb.mMax(axis);
+			e.type = EVENT_END;
+			events.push_back(e);
+		}
+	}
+}
+
+// Expected cost of split relative to cost of node.
+float KdTreeAccelerator::splitCost(const AABB& nodeBox, int axis, float split, unsigned int left, unsigned int right)
+{
+	AABB leftBox = nodeBox, rightBox = nodeBox;
+	leftBox.mMax(axis) = split;
+	rightBox.mMin(axis) = split;
+
+	float invArea = 1.0f / nodeBox.getArea();
+	float cost = KDTREE_COST_TRAVERSAL + KDTREE_COST_INTERSECT *
+		(leftBox.getArea() * invArea * left + rightBox.getArea() * invArea * right);
+	if (left == 0 || right == 0)
+		cost *= KDTREE_EMPTY_BONUS;
+	return cost;
+}
+
+unsigned int KdTreeAccelerator::buildNode(std::vector<KdEvent>& events, const AABB& nodeBox, unsigned int count, int depth)
+{
+	unsigned int node = builtNodes.size();
+	builtNodes.push_back(KdNode());
+
+	// Sweep all candidates. Counts on each axis are updated at every plane,
+	// planar objects at plane go to side where they are cheaper.
+	float bestCost = KDTREE_COST_INTERSECT * count;
+	int bestAxis = -1;
+	float bestSplit = 0.0f;
+	bool bestPlanarLeft = false;
+
+	if (depth < maxDepth && count > 0) {
+		unsigned int left[3] = { 0, 0, 0 };
+		unsigned int right[3] = { count, count, count };
+		unsigned int i = 0;
+
+		while (i < events.size()) {
+			int axis = events[i].axis;
+			float pos = events[i].pos;
+			unsigned int ends = 0, planars = 0, starts = 0;
+
+			while (i < events.size() && events[i].axis == axis && events[i].pos == pos && events[i].type == EVENT_END) {
+				ends++; i++;
+			}
+			while (i < events.size() && events[i].axis == axis && events[i].pos == pos && events[i].type == EVENT_PLANAR) {
+				planars++; i++;
+			}
+			while (i < events.size() && events[i].axis == axis && events[i].pos == pos && events[i].type == EVENT_START) {
+				starts++; i++;
+			}
+
+			right[axis] -= planars + ends;
+			// Planes on node boundary do not split anything.
+			if (pos > nodeBox.mMin(axis) && pos < nodeBox.mMax(axis)) {
+				float costLeft = splitCost(nodeBox, axis, pos, left[axis] + planars, right[axis]);
+				float costRight = splitCost(nodeBox, axis, pos, left[axis], right[axis] + planars);
+				float cost = std::min(costLeft, costRight);
+				if (cost < bestCost) {
+					bestCost = cost;
+					bestAxis = axis;
+					bestSplit = pos;
+					bestPlanarLeft = costLeft <= costRight;
+				}
+			}
+			left[axis] += starts + planars;
+		}
+	}
+
+	if (bestAxis < 0) {
+		// Every object has one start or planar event on x axis.
+		builtNodes[node].axis = KDTREE_LEAF;
+		builtNodes[node].index = builtIndexes.size();
+		for (unsigned int i = 0; i < events.size(); i++) {
+			if (events[i].axis == 0 && events[i].type != EVENT_END)
+				builtIndexes.push_back(events[i].obj);
+		}
+		builtNodes[node].count = builtIndexes.size() - builtNodes[node].index;
+		return node;
+	}
+
+	// Classify objects by events on split axis.
+	for (unsigned int i = 0; i < events.size(); i++)
+		sides[events[i].obj] = SIDE_BOTH;
+	for (unsigned int i = 0; i < events.size(); i++) {
+		const KdEvent& e = events[i];
+		if (e.axis != bestAxis)
+			continue;
+		if (e.type == EVENT_END && e.pos <= bestSplit)
+			sides[e.obj] = SIDE_LEFT;
+		else if (e.type == EVENT_START && e.pos >= bestSplit)
+			sides[e.obj] = SIDE_RIGHT;
+		else if (e.type == EVENT_PLANAR) {
+			if (e.pos < bestSplit || (e.pos == bestSplit && bestPlanarLeft))
+				sides[e.obj] = SIDE_LEFT;
+			else
+				sides[e.obj] = SIDE_RIGHT;
+		}
+	}
+
+	AABB leftBox = nodeBox, rightBox = nodeBox;
+	leftBox.mMax(bestAxis) = bestSplit;
+	rightBox.mMin(bestAxis) = bestSplit;
+
+	// Events of objects on one side keep their order. Straddling objects are
+	// clipped to each child and their new events are sorted and merged.
+	std::vector<KdEvent> leftOnly, rightOnly, bothLeft, bothRight;
+	unsigned int leftCount = 0, rightCount = 0;
+	for (unsigned int i = 0; i < events.size(); i++) {
+		const KdEvent& e = events[i];
+		unsigned char side = sides[e.obj];
+
+		if (side == SIDE_LEFT) {
+			leftOnly.push_back(e);
+			leftCount += e.axis == 0 && e.type != EVENT_END;
+		}
+		else if (side == SIDE_RIGHT) {
+			rightOnly.push_back(e);
+			rightCount += e.axis == 0 && e.type != EVENT_END;
+		}
+		else if (e.axis == 0 && e.type != EVENT_END) {
+			AABB clipped;
+			if (c_objects[e.obj]->clipAABB(leftBox, clipped)) {
+				addEvents(bothLeft, e.obj, clipped);
+				leftCount++;
+			}
+			if (c_objects[e.obj]->clipAABB(rightBox, clipped)) {
+				addEvents(bothRight, e.obj, clipped);
+				rightCount++;
+			}
+		}
+	}
+	std::vector<KdEvent>().swap(events);
+
+	std::sort(bothLeft.begin(), bothLeft.end());
+	std::sort(bothRight.begin(), bothRight.end());
+	std::vector<KdEvent> leftEvents(leftOnly.size() + bothLeft.size());
+	std::merge(leftOnly.begin(), leftOnly.end(), bothLeft.begin(), bothLeft.end(), leftEvents.begin());
+	std::vector<KdEvent>().swap(leftOnly);
+	std::vector<KdEvent>().swap(bothLeft);
+	std::vector<KdEvent> rightEvents(rightOnly.size() + bothRight.size());
+	std::merge(rightOnly.begin(), rightOnly.end(), bothRight.begin(), bothRight.end(), rightEvents.begin());
+	std::vector<KdEvent>().swap(rightOnly);
+	std::vector<KdEvent>().swap(bothRight);
+
+	// Below child is built first, so it is right behind node.
+	buildNode(leftEvents, leftBox, leftCount, depth + 1);
+	unsigned int above = buildNode(rightEvents, rightBox, rightCount, depth + 1);
+
+	builtNodes[node].axis = bestAxis;
+	builtNodes[node].split = bestSplit;
+	builtNodes[node].index = above;
+	builtNodes[node].count = 0;
+	return node;
+}
+
+void KdTreeAccelerator::getRopeNodes(std::vector<TKdNode>& ropeNodes)
+{
+	ropeNodes.assign(nodes.size(), TKdNode());
+	if (nodes.empty())
+		return;
+
+	unsigned int ropes[6] = { 0, 0, 0, 0, 0, 0 };
+	setRopes(ropeNodes, 0, box, ropes);
+}
+
+// Children inherit ropes of parent, only faces on split plane lead to sibling.
+void KdTreeAccelerator::setRopes(std::vector<TKdNode>& ropeNodes, unsigned int node, const AABB& nodeBox, const unsigned int* ropes)
+{
+	const KdNode& n = nodes[node];
+	TKdNode& ropeNode = ropeNodes[node];
+	Point3D boxMin = nodeBox.mMin;
+	Point3D boxMax = nodeBox.mMax;
+	Point3DtoFloat3(boxMin, ropeNode.boxMin);
+	Point3DtoFloat3(boxMax, ropeNode.boxMax);
+	ropeNode.axis = n.axis;
+	ropeNode.split = n.split;
+	ropeNode.index = n.index;
+
+	if (n.axis == KDTREE_LEAF) {
+		ropeNode.indexObj.objStartIndex = n.index;
+		ropeNode.indexObj.objSize = n.index + n.count;
+		for (int face = 0; face < 6; face++)
+			ropeNode.ropes[face] = optimizeRope(ropes[face], face, nodeBox);
+		return;
+	}
+
+	ropeNode.indexObj.objStartIndex = 0;
+	ropeNode.indexObj.objSize = 0;
+	for (int face = 0; face < 6; face++)
+		ropeNode.ropes[face] = ropes[face];
+
+	AABB belowBox = nodeBox;
+	AABB aboveBox = nodeBox;
+	belowBox.mMax(n.axis) = n.split;
+	aboveBox.mMin(n.axis) = n.split;
+
+	unsigned int childRopes[6];
+	for (int face = 0; face < 6; face++)
+		childRopes[face] = ropes[face];
+	childRopes[2 * n.axis + 1] = n.index;
+	setRopes(ropeNodes, node + 1, belowBox, childRopes);
+	childRopes[2 * n.axis + 1] = ropes[2 * n.axis + 1];
+	childRopes[2 * n.axis] = node + 1;
+	setRopes(ropeNodes, n.index, aboveBox, childRopes);
+}
+
+// Push rope of leaf down to smallest node which still covers whole face.
+unsigned int KdTreeAccelerator::optimizeRope(unsigned int rope, int face, const AABB& leafBox)
+{
+	if (rope == 0)
+		return 0;
+
+	unsigned int faceAxis = face >> 1;
+	while (nodes[rope].axis != KDTREE_LEAF) {
+		const KdNode& n = nodes[rope];
+		if (n.axis == faceAxis)
+			rope = (face & 1) ? rope + 1 : n.index;
+		else if (n.split <= leafBox.mMin(n.axis))
+			rope = n.index;
+		else if (n.split >= leafBox.mMax(n.axis))
+			rope = rope + 1;
+		else
+			break;
+	}
+	return rope;
+}
+
+// Part of ray inside the tree, clamped to [ray.minT, ray.maxT] like
+// getKdTreeRange() in kernels, so shadow rays do not walk leaves behind
+// the light.
+bool KdTreeAccelerator::getRange(const Ray& ray, float& tMin, float& tMax) const
+{
+	if (nodes.empty() || !box.intersect(ray, tMin, tMax))
+		return false;
+	tMin = std::max(tMin, ray.minT);
+	tMax = std::min(tMax, ray.maxT);
+	return tMin <= tMax;
+}
+
+bool KdTreeAccelerator::intersect(const Ray& ray, TraversalCounters* counters)
+{
+	float tMin, tMax;
+	if (!getRange(ray, tMin, tMax))
+		return false;
+
+	float invDir[3] = { 1.0f / ray.dir.x, 1.0f / ray.dir.y, 1.0f / ray.dir.z };
+	KdStackItem stack[KDTREE_STACK_SIZE];
+	int stackSize = 0;
+	Mailbox mailbox;
+	unsigned int node = 0;
+
+	while (true) {
+		countNode(counters);
+		const KdNode& n = nodes[node];
+
+		if (n.axis != KDTREE_LEAF) {
+			// Visit child on side of ray origin first.
+			float orig = ray.orig(n.axis);
+			float tSplit = (n.split - orig) * invDir[n.axis];
+			bool belowFirst = orig < n.split || (orig == n.split && ray.dir(n.axis) <= 0.0f);
+			unsigned int first = belowFirst ? node + 1 : n.index;
+			unsigned int second = belowFirst ? n.index : node + 1;
+
+			if (tSplit > tMax || tSplit <= 0.0f) {
+				node = first;
+			}
+			else if (tSplit < tMin) {
+				node = second;
+			}
+			else {
+				stack[stackSize].node = second;
+				stack[stackSize].tMin = tSplit;
+				stack[stackSize].tMax = tMax;
+				stackSize++;
+				node = first;
+				tMax = tSplit;
+			}
+			continue;
+		}
+
+		for (unsigned int i = n.index; i < n.index + n.count; i++) {
+			Intersectable* obj = c_objects[objIndexes[i]];
+			if (mailbox.check(obj))
+				continue;
+			countPrimitive(counters);
+			if (obj->intersect(ray))
+				return true;
+		}
+
+		if (stackSize == 0)
+			return false;
+		stackSize--;
+		node = stack[stackSize].node;
+		tMin = stack[stackSize].tMin;
+		tMax = stack[stackSize].tMax;
+	}
+}
+
+bool KdTreeAccelerator::intersect(const Ray& ray, Intersection& is, TraversalCounters* counters)
+{
+	is.mHitTime = INF;
+	float tMin, tMax;
+	if (!getRange(ray, tMin, tMax))
+		return false;
+
+	float invDir[3] = { 1.0f / ray.dir.x, 1.0f / ray.dir.y, 1.0f / ray.dir.z };
+	KdStackItem stack[KDTREE_STACK_SIZE];
+	int stackSize = 0;
+	Mailbox mailbox;
+	unsigned int node = 0;
+
+	while (true) {
+		countNode(counters);
+		const KdNode& n = nodes[node];
+
+		if (n.axis != KDTREE_LEAF) {
+			float orig = ray.orig(n.axis);
+			float tSplit = (n.split - orig) * invDir[n.axis];
+			bool belowFirst = orig < n.split || (orig == n.split && ray.dir(n.axis) <= 0.0f);
+			unsigned int first = belowFirst ? node + 1 : n.index;
+			unsigned int second = belowFirst ? n.index : node + 1;
+
+			if (tSplit > tMax || tSplit <= 0.0f) {
+				node = first;
+			}
+			else if (tSplit < tMin) {
+				node = second;
+			}
+			else {
+				stack[stackSize].node = second;
+				stack[stackSize].tMin = tSplit;
+				stack[stackSize].tMax = tMax;
+				stackSize++;
+				node = first;
+				tMax = tSplit;
+			}
+			continue;
+		}
+
+		// Hit found in earlier leaf stays in is, so mailbox can skip object.
+		for (unsigned int i = n.index; i < n.index + n.count; i++) {
+			Intersectable* obj = c_objects[objIndexes[i]];
+			if (mailbox.check(obj))
+				continue;
+
+			countPrimitive(counters);
+			Intersection currentIs;
+			if (obj->intersect(ray, currentIs) && currentIs.mHitTime < is.mHitTime)
+				is = currentIs;
+		}
+
+		// Leafs are visited front to back, hit inside this one is the nearest.
+		if (is.mHitTime <= tMax || stackSize == 0)
+			break;
+		stackSize--;
+		node = stack[stackSize].node;
+		tMin = stack[stackSize].tMin;
+		tMax = stack[stackSize].tMax;
+	}
+
+	return is.mHitTime != INF;
+}
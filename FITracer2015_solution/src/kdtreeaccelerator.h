@@ -0,0 +1,112 @@
+/*
+	Name: kdtreeaccelerator.h
+	Desc: kD-tree accelerated data structure.
+	Author: Karel Brezina (xbrezi13)
+*/
+
+#ifndef _KDTREE_H_
+#define _KDTREE_H_
+
+#include "rayaccelerator.h"
+#include "mailbox.h"
+#include "gpu_types.h"
+#include "acceleratorcache.h"
+#include <string>
+
+// Cost of one traversal step.
+#define KDTREE_COST_TRAVERSAL 1.0f
+// Cost of one ray-object intersection.
+#define KDTREE_COST_INTERSECT 1.5f
+// Split with one empty child is cheaper by this factor (cuts off empty space).
+#define KDTREE_EMPTY_BONUS 0.8f
+// Size of fixed traversal stack, depth of tree is limited by it too.
+#define KDTREE_STACK_SIZE 64
+// Axis of leaf node.
+#define KDTREE_LEAF 3
+
+// Node of kD-tree. Below child of inner node is stored right after it,
+// above child at index. Leaf has range of objects in shared index array.
+struct KdNode {
+	unsigned int axis;			// Split axis or KDTREE_LEAF.
+	float split;				// Position of split plane.
+	unsigned int index;			// Above child or first object of leaf.
+	unsigned int count;			// Objects in leaf.
+};
+
+// kD-tree built by surface area heuristic in O(N log N) (Wald, Havran 2006).
+// Split candidates are bounds of objects clipped to node, so straddling
+// triangles do not generate planes outside of node.
+class KdTreeAccelerator : public RayAccelerator {
+public:
+	KdTreeAccelerator() { verbose = false; cacheKey = 0; }
+	~KdTreeAccelerator() {}
+
+	// Print info about build to std::cout.
+	void setVerbose(bool enable) { verbose = enable; }
+	// Load built tree from file instead of build if it was built for the same key of
+	// geometry, see Scene::getGeometryKey(), write it there after build.
+	void setCacheFile(const std::string& file, unsigned long long key) { cacheFile = file; cacheKey = key; }
+
+	AABB getBox() { return box; }
+	const CachedArray<KdNode>& getNodes() { return nodes; }
+	const CachedArray<unsigned int>& getObjIndexes() { return objIndexes; }
+	// Build nodes with boxes and ropes (neighbour links of faces) for export.
+	void getRopeNodes(std::vector<TKdNode>& ropeNodes);
+
+	virtual void build(const std::vector<Intersectable*>& objects);
+	virtual bool intersect(const Ray& ray, TraversalCounters* counters = NULL);
+	virtual bool intersect(const Ray& ray, Intersection& is, TraversalCounters* counters = NULL);
+	virtual std::vector<Intersectable*> getObjects() { return c_objects; }
+	virtual AcceleratorStats getStats();
+	virtual RayAccelerator* createEmpty() const { return new KdTreeAccelerator(); }
+
+private:
+	// Start or end of object bounds on one axis, planar if both are same.
+	// Sorted by axis, position and type, so ends go before starts.
+	enum { EVENT_END = 0, EVENT_PLANAR = 1, EVENT_START = 2 };
+	struct KdEvent {
+		float pos;
+		unsigned int obj;
+		unsigned char axis;
+		unsigned char type;
+
+		bool operator<(const KdEvent& e) const {
+			if (axis != e.axis) return axis < e.axis;
+			if (pos != e.pos) return pos < e.pos;
+			return type < e.type;
+		}
+	};
+	// Side of split where object belongs.
+	enum { SIDE_BOTH = 0, SIDE_LEFT = 1, SIDE_RIGHT = 2 };
+	// Item of traversal stack.
+	struct KdStackItem {
+		unsigned int node;
+		float tMin;
+		float tMax;
+	};
+
+	void addEvents(std::vector<KdEvent>& events, unsigned int obj, const AABB& bb);
+	unsigned int buildNode(std::vector<KdEvent>& events, const AABB& nodeBox, unsigned int count, int depth);
+	float splitCost(const AABB& nodeBox, int axis, float split, unsigned int left, unsigned int right);
+	void setRopes(std::vector<TKdNode>& ropeNodes, unsigned int node, const AABB& nodeBox, const unsigned int* ropes);
+	unsigned int optimizeRope(unsigned int rope, int face, const AABB& leafBox);
+	float collectStats(AcceleratorStats& stats, unsigned int node, const AABB& nodeBox, unsigned int depth);
+	bool getRange(const Ray& ray, float& tMin, float& tMax) const;
+	bool loadCache();
+	void saveCache();
+
+	AABB box;
+	std::vector<Intersectable*> c_objects;
+	CachedArray<KdNode> nodes;			// Built or in mapped cache.
+	CachedArray<unsigned int> objIndexes;
+	AcceleratorCache cache;
+	std::vector<KdNode> builtNodes;		// Filled by build, then moved to nodes.
+	std::vector<unsigned int> builtIndexes;
+	std::vector<unsigned char> sides;
+	int maxDepth;
+	bool verbose;
+	std::string cacheFile;
+	unsigned long long cacheKey;
+};
+
+#endif // _KDTREE_H_
@@ -14,17 +14,18 @@ void ListAccelerator::build(const std::vector<Intersectable*>& objects)
 	this->objects = objects;
 }
 
-bool ListAccelerator::intersect(const Ray& ray)
+bool ListAccelerator::intersect(const Ray& ray, TraversalCounters* counters)
 {
 	std::vector<Intersectable*>::iterator i;
 	for (i = objects.begin(); i != objects.end(); ++i) {
+		countPrimitive(counters);
 		if ((*i)->intersect(ray))
 			return true;
 	}
 	return false;
 }
 
-bool ListAccelerator::intersect(const Ray& ray, Intersection& is)
+bool ListAccelerator::intersect(const Ray& ray, Intersection& is, TraversalCounters* counters)
 {
 	is.mHitTime = INF;
 
@@ -32,6 +33,7 @@ bool ListAccelerator::intersect(const Ray& ray, Intersection& is)
 	for (i = objects.begin(); i != objects.end(); ++i) {
 		Intersection currentIs;
 		
+		countPrimitive(counters);
 		if ((*i)->intersect(ray, currentIs)) {
 			if (currentIs.mHitTime < is.mHitTime)
 				is = currentIs;
@@ -40,3 +42,21 @@ bool ListAccelerator::intersect(const Ray& ray, Intersection& is)
 
 	return is.mHitTime != INF;
 }
+
+/**
+ * List is one leaf with all objects, every ray tests all of them.
+ */
+AcceleratorStats ListAccelerator::getStats()
+{
+	AcceleratorStats stats;
+	stats.nodes = 1;
+	stats.leaves = 1;
+	stats.emptyLeaves = objects.empty() ? 1 : 0;
+	stats.references = objects.size();
+	stats.maxLeafObjects = objects.size();
+	stats.avgLeafObjects = (float)objects.size();
+	stats.duplication = objects.empty() ? 0.0f : 1.0f;
+	stats.cost = (float)objects.size();
+	stats.memory = objects.size() * sizeof(Intersectable*);
+	return stats;
+}
@@ -19,10 +19,12 @@ private:
 
 public:
 	virtual void build(const std::vector<Intersectable*>& objects);
-	virtual bool intersect(const Ray& ray);
-	virtual bool intersect(const Ray& ray, Intersection& is);
+	virtual bool intersect(const Ray& ray, TraversalCounters* counters = NULL);
+	virtual bool intersect(const Ray& ray, Intersection& is, TraversalCounters* counters = NULL);
 
 	virtual std::vector<Intersectable*> getObjects() { return objects; }
+	virtual AcceleratorStats getStats();
+	virtual RayAccelerator* createEmpty() const { return new ListAccelerator(); }
 };
 
 #endif
@@ -0,0 +1,39 @@
+/*
+	Name: mailbox.h
+	Desc: Small hashed mailbox for one ray traversal.
+	Author: Karel Brezina (xbrezi13)
+*/
+
+#ifndef _MAILBOX_H_
+#define _MAILBOX_H_
+
+#include "intersectable.h"
+
+// Number of slots in mailbox (power of two).
+#define MAILBOX_SIZE 32
+
+// Direct-mapped cache of already tested objects. Lives on the stack of one
+// traversal, so the objects stay read-only and more threads can trace at once.
+// A collision only evicts older entry, the object is then tested again.
+class Mailbox {
+public:
+	Mailbox() {
+		for (int i = 0; i < MAILBOX_SIZE; i++)
+			slots[i] = NULL;
+	}
+
+	// Returns true if obj was already tested, otherwise stores it.
+	inline bool check(const Intersectable* obj) {
+		size_t key = reinterpret_cast<size_t>(obj);
+		unsigned int slot = (unsigned int)((key >> 4) ^ (key >> 9)) & (MAILBOX_SIZE - 1);
+		if (slots[slot] == obj)
+			return true;
+		slots[slot] = obj;
+		return false;
+	}
+
+private:
+	const Intersectable* slots[MAILBOX_SIZE];
+};
+
+#endif // _MAILBOX_H_
@@ -0,0 +1,90 @@
+/*
+	Name: mappedfile.cpp
+	Desc: Read-only memory mapped file.
+	Author: Karel Brezina (xbrezi13)
+*/
+
+#include "mappedfile.h"
+
+#if defined(_WIN32) || defined (_WIN64)
+#include <windows.h>
+#else // _WIN32, _WIN64
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif // _WIN32, _WIN64
+
+MappedFile::MappedFile()
+{
+	data = NULL;
+	size = 0;
+#if defined(_WIN32) || defined (_WIN64)
+	file = INVALID_HANDLE_VALUE;
+	mapping = NULL;
+#else // _WIN32, _WIN64
+	file = -1;
+#endif // _WIN32, _WIN64
+}
+
+bool MappedFile::open(const std::string& fileName)
+{
+	close();
+
+#if defined(_WIN32) || defined (_WIN64)
+	file = CreateFileA(fileName.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) {
+		close();
+		return false;
+	}
+	mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (mapping == NULL) {
+		close();
+		return false;
+	}
+	data = (const unsigned char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	size = (size_t)fileSize.QuadPart;
+#else // _WIN32, _WIN64
+	file = ::open(fileName.c_str(), O_RDONLY);
+	if (file < 0)
+		return false;
+	struct stat st;
+	if (fstat(file, &st) != 0 || st.st_size == 0) {
+		close();
+		return false;
+	}
+	void* view = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+	data = (view != MAP_FAILED) ? (const unsigned char*)view : NULL;
+	size = st.st_size;
+#endif // _WIN32, _WIN64
+	if (data == NULL) {
+		close();
+		return false;
+	}
+	return true;
+}
+
+void MappedFile::close()
+{
+#if defined(_WIN32) || defined (_WIN64)
+	if (data)
+		UnmapViewOfFile(data);
+	if (mapping)
+		CloseHandle(mapping);
+	if (file != INVALID_HANDLE_VALUE)
+		CloseHandle(file);
+	mapping = NULL;
+	file = INVALID_HANDLE_VALUE;
+#else // _WIN32, _WIN64
+	if (data)
+		munmap((void*)data, size);
+	if (file >= 0)
+		::close(file);
+	file = -1;
+#endif // _WIN32, _WIN64
+	data = NULL;
+	size = 0;
+}
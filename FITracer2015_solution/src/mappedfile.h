@@ -0,0 +1,42 @@
+/*
+	Name: mappedfile.h
+	Desc: Read-only memory mapped file.
+	Author: Karel Brezina (xbrezi13)
+*/
+
+#ifndef _MAPPED_FILE_H_
+#define _MAPPED_FILE_H_
+
+#include <string>
+
+// Whole file is mapped read-only, pages are loaded by the system on first
+// access. Empty file can not be mapped.
+class MappedFile {
+public:
+	MappedFile();
+	~MappedFile() { close(); }
+
+	// Return false if file is missing or empty.
+	bool open(const std::string& fileName);
+	void close();
+
+	bool isOpen() const { return data != NULL; }
+	const unsigned char* getData() const { return data; }
+	size_t getSize() const { return size; }
+
+private:
+	// Not copyable, mapping is released by destructor.
+	MappedFile(const MappedFile&);
+	MappedFile& operator=(const MappedFile&);
+
+	const unsigned char* data;
+	size_t size;
+#if defined(_WIN32) || defined (_WIN64)
+	void* file;
+	void* mapping;
+#else // _WIN32, _WIN64
+	int file;
+#endif // _WIN32, _WIN64
+};
+
+#endif // _MAPPED_FILE_H_
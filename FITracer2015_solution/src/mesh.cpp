@@ -9,28 +9,107 @@
 
 #include <fstream>
 #include <vector>
+#include <thread>
+#include <functional>
+#include <cstring>
+#include <algorithm>
+#include <cstdlib>
+#include <unordered_map>
+#include <queue>
 #include "defines.h"
 #include "triangle.h"
 #include "mesh.h"
+#include "mappedfile.h"
+#include <sys/stat.h>
+#include <xmmintrin.h>
 
 using namespace std;
 
+/**
+ * Stamp of file from its size and time of last change, returns false if
+ * file is missing.
+ */
+bool Mesh::getFileStamp(const std::string& filename, unsigned long long& stamp)
+{
+#if defined(_WIN32) || defined (_WIN64)
+	struct _stat64 st;
+	if (_stat64(filename.c_str(), &st) != 0)
+		return false;
+#else // _WIN32, _WIN64
+	struct stat st;
+	if (stat(filename.c_str(), &st) != 0)
+		return false;
+#endif // _WIN32, _WIN64
+	// Options changing loaded data are part of stamp.
+	long long values[3] = { (long long)st.st_size, (long long)st.st_mtime, MESH_OPTIMIZE };
+	stamp = AcceleratorCache::hashData(values, sizeof(values));
+	return true;
+}
+
 /**
  * Creates a mesh primitive.
  */
-Mesh::Mesh() : Primitive()
+Mesh::Mesh() : Primitive(), mStamp(0)
 {
+#if MESH_LOD
+	mLodError = 0.0f;
+#endif // MESH_LOD
 }
 
 /**
  * Loads a mesh from the specified file.
  * @param filename Name of the file from which to load the mesh object
  */
-Mesh::Mesh(const std::string& filename, Material* m) : Primitive(m)
+Mesh::Mesh(const std::string& filename, Material* m) : Primitive(m), mStamp(0)
 {
+#if MESH_LOD
+	mLodError = 0.0f;
+#endif // MESH_LOD
 	load(filename);
 }
 
+/**
+ * Creates a mesh sharing data of mesh which is being loaded.
+ * @param source Future of the loaded mesh, see AssetLoader
+ */
+Mesh::Mesh(const MeshFuture& source, Material* m) : Primitive(m)
+{
+#if MESH_LOD
+	mLodError = 0.0f;
+#endif // MESH_LOD
+	mPending = source;
+	mStamp = source.stamp;
+}
+
+/**
+ * Waits for the source mesh and creates triangles over its vertex attributes.
+ */
+void Mesh::waitLoaded()
+{
+	if (!mPending.valid())
+		return;
+	std::shared_ptr<Mesh> source = mPending.get();
+	mPending = MeshFuture();
+	share(source);
+}
+
+/**
+ * Creates triangles over vertex attributes of the loaded source mesh.
+ */
+void Mesh::share(const std::shared_ptr<Mesh>& source)
+{
+	mSource = source;
+	mOrigP = mSource->mOrigP;
+	mOrigN = mSource->mOrigN;
+	mUV = mSource->mUV;
+	mMtlLib = mSource->mMtlLib;
+	mFaces.reserve(mSource->mFaces.size());
+	for (unsigned int i = 0; i < mSource->mFaces.size(); i++) {
+		const Triangle& t = mSource->mFaces[i];
+		mFaces.push_back(Triangle(this, t.mVtx[0], t.mVtx[1], t.mVtx[2], t.mMaterial));
+	}
+}
+
 /**
  * Loads a mesh from the specified file.
  */
@@ -41,10 +120,103 @@ void Mesh::load(const std::string& filename)
 	// Clear out old data.
 	clear();
 	
-	// Just call load_obj() since no other file formats are supported.
-	loadOBJ(filename);
+	// Size and time of change of the file decide if cache is valid.
+	unsigned long long stamp = 0;
+	bool stamped = getFileStamp(filename, stamp);
+#if MESH_CACHE
+	std::string cacheFile = filename + MESH_CACHE_SUFFIX;
+	if (stamped && loadCache(cacheFile, stamp))
+		cout << mFaces.size() << " triangles (cached)" << endl;
+	else
+#endif // MESH_CACHE
+	{
+		// Format is given by extension, OBJ is default.
+		std::string ext = filename.substr(std::min(filename.size(), filename.rfind('.')));
+		std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+		if (ext == ".ply")
+			loadPLY(filename);
+		else
+			loadOBJ(filename);
+#if MESH_OPTIMIZE
+		optimize();
+#endif // MESH_OPTIMIZE
+
+#if MESH_LOD
+		buildLod();
+#endif // MESH_LOD
+
+#if MESH_CACHE
+		if (stamped)
+			saveCache(cacheFile, stamp);
+#endif // MESH_CACHE
+	}
+	mStamp = stamp;
+
+#if MESH_COMPACT
+	compact();
+#endif // MESH_COMPACT
 }
 
+#if MESH_COMPACT
+/**
+ * Packs loaded normals and UVs and releases their full precision arrays
+ * and the mapped cache. Positions are copied out of the cache. The proxy
+ * is packed too.
+ */
+void Mesh::compact()
+{
+	mPackedN.resize(mOrigN.size);
+	for (unsigned int i = 0; i < mOrigN.size; i++)
+		mPackedN[i] = packNormal(mOrigN[i]);
+	mPackedUV.resize(mUV.size);
+	for (unsigned int i = 0; i < mUV.size; i++)
+		mPackedUV[i] = packUV(mUV[i]);
+
+#ifdef _DEBUG
+	unsigned int failed = checkPacking();
+	if (failed > 0)
+		cout << "Packing changed " << failed << " vertex attributes more than expected." << endl;
+#endif // _DEBUG
+
+	if (mOrigVtxP.empty())
+		mOrigVtxP.assign(mOrigP.data, mOrigP.data + mOrigP.size);
+	mOrigP.set(mOrigVtxP);
+	mOrigN = AttributeArray<Vector3D>();
+	mUV = AttributeArray<UV>();
+	std::vector<Vector3D>().swap(mOrigVtxN);
+	std::vector<UV>().swap(mVtxUV);
+	mCache.close();
+
+#if MESH_LOD
+	if (mLodSource)
+		mLodSource->compact();
+#endif // MESH_LOD
+}
+
+/**
+ * Unpacks packed normals and UVs and compares them with the loaded ones.
+ * Returns number of attributes with error bigger than precision of packing.
+ */
+unsigned int Mesh::checkPacking() const
+{
+	unsigned int failed = 0;
+	// 16 bits of octahedral coordinates keep direction within about 5e-5.
+	for (unsigned int i = 0; i < mOrigN.size; i++) {
+		Vector3D n = mOrigN[i];
+		if ((unpackNormal(mPackedN[i]) - n.normalize()).length() > 1e-4f)
+			failed++;
+	}
+	// Half float keeps 11 significant bits, the smallest step is 2^-24.
+	for (unsigned int i = 0; i < mUV.size; i++) {
+		UV uv = unpackUV(mPackedUV[i]);
+		if (std::fabs(uv.u - mUV[i].u) > std::fabs(mUV[i].u) / 2048.0f + 1.0f / 16777216.0f
+			|| std::fabs(uv.v - mUV[i].v) > std::fabs(mUV[i].v) / 2048.0f + 1.0f / 16777216.0f)
+			failed++;
+	}
+	return failed;
+}
+#endif // MESH_COMPACT
+
 /**
  * Clears all data associated with the mesh.
  */
@@ -59,6 +231,27 @@ void Mesh::clear()
 	
 	// clear faces
 	mFaces.clear();
+
+	// release cache and shared mesh
+	mPending = MeshFuture();
+	mSource.reset();
+	mOrigP = AttributeArray<Point3D>();
+	mOrigN = AttributeArray<Vector3D>();
+	mUV = AttributeArray<UV>();
+	mCache.close();
+	mMtlLib.clear();
+	mStamp = 0;
+#if MESH_LOD
+	mLodSource.reset();
+	mLod.reset();
+	mLodError = 0.0f;
+#endif // MESH_LOD
+
+#if MESH_COMPACT
+	mPackedN.clear();
+	mPackedUV.clear();
+	mPackedVtxN.clear();
+#endif // MESH_COMPACT
 }
 
 
@@ -77,6 +270,7 @@ Material *Mesh::CreateMaterial(MaterialProperties &mp) const
 
 unsigned int Mesh::setIndexes(unsigned int index)
 {
+	waitLoaded();
 	for (std::vector<Triangle>::iterator it = mFaces.begin(); it != mFaces.end(); it++) {
 		index = (*it).setIndex(index);
 	}
@@ -166,26 +360,200 @@ bool Mesh::loadMTL(const std::string& filename)
 }
 
 
+// Parts of OBJ file counted by separate threads are at least this big.
+#define OBJ_MIN_CHUNK (1 << 20)
+// Vertices and triangles transformed by one thread in prepare().
+#define MESH_PREPARE_MIN_CHUNK (1 << 14)
+
+// Numbers of elements in part of OBJ file, used for sizing arrays.
+struct OBJCounts {
+	size_t positions, normals, uvs, triangles;
+
+	OBJCounts() { positions = normals = uvs = triangles = 0; }
+};
+
+static inline bool isSpace(char c)
+{
+	return c == ' ' || c == '\t' || c == '\r';
+}
+
+static inline const char* skipSpaces(const char* p, const char* end)
+{
+	while (p < end && isSpace(*p))
+		p++;
+	return p;
+}
+
+static inline const char* skipWord(const char* p, const char* end)
+{
+	while (p < end && !isSpace(*p))
+		p++;
+	return p;
+}
+
+// Is keyword at start of line followed by space?
+static inline bool isKeyword(const char* p, const char* end, const char* keyword)
+{
+	while (*keyword) {
+		if (p == end || *p != *keyword)
+			return false;
+		p++;
+		keyword++;
+	}
+	return p == end || isSpace(*p);
+}
+
+static inline const char* findLineEnd(const char* p, const char* end)
+{
+	const char* lineEnd = (const char*)memchr(p, '\n', end - p);
+	return lineEnd ? lineEnd : end;
+}
+
+// Integer with optional sign, missing number gives 0.
+static inline const char* scanInt(const char* p, const char* end, int& value)
+{
+	bool negative = false;
+	if (p < end && (*p == '-' || *p == '+')) {
+		negative = (*p == '-');
+		p++;
+	}
+	value = 0;
+	while (p < end && *p >= '0' && *p <= '9') {
+		value = value * 10 + (*p - '0');
+		p++;
+	}
+	if (negative)
+		value = -value;
+	return p;
+}
+
+// Decimal number with optional exponent, missing number gives 0. Mantissa
+// is kept exact in 64 bit integer and scaled by exact power of ten once.
+static const char* scanFloat(const char* p, const char* end, float& value)
+{
+	static const double powers[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+		1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+
+	p = skipSpaces(p, end);
+	bool negative = false;
+	if (p < end && (*p == '-' || *p == '+')) {
+		negative = (*p == '-');
+		p++;
+	}
+
+	// Digits over 15 significant ones only move exponent.
+	unsigned long long mantissa = 0;
+	int exponent = 0;
+	while (p < end && *p >= '0' && *p <= '9') {
+		if (mantissa < 100000000000000ULL)
+			mantissa = mantissa * 10 + (*p - '0');
+		else
+			exponent++;
+		p++;
+	}
+	if (p < end && *p == '.') {
+		p++;
+		while (p < end && *p >= '0' && *p <= '9') {
+			if (mantissa < 100000000000000ULL) {
+				mantissa = mantissa * 10 + (*p - '0');
+				exponent--;
+			}
+			p++;
+		}
+	}
+	if (p < end && (*p == 'e' || *p == 'E')) {
+		int e;
+		const char* q = scanInt(p + 1, end, e);
+		if (q > p + 1 && (q[-1] >= '0' && q[-1] <= '9')) {
+			exponent += e;
+			p = q;
+		}
+	}
+
+	double v = (double)mantissa;
+	if (mantissa != 0) {
+		if (exponent < 0)
+			v = (exponent >= -22) ? v / powers[-exponent] : v * std::pow(10.0, exponent);
+		else if (exponent > 0)
+			v = (exponent <= 22) ? v * powers[exponent] : v * std::pow(10.0, exponent);
+	}
+	value = (float)(negative ? -v : v);
+	return p;
+}
+
+// Count elements of lines in part of file.
+static void countOBJ(const char* p, const char* end, OBJCounts& counts)
+{
+	while (p < end) {
+		const char* lineEnd = findLineEnd(p, end);
+		p = skipSpaces(p, lineEnd);
+		if (isKeyword(p, lineEnd, "v"))
+			counts.positions++;
+		else if (isKeyword(p, lineEnd, "vn"))
+			counts.normals++;
+		else if (isKeyword(p, lineEnd, "vt"))
+			counts.uvs++;
+		else if (isKeyword(p, lineEnd, "f")) {
+			// Polygon with n vertices gives n-2 triangles.
+			int vertices = 0;
+			p = skipSpaces(p + 1, lineEnd);
+			while (p < lineEnd) {
+				vertices++;
+				p = skipSpaces(skipWord(p, lineEnd), lineEnd);
+			}
+			if (vertices > 2)
+				counts.triangles += vertices - 2;
+		}
+		p = lineEnd + 1;
+	}
+}
+
 /**
  * Loads a mesh file in the OBJ format. 
  * Note that the various arrays (mVtxP,...) are assumed to be cleared beforehand.
+ * The file is memory mapped. In the first pass parts of the file split at line
+ * boundaries are counted in parallel and the arrays are sized exactly, the second
+ * pass parses numbers straight from the mapped memory.
  */
 void Mesh::loadOBJ(const std::string& filename)
 {
 	// Open file
-	ifstream is;
-	is.open(filename.c_str(), ios_base::in);	// open in text mode
-	if(!is.is_open()) throw std::runtime_error("could not open file "+filename);
-	
-	// Reserve size in arrays to hold the loaded data.
-	// Note the std::vector arrays grows in multiples of the initial capacity,
-	// hence it is important to set these to a reasonable number.
-	mOrigVtxP.reserve(50000);
-	mOrigVtxN.reserve(50000);
-	mVtxUV.reserve(50000);
-	mFaces.reserve(50000);
+	MappedFile file;
+	if (!file.open(filename)) throw std::runtime_error("could not open file "+filename);
+	const char* begin = (const char*)file.getData();
+	const char* end = begin + file.getSize();
+
+	// Count elements in parts of file, each part starts at new line.
+	unsigned int parts = (unsigned int)std::min<size_t>(std::max(1u, std::thread::hardware_concurrency()),
+		file.getSize() / OBJ_MIN_CHUNK + 1);
+	std::vector<const char*> bounds(parts + 1, end);
+	bounds[0] = begin;
+	for (unsigned int i = 1; i < parts; i++) {
+		const char* p = std::max(begin + file.getSize() / parts * i, bounds[i - 1]);
+		bounds[i] = std::min(findLineEnd(p, end) + 1, end);
+	}
+	std::vector<OBJCounts> partCounts(parts);
+	std::vector<std::thread> threads;
+	for (unsigned int i = 1; i < parts; i++)
+		threads.push_back(std::thread(countOBJ, bounds[i], bounds[i + 1], std::ref(partCounts[i])));
+	countOBJ(bounds[0], bounds[1], partCounts[0]);
+	for (unsigned int i = 0; i < threads.size(); i++)
+		threads[i].join();
+
+	OBJCounts counts;
+	for (unsigned int i = 0; i < parts; i++) {
+		counts.positions += partCounts[i].positions;
+		counts.normals += partCounts[i].normals;
+		counts.uvs += partCounts[i].uvs;
+		counts.triangles += partCounts[i].triangles;
+	}
+
+	// Reserve exact size in arrays to hold the loaded data.
+	mOrigVtxP.reserve(counts.positions);
+	mOrigVtxN.reserve(counts.normals);
+	mVtxUV.reserve(counts.uvs);
+	mFaces.reserve(counts.triangles);
 	
-	char line[4096];
 	int line_num = 0;
 	float a,b,c;
 	bool has_normals=true, has_uv=true;
@@ -209,61 +577,66 @@ void Mesh::loadOBJ(const std::string& filename)
 
 	int nFaces = 0;
 
-	while(is.good())
+	const char* line = begin;
+	while(line < end)
 	{
-		is.getline(line, 4096);
-		string s(line);
-		istringstream iss(s);
+		const char* lineEnd = findLineEnd(line, end);
+		const char* p = skipSpaces(line, lineEnd);
 		line_num++;
 		
-		string what;
-		iss >> what;
-		
-		if(what=="v")			// Vertex
+		if(isKeyword(p, lineEnd, "v"))			// Vertex
 		{
-			iss >> a >> b >> c;
+			p = scanFloat(p + 1, lineEnd, a);
+			p = scanFloat(p, lineEnd, b);
+			scanFloat(p, lineEnd, c);
 			mOrigVtxP.push_back(Point3D(a,b,c));
 		}
-		else if(what=="vn")		// Normal
+		else if(isKeyword(p, lineEnd, "vn"))		// Normal
 		{
-			iss >> a >> b >> c;
+			p = scanFloat(p + 2, lineEnd, a);
+			p = scanFloat(p, lineEnd, b);
+			scanFloat(p, lineEnd, c);
 			mOrigVtxN.push_back(Vector3D(a,b,c));
 		}
-		else if(what=="vt")		// Texture coordinate
+		else if(isKeyword(p, lineEnd, "vt"))		// Texture coordinate
 		{
-			iss >> a >> b;
+			p = scanFloat(p + 2, lineEnd, a);
+			scanFloat(p, lineEnd, b);
 			mVtxUV.push_back(UV(a,b));
 		}
-		else if(what=="f")		// Face
+		else if(isKeyword(p, lineEnd, "f"))		// Face
 		{
 			Triangle::vertex vtx[3];
 			int n=0, k=0;
+			p++;
 						
-			while(iss.good())
+			while(true)
 			{
+				p = skipSpaces(p, lineEnd);
+				if(p==lineEnd) break;
+
 				// Read indices
 				int pidx=0, nidx=0, tidx=0;
 				
-				iss >> pidx;
+				p = scanInt(p, lineEnd, pidx);
 				if(pidx==0) break;
 				
-				if(iss.peek()=='/')
+				if(p<lineEnd && *p=='/')
 				{
-					char ch = 0;
-					iss >> ch;
-					if(iss.peek()=='/')
+					p++;
+					if(p<lineEnd && *p=='/')
 					{
 						// format: vertex//normal
-						iss >> ch >> nidx;
+						p = scanInt(p + 1, lineEnd, nidx);
 						has_uv = false;
 					}
 					else
 					{
-						iss >> tidx;
-						if(iss.peek()=='/')
+						p = scanInt(p, lineEnd, tidx);
+						if(p<lineEnd && *p=='/')
 						{
 							// format: vertex/texture/normal
-							iss >> ch >> nidx;
+							p = scanInt(p + 1, lineEnd, nidx);
 						}
 						else
 						{
@@ -272,7 +645,18 @@ void Mesh::loadOBJ(const std::string& filename)
 						}
 					}
 				}
+				else
+				{
+					// format: vertex
+					has_normals = false;
+					has_uv = false;
+				}
 				
+				// Negative indices are relative to the end of arrays.
+				if(pidx<0) pidx += (int)mOrigVtxP.size()+1;
+				if(nidx<0) nidx += (int)mOrigVtxN.size()+1;
+				if(tidx<0) tidx += (int)mVtxUV.size()+1;
+
 				// Setup vertex (the OBJ indices starts at 1, hence we subtract)
 				vtx[k].p = pidx-1;
 				vtx[k].n = nidx-1;
@@ -300,13 +684,15 @@ void Mesh::loadOBJ(const std::string& filename)
 			// if a face with less than 3 valid set of indices is found, we cast an exception
 			if(n==0) throw std::runtime_error("error on line "+int2str(line_num));
 		}
-		else if (what == "mtllib") { // Parse material file
-			iss >> what;
-			mtlFound = loadMTL(what);
+		else if (isKeyword(p, lineEnd, "mtllib")) { // Parse material file
+			p = skipSpaces(p + 6, lineEnd);
+			mMtlLib = std::string(p, skipWord(p, lineEnd));
+			mtlFound = loadMTL(mMtlLib);
 		}
-		else if (what == "usemtl") { // Set material
+		else if (isKeyword(p, lineEnd, "usemtl")) { // Set material
 			if (mtlFound) {
-				iss >> what;
+				p = skipSpaces(p + 6, lineEnd);
+				std::string what(p, skipWord(p, lineEnd));
 				// C++ sure is pretty, isn't it...?
 				std::vector<Material *>::iterator itr;
 				for (itr = mMaterials.begin(); itr != mMaterials.end(); ++itr) {
@@ -319,15 +705,28 @@ void Mesh::loadOBJ(const std::string& filename)
 					mtl = mMaterials.front();
 			}
 		}
-		else if(what=="g") { // Group
-			std::cout << "Found group: " << line << std::endl;
+		else if(isKeyword(p, lineEnd, "g")) { // Group
+			std::cout << "Found group: " << std::string(line, lineEnd) << std::endl;
 		}
+
+		line = lineEnd + 1;
 	}
 
 	// ----------- reading done --------------
 	
-	is.close();		// close input file
+	file.close();		// unmap input file
 		
+	completeAttributes(has_normals, has_uv);
+
+	// All done!
+}
+
+/**
+ * Checks the loaded mesh and creates missing normals and texture coordinates.
+ * Shared by loaders of all file formats.
+ */
+void Mesh::completeAttributes(bool has_normals, bool has_uv)
+{
 	// debug
 	int nverts = (int)mOrigVtxP.size();
 //	int nnorms = (int)mVtxN.size();
@@ -353,7 +752,12 @@ void Mesh::loadOBJ(const std::string& filename)
 		for(int i=0; i<ntris; i++)
 		{
 			Triangle& t = mFaces[i];
-			Vector3D wn = t.getArea() * t.getFaceNormal();
+			// World positions are not known before prepare(), use original ones.
+			// Cross product of edges is face normal weighted by twice the area.
+			const Point3D& p0 = mOrigVtxP[ t.mVtx[0].p ];
+			Vector3D e1 = mOrigVtxP[ t.mVtx[1].p ] - p0;
+			Vector3D e2 = mOrigVtxP[ t.mVtx[2].p ] - p0;
+			Vector3D wn = e1 % e2;
 			for(int j=0; j<3; j++)
 			{
 				t.mVtx[j].n = t.mVtx[j].p;
@@ -378,40 +782,1189 @@ void Mesh::loadOBJ(const std::string& filename)
 				mFaces[i].mVtx[j].t = j;
 	}
 	
-	// All done!
+	mOrigP.set(mOrigVtxP);
+	mOrigN.set(mOrigVtxN);
+	mUV.set(mVtxUV);
+}
+
+// Merge equal values, remap[i] is new index of values[i].
+template <class T, class Less> static void mergeEqual(std::vector<T>& values, std::vector<int>& remap, Less less)
+{
+	std::vector<int> order(values.size());
+	for (unsigned int i = 0; i < order.size(); i++)
+		order[i] = i;
+	std::sort(order.begin(), order.end(), [&](int a, int b) { return less(values[a], values[b]); });
+
+	std::vector<T> merged;
+	merged.reserve(values.size());
+	remap.resize(values.size());
+	for (unsigned int i = 0; i < order.size(); i++) {
+		if (i == 0 || less(values[order[i - 1]], values[order[i]]))
+			merged.push_back(values[order[i]]);
+		remap[order[i]] = merged.size() - 1;
+	}
+	values.swap(merged);
+}
+
+// Spread lower 10 bits of value to every third bit.
+static inline unsigned int spreadBits(unsigned int v)
+{
+	v = (v | (v << 16)) & 0x030000ff;
+	v = (v | (v << 8)) & 0x0300f00f;
+	v = (v | (v << 4)) & 0x030c30c3;
+	v = (v | (v << 2)) & 0x09249249;
+	return v;
+}
+
+/**
+ * Welds positions closer than MESH_WELD_EPSILON of the mesh size and
+ * merges equal normals and texture coordinates. Triangles which became
+ * degenerate are removed. Triangles are sorted by Morton code of their
+ * centroids and vertices are renumbered in order of first use, so that
+ * neighbouring triangles read neighbouring vertices.
+ */
+void Mesh::optimize()
+{
+	unsigned int npos = mOrigVtxP.size(), nnorm = mOrigVtxN.size(), nuv = mVtxUV.size(), ntris = mFaces.size();
+	if (npos == 0)
+		return;
+
+	Point3D bmin = mOrigVtxP[0], bmax = mOrigVtxP[0];
+	for (unsigned int i = 1; i < npos; i++) {
+		for (int k = 0; k < 3; k++) {
+			bmin(k) = std::min(bmin(k), mOrigVtxP[i](k));
+			bmax(k) = std::max(bmax(k), mOrigVtxP[i](k));
+		}
+	}
+	Vector3D extent = bmax - bmin;
+	float eps = std::max(extent.length() * MESH_WELD_EPSILON, 1e-30f);
+
+	// Spatial hash with cells of size eps, close positions are in the same
+	// or in neighbouring cells. Cells keep lists of welded positions.
+	std::unordered_map<unsigned long long, int> cells;
+	cells.reserve(npos);
+	std::vector<int> next;
+	std::vector<Point3D> welded;
+	std::vector<int> remapP(npos);
+	next.reserve(npos);
+	welded.reserve(npos);
+	for (unsigned int i = 0; i < npos; i++) {
+		const Point3D& p = mOrigVtxP[i];
+		long long c[3];
+		for (int k = 0; k < 3; k++)
+			c[k] = (long long)((p(k) - bmin(k)) / eps);
+
+		int found = -1;
+		for (int dz = -1; dz <= 1 && found < 0; dz++) {
+			for (int dy = -1; dy <= 1 && found < 0; dy++) {
+				for (int dx = -1; dx <= 1 && found < 0; dx++) {
+					unsigned long long key = ((unsigned long long)(c[0] + dx) & 0x1fffff) |
+						(((unsigned long long)(c[1] + dy) & 0x1fffff) << 21) | (((unsigned long long)(c[2] + dz) & 0x1fffff) << 42);
+					std::unordered_map<unsigned long long, int>::iterator it = cells.find(key);
+					for (int w = (it != cells.end()) ? it->second : -1; w >= 0; w = next[w]) {
+						if (std::fabs(welded[w].x - p.x) <= eps && std::fabs(welded[w].y - p.y) <= eps && std::fabs(welded[w].z - p.z) <= eps) {
+							found = w;
+							break;
+						}
+					}
+				}
+			}
+		}
+		if (found < 0) {
+			unsigned long long key = ((unsigned long long)c[0] & 0x1fffff) | (((unsigned long long)c[1] & 0x1fffff) << 21) |
+				(((unsigned long long)c[2] & 0x1fffff) << 42);
+			std::unordered_map<unsigned long long, int>::iterator it = cells.find(key);
+			found = welded.size();
+			welded.push_back(p);
+			next.push_back((it != cells.end()) ? it->second : -1);
+			cells[key] = found;
+		}
+		remapP[i] = found;
+	}
+	mOrigVtxP.swap(welded);
+
+	std::vector<int> remapN, remapT;
+	mergeEqual(mOrigVtxN, remapN, [](const Vector3D& a, const Vector3D& b) {
+		return a.x < b.x || (a.x == b.x && (a.y < b.y || (a.y == b.y && a.z < b.z)));
+	});
+	mergeEqual(mVtxUV, remapT, [](const UV& a, const UV& b) {
+		return a.u < b.u || (a.u == b.u && a.v < b.v);
+	});
+
+	// Remap indices and drop degenerate triangles, key of kept ones is Morton
+	// code of centroid.
+	std::vector<std::pair<unsigned int, int> > keys;
+	keys.reserve(ntris);
+	for (unsigned int i = 0; i < ntris; i++) {
+		Triangle& t = mFaces[i];
+		for (int j = 0; j < 3; j++) {
+			t.mVtx[j].p = remapP[t.mVtx[j].p];
+			t.mVtx[j].n = remapN[t.mVtx[j].n];
+			t.mVtx[j].t = remapT[t.mVtx[j].t];
+		}
+		const Point3D& p0 = mOrigVtxP[t.mVtx[0].p];
+		const Point3D& p1 = mOrigVtxP[t.mVtx[1].p];
+		const Point3D& p2 = mOrigVtxP[t.mVtx[2].p];
+		Vector3D e1 = p1 - p0;
+		Vector3D e2 = p2 - p0;
+		if (t.mVtx[0].p == t.mVtx[1].p || t.mVtx[1].p == t.mVtx[2].p || t.mVtx[0].p == t.mVtx[2].p || (e1 % e2).length2() == 0.0f)
+			continue;
+
+		unsigned int code = 0;
+		for (int k = 0; k < 3; k++) {
+			float centroid = (p0(k) + p1(k) + p2(k)) / 3.0f;
+			float f = (extent(k) > 0.0f) ? (centroid - bmin(k)) / extent(k) : 0.0f;
+			unsigned int q = (unsigned int)std::min(std::max(f * 1024.0f, 0.0f), 1023.0f);
+			code |= spreadBits(q) << k;
+		}
+		keys.push_back(std::make_pair(code, (int)i));
+	}
+	std::sort(keys.begin(), keys.end());
+
+	std::vector<Triangle> faces;
+	faces.reserve(keys.size());
+	for (unsigned int i = 0; i < keys.size(); i++)
+		faces.push_back(mFaces[keys[i].second]);
+	mFaces.swap(faces);
+
+	// Number vertices in order of first use, unused ones are dropped.
+	std::vector<int> newP(mOrigVtxP.size(), -1), newN(mOrigVtxN.size(), -1), newT(mVtxUV.size(), -1);
+	std::vector<Point3D> positions;
+	std::vector<Vector3D> normals;
+	std::vector<UV> uvs;
+	positions.reserve(mOrigVtxP.size());
+	normals.reserve(mOrigVtxN.size());
+	uvs.reserve(mVtxUV.size());
+	for (unsigned int i = 0; i < mFaces.size(); i++) {
+		for (int j = 0; j < 3; j++) {
+			Triangle::vertex& v = mFaces[i].mVtx[j];
+			if (newP[v.p] < 0) {
+				newP[v.p] = positions.size();
+				positions.push_back(mOrigVtxP[v.p]);
+			}
+			if (newN[v.n] < 0) {
+				newN[v.n] = normals.size();
+				normals.push_back(mOrigVtxN[v.n]);
+			}
+			if (newT[v.t] < 0) {
+				newT[v.t] = uvs.size();
+				uvs.push_back(mVtxUV[v.t]);
+			}
+			v.p = newP[v.p];
+			v.n = newN[v.n];
+			v.t = newT[v.t];
+		}
+	}
+	mOrigVtxP.swap(positions);
+	mOrigVtxN.swap(normals);
+	mVtxUV.swap(uvs);
+
+	mOrigP.set(mOrigVtxP);
+	mOrigN.set(mOrigVtxN);
+	mUV.set(mVtxUV);
+
+	cout << "optimized mesh: " << npos << " -> " << mOrigVtxP.size() << " positions, " << nnorm << " -> " << mOrigVtxN.size()
+		<< " normals, " << nuv << " -> " << mVtxUV.size() << " uvs, " << ntris - mFaces.size() << " degenerate triangles removed" << endl;
+}
+
+#if MESH_LOD
+// Quadric of squared distances to planes, symmetric 4x4 matrix stored as
+// xx, xy, xz, xw, yy, yz, yw, zz, zw, ww.
+struct Quadric {
+	double a[10];
+
+	Quadric() { std::fill(a, a + 10, 0.0); }
+	void addPlane(const Vector3D& n, float d, double w)
+	{
+		a[0] += w * n.x * n.x; a[1] += w * n.x * n.y; a[2] += w * n.x * n.z; a[3] += w * n.x * d;
+		a[4] += w * n.y * n.y; a[5] += w * n.y * n.z; a[6] += w * n.y * d;
+		a[7] += w * n.z * n.z; a[8] += w * n.z * d; a[9] += w * d * d;
+	}
+	void add(const Quadric& q)
+	{
+		for (int i = 0; i < 10; i++)
+			a[i] += q.a[i];
+	}
+	double error(const Point3D& p) const
+	{
+		double x = p.x, y = p.y, z = p.z;
+		return a[0] * x * x + 2.0 * (a[1] * x * y + a[2] * x * z + a[3] * x) + a[4] * y * y
+			+ 2.0 * (a[5] * y * z + a[6] * y) + a[7] * z * z + 2.0 * a[8] * z + a[9];
+	}
+	// Point of minimal error by Cramer's rule, false if the matrix is close to singular.
+	bool minimum(Point3D& p) const
+	{
+		double det = a[0] * (a[4] * a[7] - a[5] * a[5]) - a[1] * (a[1] * a[7] - a[5] * a[2]) + a[2] * (a[1] * a[5] - a[4] * a[2]);
+		double scale = a[0] + a[4] + a[7];
+		if (std::fabs(det) <= 1e-6 * scale * scale * scale)
+			return false;
+		double bx = -a[3], by = -a[6], bz = -a[8];
+		double x = bx * (a[4] * a[7] - a[5] * a[5]) - a[1] * (by * a[7] - a[5] * bz) + a[2] * (by * a[5] - a[4] * bz);
+		double y = a[0] * (by * a[7] - a[5] * bz) - bx * (a[1] * a[7] - a[5] * a[2]) + a[2] * (a[1] * bz - by * a[2]);
+		double z = a[0] * (a[4] * bz - by * a[5]) - a[1] * (a[1] * bz - by * a[2]) + bx * (a[1] * a[5] - a[4] * a[2]);
+		p = Point3D((float)(x / det), (float)(y / det), (float)(z / det));
+		return true;
+	}
+};
+
+// Merge of vertex v into vertex u at position p, valid while both vertices
+// have the same stamps.
+struct EdgeCollapse {
+	double cost;
+	int u, v;
+	unsigned int stampU, stampV;
+	Point3D p;
+
+	// The cheapest collapse is on top of priority queue.
+	bool operator<(const EdgeCollapse& c) const { return cost > c.cost; }
+};
+
+/**
+ * Builds simplified proxy of the loaded mesh by quadric edge collapse. Every
+ * vertex has quadric of planes of its triangles, boundary edges add planes
+ * perpendicular to their triangles. Edges are collapsed in order of error
+ * of the best position of the merged vertex until MESH_LOD_RATIO of triangles
+ * remains. Collapses flipping a triangle or changing topology are skipped.
+ * Corners of triangles keep their normals and UVs.
+ */
+void Mesh::buildLod()
+{
+	unsigned int npos = mOrigP.size, ntris = mFaces.size();
+	if (ntris < MESH_LOD_MIN_TRIANGLES)
+		return;
+	unsigned int target = (unsigned int)(ntris * MESH_LOD_RATIO);
+	// Boundary planes are stronger, so the outline of open meshes is kept.
+	const double boundaryWeight = 10.0;
+
+	std::vector<Point3D> pos(mOrigP.data, mOrigP.data + npos);
+	std::vector<int> tri(3 * ntris);
+	std::vector<bool> removed(ntris, false), dead(npos, false);
+	std::vector<unsigned int> stamp(npos, 0);
+	std::vector<Quadric> quadrics(npos);
+	std::vector<std::vector<int> > vertexFaces(npos);
+	std::unordered_map<unsigned long long, int> edges;
+	edges.reserve(3 * ntris / 2);
+	auto edgeKey = [](int a, int b) {
+		return ((unsigned long long)std::min(a, b) << 32) | (unsigned int)std::max(a, b);
+	};
+
+	for (unsigned int i = 0; i < ntris; i++) {
+		for (int j = 0; j < 3; j++) {
+			tri[3 * i + j] = mFaces[i].mVtx[j].p;
+			vertexFaces[tri[3 * i + j]].push_back(i);
+		}
+		for (int j = 0; j < 3; j++)
+			edges[edgeKey(tri[3 * i + j], tri[3 * i + (j + 1) % 3])]++;
+
+		const Point3D& p0 = pos[tri[3 * i]];
+		Vector3D n = Vector3D(pos[tri[3 * i + 1]] - p0) % Vector3D(pos[tri[3 * i + 2]] - p0);
+		if (n.length2() == 0.0f)
+			continue;
+		n.normalize();
+		for (int j = 0; j < 3; j++)
+			quadrics[tri[3 * i + j]].addPlane(n, -(n * Vector3D(p0)), 1.0);
+	}
+	for (unsigned int i = 0; i < ntris; i++) {
+		const Point3D& p0 = pos[tri[3 * i]];
+		Vector3D n = Vector3D(pos[tri[3 * i + 1]] - p0) % Vector3D(pos[tri[3 * i + 2]] - p0);
+		for (int j = 0; j < 3; j++) {
+			int a = tri[3 * i + j], b = tri[3 * i + (j + 1) % 3];
+			if (edges[edgeKey(a, b)] != 1)
+				continue;
+			Vector3D m = Vector3D(pos[b] - pos[a]) % n;
+			if (m.length2() == 0.0f)
+				continue;
+			m.normalize();
+			float d = -(m * Vector3D(pos[a]));
+			quadrics[a].addPlane(m, d, boundaryWeight);
+			quadrics[b].addPlane(m, d, boundaryWeight);
+		}
+	}
+
+	std::priority_queue<EdgeCollapse> heap;
+	auto evaluate = [&](int u, int v) {
+		Quadric q = quadrics[u];
+		q.add(quadrics[v]);
+		EdgeCollapse c;
+		c.u = u;
+		c.v = v;
+		c.stampU = stamp[u];
+		c.stampV = stamp[v];
+		// Optimal position far from the edge is caused by nearly flat quadric.
+		Point3D candidates[4] = { pos[u], pos[v], Point3D(0.5f * (pos[u].x + pos[v].x), 0.5f * (pos[u].y + pos[v].y), 0.5f * (pos[u].z + pos[v].z)) };
+		int count = 3;
+		if (q.minimum(candidates[3]) && Vector3D(candidates[3] - candidates[2]).length2() <= Vector3D(pos[u] - pos[v]).length2())
+			count = 4;
+		c.cost = INF;
+		for (int k = 0; k < count; k++) {
+			double cost = q.error(candidates[k]);
+			if (cost < c.cost) {
+				c.cost = cost;
+				c.p = candidates[k];
+			}
+		}
+		heap.push(c);
+	};
+	for (std::unordered_map<unsigned long long, int>::iterator it = edges.begin(); it != edges.end(); ++it)
+		evaluate((int)(it->first >> 32), (int)(it->first & 0xffffffff));
+	edges.clear();
+
+	// Vertices adjacent to both ends must be the opposite vertices of shared
+	// triangles, moved triangles must not turn by more than about 80 degrees.
+	std::vector<int> neighborsU, neighborsV;
+	auto collapsible = [&](int u, int v, const Point3D& p) {
+		int shared = 0;
+		neighborsU.clear();
+		neighborsV.clear();
+		for (int end = 0; end < 2; end++) {
+			int a = end ? v : u, b = end ? u : v;
+			std::vector<int>& neighbors = end ? neighborsV : neighborsU;
+			for (unsigned int i = 0; i < vertexFaces[a].size(); i++) {
+				int f = vertexFaces[a][i];
+				if (removed[f])
+					continue;
+				const int* t = &tri[3 * f];
+				for (int k = 0; k < 3; k++) {
+					if (t[k] != a && t[k] != b)
+						neighbors.push_back(t[k]);
+				}
+				if (t[0] == b || t[1] == b || t[2] == b) {
+					shared += end ? 0 : 1;
+					continue;
+				}
+				Point3D moved[3] = { pos[t[0]], pos[t[1]], pos[t[2]] };
+				for (int k = 0; k < 3; k++) {
+					if (t[k] == a)
+						moved[k] = p;
+				}
+				Vector3D before = Vector3D(pos[t[1]] - pos[t[0]]) % Vector3D(pos[t[2]] - pos[t[0]]);
+				Vector3D after = Vector3D(moved[1] - moved[0]) % Vector3D(moved[2] - moved[0]);
+				if (before * after <= 0.2f * before.length() * after.length())
+					return false;
+			}
+		}
+		std::sort(neighborsU.begin(), neighborsU.end());
+		std::sort(neighborsV.begin(), neighborsV.end());
+		neighborsU.erase(std::unique(neighborsU.begin(), neighborsU.end()), neighborsU.end());
+		neighborsV.erase(std::unique(neighborsV.begin(), neighborsV.end()), neighborsV.end());
+		std::vector<int>::iterator itU = neighborsU.begin(), itV = neighborsV.begin();
+		int common = 0;
+		while (itU != neighborsU.end() && itV != neighborsV.end()) {
+			if (*itU < *itV)
+				++itU;
+			else if (*itV < *itU)
+				++itV;
+			else {
+				common++;
+				++itU;
+				++itV;
+			}
+		}
+		return shared > 0 && common == shared;
+	};
+
+	double maxCost = 0.0;
+	unsigned int live = ntris;
+	std::vector<int> around;
+	while (live > target && !heap.empty()) {
+		EdgeCollapse c = heap.top();
+		heap.pop();
+		if (dead[c.u] || dead[c.v] || stamp[c.u] != c.stampU || stamp[c.v] != c.stampV || !collapsible(c.u, c.v, c.p))
+			continue;
+
+		// Triangles of v are moved to u, the shared ones disappear.
+		int u = c.u, v = c.v;
+		pos[u] = c.p;
+		quadrics[u].add(quadrics[v]);
+		dead[v] = true;
+		for (unsigned int i = 0; i < vertexFaces[v].size(); i++) {
+			int f = vertexFaces[v][i];
+			if (removed[f])
+				continue;
+			int* t = &tri[3 * f];
+			if (t[0] == u || t[1] == u || t[2] == u) {
+				removed[f] = true;
+				live--;
+				continue;
+			}
+			for (int k = 0; k < 3; k++) {
+				if (t[k] == v)
+					t[k] = u;
+			}
+			vertexFaces[u].push_back(f);
+		}
+		std::vector<int>().swap(vertexFaces[v]);
+		vertexFaces[u].erase(std::remove_if(vertexFaces[u].begin(), vertexFaces[u].end(), [&](int f) { return removed[f]; }),
+			vertexFaces[u].end());
+		stamp[u]++;
+		maxCost = std::max(maxCost, c.cost);
+
+		// Edges around u are evaluated again with the merged quadric.
+		around.clear();
+		for (unsigned int i = 0; i < vertexFaces[u].size(); i++) {
+			for (int k = 0; k < 3; k++) {
+				if (tri[3 * vertexFaces[u][i] + k] != u)
+					around.push_back(tri[3 * vertexFaces[u][i] + k]);
+			}
+		}
+		std::sort(around.begin(), around.end());
+		around.erase(std::unique(around.begin(), around.end()), around.end());
+		for (unsigned int i = 0; i < around.size(); i++)
+			evaluate(u, around[i]);
+	}
+
+	// Kept vertices are numbered in order of first use like in optimize().
+	std::shared_ptr<Mesh> lod(new Mesh());
+	std::vector<int> newP(npos, -1), newN(mOrigN.size, -1), newT(mUV.size, -1);
+	lod->mFaces.reserve(live);
+	for (unsigned int i = 0; i < ntris; i++) {
+		if (removed[i])
+			continue;
+		Triangle::vertex vtx[3];
+		for (int j = 0; j < 3; j++) {
+			vtx[j] = mFaces[i].mVtx[j];
+			int p = tri[3 * i + j];
+			if (newP[p] < 0) {
+				newP[p] = lod->mOrigVtxP.size();
+				lod->mOrigVtxP.push_back(pos[p]);
+			}
+			if (newN[vtx[j].n] < 0) {
+				newN[vtx[j].n] = lod->mOrigVtxN.size();
+				lod->mOrigVtxN.push_back(mOrigN[vtx[j].n]);
+			}
+			if (newT[vtx[j].t] < 0) {
+				newT[vtx[j].t] = lod->mVtxUV.size();
+				lod->mVtxUV.push_back(mUV[vtx[j].t]);
+			}
+			vtx[j].p = newP[p];
+			vtx[j].n = newN[vtx[j].n];
+			vtx[j].t = newT[vtx[j].t];
+		}
+		lod->mFaces.push_back(Triangle(lod.get(), vtx[0], vtx[1], vtx[2], mFaces[i].mMaterial));
+	}
+	lod->mOrigP.set(lod->mOrigVtxP);
+	lod->mOrigN.set(lod->mOrigVtxN);
+	lod->mUV.set(lod->mVtxUV);
+	lod->mLodError = (float)std::sqrt(maxCost);
+	mLodSource = lod;
+
+	cout << "simplified mesh: " << ntris << " -> " << lod->mFaces.size() << " triangles, error " << lod->mLodError << endl;
+}
+#endif // MESH_LOD
+
+// Types of PLY properties.
+enum PLYType { PLY_CHAR, PLY_UCHAR, PLY_SHORT, PLY_USHORT, PLY_INT, PLY_UINT, PLY_FLOAT, PLY_DOUBLE, PLY_INVALID };
+
+static PLYType getPLYType(const std::string& name)
+{
+	if (name == "char" || name == "int8") return PLY_CHAR;
+	if (name == "uchar" || name == "uint8") return PLY_UCHAR;
+	if (name == "short" || name == "int16") return PLY_SHORT;
+	if (name == "ushort" || name == "uint16") return PLY_USHORT;
+	if (name == "int" || name == "int32") return PLY_INT;
+	if (name == "uint" || name == "uint32") return PLY_UINT;
+	if (name == "float" || name == "float32") return PLY_FLOAT;
+	if (name == "double" || name == "float64") return PLY_DOUBLE;
+	return PLY_INVALID;
+}
+
+static const int plyTypeSize[] = { 1, 1, 2, 2, 4, 4, 4, 8 };
+
+// Property of PLY element, list has type of its count and of its items.
+struct PLYProperty {
+	std::string name;
+	PLYType type;
+	PLYType countType;
+	bool isList;
+};
+
+struct PLYElement {
+	std::string name;
+	size_t count;
+	std::vector<PLYProperty> properties;
+};
+
+// Read one binary value of given type, bytes are swapped if file has other byte order.
+static inline double readPLYValue(const unsigned char* p, PLYType type, bool swap)
+{
+	unsigned char b[8];
+	int size = plyTypeSize[type];
+	if (swap) {
+		for (int i = 0; i < size; i++)
+			b[i] = p[size - 1 - i];
+	}
+	else
+		memcpy(b, p, size);
+
+	switch (type) {
+	case PLY_CHAR: { signed char v; memcpy(&v, b, 1); return v; }
+	case PLY_UCHAR: return b[0];
+	case PLY_SHORT: { short v; memcpy(&v, b, 2); return v; }
+	case PLY_USHORT: { unsigned short v; memcpy(&v, b, 2); return v; }
+	case PLY_INT: { int v; memcpy(&v, b, 4); return v; }
+	case PLY_UINT: { unsigned int v; memcpy(&v, b, 4); return v; }
+	case PLY_FLOAT: { float v; memcpy(&v, b, 4); return v; }
+	default: { double v; memcpy(&v, b, 8); return v; }
+	}
+}
+
+// True if three properties from first are floats stored one after other,
+// so they are copied as Point3D or Vector3D when byte order matches.
+static inline bool isPLYFloat3(const int* offset, const PLYType* type, int first)
+{
+	for (int i = 0; i < 3; i++) {
+		if (offset[first + i] != offset[first] + 4 * i || type[first + i] != PLY_FLOAT)
+			return false;
+	}
+	return true;
+}
+
+// Skip one element record with lists, return NULL if file ends.
+static const unsigned char* skipPLYRecord(const unsigned char* p, const unsigned char* end, const PLYElement& element, bool swap)
+{
+	for (unsigned int i = 0; i < element.properties.size(); i++) {
+		const PLYProperty& prop = element.properties[i];
+		if (prop.isList) {
+			if (p + plyTypeSize[prop.countType] > end)
+				return NULL;
+			size_t n = (size_t)readPLYValue(p, prop.countType, swap);
+			p += plyTypeSize[prop.countType] + n * plyTypeSize[prop.type];
+		}
+		else
+			p += plyTypeSize[prop.type];
+		if (p > end)
+			return NULL;
+	}
+	return p;
+}
+
+/**
+ * Loads a mesh file in the binary PLY format (little or big endian).
+ * Vertex element gives positions and optionally normals (nx, ny, nz) and
+ * texture coordinates (u, v or s, t), face element gives lists of vertex
+ * indices, polygons are triangulated as fans. Other elements are skipped.
+ * Records of vertices have fixed size, so the whole vertex block is read
+ * with precomputed offsets of properties. Native float positions and normals
+ * and native triangle records are copied, other files are converted value
+ * by value.
+ */
+void Mesh::loadPLY(const std::string& filename)
+{
+	MappedFile file;
+	if (!file.open(filename)) throw std::runtime_error("could not open file "+filename);
+	const char* begin = (const char*)file.getData();
+	const char* end = begin + file.getSize();
+
+	// ----------- header --------------
+
+	const char* line = begin;
+	if (!isKeyword(skipSpaces(line, end), findLineEnd(line, end), "ply"))
+		throw std::runtime_error("not a PLY file "+filename);
+
+	bool little = false, headerDone = false;
+	std::vector<PLYElement> elements;
+	while (line < end && !headerDone) {
+		const char* lineEnd = findLineEnd(line, end);
+		const char* p = skipSpaces(line, lineEnd);
+		std::vector<std::string> words;
+		while (p < lineEnd) {
+			const char* wordEnd = skipWord(p, lineEnd);
+			words.push_back(std::string(p, wordEnd));
+			p = skipSpaces(wordEnd, lineEnd);
+		}
+		line = lineEnd + 1;
+
+		if (words.empty())
+			continue;
+		if (words[0] == "format" && words.size() >= 2) {
+			if (words[1] == "binary_little_endian")
+				little = true;
+			else if (words[1] != "binary_big_endian")
+				throw std::runtime_error("unsupported PLY format "+words[1]+" in "+filename);
+		}
+		else if (words[0] == "element" && words.size() >= 3) {
+			PLYElement element;
+			element.name = words[1];
+			element.count = (size_t)atoll(words[2].c_str());
+			elements.push_back(element);
+		}
+		else if (words[0] == "property" && !elements.empty()) {
+			PLYProperty prop;
+			prop.isList = words.size() >= 5 && words[1] == "list";
+			prop.countType = prop.isList ? getPLYType(words[2]) : PLY_UCHAR;
+			prop.type = getPLYType(words[prop.isList ? 3 : 1]);
+			prop.name = words.back();
+			if (words.size() < 3 || prop.type == PLY_INVALID || prop.countType == PLY_INVALID)
+				throw std::runtime_error("invalid PLY property in "+filename);
+			elements.back().properties.push_back(prop);
+		}
+		else if (words[0] == "end_header")
+			headerDone = true;
+	}
+	if (!headerDone)
+		throw std::runtime_error("invalid PLY header in "+filename);
+
+	// Byte order of this machine.
+	unsigned int one = 1;
+	bool swap = (*(unsigned char*)&one == 1) != little;
+
+	MaterialProperties mp;
+	mp.reset();
+	mMaterials.push_back(CreateMaterial(mp));
+
+	// ----------- data --------------
+
+	const unsigned char* p = (const unsigned char*)std::min(line, end);
+	const unsigned char* dataEnd = (const unsigned char*)end;
+	bool has_normals = false, has_uv = false;
+	for (unsigned int e = 0; e < elements.size(); e++) {
+		const PLYElement& element = elements[e];
+
+		if (element.name == "vertex") {
+			// Offsets of known properties in record, -1 if missing.
+			enum { X, Y, Z, NX, NY, NZ, U, V, ATTRIBUTES };
+			int offset[ATTRIBUTES];
+			PLYType type[ATTRIBUTES];
+			for (int i = 0; i < ATTRIBUTES; i++)
+				offset[i] = -1;
+			int stride = 0;
+			for (unsigned int i = 0; i < element.properties.size(); i++) {
+				const PLYProperty& prop = element.properties[i];
+				if (prop.isList)
+					throw std::runtime_error("list in PLY vertex is not supported in "+filename);
+				int a = -1;
+				if (prop.name == "x") a = X;
+				else if (prop.name == "y") a = Y;
+				else if (prop.name == "z") a = Z;
+				else if (prop.name == "nx") a = NX;
+				else if (prop.name == "ny") a = NY;
+				else if (prop.name == "nz") a = NZ;
+				else if (prop.name == "u" || prop.name == "s" || prop.name == "texture_u") a = U;
+				else if (prop.name == "v" || prop.name == "t" || prop.name == "texture_v") a = V;
+				if (a >= 0) {
+					offset[a] = stride;
+					type[a] = prop.type;
+				}
+				stride += plyTypeSize[prop.type];
+			}
+			if (offset[X] < 0 || offset[Y] < 0 || offset[Z] < 0)
+				throw std::runtime_error("PLY vertex without position in "+filename);
+			if ((size_t)(dataEnd - p) < element.count * stride)
+				throw std::runtime_error("PLY file is truncated "+filename);
+			has_normals = offset[NX] >= 0 && offset[NY] >= 0 && offset[NZ] >= 0;
+			has_uv = offset[U] >= 0 && offset[V] >= 0;
+
+			bool copyP = !swap && isPLYFloat3(offset, type, X);
+			bool copyN = !swap && has_normals && isPLYFloat3(offset, type, NX);
+
+			mOrigVtxP.resize(element.count);
+			if (has_normals)
+				mOrigVtxN.resize(element.count);
+			if (has_uv)
+				mVtxUV.resize(element.count);
+			for (size_t i = 0; i < element.count; i++, p += stride) {
+				if (copyP)
+					memcpy(&mOrigVtxP[i], p + offset[X], sizeof(Point3D));
+				else
+					mOrigVtxP[i] = Point3D((float)readPLYValue(p + offset[X], type[X], swap),
+						(float)readPLYValue(p + offset[Y], type[Y], swap), (float)readPLYValue(p + offset[Z], type[Z], swap));
+				if (copyN)
+					memcpy(&mOrigVtxN[i], p + offset[NX], sizeof(Vector3D));
+				else if (has_normals)
+					mOrigVtxN[i] = Vector3D((float)readPLYValue(p + offset[NX], type[NX], swap),
+						(float)readPLYValue(p + offset[NY], type[NY], swap), (float)readPLYValue(p + offset[NZ], type[NZ], swap));
+				if (has_uv)
+					mVtxUV[i] = UV((float)readPLYValue(p + offset[U], type[U], swap), (float)readPLYValue(p + offset[V], type[V], swap));
+			}
+		}
+		else if (element.name == "face") {
+			int indices = -1;
+			for (unsigned int i = 0; i < element.properties.size(); i++) {
+				const PLYProperty& prop = element.properties[i];
+				if (prop.isList && (prop.name == "vertex_indices" || prop.name == "vertex_index"))
+					indices = i;
+			}
+			if (indices < 0)
+				throw std::runtime_error("PLY face without vertex indices in "+filename);
+
+			// Most of scanned models are triangulated. Triangle with uchar count
+			// and native int indices, which are the last list of record, is
+			// copied from record, other faces are read by properties.
+			const PLYProperty& indexList = element.properties[indices];
+			bool copyFaces = !swap && indices + 1 == (int)element.properties.size() && indexList.countType == PLY_UCHAR
+				&& (indexList.type == PLY_INT || indexList.type == PLY_UINT);
+			size_t listOffset = 0;
+			for (int i = 0; i < indices; i++) {
+				copyFaces = copyFaces && !element.properties[i].isList;
+				listOffset += plyTypeSize[element.properties[i].type];
+			}
+			size_t triangleSize = listOffset + 1 + 3 * sizeof(int);
+
+			mFaces.reserve(element.count);
+			size_t nverts = mOrigVtxP.size();
+			for (size_t f = 0; f < element.count; f++) {
+				if (copyFaces && (size_t)(dataEnd - p) >= triangleSize && p[listOffset] == 3) {
+					unsigned int idx[3];
+					memcpy(idx, p + listOffset + 1, sizeof(idx));
+					Triangle::vertex vtx[3];
+					for (int k = 0; k < 3; k++) {
+						if (idx[k] >= nverts)
+							throw std::runtime_error("invalid PLY face "+int2str((int)f)+" in "+filename);
+						vtx[k].p = vtx[k].n = vtx[k].t = (int)idx[k];
+					}
+					mFaces.push_back(Triangle(this, vtx[0], vtx[1], vtx[2], 0));
+					p += triangleSize;
+					continue;
+				}
+				const unsigned char* next = skipPLYRecord(p, dataEnd, element, swap);
+				if (next == NULL)
+					throw std::runtime_error("PLY file is truncated "+filename);
+				// Properties before indices.
+				for (int i = 0; i < indices; i++) {
+					const PLYProperty& prop = element.properties[i];
+					if (prop.isList)
+						p += plyTypeSize[prop.countType] + (size_t)readPLYValue(p, prop.countType, swap) * plyTypeSize[prop.type];
+					else
+						p += plyTypeSize[prop.type];
+				}
+
+				const PLYProperty& prop = element.properties[indices];
+				int n = (int)readPLYValue(p, prop.countType, swap);
+				p += plyTypeSize[prop.countType];
+				Triangle::vertex vtx[3];
+				for (int k = 0; k < n; k++, p += plyTypeSize[prop.type]) {
+					long long idx = (long long)readPLYValue(p, prop.type, swap);
+					if (idx < 0 || (size_t)idx >= nverts)
+						throw std::runtime_error("invalid PLY face "+int2str((int)f)+" in "+filename);
+					// Same index for all attributes, they are stored per vertex.
+					Triangle::vertex& v = vtx[std::min(k, 2)];
+					v.p = v.n = v.t = (int)idx;
+					if (k >= 2) {
+						mFaces.push_back(Triangle(this, vtx[0], vtx[1], vtx[2], 0));
+						vtx[1] = vtx[2];
+					}
+				}
+				p = next;
+			}
+		}
+		else {
+			for (size_t i = 0; i < element.count && p != NULL; i++)
+				p = skipPLYRecord(p, dataEnd, element, swap);
+			if (p == NULL)
+				throw std::runtime_error("PLY file is truncated "+filename);
+		}
+	}
+
+	file.close();
+
+	completeAttributes(has_normals, has_uv);
+}
+
+// Faces of mesh in cache, three vertices and index of material of each face.
+struct CachedFaces {
+	std::vector<Triangle::vertex> vertices;
+	std::vector<int> materials;
+};
+
+/**
+ * Loads the mesh from binary cache. Sections of the mesh are vertex positions,
+ * normals, texture coordinates, vertex indices and material of faces, see
+ * addCacheSections(). They are followed by name of material file, the same
+ * sections of the proxy and its error, proxy sections are empty without
+ * proxy. Vertex attributes of the mesh stay in the mapped file, only
+ * triangles are created. Returns false if the cache is missing or belongs
+ * to other file.
+ */
+bool Mesh::loadCache(const std::string& filename, unsigned long long stamp)
+{
+	CachedFaces faces;
+	std::vector<char> mtlLib;
+	std::vector<float> lodError;
+	if (!mCache.open(filename, CACHE_MESH, stamp, 0) || mCache.getSectionsCnt() != 12
+		|| !mCache.getSection(5, mtlLib) || !mCache.getSection(11, lodError) || lodError.size() > 1
+		|| !readCacheSections(mCache, 0, false, faces) || faces.materials.empty()) {
+		clear();
+		return false;
+	}
+#if MESH_LOD
+	// Proxy attributes are copied, so they outlive the mapping.
+	std::shared_ptr<Mesh> lod;
+	CachedFaces lodFaces;
+	if (!lodError.empty()) {
+		lod.reset(new Mesh());
+		if (!lod->readCacheSections(mCache, 6, true, lodFaces)) {
+			clear();
+			return false;
+		}
+		lod->mLodError = lodError[0];
+	}
+#endif // MESH_LOD
+
+	// Same materials as loadOBJ() creates.
+	MaterialProperties mp;
+	mp.reset();
+	mMaterials.push_back(CreateMaterial(mp));
+	mMtlLib.assign(mtlLib.begin(), mtlLib.end());
+	if (!mMtlLib.empty())
+		loadMTL(mMtlLib);
+
+	createFaces(faces, mMaterials);
+#if MESH_LOD
+	if (lod) {
+		lod->createFaces(lodFaces, mMaterials);
+		mLodSource = lod;
+	}
+#endif // MESH_LOD
+	return true;
+}
+
+/**
+ * Reads vertex attributes from sections first to first + 2 of the cache and
+ * vertex indices and materials of faces from the next two. Attributes are
+ * copied if copy is set, otherwise they stay in the mapped file. Returns
+ * false if sizes of sections or indices do not fit.
+ */
+bool Mesh::readCacheSections(AcceleratorCache& cache, unsigned int first, bool copy, CachedFaces& faces)
+{
+	const std::vector<Triangle::vertex>& vertices = faces.vertices;
+	if (!cache.getSection(first + 3, faces.vertices) || !cache.getSection(first + 4, faces.materials)
+		|| vertices.size() != 3 * faces.materials.size())
+		return false;
+	CacheSection positions = cache.getSection(first);
+	CacheSection normals = cache.getSection(first + 1);
+	CacheSection uvs = cache.getSection(first + 2);
+	if (positions.size % sizeof(Point3D) != 0 || normals.size % sizeof(Vector3D) != 0 || uvs.size % sizeof(UV) != 0)
+		return false;
+	unsigned int npos = positions.size / sizeof(Point3D);
+	unsigned int nnorm = normals.size / sizeof(Vector3D);
+	unsigned int nuv = uvs.size / sizeof(UV);
+	if (copy) {
+		mOrigVtxP.assign((const Point3D*)positions.data, (const Point3D*)positions.data + npos);
+		mOrigVtxN.assign((const Vector3D*)normals.data, (const Vector3D*)normals.data + nnorm);
+		mVtxUV.assign((const UV*)uvs.data, (const UV*)uvs.data + nuv);
+		mOrigP.set(mOrigVtxP);
+		mOrigN.set(mOrigVtxN);
+		mUV.set(mVtxUV);
+	}
+	else {
+		mOrigP.set(positions.data, npos);
+		mOrigN.set(normals.data, nnorm);
+		mUV.set(uvs.data, nuv);
+	}
+
+	// Indices out of arrays would be read during rendering.
+	for (unsigned int i = 0; i < vertices.size(); i++) {
+		if ((unsigned int)vertices[i].p >= npos || (unsigned int)vertices[i].n >= nnorm
+			|| (unsigned int)vertices[i].t >= nuv)
+			return false;
+	}
+	return true;
+}
+
+/**
+ * Creates triangles from vertex indices and indices of materials in given
+ * array, faces with other material index have no material.
+ */
+void Mesh::createFaces(const CachedFaces& faces, const std::vector<Material*>& mtls)
+{
+	const std::vector<Triangle::vertex>& vertices = faces.vertices;
+	const std::vector<int>& materials = faces.materials;
+	mFaces.reserve(materials.size());
+	for (unsigned int i = 0; i < materials.size(); i++) {
+		Material* mtl = (materials[i] >= 0 && materials[i] < (int)mtls.size()) ? mtls[materials[i]] : 0;
+		mFaces.push_back(Triangle(this, vertices[3 * i], vertices[3 * i + 1], vertices[3 * i + 2], mtl));
+	}
+}
+
+/**
+ * Writes the loaded mesh and its proxy to binary cache, see loadCache().
+ */
+void Mesh::saveCache(const std::string& filename, unsigned long long stamp)
+{
+	CachedFaces faces, lodFaces;
+	std::vector<float> lodError;
+	std::vector<CacheSection> sections;
+	addCacheSections(sections, faces, mMaterials);
+	sections.push_back(CacheSection(mMtlLib.data(), mMtlLib.size()));
+#if MESH_LOD
+	if (mLodSource) {
+		mLodSource->addCacheSections(sections, lodFaces, mMaterials);
+		lodError.push_back(mLodSource->mLodError);
+	}
+	else
+#endif // MESH_LOD
+		sections.resize(sections.size() + 5);
+	sections.push_back(CacheSection(lodError.data(), lodError.size() * sizeof(float)));
+	if (!mCache.write(filename, CACHE_MESH, stamp, 0, sections))
+		cout << "Mesh cache " << filename << " can not be written." << endl;
+}
+
+/**
+ * Adds sections of vertex attributes and faces to cache sections. Vertex
+ * indices and indices of materials in mtls are collected to faces, they
+ * must live until the cache is written.
+ */
+void Mesh::addCacheSections(std::vector<CacheSection>& sections, CachedFaces& faces, const std::vector<Material*>& mtls) const
+{
+	std::vector<Triangle::vertex>& vertices = faces.vertices;
+	std::vector<int>& materials = faces.materials;
+	vertices.resize(3 * mFaces.size());
+	materials.assign(mFaces.size(), -1);
+	for (unsigned int i = 0; i < mFaces.size(); i++) {
+		for (int j = 0; j < 3; j++)
+			vertices[3 * i + j] = mFaces[i].mVtx[j];
+		for (unsigned int m = 0; m < mtls.size(); m++) {
+			if (mFaces[i].mMaterial == mtls[m]) {
+				materials[i] = m;
+				break;
+			}
+		}
+	}
+
+	sections.push_back(CacheSection(mOrigP.data, mOrigP.size * sizeof(Point3D)));
+	sections.push_back(CacheSection(mOrigN.data, mOrigN.size * sizeof(Vector3D)));
+	sections.push_back(CacheSection(mUV.data, mUV.size * sizeof(UV)));
+	sections.push_back(CacheSection(vertices.data(), vertices.size() * sizeof(Triangle::vertex)));
+	sections.push_back(CacheSection(materials.data(), materials.size() * sizeof(int)));
+}
+
+// Call f(begin, end) on parts of range [0, n) on separate threads, each part
+// has at least minChunk items. Small ranges are done on calling thread.
+template <class F> static void parallelFor(int n, int minChunk, F f)
+{
+	int parts = std::min<int>(std::max(1u, std::thread::hardware_concurrency()), n / minChunk + 1);
+	std::vector<std::thread> threads;
+	for (int i = 1; i < parts; i++)
+		threads.push_back(std::thread(f, (int)((long long)n * i / parts), (int)((long long)n * (i + 1) / parts)));
+	f(0, n / parts);
+	for (unsigned int i = 0; i < threads.size(); i++)
+		threads[i].join();
+}
+
+// Transform points by matrix, four points per iteration. Components are
+// gathered to SSE registers, so results equal Matrix::operator*.
+static void transformPoints(const Matrix& m, const Point3D* src, Point3D* dst, int begin, int end)
+{
+	__m128 e[12];
+	for (int i = 0; i < 12; i++)
+		e[i] = _mm_set1_ps(m(i / 4, i % 4));
+
+	int i = begin;
+	for (; i + 4 <= end; i += 4) {
+		const Point3D* p = src + i;
+		__m128 x = _mm_setr_ps(p[0].x, p[1].x, p[2].x, p[3].x);
+		__m128 y = _mm_setr_ps(p[0].y, p[1].y, p[2].y, p[3].y);
+		__m128 z = _mm_setr_ps(p[0].z, p[1].z, p[2].z, p[3].z);
+		float r[3][4];
+		for (int k = 0; k < 3; k++) {
+			__m128 v = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e[4 * k], x), _mm_mul_ps(e[4 * k + 1], y)),
+				_mm_mul_ps(e[4 * k + 2], z)), e[4 * k + 3]);
+			_mm_storeu_ps(r[k], v);
+		}
+		for (int j = 0; j < 4; j++)
+			dst[i + j] = Point3D(r[0][j], r[1][j], r[2][j]);
+	}
+	for (; i < end; i++)
+		dst[i] = m * src[i];
+}
+
+// Transform and normalize normals, four normals per iteration.
+static void transformNormals(const Matrix& m, const Vector3D* src, Vector3D* dst, int begin, int end)
+{
+	__m128 e[12];
+	for (int i = 0; i < 12; i++)
+		e[i] = _mm_set1_ps(m(i / 4, i % 4));
+	const __m128 one = _mm_set1_ps(1.0f);
+
+	int i = begin;
+	for (; i + 4 <= end; i += 4) {
+		const Vector3D* n = src + i;
+		__m128 x = _mm_setr_ps(n[0].x, n[1].x, n[2].x, n[3].x);
+		__m128 y = _mm_setr_ps(n[0].y, n[1].y, n[2].y, n[3].y);
+		__m128 z = _mm_setr_ps(n[0].z, n[1].z, n[2].z, n[3].z);
+		__m128 v[3];
+		for (int k = 0; k < 3; k++)
+			v[k] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e[4 * k], x), _mm_mul_ps(e[4 * k + 1], y)), _mm_mul_ps(e[4 * k + 2], z));
+		__m128 length = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(v[0], v[0]), _mm_mul_ps(v[1], v[1])), _mm_mul_ps(v[2], v[2])));
+		__m128 l = _mm_div_ps(one, length);
+		float r[3][4];
+		for (int k = 0; k < 3; k++)
+			_mm_storeu_ps(r[k], _mm_mul_ps(v[k], l));
+		for (int j = 0; j < 4; j++)
+			dst[i + j] = Vector3D(r[0][j], r[1][j], r[2][j]);
+	}
+	for (; i < end; i++) {
+		dst[i] = m * src[i];
+		dst[i].normalize();
+	}
+}
+
+// Vectors of four triangles in SSE registers, one register per component.
+struct Vector3D4 {
+	__m128 x, y, z;
+};
+
+static inline Vector3D4 sub4(const Vector3D4& a, const Vector3D4& b)
+{
+	Vector3D4 r = { _mm_sub_ps(a.x, b.x), _mm_sub_ps(a.y, b.y), _mm_sub_ps(a.z, b.z) };
+	return r;
+}
+
+static inline Vector3D4 cross4(const Vector3D4& a, const Vector3D4& b)
+{
+	Vector3D4 r = {
+		_mm_sub_ps(_mm_mul_ps(a.y, b.z), _mm_mul_ps(a.z, b.y)),
+		_mm_sub_ps(_mm_mul_ps(a.z, b.x), _mm_mul_ps(a.x, b.z)),
+		_mm_sub_ps(_mm_mul_ps(a.x, b.y), _mm_mul_ps(a.y, b.x)) };
+	return r;
+}
+
+static inline __m128 dot4(const Vector3D4& a, const Vector3D4& b)
+{
+	return _mm_add_ps(_mm_add_ps(_mm_mul_ps(a.x, b.x), _mm_mul_ps(a.y, b.y)), _mm_mul_ps(a.z, b.z));
+}
+
+/**
+ * Computes edge planes of triangles [begin, end), four triangles per iteration.
+ * Operations follow Triangle::prepare(), so the planes are the same.
+ */
+void Mesh::prepareFaces(int begin, int end)
+{
+	const __m128 one = _mm_set1_ps(1.0f);
+
+	int i = begin;
+	for (; i + 4 <= end; i += 4) {
+		Triangle* t = &mFaces[i];
+		Vector3D4 p[3];
+		for (int k = 0; k < 3; k++) {
+			const Point3D& a = mVtxP[t[0].mVtx[k].p];
+			const Point3D& b = mVtxP[t[1].mVtx[k].p];
+			const Point3D& c = mVtxP[t[2].mVtx[k].p];
+			const Point3D& d = mVtxP[t[3].mVtx[k].p];
+			p[k].x = _mm_setr_ps(a.x, b.x, c.x, d.x);
+			p[k].y = _mm_setr_ps(a.y, b.y, c.y, d.y);
+			p[k].z = _mm_setr_ps(a.z, b.z, c.z, d.z);
+		}
+
+		// Face normal, see Triangle::getFaceNormal().
+		Vector3D4 n = cross4(sub4(p[1], p[0]), sub4(p[2], p[0]));
+		__m128 l = _mm_div_ps(one, _mm_sqrt_ps(dot4(n, n)));
+		n.x = _mm_mul_ps(n.x, l);
+		n.y = _mm_mul_ps(n.y, l);
+		n.z = _mm_mul_ps(n.z, l);
+
+		float planes[3][3][4], offsets[3][4];
+		for (int k = 0; k < 3; k++) {
+			const Vector3D4& p0 = p[k];
+			const Vector3D4& p1 = p[(k + 1) % 3];
+			const Vector3D4& p2 = p[(k + 2) % 3];
+			Vector3D4 np = cross4(n, sub4(p2, p1));
+			__m128 a = dot4(np, p1);
+			__m128 b = dot4(np, p0);
+			__m128 f = _mm_div_ps(one, _mm_sub_ps(b, a));
+			_mm_storeu_ps(offsets[k], _mm_sub_ps(one, _mm_mul_ps(f, b)));
+			_mm_storeu_ps(planes[k][0], _mm_mul_ps(f, np.x));
+			_mm_storeu_ps(planes[k][1], _mm_mul_ps(f, np.y));
+			_mm_storeu_ps(planes[k][2], _mm_mul_ps(f, np.z));
+		}
+		for (int j = 0; j < 4; j++) {
+			for (int k = 0; k < 3; k++)
+				t[j].mPlanes[k] = Vector3D(planes[k][0][j], planes[k][1][j], planes[k][2][j]);
+			t[j].mPlaneOffsets = Vector3D(offsets[0][j], offsets[1][j], offsets[2][j]);
+		}
+	}
+	for (; i < end; i++)
+		mFaces[i].prepare();
 }
 
 /**
  * Prepares the mesh for rendering by transforming all vertex positions/normals
- * to world space.
+ * to world space. Large meshes are transformed by several threads.
  */
 void Mesh::prepare()
 {
-	// Transform vertex positions.
-	int npos = (int)mOrigVtxP.size();
+	waitLoaded();
 
-	mVtxP.resize(npos);
-
-	for(int i=0; i<npos; i++)
-		mVtxP[i] = mWorldTransform * mOrigVtxP[i];
-	
 	Matrix worldInvT = mWorldTransform;
 	worldInvT = worldInvT.inverse();
 	worldInvT = worldInvT.transpose();
 
+	// Transform vertex positions.
+	int npos = (int)mOrigP.size;
+
+	mVtxP.resize(npos);
+
+	parallelFor(npos, MESH_PREPARE_MIN_CHUNK, [&](int begin, int end) {
+		transformPoints(mWorldTransform, mOrigP.data, mVtxP.data(), begin, end);
+	});
+
+#if MESH_COMPACT
+	// Normals are decoded, transformed and packed again.
+	const Mesh& packed = getPacked();
+	int nnorm = (int)packed.mPackedN.size();
+
+	mPackedVtxN.resize(nnorm);
+
+	parallelFor(nnorm, MESH_PREPARE_MIN_CHUNK, [&](int begin, int end) {
+		for (int i = begin; i < end; i++) {
+			Vector3D n = worldInvT * unpackNormal(packed.mPackedN[i]);
+			mPackedVtxN[i] = packNormal(n.normalize());
+		}
+	});
+#else
 	// Transform and normalize vertex normals.
-	int nnorm = (int)mOrigVtxN.size();
+	int nnorm = (int)mOrigN.size;
 
 	mVtxN.resize(nnorm);
 
-	for(int i=0; i<nnorm; i++)
-	{
-		mVtxN[i] = worldInvT * mOrigVtxN[i];
-		mVtxN[i].normalize();
-	}
+	parallelFor(nnorm, MESH_PREPARE_MIN_CHUNK, [&](int begin, int end) {
+		transformNormals(worldInvT, mOrigN.data, mVtxN.data(), begin, end);
+	});
+#endif // MESH_COMPACT
 	
-	for (int i = 0; i < (int)mFaces.size(); i++)
-		mFaces[i].prepare();
+	// Planes of triangles are computed from transformed positions.
+	parallelFor((int)mFaces.size(), MESH_PREPARE_MIN_CHUNK, [&](int begin, int end) {
+		prepareFaces(begin, end);
+	});
+
+#if MESH_LOD
+	// Proxy instance shares the simplified source mesh and the transform.
+	const std::shared_ptr<Mesh>& lodSource = mSource ? mSource->mLodSource : mLodSource;
+	if (lodSource) {
+		if (!mLod) {
+			mLod.reset(new Mesh());
+			mLod->share(lodSource);
+		}
+		mLod->mMaterial = mMaterial;
+		mLod->setupTransform(mWorldTransform);
+		mLod->prepare();
+
+		// Error grows with the largest scale of the transform.
+		float scale = 0.0f;
+		for (int k = 0; k < 3; k++) {
+			Vector3D axis(0.0f, 0.0f, 0.0f);
+			axis(k) = 1.0f;
+			scale = std::max(scale, (mWorldTransform * axis).length());
+		}
+		mLod->mLodError = lodSource->mLodError * scale;
+	}
+#endif // MESH_LOD
+}
+
+/**
+ * Extracts geometry for secondary rays, the simplified proxy if the mesh has
+ * one. Then returns true and raises error to the distance of the proxy.
+ */
+bool Mesh::getLodGeometry(std::vector<Intersectable*>& geometry)
+{
+#if MESH_LOD
+	if (mLod) {
+		mLod->getGeometry(geometry);
+		return true;
+	}
+#endif // MESH_LOD
+	getGeometry(geometry);
+	return false;
 }
 
 /**
@@ -431,16 +1984,37 @@ void Mesh::getGeometry(std::vector<Intersectable*>& geometry)
 
 void Mesh::getMesh(std::vector<TMesh>* mesh) 
 {
+#if MESH_COMPACT
+	const Mesh& packed = getPacked();
+	unsigned int mVtxPSize = mVtxP.size();
+	unsigned int mVtxNSize = mPackedVtxN.size();
+	unsigned int mVtxUVSize = packed.mPackedUV.size();
+	unsigned int mMaterialsSize = mMaterials.size();
+	unsigned int max = std::max(std::max(mVtxPSize, mVtxNSize), std::max(mVtxUVSize, mMaterialsSize));
+
+	for (unsigned int i = 0; i < max; i++) {
+		TMesh tmp;
+		if (i < mVtxPSize) {
+			Point3DtoFloat3(mVtxP[i], tmp.vtxP);
+		}
+		tmp.vtxN = (i < mVtxNSize) ? mPackedVtxN[i] : 0;
+		tmp.vtxUV = (i < mVtxUVSize) ? packed.mPackedUV[i] : 0;
+		if (i < mMaterialsSize) {
+			mMaterials[i]->getMaterial(tmp.material);
+		}
+		mesh->push_back(tmp);
+	}
+#else
 	unsigned int max = 0;
-	unsigned int mOrigVtxPSize = mOrigVtxP.size();
+	unsigned int mOrigVtxPSize = mOrigP.size;
 	if (max < mOrigVtxPSize) max = mOrigVtxPSize;
-	unsigned int mOrigVtxNSize = mOrigVtxN.size();
+	unsigned int mOrigVtxNSize = mOrigN.size;
 	if (max < mOrigVtxNSize) max = mOrigVtxNSize;
 	unsigned int mVtxPSize = mVtxP.size();
 	if (max < mVtxPSize) max = mVtxPSize;
 	unsigned int mVtxNSize = mVtxN.size();
 	if (max < mVtxNSize) max = mVtxNSize;
-	unsigned int mVtxUVSize = mVtxUV.size();
+	unsigned int mVtxUVSize = mUV.size;
 	if (max < mVtxUVSize) max = mVtxUVSize;
 	unsigned int mMaterialsSize = mMaterials.size();
 	if (max < mMaterialsSize) max = mMaterialsSize;
@@ -448,10 +2022,10 @@ void Mesh::getMesh(std::vector<TMesh>* mesh)
 	for (unsigned int i = 0; i < max; i++) {
 		TMesh tmp;
 		if (i < mOrigVtxPSize) {
-			Point3DtoFloat3(mOrigVtxP[i], tmp.origVtxP);
+			Point3DtoFloat3(mOrigP[i], tmp.origVtxP);
 		}
 		if (i < mOrigVtxNSize) {
-			Vector3DToFloat3(mOrigVtxN[i], tmp.origVtxN);
+			Vector3DToFloat3(mOrigN[i], tmp.origVtxN);
 		}
 		if (i < mVtxPSize) {
 			Point3DtoFloat3(mVtxP[i], tmp.vtxP);
@@ -460,12 +2034,13 @@ void Mesh::getMesh(std::vector<TMesh>* mesh)
 			Vector3DToFloat3(mVtxN[i], tmp.vtxN);
 		}
 		if (i < mVtxUVSize) {
-			tmp.vtxUV.uv.s[0] = mVtxUV[i].u;
-			tmp.vtxUV.uv.s[1] = mVtxUV[i].v;
+			tmp.vtxUV.uv.s[0] = mUV[i].u;
+			tmp.vtxUV.uv.s[1] = mUV[i].v;
 		}
 		if (i < mMaterialsSize) {
 			mMaterials[i]->getMaterial(tmp.material);
 		}
 		mesh->push_back(tmp);
 	}
+#endif // MESH_COMPACT
 }
@@ -15,8 +15,55 @@
 //#include "triangle.h"
 #include "primitive.h"
 #include "gpu_types.h"
+#include "acceleratorcache.h"
+#include "vertexpacking.h"
+#include <future>
+#include <memory>
+
+// Write binary cache next to loaded OBJ file and load it on next start.
+#define MESH_CACHE 1
+// Cache of "file.obj" is "file.obj.cache".
+#define MESH_CACHE_SUFFIX ".cache"
+// Weld vertices, remove degenerate triangles and reorder mesh after load.
+#define MESH_OPTIMIZE 1
+// Positions closer than this part of diagonal of mesh bounds are welded.
+#define MESH_WELD_EPSILON 1e-6f
+// Build simplified proxy of loaded mesh for secondary rays, see Scene::intersectLod().
+#define MESH_LOD 1
+// Part of triangles kept in proxy.
+#define MESH_LOD_RATIO 0.25f
+// Smaller meshes have no proxy.
+#define MESH_LOD_MIN_TRIANGLES 16384
 
 class Triangle;
+class Mesh;
+
+// Mesh being loaded on other thread, see AssetLoader. Stamp of its file is
+// known at once, so caches keyed by it are checked before loading ends.
+struct MeshFuture {
+	std::shared_future<std::shared_ptr<Mesh> > future;
+	unsigned long long stamp;
+
+	MeshFuture() { stamp = 0; }
+	bool valid() const { return future.valid(); }
+	void wait() const { future.wait(); }
+	std::shared_ptr<Mesh> get() const { return future.get(); }
+};
+
+// Faces of mesh in cache, defined in mesh.cpp.
+struct CachedFaces;
+
+// Read-only array of vertex attributes. It points either to vector filled by
+// OBJ loader or straight to memory mapped mesh cache.
+template <class T> struct AttributeArray {
+	const T* data;
+	unsigned int size;
+
+	AttributeArray() { data = NULL; size = 0; }
+	void set(const std::vector<T>& v) { data = v.empty() ? NULL : &v[0]; size = v.size(); }
+	void set(const void* data_, unsigned int size_) { data = (const T*)data_; size = size_; }
+	const T& operator[](int i) const { return data[i]; }
+};
 
 struct MaterialProperties {	
 	Color ambient;
@@ -63,23 +110,67 @@ struct MaterialProperties {
  * three sets of indices into these vectors. If the normals are
  * not specified in the obj-file, these are computed by area-weighting
  * the face normals.
+ * Meshes in the binary PLY format are loaded as well, the format is
+ * given by the extension of the file.
+ * Loaded mesh is written to binary cache next to the obj-file. Next load
+ * maps the cache and vertex attributes are read from mapped memory, the
+ * cache is valid only for same size and time of change of the obj-file.
+ * Mesh created from MeshFuture shares vertex attributes of the loaded mesh
+ * and creates own triangles once the loading is finished.
+ * With MESH_COMPACT the loaded normals and UVs are packed and the full
+ * precision arrays are released. Positions stay floats, they are transformed
+ * to world space by prepare() and used by intersection on CPU and on device.
+ * With MESH_LOD the loaded mesh is simplified by quadric edge collapse and
+ * every instance gets a proxy instance of the simplified mesh, which is
+ * traced instead of the full mesh by secondary rays. The simplified mesh
+ * is written to the cache with the loaded one.
  */
 class Mesh : public Primitive
 {
 public:
 	Mesh();
 	Mesh(const std::string& filename, Material* m=0);
+	Mesh(const MeshFuture& source, Material* m=0);
 	void load(const std::string& filename);
+	// Wait for mesh loaded on other thread.
+	void waitLoaded();
+	// Stamp of file from its size and time of last change, false if file is missing.
+	static bool getFileStamp(const std::string& filename, unsigned long long& stamp);
 
 	// TEMP TEMP - Should be protected
 	void getGeometry(std::vector<Intersectable*>& geometry);
 	void getMesh(std::vector<TMesh>* mesh);
+	bool getLodGeometry(std::vector<Intersectable*>& geometry);
+#if MESH_LOD
+	// Distance of proxy from this instance in world space, 0 without proxy.
+	float getLodError() const { return mLod ? mLod->mLodError : 0.0f; }
+#endif // MESH_LOD
 
 	unsigned int setIndexes(unsigned int index);
 protected:
 	void prepare();
+	void prepareFaces(int begin, int end);
+	unsigned long long getGeometryStamp() { return mStamp; }
 	void clear();
 	void loadOBJ(const std::string& filename);
+	void loadPLY(const std::string& filename);
+	void completeAttributes(bool has_normals, bool has_uv);
+	void optimize();
+	void share(const std::shared_ptr<Mesh>& source);
+#if MESH_LOD
+	void buildLod();
+#endif // MESH_LOD
+	bool loadCache(const std::string& filename, unsigned long long stamp);
+	void saveCache(const std::string& filename, unsigned long long stamp);
+	bool readCacheSections(AcceleratorCache& cache, unsigned int first, bool copy, CachedFaces& faces);
+	void addCacheSections(std::vector<CacheSection>& sections, CachedFaces& faces, const std::vector<Material*>& mtls) const;
+	void createFaces(const CachedFaces& faces, const std::vector<Material*>& mtls);
+#if MESH_COMPACT
+	void compact();
+	unsigned int checkPacking() const;
+	// Mesh owning packed attributes, instances share them with the loaded mesh.
+	const Mesh& getPacked() const { return mSource ? *mSource : *this; }
+#endif // MESH_COMPACT
 
 	bool loadMTL(const std::string& filename);
 	Material *CreateMaterial(MaterialProperties &mp) const;
@@ -93,6 +184,26 @@ protected:
 	std::vector<UV> mVtxUV;				///< Array of vertex UV coordinates.
 	std::vector<Triangle> mFaces;		///< Array of triangles.
 	std::vector<Material *> mMaterials;	///< Array of materials.
+	std::string mMtlLib;				///< Material file of the mesh.
+	unsigned long long mStamp;			///< Stamp of loaded file, 0 if it is missing.
+
+	AttributeArray<Point3D> mOrigP;		///< Original vertex positions, in mOrigVtxP or in cache.
+	AttributeArray<Vector3D> mOrigN;	///< Original vertex normals, in mOrigVtxN or in cache.
+	AttributeArray<UV> mUV;				///< Vertex UV coordinates, in mVtxUV or in cache.
+	AcceleratorCache mCache;			///< Mapped cache file.
+	MeshFuture mPending;				///< Mesh being loaded, valid until waitLoaded().
+	std::shared_ptr<Mesh> mSource;		///< Loaded mesh owning shared vertex attributes.
+#if MESH_LOD
+	std::shared_ptr<Mesh> mLodSource;	///< Simplified loaded mesh, NULL for small meshes.
+	std::unique_ptr<Mesh> mLod;			///< Instance of simplified mesh with the same transform.
+	float mLodError;					///< Distance of simplified surface from the original one.
+#endif // MESH_LOD
+
+#if MESH_COMPACT
+	std::vector<unsigned int> mPackedN;	///< Original normals in octahedral mapping.
+	std::vector<unsigned int> mPackedUV;	///< UV coordinates as half floats.
+	std::vector<unsigned int> mPackedVtxN;	///< Transformed normals in octahedral mapping.
+#endif // MESH_COMPACT
 	
 	friend class Triangle;				// Triangle is a friend class so it can access protected data.
 };
@@ -40,6 +40,10 @@ public:
 protected:
 	virtual void prepare() { }
 	virtual void getGeometry(std::vector<Intersectable*>& geometry) { }
+	// Stamp of geometry in object space for keys of caches, 0 without geometry.
+	virtual unsigned long long getGeometryStamp() { return 0; }
+	// Geometry for secondary rays, true if simplified proxy is used.
+	virtual bool getLodGeometry(std::vector<Intersectable*>& geometry) { getGeometry(geometry); return false; }
 	
 	void addChild(Node* child);	
 	bool hasChild(const Node* child) const;
@@ -5,225 +5,306 @@
 */
 
 #include "octreeaccelerator.h"
+#include "acceleratorcache.h"
+#include "Timer.h"
+#include <thread>
+#include <future>
 
 void OctreeAccelerator::build(const std::vector<Intersectable*>& objects) 
 {
+	CTimer timer;
 	c_objects = objects;
+	nodes.clear();
+	objIndexes.clear();
+	cache.close();
+	box = AABB();
+
+	if (!cacheFile.empty() && loadCache()) {
+		if (verbose)
+			std::cout << "Octree loaded from " << cacheFile << ": " << timer.f_Time() << " s" << std::endl;
+		return;
+	}
 
 	std::for_each(c_objects.begin(), c_objects.end(), [&](Intersectable* obj) {
 		AABB aabb;
 		obj->getAABB(aabb);
 		box.include(aabb);
 	});
+	// Flat scene would have box with zero size.
+	box.grow(1e-3f);
+
+	std::vector<unsigned int> all(c_objects.size());
+	for (unsigned int i = 0; i < all.size(); i++)
+		all[i] = i;
+
+	// Split top levels to tasks until there are enough of them for all cores.
+	unsigned int cores = std::max(1u, std::thread::hardware_concurrency());
+	unsigned int tasks = 1;
+	taskLevels = 0;
+	while (cores > 1 && tasks < 2 * cores) {
+		tasks *= MAX_CELLS;
+		taskLevels++;
+	}
+
+	OctreeArena arena;
+	arena.nodes.push_back(TOctreeNode());
+	buildNode(arena, 0, box, all, 0);
+	nodes.swap(arena.nodes);
+	objIndexes.swap(arena.objIndexes);
+
+	if (verbose) {
+		AcceleratorStats stats = getStats();
+		std::cout << "Octree build: " << timer.f_Time() << " s (" << cores << " cores)" << std::endl;
+		std::cout << "  nodes " << stats.nodes << ", leaves " << stats.leaves << " (" << stats.emptyLeaves 
+			<< " empty), depth " << stats.maxDepth << std::endl;
+		std::cout << "  objects per leaf " << stats.avgLeafObjects << " (max " << stats.maxLeafObjects 
+			<< "), duplication " << stats.duplication << std::endl;
+		std::cout << "  SAH cost " << stats.cost << ", memory " << stats.memory / 1024 << " kB" << std::endl;
+	}
+
+	if (!cacheFile.empty())
+		saveCache();
+}
+
+// Sections are box, nodes and object indexes. Nodes and indexes are not
+// copied, they point to mapped cache until next build.
+bool OctreeAccelerator::loadCache()
+{
+	std::vector<float> bounds;
+	if (!cache.open(cacheFile, CACHE_OCTREE, cacheKey, c_objects.size()) || cache.getSectionsCnt() != 3
+		|| !cache.getSection(0, bounds) || bounds.size() != 6
+		|| !nodes.map(cache.getSection(1)) || !objIndexes.map(cache.getSection(2))) {
+		nodes.clear();
+		objIndexes.clear();
+		cache.close();
+		return false;
+	}
+	box = AABB(Point3D(bounds[0], bounds[1], bounds[2]), Point3D(bounds[3], bounds[4], bounds[5]));
+	return true;
+}
 
-	middlePoint.x = ((box.mMax.x - box.mMin.x) / 2) + box.mMin.x;
-	middlePoint.y = ((box.mMax.y - box.mMin.y) / 2) + box.mMin.y;
-	middlePoint.z = (((box.mMin.z - box.mMax.z) / 2) + box.mMax.z) * -1;
+void OctreeAccelerator::saveCache()
+{
+	float bounds[6] = { box.mMin.x, box.mMin.y, box.mMin.z, box.mMax.x, box.mMax.y, box.mMax.z };
+	std::vector<CacheSection> sections;
+	sections.push_back(CacheSection(bounds, sizeof(bounds)));
+	sections.push_back(CacheSection(nodes.data(), nodes.size() * sizeof(TOctreeNode)));
+	sections.push_back(CacheSection(objIndexes.data(), objIndexes.size() * sizeof(unsigned int)));
+	if (!cache.write(cacheFile, CACHE_OCTREE, cacheKey, c_objects.size(), sections))
+		std::cout << "Octree cache " << cacheFile << " can not be written." << std::endl;
+}
 
-	if (c_objects.size() > MAX_OBJECTS) {
-		leaf = false;
+AcceleratorStats OctreeAccelerator::getStats()
+{
+	AcceleratorStats stats;
+	stats.nodes = nodes.size();
+	stats.references = objIndexes.size();
+	stats.memory = nodes.size() * sizeof(TOctreeNode) + objIndexes.size() * sizeof(unsigned int);
+	stats.cost = nodes.empty() ? 0.0f : collectStats(stats, 0, box, 0);
+
+	unsigned int filled = stats.leaves - stats.emptyLeaves;
+	stats.avgDepth = stats.leaves ? stats.avgDepth / stats.leaves : 0.0f;
+	stats.avgLeafObjects = filled ? (float)stats.references / filled : 0.0f;
+	stats.duplication = c_objects.empty() ? 0.0f : (float)stats.references / c_objects.size();
+	return stats;
+}
+
+// Walks the tree, fills counters and returns SAH cost of subtree relative to its box.
+// Sum of leaf depths is stored in avgDepth.
+float OctreeAccelerator::collectStats(AcceleratorStats& stats, unsigned int node, const AABB& nodeBox, unsigned int depth)
+{
+	const TOctreeNode& octNode = nodes[node];
+	stats.maxDepth = std::max(stats.maxDepth, depth);
+
+	if (octNode.children == 0) {
+		unsigned int count = octNode.boxLink.objSize - octNode.boxLink.objStartIndex;
+		stats.leaves++;
+		stats.avgDepth += depth;
+		if (count == 0)
+			stats.emptyLeaves++;
+		stats.maxLeafObjects = std::max(stats.maxLeafObjects, count);
+		return costIntersect * count;
+	}
+
+	float invArea = 1.0f / nodeBox.getArea();
+	float cost = costTraversal;
+	for (int i = 0; i < MAX_CELLS; i++) {
+		AABB childBox = getChildBox(nodeBox, i);
+		float p = childBox.getArea() * invArea;
+		cost += p * (costTraversal + collectStats(stats, octNode.children + i, childBox, depth + 1));
+	}
+	return cost;
+}
+
+void OctreeAccelerator::buildNode(OctreeArena& arena, unsigned int node, const AABB& nodeBox,
+	const std::vector<unsigned int>& objects, int level)
+{
+	AABB childBox[MAX_CELLS];
+	std::vector<unsigned int> childObjects[MAX_CELLS];
+	bool split = objects.size() > 1 && level < MAX_DEPTH;
+
+	if (split) {
 		for (int i = 0; i < MAX_CELLS; i++) {
-			child[i] = new OctreeAccelerator();
-			child[i]->setLevel( getLevel() + 1 );
-		}
+			childBox[i] = getChildBox(nodeBox, i);
 
-		initBoundaries();
-
-		for (std::vector<Intersectable*>::iterator it = c_objects.begin(); it != c_objects.end(); it++) {
-			AABB aabb;
-			(*it)->getAABB(aabb);
-			std::vector<int> inserted;
-			Point3D diff = aabb.mMax - aabb.mMin;
-
-			Point3D point = aabb.mMin;
-			insertObject(point, (*it), inserted); // -x-y-z
-			point.z += diff.z;
-			insertObject(point, (*it), inserted); // -x-y+z
-			point.y += diff.y;
-			insertObject(point, (*it), inserted); // -x+y+z
-			point.z -= diff.z;
-			insertObject(point, (*it), inserted); // -x+y-z
-			point.x += diff.x;
-			insertObject(point, (*it), inserted); // +x+y-z
-			point.z += diff.z;
-			insertObject(point, (*it), inserted); // +x+y+z
-			point.y -= diff.y;
-			insertObject(point, (*it), inserted); // +x-y+z
-			point.z -= diff.z;
-			insertObject(point, (*it), inserted); // +x-y-z
+			for (std::vector<unsigned int>::const_iterator it = objects.begin(); it != objects.end(); it++) {
+				if (c_objects[*it]->overlapAABB(childBox[i]))
+					childObjects[i].push_back(*it);
+			}
+
+			if (verbose && level == 0) {
+				std::cout << "Octree child " << i << ": " << childObjects[i].size() << " objects" << std::endl;
+			}
 		}
 
+		// SAH: ray hits child with probability given by area ratio. Straddling
+		// objects are counted in every child, so duplication raises the cost.
+		float invArea = 1.0f / nodeBox.getArea();
+		float costSplit = costTraversal;
 		for (int i = 0; i < MAX_CELLS; i++) {
-			child[i]->recursiveBuild();
-			std::cout << child[i]->c_objects.size() << std::endl;
+			float p = childBox[i].getArea() * invArea;
+			costSplit += p * (costTraversal + costIntersect * childObjects[i].size());
 		}
+		split = costSplit < costIntersect * objects.size();
 	}
-	else {
-		leaf = true;
-	}
-	middlePoint.z *= -1;
-}
 
-void OctreeAccelerator::recursiveBuild() 
-{
-	if (level > MAX_DEPTH) {
-		leaf = true;
+	if (!split) {
+		arena.nodes[node].children = 0;
+		arena.nodes[node].boxLink.objStartIndex = arena.objIndexes.size();
+		arena.objIndexes.insert(arena.objIndexes.end(), objects.begin(), objects.end());
+		arena.nodes[node].boxLink.objSize = arena.objIndexes.size();
 		return;
 	}
 
-	middlePoint.x = ((box.mMax.x - box.mMin.x) / 2) + box.mMin.x;
-	middlePoint.y = ((box.mMax.y - box.mMin.y) / 2) + box.mMin.y;
-	middlePoint.z = (((box.mMin.z - box.mMax.z) / 2) + box.mMax.z) * -1;
+	// Children are allocated as one block, node stays valid only as index.
+	unsigned int first = arena.nodes.size();
+	arena.nodes.resize(first + MAX_CELLS);
+	arena.nodes[node].children = first;
+	arena.nodes[node].boxLink.objStartIndex = 0;
+	arena.nodes[node].boxLink.objSize = 0;
 
-	if (c_objects.size() > MAX_OBJECTS) {
-		leaf = false;
-		for (int i = 0; i < MAX_CELLS; i++) {
-			child[i] = new OctreeAccelerator();
-			child[i]->setLevel(getLevel() + 1);
-		}
+	if (level < taskLevels && objects.size() >= MIN_TASK_OBJECTS) {
+		// Every child is built by own task to own arena, arenas are merged
+		// in child order, so result is same as from serial build.
+		OctreeArena childArena[MAX_CELLS];
+		std::future<void> task[MAX_CELLS];
 
-		initBoundaries();
-
-		for (std::vector<Intersectable*>::iterator it = c_objects.begin(); it != c_objects.end(); it++) {
-			AABB aabb;
-			(*it)->getAABB(aabb);
-			std::vector<int> inserted;
-			Point3D diff = aabb.mMax - aabb.mMin;
-
-			Point3D point = aabb.mMin;
-			insertObject(point, (*it), inserted); // -x-y-z
-			point.z += diff.z;
-			insertObject(point, (*it), inserted); // -x-y+z
-			point.y += diff.y;
-			insertObject(point, (*it), inserted); // -x+y+z
-			point.z -= diff.z;
-			insertObject(point, (*it), inserted); // -x+y-z
-			point.x += diff.x;
-			insertObject(point, (*it), inserted); // +x+y-z
-			point.z += diff.z;
-			insertObject(point, (*it), inserted); // +x+y+z
-			point.y -= diff.y;
-			insertObject(point, (*it), inserted); // +x-y+z
-			point.z -= diff.z;
-			insertObject(point, (*it), inserted); // +x-y-z
+		for (int i = 0; i < MAX_CELLS; i++) {
+			childArena[i].nodes.push_back(TOctreeNode());
+			task[i] = std::async(std::launch::async, [&, i]() {
+				buildNode(childArena[i], 0, childBox[i], childObjects[i], level + 1);
+			});
 		}
-
 		for (int i = 0; i < MAX_CELLS; i++) {
-			child[i]->recursiveBuild();
+			task[i].get();
+			mergeArena(arena, first + i, childArena[i]);
 		}
 	}
 	else {
-		leaf = true;
+		for (int i = 0; i < MAX_CELLS; i++) {
+			buildNode(arena, first + i, childBox[i], childObjects[i], level + 1);
+		}
 	}
-	middlePoint.z *= -1;
 }
 
-void OctreeAccelerator::insertObject(Point3D point, Intersectable* obj, std::vector<int>& inserted) 
+void OctreeAccelerator::mergeArena(OctreeArena& dst, unsigned int node, const OctreeArena& src)
 {
-	int index = getSector(point, middlePoint);
+	// Root of src goes to node, other nodes are appended behind dst.
+	unsigned int nodeOffset = dst.nodes.size() - 1;
+	unsigned int objOffset = dst.objIndexes.size();
+
+	for (unsigned int i = 0; i < src.nodes.size(); i++) {
+		TOctreeNode n = src.nodes[i];
+		if (n.children != 0) {
+			n.children += nodeOffset;
+		}
+		else {
+			n.boxLink.objStartIndex += objOffset;
+			n.boxLink.objSize += objOffset;
+		}
 
-	for (std::vector<int>::iterator it = inserted.begin(); it != inserted.end(); it++) {
-		if ((*it) == index) return;
+		if (i == 0)
+			dst.nodes[node] = n;
+		else
+			dst.nodes.push_back(n);
 	}
-
-	inserted.push_back(index);
-
-	child[index]->c_objects.push_back(obj);
+	dst.objIndexes.insert(dst.objIndexes.end(), src.objIndexes.begin(), src.objIndexes.end());
 }
 
-void OctreeAccelerator::initBoundaries() 
+AABB OctreeAccelerator::getChildBox(const AABB& nodeBox, int child)
 {
-	child[0]->box.mMin.x = box.mMin.x;
-	child[0]->box.mMin.y = box.mMin.y;
-	child[0]->box.mMin.z = box.mMin.z;
-
-	child[0]->box.mMax.x = middlePoint.x;
-	child[0]->box.mMax.y = middlePoint.y;
-	child[0]->box.mMax.z = -middlePoint.z;
-
-	child[1]->box.mMin.x = box.mMin.x;
-	child[1]->box.mMin.y = box.mMin.y;
-	child[1]->box.mMin.z = -middlePoint.z;
-
-	child[1]->box.mMax.x = middlePoint.x;
-	child[1]->box.mMax.y = middlePoint.y;
-	child[1]->box.mMax.z = box.mMax.z;
-
-	child[2]->box.mMin.x = box.mMin.x;
-	child[2]->box.mMin.y = middlePoint.y;
-	child[2]->box.mMin.z = box.mMin.z;
-
-	child[2]->box.mMax.x = middlePoint.x;
-	child[2]->box.mMax.y = box.mMax.y;
-	child[2]->box.mMax.z = -middlePoint.z;
-
-	child[3]->box.mMin.x = box.mMin.x;
-	child[3]->box.mMin.y = middlePoint.y;
-	child[3]->box.mMin.z = -middlePoint.z;
-
-	child[3]->box.mMax.x = middlePoint.x;
-	child[3]->box.mMax.y = box.mMax.y;
-	child[3]->box.mMax.z = box.mMax.z;
-
-	child[4]->box.mMin.x = middlePoint.x;
-	child[4]->box.mMin.y = box.mMin.y;
-	child[4]->box.mMin.z = box.mMin.z;
-
-	child[4]->box.mMax.x = box.mMax.x;
-	child[4]->box.mMax.y = middlePoint.y;
-	child[4]->box.mMax.z = -middlePoint.z;
-
-	child[5]->box.mMin.x = middlePoint.x;
-	child[5]->box.mMin.y = box.mMin.y;
-	child[5]->box.mMin.z = -middlePoint.z;
-
-	child[5]->box.mMax.x = box.mMax.x;
-	child[5]->box.mMax.y = middlePoint.y;
-	child[5]->box.mMax.z = box.mMax.z;
+	AABB childBox = nodeBox;
+	for (int axis = 0; axis < 3; axis++) {
+		float middle = 0.5f * (nodeBox.mMin(axis) + nodeBox.mMax(axis));
+		if (child & (4 >> axis))
+			childBox.mMin(axis) = middle;
+		else
+			childBox.mMax(axis) = middle;
+	}
+	return childBox;
+}
 
-	child[6]->box.mMin.x = middlePoint.x;
-	child[6]->box.mMin.y = middlePoint.y;
-	child[6]->box.mMin.z = box.mMin.z;
+// Nodes are visited level by level, so neighbour of parent has its cell set
+// already. Child takes sibling as neighbour inside parent, otherwise rope of
+// parent, refined to its child if that neighbour is split and of same size.
+void OctreeAccelerator::getLinks(std::vector<TOctreeLink>& links)
+{
+	links.assign(nodes.size(), TOctreeLink());
+	if (nodes.empty())
+		return;
 
-	child[6]->box.mMax.x = box.mMax.x;
-	child[6]->box.mMax.y = box.mMax.y;
-	child[6]->box.mMax.z = -middlePoint.z;
+	for (int face = 0; face < 6; face++)
+		links[0].ropes[face] = 0;
+	links[0].cell[0] = 0;
+	links[0].cell[1] = 0;
 
-	child[7]->box.mMin.x = middlePoint.x;
-	child[7]->box.mMin.y = middlePoint.y;
-	child[7]->box.mMin.z = -middlePoint.z;
+	std::vector<unsigned int> queue(1, 0);
+	for (unsigned int head = 0; head < queue.size(); head++) {
+		unsigned int node = queue[head];
+		const TOctreeLink& parent = links[node];
+		unsigned int first = nodes[node].children;
+		if (first == 0)
+			continue;
 
-	child[7]->box.mMax.x = box.mMax.x;
-	child[7]->box.mMax.y = box.mMax.y;
-	child[7]->box.mMax.z = box.mMax.z;
-}
+		unsigned int level = parent.cell[1] >> 16;
+		unsigned int cell[3] = { parent.cell[0] & 0xFFFF, parent.cell[0] >> 16, parent.cell[1] & 0xFFFF };
 
-void OctreeAccelerator::pushObject(Intersectable* obj) 
-{
-	c_objects.push_back(obj);
-}
-
-int OctreeAccelerator::getSector(const Point3D& point, const Point3D& origin) 
-{
-	int oct = 0;
-	if (point.z < origin.z) oct |= 1;
-	if (point.y >= origin.y) oct |= 2;
-	if (point.x >= origin.x) oct |= 4;
-	return oct;
+		for (int i = 0; i < MAX_CELLS; i++) {
+			TOctreeLink& link = links[first + i];
+			unsigned int childCell[3];
+
+			for (int axis = 0; axis < 3; axis++) {
+				unsigned int bit = (i & (4 >> axis)) ? 1 : 0;
+				childCell[axis] = 2 * cell[axis] + bit;
+
+				for (unsigned int side = 0; side < 2; side++) {
+					unsigned int rope;
+					if (bit != side) {
+						rope = first + (i ^ (4 >> axis));
+					}
+					else {
+						rope = parent.ropes[2 * axis + side];
+						if (rope != 0 && nodes[rope].children != 0 && (links[rope].cell[1] >> 16) == level)
+							rope = nodes[rope].children + (i ^ (4 >> axis));
+					}
+					link.ropes[2 * axis + side] = rope;
+				}
+			}
+			link.cell[0] = childCell[0] | (childCell[1] << 16);
+			link.cell[1] = childCell[2] | ((level + 1) << 16);
+			queue.push_back(first + i);
+		}
+	}
 }
 
-bool OctreeAccelerator::intersect(const Ray& ray) 
+bool OctreeAccelerator::GetRootParams(const Ray& ray, unsigned char& flag,
+	float& tx0, float& ty0, float& tz0, float& tx1, float& ty1, float& tz1)
 {
 	//flags for the negative direction, used to transform the octree nodes using an XOR operation.
-	unsigned char flag = 0;
-	AABB bounds;
-	Point3D halfSize = box.mMax - middlePoint;
-
+	flag = 0;
 	Vector3D dir = ray.dir;
-	Point3D origin = ray.orig - middlePoint + halfSize;
-	bounds.mMin = { 0, 0, 0 };
-	bounds.mMax = box.mMax - box.mMin;
-	Point3D boxSize = bounds.mMax;
+	Point3D origin = ray.orig - box.mMin;
+	Point3D boxSize = box.mMax - box.mMin;
 
 	if (dir.x < 0.0f) {
 		origin.x = boxSize.x - origin.x;
@@ -240,8 +321,6 @@ bool OctreeAccelerator::intersect(const Ray& ray)
 	if (dir.z < 0.0f) {
 		origin.z = boxSize.z - origin.z;
 		dir.z *= -1.0f;
-	}
-	else {
 		flag |= 1;
 	}
 
@@ -249,82 +328,59 @@ bool OctreeAccelerator::intersect(const Ray& ray)
 	float invDiry = 1.0f / dir.y;
 	float invDirz = 1.0f / dir.z;
 
-	float tx0 = (bounds.mMin.x - origin.x) * invDirx;
-	float tx1 = (bounds.mMax.x - origin.x) * invDirx;
+	tx0 = -origin.x * invDirx;
+	tx1 = (boxSize.x - origin.x) * invDirx;
 
-	float ty0 = (bounds.mMin.y - origin.y) * invDiry;
-	float ty1 = (bounds.mMax.y - origin.y) * invDiry;
+	ty0 = -origin.y * invDiry;
+	ty1 = (boxSize.y - origin.y) * invDiry;
 
-	float tz0 = (bounds.mMin.z - origin.z) * invDirz;
-	float tz1 = (bounds.mMax.z - origin.z) * invDirz;
+	tz0 = -origin.z * invDirz;
+	tz1 = (boxSize.z - origin.z) * invDirz;
 
-	float maxOf0 = 0.f;
-	float minOf1 = 0.f;
-	// Compute max for maxOf0
-	if (tx0 > ty0) {
-		if (tx0 > tz0) {
-			maxOf0 = tx0;
-		}
-		else {
-			maxOf0 = tz0;
-		}
-	}
-	else {
-		if (ty0 > tz0) {
-			maxOf0 = ty0;
-		}
-		else {
-			maxOf0 = tz0;
-		}
-	}
-	// Compute min for minOf1
-	if (tx1 < ty1) {
-		if (tx1 < tz1) {
-			minOf1 = tx1;
-		}
-		else {
-			minOf1 = tz1;
-		}
-	}
-	else {
-		if (ty1 < tz1) {
-			minOf1 = ty1;
-		}
-		else {
-			minOf1 = tz1;
-		}
-	}
+	float maxOf0 = std::max(tx0, std::max(ty0, tz0));
+	float minOf1 = std::min(tx1, std::min(ty1, tz1));
 
-	if (maxOf0 < minOf1) {
-		return ProcessSubNode(ray, flag, tx0, ty0, tz0, tx1, ty1, tz1);
-	}
-	return false;
+	return maxOf0 < minOf1;
 }
 
-bool OctreeAccelerator::ProcessSubNode(const Ray& ray, unsigned char flag,
+bool OctreeAccelerator::intersect(const Ray& ray, TraversalCounters* counters)
+{
+	unsigned char flag;
+	float tx0, ty0, tz0, tx1, ty1, tz1;
+
+	if (nodes.empty() || !GetRootParams(ray, flag, tx0, ty0, tz0, tx1, ty1, tz1))
+		return false;
+
+	Mailbox mailbox;
+	return ProcessSubNode(ray, mailbox, counters, 0, flag, tx0, ty0, tz0, tx1, ty1, tz1);
+}
+
+bool OctreeAccelerator::ProcessSubNode(const Ray& ray, Mailbox& mailbox, TraversalCounters* counters, unsigned int node, unsigned char flag,
 	float tx0, float ty0, float tz0, float tx1, float ty1, float tz1)
 {
 	if (tx1 < 0 || ty1 < 0 || tz1 < 0) {
 		return false;
 	}
 
-	if (this->isLeaf())
+	countNode(counters);
+	const TOctreeNode& octNode = nodes[node];
+	if (octNode.children == 0)
 	{
-		std::vector<Intersectable*>::iterator i;
-		for (i = c_objects.begin(); i != c_objects.end(); ++i) {
-			Intersection currentIs;
+		for (unsigned int i = octNode.boxLink.objStartIndex; i < octNode.boxLink.objSize; i++) {
+			Intersectable* obj = c_objects[objIndexes[i]];
 
-			if ((*i)->rayID == ray.ID) {
+			if (mailbox.check(obj)) {
 				continue;
 			}
-			(*i)->rayID = ray.ID;
-			if ((*i)->intersect(ray, currentIs)) {
+			countPrimitive(counters);
+			if (obj->intersect(ray)) {
 				return true;
 			}
 		}
 		return false;
 	}
 
+	unsigned int children = octNode.children;
 	float txM = 0.5f * (tx0 + tx1);
 	float tyM = 0.5f * (ty0 + ty1);
 	float tzM = 0.5f * (tz0 + tz1);
@@ -335,35 +391,35 @@ bool OctreeAccelerator::ProcessSubNode(const Ray& ray, unsigned char flag,
 	{
 		switch (currentNode)
 		{
-		case 0: success = child[flag]->ProcessSubNode(ray, flag, tx0, ty0, tz0, txM, tyM, tzM);
+		case 0: success = ProcessSubNode(ray, mailbox, counters, children + flag, flag, tx0, ty0, tz0, txM, tyM, tzM);
 			currentNode = GetNextNode(currentNode, txM, tyM, tzM);
 			break;
 
-		case 1: success = child[flag ^ 1]->ProcessSubNode(ray, flag, tx0, ty0, tzM, txM, tyM, tz1);
+		case 1: success = ProcessSubNode(ray, mailbox, counters, children + (flag ^ 1), flag, tx0, ty0, tzM, txM, tyM, tz1);
 			currentNode = GetNextNode(currentNode, txM, tyM, tz1);
 			break;
 
-		case 2: success = child[flag ^ 2]->ProcessSubNode(ray, flag, tx0, tyM, tz0, txM, ty1, tzM);
+		case 2: success = ProcessSubNode(ray, mailbox, counters, children + (flag ^ 2), flag, tx0, tyM, tz0, txM, ty1, tzM);
 			currentNode = GetNextNode(currentNode, txM, ty1, tzM);
 			break;
 
-		case 3: success = child[flag ^ 3]->ProcessSubNode(ray, flag, tx0, tyM, tzM, txM, ty1, tz1);
+		case 3: success = ProcessSubNode(ray, mailbox, counters, children + (flag ^ 3), flag, tx0, tyM, tzM, txM, ty1, tz1);
 			currentNode = GetNextNode(currentNode, txM, ty1, tz1);
 			break;
 
-		case 4: success = child[flag ^ 4]->ProcessSubNode(ray, flag, txM, ty0, tz0, tx1, tyM, tzM);
+		case 4: success = ProcessSubNode(ray, mailbox, counters, children + (flag ^ 4), flag, txM, ty0, tz0, tx1, tyM, tzM);
 			currentNode = GetNextNode(currentNode, tx1, tyM, tzM);
 			break;
 
-		case 5: success = child[flag ^ 5]->ProcessSubNode(ray, flag, txM, ty0, tzM, tx1, tyM, tz1);
+		case 5: success = ProcessSubNode(ray, mailbox, counters, children + (flag ^ 5), flag, txM, ty0, tzM, tx1, tyM, tz1);
 			currentNode = GetNextNode(currentNode, tx1, tyM, tz1);
 			break;
 
-		case 6: success = child[flag ^ 6]->ProcessSubNode(ray, flag, txM, tyM, tz0, tx1, ty1, tzM);
+		case 6: success = ProcessSubNode(ray, mailbox, counters, children + (flag ^ 6), flag, txM, tyM, tz0, tx1, ty1, tzM);
 			currentNode = GetNextNode(currentNode, tx1, ty1, tzM);
 			break;
 
-		case 7: success = child[flag ^ 7]->ProcessSubNode(ray, flag, txM, tyM, tzM, tx1, ty1, tz1);
+		case 7: success = ProcessSubNode(ray, mailbox, counters, children + (flag ^ 7), flag, txM, tyM, tzM, tx1, ty1, tz1);
 			currentNode = 8;
 			break;
 		}
@@ -376,122 +432,51 @@ bool OctreeAccelerator::ProcessSubNode(const Ray& ray, unsigned char flag,
 	return false;
 }
 
-bool OctreeAccelerator::intersect(const Ray& ray, Intersection& is)
+bool OctreeAccelerator::intersect(const Ray& ray, Intersection& is, TraversalCounters* counters)
 {
-	//flags for the negative direction, used to transform the octree nodes using an XOR operation.
-	unsigned char flag = 0;
-	AABB bounds;
-	Point3D halfSize = box.mMax - middlePoint;
-
-	Vector3D dir = ray.dir;
-	Point3D origin = ray.orig - middlePoint + halfSize;
-	bounds.mMin = { 0, 0, 0 };
-	bounds.mMax = box.mMax - box.mMin;
-	Point3D boxSize = bounds.mMax;
-
-	if (dir.x < 0.0f) {
-		origin.x = boxSize.x - origin.x;
-		dir.x *= -1.0f;
-		flag |= 4;
-	}
-
-	if (dir.y < 0.0f) {
-		origin.y = boxSize.y - origin.y;
-		dir.y *= -1.0f;
-		flag |= 2;
-	}
-
-	if (dir.z < 0.0f) {
-		origin.z = boxSize.z - origin.z;
-		dir.z *= -1.0f;
-	}
-	else {
-		flag |= 1;
-	}
-
-	float invDirx = 1.0f / dir.x;
-	float invDiry = 1.0f / dir.y;
-	float invDirz = 1.0f / dir.z;
-
-	float tx0 = (bounds.mMin.x - origin.x) * invDirx;
-	float tx1 = (bounds.mMax.x - origin.x) * invDirx;
-
-	float ty0 = (bounds.mMin.y - origin.y) * invDiry;
-	float ty1 = (bounds.mMax.y - origin.y) * invDiry;
-
-	float tz0 = (bounds.mMin.z - origin.z) * invDirz;
-	float tz1 = (bounds.mMax.z - origin.z) * invDirz;
+	is.mHitTime = INF;
+	unsigned char flag;
+	float tx0, ty0, tz0, tx1, ty1, tz1;
 
-	float maxOf0 = 0.f;
-	float minOf1 = 0.f;
-	// Compute max for maxOf0
-	if (tx0 > ty0) {
-		if (tx0 > tz0) {
-			maxOf0 = tx0;
-		}
-		else {
-			maxOf0 = tz0;
-		}
-	}
-	else {
-		if (ty0 > tz0) {
-			maxOf0 = ty0;
-		}
-		else {
-			maxOf0 = tz0;
-		}
-	}
-	// Compute min for minOf1
-	if (tx1 < ty1) {
-		if (tx1 < tz1) {
-			minOf1 = tx1;
-		}
-		else {
-			minOf1 = tz1;
-		}
-	}
-	else {
-		if (ty1 < tz1) {
-			minOf1 = ty1;
-		}
-		else {
-			minOf1 = tz1;
-		}
-	}
+	if (nodes.empty() || !GetRootParams(ray, flag, tx0, ty0, tz0, tx1, ty1, tz1))
+		return false;
 
-	if (maxOf0 < minOf1) {
-		return ProcessSubNode(ray, is, flag, tx0, ty0, tz0, tx1, ty1, tz1);
-	}
-	return false;
+	Mailbox mailbox;
+	ProcessSubNode(ray, is, mailbox, counters, 0, flag, tx0, ty0, tz0, tx1, ty1, tz1);
+	return is.mHitTime != INF;
 }
 
-bool OctreeAccelerator::ProcessSubNode(const Ray& ray, Intersection& is, unsigned char flag,
+// Returns true when the closest hit is found (hit lies inside visited leaf,
+// so no later leaf can contain closer one).
+bool OctreeAccelerator::ProcessSubNode(const Ray& ray, Intersection& is, Mailbox& mailbox, TraversalCounters* counters, unsigned int node, unsigned char flag,
 	float tx0, float ty0, float tz0, float tx1, float ty1, float tz1)
 {
-	char znak = 0;
 	if (tx1 < 0 || ty1 < 0 || tz1 < 0) {
 		return false;
 	}
 
-	if (this->isLeaf())
+	countNode(counters);
+	const TOctreeNode& octNode = nodes[node];
+	if (octNode.children == 0)
 	{
-		std::vector<Intersectable*>::iterator i;
-		for (i = c_objects.begin(); i != c_objects.end(); ++i) {
+		for (unsigned int i = octNode.boxLink.objStartIndex; i < octNode.boxLink.objSize; i++) {
+			Intersectable* obj = c_objects[objIndexes[i]];
 			Intersection currentIs;
-			unsigned int iid = (*i)->getIndex();
-			if ((*i)->rayID == ray.ID) {
+
+			if (mailbox.check(obj)) {
 				continue;
 			}
-			(*i)->rayID = ray.ID;
-			if ((*i)->intersect(ray, currentIs)) {
+			countPrimitive(counters);
+			if (obj->intersect(ray, currentIs)) {
 				if (currentIs.mHitTime < is.mHitTime) {
 					is = currentIs;
 				}
 			}
 		}
-		return is.mHitTime != INF;
+		return is.mHitTime <= std::min(tx1, std::min(ty1, tz1));
 	}
 
+	unsigned int children = octNode.children;
 	float txM = 0.5f * (tx0 + tx1);
 	float tyM = 0.5f * (ty0 + ty1);
 	float tzM = 0.5f * (tz0 + tz1);
@@ -503,57 +488,52 @@ bool OctreeAccelerator::ProcessSubNode(const Ray& ray, Intersection& is, unsigne
 		switch (currentNode)
 		{
 		case 0: 
-			znak = flag;
-			success = child[flag]->ProcessSubNode(ray, is, flag, tx0, ty0, tz0, txM, tyM, tzM);
+			success = ProcessSubNode(ray, is, mailbox, counters, children + flag, flag, tx0, ty0, tz0, txM, tyM, tzM);
 			currentNode = GetNextNode(currentNode, txM, tyM, tzM);
 			break;
 
 		case 1:
-			znak = flag ^ 1;
-			success = child[flag ^ 1]->ProcessSubNode(ray, is, flag, tx0, ty0, tzM, txM, tyM, tz1);
+			success = ProcessSubNode(ray, is, mailbox, counters, children + (flag ^ 1), flag, tx0, ty0, tzM, txM, tyM, tz1);
 			currentNode = GetNextNode(currentNode, txM, tyM, tz1);
 			break;
 
 		case 2: 
-			znak = flag ^ 2;
-			success = child[flag ^ 2]->ProcessSubNode(ray, is, flag, tx0, tyM, tz0, txM, ty1, tzM);
+			success = ProcessSubNode(ray, is, mailbox, counters, children + (flag ^ 2), flag, tx0, tyM, tz0, txM, ty1, tzM);
 			currentNode = GetNextNode(currentNode, txM, ty1, tzM);
 			break;
 
 		case 3: 
-			znak = flag ^ 3;
-			success = child[flag ^ 3]->ProcessSubNode(ray, is, flag, tx0, tyM, tzM, txM, ty1, tz1);
+			success = ProcessSubNode(ray, is, mailbox, counters, children + (flag ^ 3), flag, tx0, tyM, tzM, txM, ty1, tz1);
 			currentNode = GetNextNode(currentNode, txM, ty1, tz1);
 			break;
 
 		case 4: 
-			znak = flag ^ 4;
-			success = child[flag ^ 4]->ProcessSubNode(ray, is, flag, txM, ty0, tz0, tx1, tyM, tzM);
+			success = ProcessSubNode(ray, is, mailbox, counters, children + (flag ^ 4), flag, txM, ty0, tz0, tx1, tyM, tzM);
 			currentNode = GetNextNode(currentNode, tx1, tyM, tzM);
 			break;
 
 		case 5: 
-			znak = flag ^ 5;
-			success = child[flag ^ 5]->ProcessSubNode(ray, is, flag, txM, ty0, tzM, tx1, tyM, tz1);
+			success = ProcessSubNode(ray, is, mailbox, counters, children + (flag ^ 5), flag, txM, ty0, tzM, tx1, tyM, tz1);
 			currentNode = GetNextNode(currentNode, tx1, tyM, tz1);
 			break;
 
 		case 6: 
-			znak = flag ^ 6;
-			success = child[flag ^ 6]->ProcessSubNode(ray, is, flag, txM, tyM, tz0, tx1, ty1, tzM);
+			success = ProcessSubNode(ray, is, mailbox, counters, children + (flag ^ 6), flag, txM, tyM, tz0, tx1, ty1, tzM);
 			currentNode = GetNextNode(currentNode, tx1, ty1, tzM);
 			break;
 
 		case 7: 
-			znak = flag ^ 7;
-			success = child[flag ^ 7]->ProcessSubNode(ray, is, flag, txM, tyM, tzM, tx1, ty1, tz1);
+			success = ProcessSubNode(ray, is, mailbox, counters, children + (flag ^ 7), flag, txM, tyM, tzM, tx1, ty1, tz1);
 			currentNode = 8;       
 			break;
 		}
-		
+
+		if (success) {
+			return true;
+		}
 	} while (currentNode < 8);
 
-	return success;
+	return false;
 }
 
 unsigned int OctreeAccelerator::GetFirstNode(float tx0, float ty0, float tz0, float txm, float tym, float tzm, unsigned char rayFlags)
@@ -8,63 +8,95 @@
 #define _OCTREE_H_
 
 #include "rayaccelerator.h"
+#include "mailbox.h"
 #include "matrix.h"
+#include "gpu_types.h"
+#include "acceleratorcache.h"
+#include <string>
 
 // Octree has 8 leafs.
 #define MAX_CELLS 8
-// Max object in octree box.
-#define MAX_OBJECTS 3
-// Max depth of octree.
-#define MAX_DEPTH 7
+// Cost of one traversal step (ray enters node).
+#define OCTREE_COST_TRAVERSAL 1.0f
+// Cost of one ray-object intersection.
+#define OCTREE_COST_INTERSECT 1.0f
+// Max depth of octree, only as safety limit, subdivision is driven by cost.
+#define MAX_DEPTH 16
+// Min objects in node to build its children as parallel tasks.
+#define MIN_TASK_OBJECTS 1024
 
+// Linear octree. All nodes are stored in one array, children of inner node
+// are stored in block of 8 nodes (child index is x << 2 | y << 1 | z, bit is
+// set for upper half). Leafs point to range in shared array of object indexes.
+// Node array has same layout as on OpenCL device, so it is uploaded as it is.
 class OctreeAccelerator : public RayAccelerator {
 public:
 	OctreeAccelerator() { 
-		for (int i = 0; i < MAX_CELLS; i++) 
-			child[i] = NULL; 
-
-		level = 0;
-		leaf = false;
+		verbose = false; 
+		taskLevels = 0; 
+		cacheKey = 0;
+		costTraversal = OCTREE_COST_TRAVERSAL;
+		costIntersect = OCTREE_COST_INTERSECT;
 	}
 	~OctreeAccelerator() {}
-	void pushObject(Intersectable* obj);
-	void setLevel(int lvl) { level = lvl; }
-	int getLevel() { return level; }
-	void insertObject(Point3D point, Intersectable* obj, std::vector<int>& inserted);
+
+	// Print info about build to std::cout.
+	void setVerbose(bool enable) { verbose = enable; }
+	// Set cost model used to terminate subdivision, call before build.
+	void setCosts(float traversal, float intersect) { costTraversal = traversal; costIntersect = intersect; }
+	// Load built octree from file instead of build if it was built for the same key of
+	// geometry, see Scene::getGeometryKey(), write it there after build.
+	void setCacheFile(const std::string& file, unsigned long long key) { cacheFile = file; cacheKey = key; }
+	virtual AcceleratorStats getStats();
+	virtual RayAccelerator* createEmpty() const { return new OctreeAccelerator(); }
 
 	AABB getBox() { return box; }
-	Point3D getMiddlePoint() { return middlePoint; }
-	bool isLeaf() { return leaf; }
-	OctreeAccelerator* getChild(unsigned int i) {
-		if (i < 8) {
-			return child[i];
-		}
-		return NULL;
-	}
+	const CachedArray<TOctreeNode>& getNodes() { return nodes; }
+	const CachedArray<unsigned int>& getObjIndexes() { return objIndexes; }
+	// Build neighbour links of all nodes (parallel to node array) for export.
+	void getLinks(std::vector<TOctreeLink>& links);
 
 	virtual void build(const std::vector<Intersectable*>& objects);
-	virtual bool intersect(const Ray& ray);
-	virtual bool intersect(const Ray& ray, Intersection& is);
+	virtual bool intersect(const Ray& ray, TraversalCounters* counters = NULL);
+	virtual bool intersect(const Ray& ray, Intersection& is, TraversalCounters* counters = NULL);
 	virtual std::vector<Intersectable*> getObjects() { return c_objects; }
 
 private:
-	bool ProcessSubNode(const Ray& ray, unsigned char flag,
+	bool ProcessSubNode(const Ray& ray, Mailbox& mailbox, TraversalCounters* counters, unsigned int node, unsigned char flag,
+		float tx0, float ty0, float tz0, float tx1, float ty1, float tz1);
+	bool ProcessSubNode(const Ray& ray, Intersection& is, Mailbox& mailbox, TraversalCounters* counters, unsigned int node, unsigned char flag,
 		float tx0, float ty0, float tz0, float tx1, float ty1, float tz1);
-	bool ProcessSubNode(const Ray& ray, Intersection& is, unsigned char flag,
-						float tx0, float ty0, float tz0, float tx1, float ty1, float tz1);
 	unsigned int GetFirstNode(float tx0, float ty0, float tz0, float txm, float tym, float tzm, unsigned char rayFlags);
 	unsigned int GetNextNode(unsigned char currentNode, float tx1, float ty1, float tz1);
+	bool GetRootParams(const Ray& ray, unsigned char& flag,
+		float& tx0, float& ty0, float& tz0, float& tx1, float& ty1, float& tz1);
+
+	// Storage for nodes and object indexes of one build task. Subtree root is
+	// node 0, indexes are local to arena until it is merged to parent.
+	struct OctreeArena {
+		std::vector<TOctreeNode> nodes;
+		std::vector<unsigned int> objIndexes;
+	};
 
-	int OctreeAccelerator::getSector(const Point3D& aabb, const Point3D& middlePoint);
-	void initBoundaries();
-	void recursiveBuild();
+	void buildNode(OctreeArena& arena, unsigned int node, const AABB& nodeBox,
+		const std::vector<unsigned int>& objects, int level);
+	void mergeArena(OctreeArena& dst, unsigned int node, const OctreeArena& src);
+	AABB getChildBox(const AABB& nodeBox, int child);
+	float collectStats(AcceleratorStats& stats, unsigned int node, const AABB& nodeBox, unsigned int depth);
+	bool loadCache();
+	void saveCache();
 
 	AABB box;
-	Point3D middlePoint;
-	int level;
 	std::vector<Intersectable*> c_objects;
-	OctreeAccelerator* child[8];
-	bool leaf;
+	CachedArray<TOctreeNode> nodes;			// Built or in mapped cache.
+	CachedArray<unsigned int> objIndexes;
+	AcceleratorCache cache;
+	int taskLevels;
+	bool verbose;
+	float costTraversal;
+	float costIntersect;
+	std::string cacheFile;
+	unsigned long long cacheKey;
 };
 
-#endif // _OCTREE_H_
\ No newline at end of file
+#endif // _OCTREE_H_
@@ -9,6 +9,8 @@
 #include "camera.h"
 #include "ray.h"
 #include "intersection.h"
+#include "triangle.h"
+#include "mesh.h"
 #include "material.h"
 #include "emissive.h"
 #include "pathtracer.h"
@@ -17,7 +19,7 @@
 #include "lightprobe.h"
 #include "SDLGLContext.h"
 
-PathTracer::PathTracer(Scene* scene, Image* img) : Raytracer(scene,img)
+PathTracer::PathTracer(Scene* scene, Image* img) : Raytracer(scene,img), mStats(NULL), mHeatmap(false)
 {
 }
 
@@ -114,12 +116,27 @@ Color PathTracer::tracePixel(int x, int y, int& ID)
 	ID++;
 	ray.ID = ID;
 
-	pixelColor += trace(ray, 0, ID);
+	if (mHeatmap)
+		pixelColor += heatmap(ray);
+	else
+		pixelColor += trace(ray, 0, ID);
 
 	return pixelColor;
 }
 
-Color PathTracer::trace(const Ray& ray, int depth, int& ID)
+// Distance of proxy from the hit mesh, 0 for spheres and meshes without proxy.
+static float getLodError(const Intersection& is)
+{
+#if MESH_LOD
+	if (is.mObject != NULL && !is.mObject->isSphere())
+		return ((Triangle*)is.mObject)->getMesh()->getLodError();
+#endif // MESH_LOD
+	return 0.0f;
+}
+
+// Camera rays intersect full meshes, after the first diffuse bounce lod is
+// set and proxies of meshes are intersected.
+Color PathTracer::trace(const Ray& ray, int depth, int& ID, bool lod)
 {
 	static int MINIMUM_DEPTH = 4;
 	static float p_absorption = 0.1f;
@@ -128,7 +145,7 @@ Color PathTracer::trace(const Ray& ray, int depth, int& ID)
 
 	Intersection is;
 	is.mHitTime = INF;
-	if (mScene->intersect(ray, is)) {
+	if (intersect(ray, is, lod)) {
 		Color emittedLight, directLight, indirectLight;
 		Material* material = is.mMaterial;
 
@@ -145,12 +162,12 @@ Color PathTracer::trace(const Ray& ray, int depth, int& ID)
 			Ray reflectedRay = is.getReflectedRay();
 			ID++;
 			reflectedRay.ID = ID;
-			emittedLight = trace(reflectedRay, depth + 1, ID);
+			emittedLight = trace(reflectedRay, depth + 1, ID, lod);
 		} else if (light_type - reflectivity <= transparency) {
 			Ray refractedRay = is.getRefractedRay();
 			ID++;
 			refractedRay.ID = ID;
-			emittedLight = trace(refractedRay, depth + 1, ID);
+			emittedLight = trace(refractedRay, depth + 1, ID, lod);
 		} else {
 			// Direct lighting
 			for (int i = 0; i < mScene->getNumberOfLights(); ++i) {
@@ -159,7 +176,7 @@ Color PathTracer::trace(const Ray& ray, int depth, int& ID)
 				Ray shadowRay = is.getShadowRay(light);
 				ID++;
 				shadowRay.ID = ID;
-				if (mScene->intersect(shadowRay))
+				if (intersect(shadowRay, lod))
 					continue;
 
 				float intensity = pow(shadowRay.maxT, -2);
@@ -201,8 +218,13 @@ Color PathTracer::trace(const Ray& ray, int depth, int& ID)
 				pathRay.ID = ID;
 				pathRay.orig = is.mPosition;
 				pathRay.dir = dir;
+				// Ray leaving full mesh starts beyond distance of its own proxy
+				// from it, rays leaving other surfaces are not offset.
+				bool pathLod = (PATHTRACER_LOD != 0);
+				if (pathLod && !lod)
+					pathRay.minT = maxT(pathRay.minT, getLodError(is));
 				Color brdf = material->evalBRDF(is, dir);
-				indirectLight = (float)M_PI * trace(pathRay, depth + 1, ID) * brdf;
+				indirectLight = (float)M_PI * trace(pathRay, depth + 1, ID, pathLod) * brdf;
 				if (depth > MINIMUM_DEPTH) {
 					indirectLight *= absorption_factor;
 				}
@@ -214,4 +236,51 @@ Color PathTracer::trace(const Ray& ray, int depth, int& ID)
 		return emittedLight;
 	} 
 	return Color(0,0,0);
+}
+
+// False colour of visited nodes and tested objects of ray in log scale,
+// from blue over cyan, green and yellow to red for HEATMAP_MAX_COST and more.
+// Same colours are computed by heatColor() in OpenCL kernels.
+Color PathTracer::heatmap(const Ray& ray)
+{
+	TraversalCounters counters;
+	Intersection is;
+	is.mHitTime = INF;
+	mScene->getAccelerator()->intersect(ray, is, &counters);
+	if (mStats)
+		mStats->add(counters);
+
+	float cost = (float)(counters.nodes + counters.primitives);
+	float t = 4.0f * minT(std::log(1.0f + cost) / std::log(1.0f + HEATMAP_MAX_COST), 1.0f);
+	Color c;
+	c.r = minT(maxT(t - 2.0f, 0.0f), 1.0f);
+	c.g = minT(t, 1.0f) - minT(maxT(t - 3.0f, 0.0f), 1.0f);
+	c.b = 1.0f - minT(maxT(t - 1.0f, 0.0f), 1.0f);
+	return c;
+}
+
+// Intersect scene, or its proxies if lod is set, and count traversal of ray
+// if stats are set.
+bool PathTracer::intersect(const Ray& ray, bool lod)
+{
+	if (mStats == NULL)
+		return lod ? mScene->intersectLod(ray) : mScene->intersect(ray);
+
+	RayAccelerator* accelerator = lod ? mScene->getLodAccelerator() : mScene->getAccelerator();
+	TraversalCounters counters;
+	bool hit = accelerator->intersect(ray, &counters);
+	mStats->add(counters);
+	return hit;
+}
+
+bool PathTracer::intersect(const Ray& ray, Intersection& is, bool lod)
+{
+	if (mStats == NULL)
+		return lod ? mScene->intersectLod(ray, is) : mScene->intersect(ray, is);
+
+	RayAccelerator* accelerator = lod ? mScene->getLodAccelerator() : mScene->getAccelerator();
+	TraversalCounters counters;
+	bool hit = accelerator->intersect(ray, is, &counters);
+	mStats->add(counters);
+	return hit;
 }
\ No newline at end of file
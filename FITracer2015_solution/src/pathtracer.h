@@ -8,6 +8,13 @@
 #define PATHTRACER_H
 
 #include "raytracer.h"
+#include "acceleratorstats.h"
+
+// Indirect diffuse rays and rays spawned by them trace simplified proxies of meshes.
+#define PATHTRACER_LOD 1
+
+class Ray;
+class Intersection;
 
 class PathTracer : public Raytracer
 {
@@ -18,10 +25,20 @@ public:
 	void computeFirstImage(SDLGLContext* context, float* data);
 	virtual void computeImage(SDLGLContext* context, float* data);
 	void setScene(Scene* scene) { this->mScene = scene; }
+	// Add traversal counters of every traced ray to stats, NULL disables counting.
+	void setTraversalStats(TraversalStats* stats) { mStats = stats; }
+	// Draw false colour of traversal cost of camera rays instead of pathtracing.
+	void setHeatmap(bool heatmap) { mHeatmap = heatmap; }
 	
 protected:
 	Color tracePixel(int x, int y, int& ID);
-	Color trace(const Ray& ray, int depth, int& ID);
+	Color trace(const Ray& ray, int depth, int& ID, bool lod = false);
+	Color heatmap(const Ray& ray);
+	bool intersect(const Ray& ray, bool lod = false);
+	bool intersect(const Ray& ray, Intersection& is, bool lod = false);
+
+	TraversalStats* mStats;
+	bool mHeatmap;
 };
 
 #endif
@@ -11,17 +11,31 @@
 #define RAYACCELERATOR_H
 
 #include "intersectable.h"
+#include "acceleratorstats.h"
 #include <vector>
 
 class RayAccelerator
 {
 public:
 	virtual void build(const std::vector<Intersectable*>& objects) = 0;
-	virtual bool intersect(const Ray& ray) = 0;
-	virtual bool intersect(const Ray& ray, Intersection& is) = 0;
+	/// Traversal adds visited nodes and tested objects to counters of caller,
+	/// NULL disables counting. Structure itself is not changed by traversal.
+	virtual bool intersect(const Ray& ray, TraversalCounters* counters = NULL) = 0;
+	virtual bool intersect(const Ray& ray, Intersection& is, TraversalCounters* counters = NULL) = 0;
 	virtual ~RayAccelerator() {}
 
 	virtual std::vector<Intersectable*> getObjects() = 0;
+
+	/// Statistics of built structure.
+	virtual AcceleratorStats getStats() = 0;
+
+	/// Empty structure of the same type, e.g. for other geometry.
+	virtual RayAccelerator* createEmpty() const = 0;
+
+protected:
+	static inline void countNode(TraversalCounters* counters) { if (counters) counters->nodes++; }
+	static inline void countPrimitive(TraversalCounters* counters) { if (counters) counters->primitives++; }
+	static inline void countPrimitives(TraversalCounters* counters, unsigned int n) { if (counters) counters->primitives += n; }
 };
 
 #endif
@@ -12,22 +12,28 @@
 #include "camera.h"
 #include "lightprobe.h"
 #include "scene.h"
+#include "sphere.h"
 
 /**
  * Initializes an empty scene.
  */
-Scene::Scene(RayAccelerator* accelerator) : mRoot(new Node()), mBackgroundProbe(0)
+Scene::Scene(RayAccelerator* accelerator) : mRoot(new Node()), mBackgroundProbe(0), mLodBuilder(NULL), mLodAccelerator(NULL)
 {
 	mAccelerator = accelerator;
+	if (mAccelerator)
+		mAccelerators.push_back(mAccelerator);
 	std::cout << "creating scene" << std::endl;
 	mBackgroundColor = Color(0.0f, 0.0f, 0.0f);
 }
 
 /**
- * Destroys the scene and all its nodes.
+ * Destroys the scene, all its nodes and accelerators.
  */
 Scene::~Scene()
 {
+	clearLod();
+	for (unsigned int i = 0; i < mAccelerators.size(); i++)
+		delete mAccelerators[i];
 	if (mRoot)
 		delete mRoot; // Recursively deletes all children nodes.
 }
@@ -63,6 +69,9 @@ void Scene::prepare()
 {
 	std::cout << "preparing scene..." << std::endl;
 
+	// Meshes and textures are still loading.
+	mLoader.wait();
+
 	// Recursively setup transform matrices.
 	setupTransform(mRoot, Matrix());
 
@@ -71,13 +80,16 @@ void Scene::prepare()
 
 	// Extract scene data that will be needed during renderng.
 	mCameras.clear();
+	mPLights.clear();
 
-	std::vector<Intersectable*> geometry;
-	geometry.reserve(1000);
-	extractData(mRoot, geometry);
+	mGeometry.clear();
+	mGeometry.reserve(1000);
+	extractData(mRoot, mGeometry);
 	
 	// Build accelerator.
-	mAccelerator->build(geometry);
+	if (mAccelerator)
+		mAccelerator->build(mGeometry);
+	buildLod();
 }
 
 void Scene::rebuild() {
@@ -85,11 +97,101 @@ void Scene::rebuild() {
 	mCameras.clear();
 	mPLights.clear();
 
-	std::vector<Intersectable*> geometry;
-	geometry.reserve(1000);
-	extractData(mRoot, geometry);
-	// Build accelerator.
-	mAccelerator->build(geometry);
+	mGeometry.clear();
+	mGeometry.reserve(1000);
+	extractData(mRoot, mGeometry);
+	// Build all accelerators.
+	for (unsigned int i = 0; i < mAccelerators.size(); i++)
+		mAccelerators[i]->build(mGeometry);
+	buildLod();
+}
+
+/**
+ * Extracts geometry with meshes replaced by their proxies and starts build
+ * of accelerator over it. Without proxies secondary rays use the same
+ * accelerator as camera rays.
+ */
+void Scene::buildLod()
+{
+	clearLod();
+	if (!extractLod(mRoot, mLodGeometry)) {
+		mLodGeometry.clear();
+		return;
+	}
+	std::cout << "proxies: " << mGeometry.size() << " -> " << mLodGeometry.size() << " objects" << std::endl;
+	mLodBuilder = new AcceleratorBuilder(mLodGeometry);
+	updateLod();
+}
+
+/**
+ * Waits for running build over proxies and deletes all their accelerators.
+ */
+void Scene::clearLod()
+{
+	delete mLodBuilder;
+	mLodBuilder = NULL;
+	std::map<RayAccelerator*, RayAccelerator*>::iterator itr = mLodAccelerators.begin();
+	for ( ; itr != mLodAccelerators.end(); ++itr)
+		delete itr->second;
+	mLodAccelerators.clear();
+	mLodAccelerator = NULL;
+	mLodGeometry.clear();
+}
+
+/**
+ * Uses accelerator over proxies of the same type as the used accelerator
+ * if it is built, otherwise requests its build.
+ */
+void Scene::updateLod()
+{
+	mLodAccelerator = NULL;
+	if (mLodBuilder == NULL || mAccelerator == NULL)
+		return;
+	RayAccelerator*& lod = mLodAccelerators[mAccelerator];
+	if (lod == NULL) {
+		lod = mAccelerator->createEmpty();
+		mLodBuilder->add(lod, "Proxies");
+		mLodBuilder->start();
+	}
+	if (mLodBuilder->isReady(lod))
+		mLodAccelerator = lod;
+	else
+		mLodBuilder->request(lod);
+}
+
+void Scene::useAccelerator(RayAccelerator* accelerator)
+{
+	mAccelerator = accelerator;
+	updateLod();
+}
+
+/**
+ * Returns key of scene geometry for caches of built structures. It covers
+ * stamps and world transforms of all nodes with geometry in order of their
+ * extraction. It does not need loaded meshes, so caches can be checked
+ * before prepare().
+ */
+unsigned long long Scene::getGeometryKey()
+{
+	setupTransform(mRoot, Matrix());
+	std::vector<unsigned long long> stamps;
+	extractKey(mRoot, stamps);
+	return AcceleratorCache::hashData(stamps.data(), stamps.size() * sizeof(unsigned long long));
+}
+
+/**
+ * Builds the accelerator over geometry extracted by prepare(). The scene
+ * owns the accelerator, but keeps using the current one until
+ * useAccelerator() is called. The first added accelerator is used at once.
+ */
+RayAccelerator* Scene::addAccelerator(RayAccelerator* accelerator, bool build)
+{
+	if (build)
+		accelerator->build(mGeometry);
+	mAccelerators.push_back(accelerator);
+	if (mAccelerator == NULL)
+		useAccelerator(accelerator);
+	return accelerator;
 }
 
 /**
@@ -174,6 +276,37 @@ void Scene::extractData(Node* node, std::vector<Intersectable*>& geometry)
 		extractData(*itr, geometry);
 }
 
+/**
+ * Recursively store stamp and hash of world transform of nodes with geometry.
+ */
+void Scene::extractKey(Node* node, std::vector<unsigned long long>& stamps)
+{
+	unsigned long long stamp = node->getGeometryStamp();
+	if (stamp) {
+		float transform[16];
+		for (int i = 0; i < 16; i++)
+			transform[i] = node->mWorldTransform(i / 4, i % 4);
+		stamps.push_back(stamp);
+		stamps.push_back(AcceleratorCache::hashData(transform, sizeof(transform)));
+	}
+	Node::t_itr itr = node->mChildren.begin();
+	for( ; itr!=node->mChildren.end(); ++itr)
+		extractKey(*itr, stamps);
+}
+
+/**
+ * Recursively extract geometry for secondary rays, returns true if any node
+ * has a proxy.
+ */
+bool Scene::extractLod(Node* node, std::vector<Intersectable*>& geometry)
+{
+	bool proxy = node->getLodGeometry(geometry);
+	Node::t_itr itr = node->mChildren.begin();
+	for( ; itr!=node->mChildren.end(); ++itr)
+		proxy = extractLod(*itr, geometry) || proxy;
+	return proxy;
+}
+
 /**
  * Returns true if the given ray intersects the scene.
  * However, no info about the hit point is returned.
@@ -192,14 +325,28 @@ bool Scene::intersect(const Ray& ray, Intersection& is)
 	return mAccelerator->intersect(ray, is);
 }
 
+/**
+ * Intersection tests of secondary rays, meshes are replaced by their proxies.
+ */
+bool Scene::intersectLod(const Ray& ray)
+{
+	return getLodAccelerator()->intersect(ray);
+}
+
+bool Scene::intersectLod(const Ray& ray, Intersection& is)
+{
+	return getLodAccelerator()->intersect(ray, is);
+}
+
 
-void Scene::getObjects(std::vector<TSphere>* sp_obj, std::vector<TTriangle>* tr_obj, 
-	std::vector<TMesh>* meshes,	std::vector<unsigned int>* size_meshes)
+void Scene::getObjects(std::vector<TSphere>* sp_obj, std::vector<TSphereData>* spd_obj,
+	std::vector<TTriangle>* tr_obj, std::vector<TMesh>* meshes,	std::vector<unsigned int>* size_meshes)
 {
-	std::vector<Intersectable*> list = mAccelerator->getObjects();
+	std::vector<Intersectable*> list = mGeometry;
 	std::vector<Intersectable*>::iterator obj = list.begin();
 
 	TSphere sphere;
+	TSphereData sphereData;
 	TTriangle triangle;
 	std::vector<Mesh*> st_mesh_addr;
 	std::vector<Mesh*>::iterator it;
@@ -211,10 +358,12 @@ void Scene::getObjects(std::vector<TSphere>* sp_obj, std::vector<TTriangle>* tr_
 
 	for (int i = 0; i < size; i++) {
 		if ((*obj)->isSphere()) {
-			((*obj))->setObj(&sphere);
-			sphere.index = (*obj)->getIndex();
+			((*obj))->setObj(&sphereData);
+			sphereData.index = (*obj)->getIndex();
+			((Sphere*)(*obj))->getSphere(sphere);
 			//memcpy(tmp.object, &sphere, 96);
 			sp_obj->push_back(sphere);
+			spd_obj->push_back(sphereData);
 		}
 		else {
 			// Get info about triangle.
@@ -11,10 +11,13 @@
 #define SCENE_H
 
 #include <vector>
+#include <map>
 #include "rayaccelerator.h"
 #include "pointlight.h"
 #include "triangle.h"
 #include "gpu_types.h"
+#include "assetloader.h"
+#include "acceleratorbuilder.h"
 
 class Node;
 class Dummy;
@@ -34,15 +37,27 @@ class Intersectable;
  * acceleration data structure, and caching necessary data.
  * A ray can be intersected tested against the scene by calling the
  * intersect() functions.
+ * Geometry is extracted only once, any number of acceleration structures
+ * can be built over it by addAccelerator() and one of them is used for
+ * intersection tests, see useAccelerator().
+ * Meshes and textures can be loaded in parallel by getLoader(), prepare()
+ * waits until all of them are loaded.
+ * Meshes with simplified proxies are replaced by them in separate geometry,
+ * which is traced by intersectLod() for secondary rays. Structure over it
+ * has the type of the used accelerator and is built on background thread,
+ * secondary rays trace the full geometry until it is ready.
  */
 class Scene
 {
 public:
-	Scene(RayAccelerator* accelerator);
+	Scene(RayAccelerator* accelerator = NULL);
 	~Scene();
 	
 	void add(Node* node, Node* parent=0);
 	void prepare();
+
+	// Loader of assets of the scene, repeated files are loaded once.
+	AssetLoader& getLoader() { return mLoader; }
 	
 	void setBackground(const Color& c);
 	void setBackground(LightProbe* lp);
@@ -51,6 +66,8 @@ public:
 	// Ray-scene intersection tests
 	bool intersect(const Ray& ray);
 	bool intersect(const Ray& ray, Intersection& is);
+	bool intersectLod(const Ray& ray);
+	bool intersectLod(const Ray& ray, Intersection& is);
 
 	/// Returns the number of cameras in the scene.
 	int getNumberOfCameras() const { return (int)mCameras.size(); }
@@ -64,19 +81,26 @@ public:
 	/// Returns a pointer to light number i (starting at 0).
 	PointLight* getLight(int i) const { return mPLights.at(i); }
 
-	//Set new accelerate data structure
-	void setAccelerator(RayAccelerator* accelerator) { 
-		if (mAccelerator != NULL)
-			delete mAccelerator;
-		mAccelerator = accelerator; 
-	}
+	// Build accelerator over geometry of prepared scene, scene owns it. Without
+	// build the caller builds it later over getGeometry(), e.g. on other thread.
+	RayAccelerator* addAccelerator(RayAccelerator* accelerator, bool build = true);
+	// Use one of added accelerators for intersection tests.
+	void useAccelerator(RayAccelerator* accelerator);
 
 	RayAccelerator* getAccelerator() { return mAccelerator; }
+	// Key of geometry for caches of built structures, see AcceleratorCache.
+	unsigned long long getGeometryKey();
+	const std::vector<Intersectable*>& getGeometry() const { return mGeometry; }
+
+	// Accelerator over proxies, the used one until it is built or if no mesh has a proxy.
+	RayAccelerator* getLodAccelerator() { return mLodAccelerator ? mLodAccelerator : mAccelerator; }
+	// Switch secondary rays to built accelerator over proxies, call between images.
+	void updateLod();
 
 	void rebuild();
 
-	void getObjects(std::vector<TSphere>* sp_obj, std::vector<TTriangle>* tr_obj, 
-		std::vector<TMesh>* meshes, std::vector<unsigned int>* size_meshes);
+	void getObjects(std::vector<TSphere>* sp_obj, std::vector<TSphereData>* spd_obj,
+		std::vector<TTriangle>* tr_obj, std::vector<TMesh>* meshes, std::vector<unsigned int>* size_meshes);
 
 	void getLights(std::vector<TLight>* lights);
 
@@ -84,6 +108,10 @@ private:
 	void setupTransform(Node* node, const Matrix& parent);
 	void prepareNode(Node* node);
 	void extractData(Node* node, std::vector<Intersectable*>& geometry);
+	void extractKey(Node* node, std::vector<unsigned long long>& stamps);
+	bool extractLod(Node* node, std::vector<Intersectable*>& geometry);
+	void buildLod();
+	void clearLod();
 
 private:
 	Node* mRoot;							///< Ptr to root node in the scene hierarchy.
@@ -91,7 +119,14 @@ private:
 	std::vector<PointLight*> mPLights;		///< Array of ptrs to lights in the scene.
 	Color mBackgroundColor;					///< Background color to use if not using light probe.
 	LightProbe* mBackgroundProbe;			///< Ptr to light probe or 0 if none.
-	RayAccelerator* mAccelerator;		///< kD-tree accelerator structure.
+	RayAccelerator* mAccelerator;		///< Used ray accelerator structure (list, BVH, octree, grid or kD-tree).
+	std::vector<RayAccelerator*> mAccelerators;	///< All accelerators built over geometry.
+	std::vector<Intersectable*> mGeometry;	///< Intersectable geometry, extracted once by prepare().
+	std::vector<Intersectable*> mLodGeometry;	///< Geometry with meshes replaced by their proxies.
+	AcceleratorBuilder* mLodBuilder;		///< Builder of accelerators over proxies, NULL without proxies.
+	std::map<RayAccelerator*, RayAccelerator*> mLodAccelerators;	///< Accelerator over proxies for each used one.
+	RayAccelerator* mLodAccelerator;		///< Built accelerator over proxies of used one, NULL until it is built.
+	AssetLoader mLoader;					///< Parallel loader of meshes and textures.
 };
 
 #endif
@@ -0,0 +1,224 @@
+/*
+	Name: scenefile.cpp
+	Desc: Text description of scene.
+	Author: Karel Brezina (xbrezi13)
+*/
+
+#include "scenefile.h"
+#include "diffuse.h"
+#include "emissive.h"
+#include "sphere.h"
+#include "mesh.h"
+#include "pointlight.h"
+#include <fstream>
+
+static bool readVector(std::istringstream& args, float& x, float& y, float& z)
+{
+	return (bool)(args >> x >> y >> z);
+}
+
+void SceneFile::clear()
+{
+	filename.clear();
+	materials.clear();
+	meshes.clear();
+	objects.clear();
+	lights.clear();
+	hasCamera = false;
+	hasBackground = false;
+	accelerator.clear();
+}
+
+void SceneFile::error(int line, const std::string& message) const
+{
+	std::ostringstream text;
+	text << filename << ":" << line << ": " << message;
+	throw std::runtime_error(text.str());
+}
+
+void SceneFile::read(const std::string& filename)
+{
+	clear();
+	this->filename = filename;
+	std::ifstream file(filename.c_str());
+	if (!file)
+		throw std::runtime_error("could not open file " + filename);
+
+	std::string text;
+	int line = 0;
+	while (std::getline(file, text)) {
+		line++;
+		size_t comment = text.find('#');
+		if (comment != std::string::npos)
+			text.erase(comment);
+		std::istringstream args(text);
+		std::string command;
+		if (args >> command)
+			readLine(command, args, line);
+	}
+
+	// Names can be used before declaration, they are checked at the end.
+	for (unsigned int i = 0; i < objects.size(); i++) {
+		const ObjectDesc& object = objects[i];
+		if (!object.sphere && meshes.count(object.mesh) == 0)
+			error(object.line, "unknown mesh " + object.mesh);
+		if (materials.count(object.material) == 0)
+			error(object.line, "unknown material " + object.material);
+	}
+}
+
+void SceneFile::readLine(const std::string& command, std::istringstream& args, int line)
+{
+	if (command == "material") {
+		std::string name, type;
+		MaterialDesc material;
+		material.reflectivity = 0.0f;
+		material.transparency = 0.0f;
+		material.index = 1.0f;
+		if (!(args >> name >> type) || (type != "diffuse" && type != "emissive"))
+			error(line, "expected material <name> diffuse|emissive <r g b>");
+		material.emissive = (type == "emissive");
+		if (!readVector(args, material.color.r, material.color.g, material.color.b))
+			error(line, "expected color of material " + name);
+		if (!material.emissive && !(args >> std::ws).eof()) {
+			if (!(args >> material.reflectivity >> material.transparency >> material.index))
+				error(line, "expected <reflectivity> <transparency> <index>");
+		}
+		if (materials.count(name))
+			error(line, "material " + name + " is already declared");
+		materials[name] = material;
+	}
+	else if (command == "mesh") {
+		std::string name, file;
+		if (!(args >> name >> file))
+			error(line, "expected mesh <name> <file>");
+		if (meshes.count(name))
+			error(line, "mesh " + name + " is already declared");
+		meshes[name] = file;
+	}
+	else if (command == "instance" || command == "sphere") {
+		ObjectDesc object;
+		object.sphere = (command == "sphere");
+		object.radius = 0.0f;
+		object.scale = 1.0f;
+		object.line = line;
+		if (object.sphere ? !(args >> object.radius >> object.material) : !(args >> object.mesh >> object.material))
+			error(line, object.sphere ? "expected sphere <radius> <material>" : "expected instance <mesh> <material>");
+
+		std::string option;
+		while (args >> option) {
+			bool valid = false;
+			if (option == "translate")
+				valid = readVector(args, object.translation.x, object.translation.y, object.translation.z);
+			else if (option == "scale" && !object.sphere)
+				valid = (bool)(args >> object.scale);
+			else if (option == "rotate" && !object.sphere)
+				valid = readVector(args, object.rotation.x, object.rotation.y, object.rotation.z);
+			else
+				error(line, "unknown option " + option);
+			if (!valid)
+				error(line, "expected values of " + option);
+		}
+		objects.push_back(object);
+		return;
+	}
+	else if (command == "light") {
+		LightDesc light;
+		light.intensity = 1.0f;
+		if (!readVector(args, light.position.x, light.position.y, light.position.z)
+			|| !readVector(args, light.color.r, light.color.g, light.color.b))
+			error(line, "expected light <x y z> <r g b>");
+		if (!(args >> std::ws).eof() && !(args >> light.intensity))
+			error(line, "expected intensity of light");
+		lights.push_back(light);
+	}
+	else if (command == "camera") {
+		if (!readVector(args, cameraPosition.x, cameraPosition.y, cameraPosition.z)
+			|| !readVector(args, cameraTarget.x, cameraTarget.y, cameraTarget.z)
+			|| !readVector(args, cameraUp.x, cameraUp.y, cameraUp.z) || !(args >> cameraFov))
+			error(line, "expected camera <position> <target> <up> <fov>");
+		hasCamera = true;
+	}
+	else if (command == "background") {
+		if (!readVector(args, background.r, background.g, background.b))
+			error(line, "expected background <r g b>");
+		hasBackground = true;
+	}
+	else if (command == "accelerator") {
+		if (!(args >> accelerator) || (accelerator != "list" && accelerator != "octree" && accelerator != "grid"
+			&& accelerator != "bvh" && accelerator != "kdtree" && accelerator != "auto"))
+			error(line, "expected accelerator list|octree|grid|bvh|kdtree|auto");
+	}
+	else {
+		error(line, "unknown command " + command);
+	}
+
+	std::string rest;
+	if (args >> rest)
+		error(line, "unexpected " + rest);
+}
+
+void SceneFile::build(Scene* scene) const
+{
+	// Start loading of all used meshes before the first node is created.
+	std::map<std::string, MeshFuture> loads;
+	for (unsigned int i = 0; i < objects.size(); i++) {
+		if (!objects[i].sphere && loads.count(objects[i].mesh) == 0)
+			loads[objects[i].mesh] = scene->getLoader().loadMesh(meshes.find(objects[i].mesh)->second);
+	}
+
+	// Objects share materials of the same name.
+	std::map<std::string, Material*> created;
+	for (std::map<std::string, MaterialDesc>::const_iterator it = materials.begin(); it != materials.end(); ++it) {
+		const MaterialDesc& m = it->second;
+		if (m.emissive)
+			created[it->first] = new Emissive(m.color);
+		else
+			created[it->first] = new Diffuse(m.color, m.reflectivity, m.transparency, m.index);
+	}
+
+	unsigned int index = 0;
+	for (unsigned int i = 0; i < objects.size(); i++) {
+		const ObjectDesc& object = objects[i];
+		Material* material = created[object.material];
+		if (object.sphere) {
+			Sphere* sphere = new Sphere(object.radius, material);
+			sphere->setTranslation(object.translation);
+			index = sphere->setIndex(index);
+			scene->add(sphere);
+		}
+		else {
+			Mesh* mesh = new Mesh(loads[object.mesh], material);
+			mesh->setScale(object.scale);
+			mesh->setRotation(object.rotation);
+			mesh->setTranslation(object.translation);
+			index = mesh->setIndexes(index);
+			scene->add(mesh);
+		}
+	}
+
+	for (unsigned int i = 0; i < lights.size(); i++)
+		scene->add(new PointLight(lights[i].position, lights[i].color, lights[i].intensity));
+	if (hasBackground)
+		scene->setBackground(background);
+}
+
+bool SceneFile::setupCamera(Camera* camera) const
+{
+	if (!hasCamera)
+		return false;
+	camera->setLookAt(cameraPosition, cameraTarget, cameraUp, cameraFov);
+	return true;
+}
+
+// Without meshes only few spheres are traced faster by list.
+std::string SceneFile::getAccelerator() const
+{
+	if (!accelerator.empty())
+		return accelerator;
+	for (unsigned int i = 0; i < objects.size(); i++) {
+		if (!objects[i].sphere)
+			return "bvh";
+	}
+	return (objects.size() <= SCENE_FILE_LIST_MAX_OBJECTS) ? "list" : "bvh";
+}
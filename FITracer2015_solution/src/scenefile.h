@@ -0,0 +1,97 @@
+/*
+	Name: scenefile.h
+	Desc: Text description of scene.
+	Author: Karel Brezina (xbrezi13)
+*/
+
+#ifndef _SCENE_FILE_H_
+#define _SCENE_FILE_H_
+
+#include "scene.h"
+#include "camera.h"
+#include "color.h"
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Scene with at most this number of spheres and without meshes is traced by list.
+#define SCENE_FILE_LIST_MAX_OBJECTS 16
+
+// One command per line, '#' starts comment. Names are declared before or
+// after their use, files are relative to working directory.
+//   material <name> diffuse <r g b> [<reflectivity> <transparency> <index>]
+//   material <name> emissive <r g b>
+//   mesh <name> <file>
+//   instance <mesh> <material> [scale <s>] [rotate <x y z>] [translate <x y z>]
+//   sphere <radius> <material> [translate <x y z>]
+//   light <x y z> <r g b> [<intensity>]
+//   camera <position x y z> <target x y z> <up x y z> <fov>
+//   background <r g b>
+//   accelerator list|octree|grid|bvh|kdtree|auto
+// Whole file is read and checked by read() before build(), so build() starts
+// loading of all used meshes at once, every file only once, and structure
+// named by getAccelerator() can be queued for build before meshes are loaded.
+class SceneFile {
+public:
+	SceneFile() { clear(); }
+
+	// Throws std::runtime_error with file and line of the first error.
+	void read(const std::string& filename);
+	void clear();
+
+	// Add nodes, lights and background of read scene.
+	void build(Scene* scene) const;
+	// Return false if the file has no camera.
+	bool setupCamera(Camera* camera) const;
+
+	// Structure named by the file, otherwise chosen by content of the file.
+	std::string getAccelerator() const;
+
+private:
+	struct MaterialDesc {
+		bool emissive;
+		Color color;
+		float reflectivity;
+		float transparency;
+		float index;
+	};
+
+	// Instance of mesh or sphere, line is used in messages.
+	struct ObjectDesc {
+		bool sphere;
+		std::string mesh;
+		float radius;
+		std::string material;
+		float scale;
+		Vector3D rotation;
+		Vector3D translation;
+		int line;
+	};
+
+	struct LightDesc {
+		Point3D position;
+		Color color;
+		float intensity;
+	};
+
+	void readLine(const std::string& command, std::istringstream& args, int line);
+	void error(int line, const std::string& message) const;
+
+	std::string filename;
+	std::map<std::string, MaterialDesc> materials;
+	std::map<std::string, std::string> meshes;
+	std::vector<ObjectDesc> objects;
+	std::vector<LightDesc> lights;
+	bool hasCamera;
+	Point3D cameraPosition;
+	Point3D cameraTarget;
+	Vector3D cameraUp;
+	float cameraFov;
+	bool hasBackground;
+	Color background;
+	std::string accelerator;
+};
+
+#endif // _SCENE_FILE_H_
@@ -9,11 +9,12 @@
 
 #include "defines.h"
 #include "sphere.h"
+#include "acceleratorcache.h"
 	
 /**
  * Creates a sphere primitive.
  */
-Sphere::Sphere() : Primitive(), mRadius(0.5f)
+Sphere::Sphere() : Primitive(), mRadius(0.5f), mSimple(false)
 {
 
 }
@@ -21,7 +22,7 @@ Sphere::Sphere() : Primitive(), mRadius(0.5f)
 /**
  * Creates a sphere at origin with radius r and material m.
  */
-Sphere::Sphere(float r, Material* m) : Primitive(m), mRadius(r)
+Sphere::Sphere(float r, Material* m) : Primitive(m), mRadius(r), mSimple(false)
 {
 }
 
@@ -43,18 +44,42 @@ void Sphere::setRadius(float r)
 /**
  * Prepare sphere for rendering. This function computes the world->object
  * transform (inverse of the mWorldTransform matrix), so that intersection
- * tests can be performed in object space.
+ * tests can be performed in object space. Sphere which is only translated
+ * and uniformly scaled is stored as world space center and radius and
+ * tested without transforms, the matrices are used only for ellipsoids.
  */
 void Sphere::prepare()
 {
 	// Compute inverse world transform.
 	mInvWorldTransform = mWorldTransform.inverse();
+
+	float scale = mWorldTransform(0,0);
+	mSimple = scale > 0.0f;
+	for (int i = 0; i < 3; i++) {
+		for (int j = 0; j < 3; j++) {
+			float expected = (i == j) ? scale : 0.0f;
+			if (std::fabs(mWorldTransform(i,j) - expected) > 1e-6f * scale)
+				mSimple = false;
+		}
+	}
+
+	mCenter = mWorldTransform * Point3D(0.0f, 0.0f, 0.0f);
+	mWorldRadius = mSimple ? scale * mRadius : mRadius;
+	mRadius2 = mWorldRadius * mWorldRadius;
 }
 
 /**
  * Append all intersectable geometry in this object to the array.
  * In this case, the Sphere itself is intersectable, so just add the this pointer.
  */
+/**
+ * Stamp of the sphere is given by its radius, the rest is in its transform.
+ */
+unsigned long long Sphere::getGeometryStamp()
+{
+	return AcceleratorCache::hashData(&mRadius, sizeof(mRadius));
+}
+
 void Sphere::getGeometry(std::vector<Intersectable*>& geometry)
 {
 	geometry.push_back(this);
@@ -89,6 +114,22 @@ bool Sphere::solveQuadratic(float A, float B, float C, float& t0, float& t1) con
 	return true;
 }
 
+/**
+ * Returns ray in space where the sphere is centered about origin. Simple
+ * sphere only moves the origin, its radius is in world space.
+ */
+void Sphere::toObject(const Ray& ray, Point3D& o, Vector3D& d) const
+{
+	if (mSimple) {
+		o = ray.orig - mCenter;
+		d = ray.dir;
+	}
+	else {
+		o = mInvWorldTransform * ray.orig;
+		d = mInvWorldTransform * ray.dir;
+	}
+}
+
 // Implementation of the Intersectable interface.
 
 /**
@@ -97,13 +138,14 @@ bool Sphere::solveQuadratic(float A, float B, float C, float& t0, float& t1) con
 bool Sphere::intersect(const Ray& ray) const
 {
 	// First, translate the ray to object space.
-	Point3D o = mInvWorldTransform * ray.orig;
-	Vector3D d = mInvWorldTransform * ray.dir;
+	Point3D o;
+	Vector3D d;
+	toObject(ray, o, d);
 	
 	// Compute polynom coefficients.
 	float A = d.x*d.x + d.y*d.y + d.z*d.z;
 	float B = 2.0f * ( d.x*o.x + d.y*o.y + d.z*o.z );
-	float C = o.x*o.x + o.y*o.y + o.z*o.z - mRadius*mRadius;
+	float C = o.x*o.x + o.y*o.y + o.z*o.z - mRadius2;
 
 	// Solve quadratic equation for ray enter/exit point t0,t1 respectively.
 	float t0, t1;
@@ -121,13 +163,14 @@ bool Sphere::intersect(const Ray& ray) const
 bool Sphere::intersect(const Ray& ray, Intersection& isect) const
 {
 	// First, translate the ray to object space.
-	Point3D o = mInvWorldTransform * ray.orig;
-	Vector3D d = mInvWorldTransform * ray.dir;
+	Point3D o;
+	Vector3D d;
+	toObject(ray, o, d);
 	
 	// Compute polynom coefficients.
 	float A = d.x*d.x + d.y*d.y + d.z*d.z;
 	float B = 2.0f * ( d.x*o.x + d.y*o.y + d.z*o.z );
-	float C = o.x*o.x + o.y*o.y + o.z*o.z - mRadius*mRadius;
+	float C = o.x*o.x + o.y*o.y + o.z*o.z - mRadius2;
 	
 	// Solve quadratic equation for ray enter/exit point t0,t1 respectively.
 	float t0, t1;
@@ -140,12 +183,12 @@ bool Sphere::intersect(const Ray& ray, Intersection& isect) const
 	float t = t0<ray.minT ? t1 : t0;		// ray hit time
 	Point3D p = o + t*d;						// hit point in object space
 	Vector3D n = p;				// since sphere is centered about origin in object space,
-	n /= mRadius;
+	n /= mWorldRadius;
 	
 	// Compute spherical coordinates (theta,phi) in the range [0,1] for use as texture coords.
 	float u = std::atan2(-p.z,p.x) / (2.0f*M_PI);	// phi (angle around perimeter, CCW seen from top)
 	if(u<0.0f) u+=1.0f;
-	float v = std::acos(p.y/mRadius) / M_PI;		// theta (angle from top of sphere)
+	float v = std::acos(p.y/mWorldRadius) / M_PI;		// theta (angle from top of sphere)
 	
 	if (v != v) // Check for NaN
 		v = p.y > 0.0f ? 0.0f : 1.0f;
@@ -155,8 +198,14 @@ bool Sphere::intersect(const Ray& ray, Intersection& isect) const
 	isect.mObject = this;					// The object by the ray (this object itself).
 	isect.mMaterial = getMaterial();		// Store ptr to the material.
 	isect.mHitTime = t;						// Store hit time parameter t.
-	isect.mPosition = mWorldTransform * p;	// Store world space hit point.
-	isect.mNormal = mWorldTransform * n;	// Store world space normal.
+	if (mSimple) {
+		isect.mPosition = mCenter + p;			// Store world space hit point.
+		isect.mNormal = n;						// Store world space normal.
+	}
+	else {
+		isect.mPosition = mWorldTransform * p;	// Store world space hit point.
+		isect.mNormal = mWorldTransform * n;	// Store world space normal.
+	}
 	isect.mNormal.normalize();	// just in case
 	isect.mView = -ray.dir;					// View direction is negative ray direction.
 	isect.mFrontFacing = isect.mView.dot(isect.mNormal) > 0.0f;
@@ -186,6 +235,33 @@ void Sphere::getAABB(AABB& bb) const
 	}	
 }
 
+/**
+ * Returns true if the sphere may overlap the box bb. The test is done
+ * against the sphere's bounding box, which is conservative.
+ */
+bool Sphere::overlapAABB(const AABB& bb) const
+{
+	AABB box;
+	getAABB(box);
+	return box.overlap(bb);
+}
+
+/**
+ * Computes the part of the sphere's bounding box inside the box bb.
+ * Returns false if the boxes do not overlap.
+ */
+bool Sphere::clipAABB(const AABB& bb, AABB& clipped) const
+{
+	getAABB(clipped);
+	for (int i = 0; i < 3; i++) {
+		clipped.mMin(i) = std::max(clipped.mMin(i), bb.mMin(i));
+		clipped.mMax(i) = std::min(clipped.mMax(i), bb.mMax(i));
+		if (clipped.mMin(i) > clipped.mMax(i))
+			return false;
+	}
+	return true;
+}
+
 UV Sphere::calculateTextureDifferential(const Point3D& p, const Vector3D& dp) const
 {
 	Point3D lp = mInvWorldTransform * p;
@@ -20,7 +20,9 @@
  * By setting its transform, the translation/scale/orientation can
  * be changed. The ray/sphere intersection is done by transforming the
  * ray to object space, and solving the quadratic equation for the
- * sphere: x^2 + y^2 + z^2 = r^2.
+ * sphere: x^2 + y^2 + z^2 = r^2. Sphere which is not rotated and
+ * is scaled uniformly skips the transform, the ray is only moved by
+ * the world space center and r is the world space radius.
  */
 class Sphere : public Primitive, public Intersectable
 {
@@ -35,15 +37,25 @@ public:
 	bool intersect(const Ray& ray) const;
 	bool intersect(const Ray& ray, Intersection& isect) const;
 	void getAABB(AABB& bb) const;
+	bool overlapAABB(const AABB& bb) const;
+	bool clipAABB(const AABB& bb, AABB& clipped) const;
 	UV calculateTextureDifferential(const Point3D& p, const Vector3D& dp) const;
 	Vector3D calculateNormalDifferential(const Point3D& p, const Vector3D& dp, bool isFrontFacing) const;
 
 	bool isSphere() const { return true; }
 
 	void setObj(void* obj) {
-		((TSphere*)obj)->radius = mRadius;
-		setMatrixes(((TSphere*)obj)->InvWorldTransform, ((TSphere*)obj)->WorldTransform);
-		setMaterial(((TSphere*)obj)->material);
+		((TSphereData*)obj)->radius = mRadius;
+		setMatrixes(((TSphereData*)obj)->InvWorldTransform, ((TSphereData*)obj)->WorldTransform);
+		setMaterial(((TSphereData*)obj)->material);
+	}
+
+	// Center and squared radius for intersection test on device, ellipsoid has negative radius.
+	void getSphere(TSphere& sphere) {
+		sphere.centerRadius2.s[0] = mCenter.x;
+		sphere.centerRadius2.s[1] = mCenter.y;
+		sphere.centerRadius2.s[2] = mCenter.z;
+		sphere.centerRadius2.s[3] = mSimple ? mRadius2 : -1.0f;
 	}
 
 	unsigned int getIndex() { return index; }
@@ -57,7 +69,9 @@ public:
 protected:
 	void prepare();
 	void getGeometry(std::vector<Intersectable*>& geometry);
+	unsigned long long getGeometryStamp();
 	bool solveQuadratic(float A, float B, float C, float& t0, float& t1) const;
+	void toObject(const Ray& ray, Point3D& o, Vector3D& d) const;
 	
 	void setMatrixes(TMatrix& mat, TMatrix& mat2) {
 		for (int i = 0; i < 4; i++) {
@@ -85,6 +99,10 @@ protected:
 protected:
 	float mRadius;					///< Radius of sphere.
 	Matrix mInvWorldTransform;		///< World->Object transform.	
+	bool mSimple;					///< Only translated and uniformly scaled, tested without transforms.
+	Point3D mCenter;				///< World space center.
+	float mWorldRadius;				///< Radius in space of toObject(), world space for simple sphere.
+	float mRadius2;					///< Squared mWorldRadius.
 };
 
 #endif
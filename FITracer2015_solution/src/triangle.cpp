@@ -11,6 +11,7 @@
 #include "ray.h"
 #include "triangle.h"
 #include "mesh.h"
+#include "trianglebatch.h"
 
 /// Triangle overlap distance to avoid problems at edges.
 static const float overlap = 1e-3f;
@@ -66,41 +67,15 @@ float Triangle::getArea() const
  * Returns true if the ray intersects the triangle.
  * This is useful for quickly determining if it's a hit or miss,
  * but no information about the hit point is returned.
+ * The test is watertight, rays hitting shared edge or vertex of
+ * two triangles never pass between them.
  */
 bool Triangle::intersect(const Ray& ray) const
 {
-	float eps = 0.001f;
-	Point3D P = ray.orig;
-	Vector3D D = ray.dir;
-	Vector3D v0 = getVtxPosition(0);
-	Vector3D v1 = getVtxPosition(1);
-	Vector3D v2 = getVtxPosition(2);
-
-	Vector3D e1 = v1 - v0;
-	Vector3D e2 = v2 - v0;
-
-	Vector3D N = e1 % e2;
-	float s = -D * N;
-	if (abs(s) < eps)
-		return false;
-
-	float s_inv = 1 / s;
-
-	Vector3D R = P - v0;
-	float t = R * N * s_inv;
-	if (t <= ray.minT || t >= ray.maxT)
-		return false;
-
-	Vector3D Q = -D % R;
-	float v = Q * e2 * s_inv;
-	if (v < 0)
-		return false;
-
-	float w = -e1 * Q * s_inv;
-	if (w < 0 || v + w > 1)
+	float t, u, v, w;
+	if (!intersectWatertight(WatertightRay(ray), getVtxPosition(0), getVtxPosition(1), getVtxPosition(2), t, u, v, w))
 		return false;
-
-	return true;
+	return t > ray.minT && t < ray.maxT;
 }
 
 /**
@@ -111,42 +86,22 @@ bool Triangle::intersect(const Ray& ray) const
 bool Triangle::intersect(const Ray& ray, Intersection& isect) const
 {
 	float t, u, v, w;
-	float eps = 0.001f;
-	Point3D P = ray.orig;
-	Vector3D D = ray.dir;
-	Vector3D v0 = getVtxPosition(0);
-	Vector3D v1 = getVtxPosition(1);
-	Vector3D v2 = getVtxPosition(2);
-
-	Vector3D e1 = v1 - v0;
-	Vector3D e2 = v2 - v0;
-
-	Vector3D N = e1 % e2;
-	float s = -D * N;
-	if (abs(s) < eps)
+	if (!intersectWatertight(WatertightRay(ray), getVtxPosition(0), getVtxPosition(1), getVtxPosition(2), t, u, v, w))
 		return false;
-
-	float s_inv = 1 / s;
-
-	Vector3D R = P - v0;
-	t = R * N * s_inv;
 	if (t <= ray.minT || t >= ray.maxT)
 		return false;
 
-	Vector3D Q = -D % R;
-	v = Q * e2 * s_inv;
-	if (v < 0)
-		return false;
-
-	w = -e1 * Q * s_inv;
-	if (w < 0 || v + w > 1)
-		return false;
-
-	u = 1 - v - w;
-
 	// If test passes...
+	setHit(ray, t, u, v, w, isect);
+	return true;
+}
 
-	// Compute information about the hit point
+/**
+ * Computes information about the hit point at time t, where u, v, w
+ * are barycentric coordinates (weights of vertices 0, 1, 2).
+ */
+void Triangle::setHit(const Ray& ray, float t, float u, float v, float w, Intersection& isect) const
+{
 	isect.mRay = ray;
 	isect.mObject = this;						// Store ptr to the object hit by the ray (this).
 	isect.mMaterial = getMaterial();
@@ -161,8 +116,6 @@ bool Triangle::intersect(const Ray& ray, Intersection& isect) const
 	isect.mTexture = u  *   getVtxTexture(0) + v*getVtxTexture(1) + w*getVtxTexture(2);
 	isect.mHitTime = t;
 	isect.mHitParam = UV(u,v);
-	
-	return true;
 }
 
 
@@ -174,6 +127,124 @@ void Triangle::getAABB(AABB& bb) const
 	bb = AABB(getVtxPosition(0), getVtxPosition(1), getVtxPosition(2));
 }
 
+/**
+ * Returns true if the triangle overlaps the box bb. Uses the separating
+ * axis test (Akenine-Moller): the three box normals, the triangle normal
+ * and the nine cross products of box and triangle edges.
+ */
+bool Triangle::overlapAABB(const AABB& bb) const
+{
+	float center[3], half[3], v[3][3], e[3][3];
+
+	for (int i = 0; i < 3; i++) {
+		center[i] = 0.5f * (bb.mMin(i) + bb.mMax(i));
+		half[i] = 0.5f * (bb.mMax(i) - bb.mMin(i)) + overlap;
+	}
+	for (int k = 0; k < 3; k++) {
+		const Point3D& p = getVtxPosition(k);
+		for (int i = 0; i < 3; i++)
+			v[k][i] = p(i) - center[i];
+	}
+	for (int k = 0; k < 3; k++) {
+		for (int i = 0; i < 3; i++)
+			e[k][i] = v[(k+1)%3][i] - v[k][i];
+	}
+
+	// Box normals, equal to AABB vs AABB test.
+	for (int i = 0; i < 3; i++) {
+		float mn = std::min(v[0][i], std::min(v[1][i], v[2][i]));
+		float mx = std::max(v[0][i], std::max(v[1][i], v[2][i]));
+		if (mn > half[i] || mx < -half[i])
+			return false;
+	}
+
+	// Cross products of box axis and triangle edges.
+	for (int k = 0; k < 3; k++) {
+		for (int i = 0; i < 3; i++) {
+			float a[3] = { 0.0f, 0.0f, 0.0f };
+			int i1 = (i+1)%3, i2 = (i+2)%3;
+			a[i1] = -e[k][i2];
+			a[i2] = e[k][i1];
+
+			float p0 = a[0]*v[0][0] + a[1]*v[0][1] + a[2]*v[0][2];
+			float p1 = a[0]*v[1][0] + a[1]*v[1][1] + a[2]*v[1][2];
+			float p2 = a[0]*v[2][0] + a[1]*v[2][1] + a[2]*v[2][2];
+			float r = half[0]*fabsf(a[0]) + half[1]*fabsf(a[1]) + half[2]*fabsf(a[2]);
+			float mn = std::min(p0, std::min(p1, p2));
+			float mx = std::max(p0, std::max(p1, p2));
+			if (mn > r || mx < -r)
+				return false;
+		}
+	}
+
+	// Triangle normal.
+	float n[3];
+	n[0] = e[0][1]*e[1][2] - e[0][2]*e[1][1];
+	n[1] = e[0][2]*e[1][0] - e[0][0]*e[1][2];
+	n[2] = e[0][0]*e[1][1] - e[0][1]*e[1][0];
+	float d = n[0]*v[0][0] + n[1]*v[0][1] + n[2]*v[0][2];
+	float r = half[0]*fabsf(n[0]) + half[1]*fabsf(n[1]) + half[2]*fabsf(n[2]);
+	return fabsf(d) <= r;
+}
+
+/**
+ * Computes the bounding box of the part of the triangle inside the box bb.
+ * The triangle is clipped by the six planes of the box (Sutherland-Hodgman),
+ * which gives tighter bounds than overlap of the boxes. The box is grown by
+ * overlap, so triangles touching the box within rounding are kept.
+ * Returns false if nothing is left after clipping.
+ */
+bool Triangle::clipAABB(const AABB& bb, AABB& clipped) const
+{
+	// Every plane adds at most two vertices (even for touching edges).
+	Point3D poly[16], next[16];
+	int n = 3;
+	for (int k = 0; k < 3; k++)
+		poly[k] = getVtxPosition(k);
+
+	for (int axis = 0; axis < 3; axis++) {
+		for (int side = 0; side < 2; side++) {
+			float plane = side ? bb.mMax(axis) + overlap : bb.mMin(axis) - overlap;
+			float sign = side ? -1.0f : 1.0f;
+			int m = 0;
+
+			for (int k = 0; k < n; k++) {
+				const Point3D& a = poly[k];
+				const Point3D& b = poly[(k+1)%n];
+				float da = sign * (a(axis) - plane);
+				float db = sign * (b(axis) - plane);
+
+				if (da >= 0.0f)
+					next[m++] = a;
+				if ((da < 0.0f) != (db < 0.0f)) {
+					float t = da / (da - db);
+					Point3D p;
+					for (int i = 0; i < 3; i++)
+						p(i) = a(i) + t * (b(i) - a(i));
+					p(axis) = plane;
+					next[m++] = p;
+				}
+			}
+
+			n = m;
+			if (n == 0)
+				return false;
+			for (int k = 0; k < n; k++)
+				poly[k] = next[k];
+		}
+	}
+
+	clipped = AABB(poly[0]);
+	for (int k = 1; k < n; k++)
+		clipped.include(poly[k]);
+	// Result must not leave the box.
+	for (int i = 0; i < 3; i++) {
+		clipped.mMin(i) = std::min(std::max(clipped.mMin(i), bb.mMin(i)), bb.mMax(i));
+		clipped.mMax(i) = std::max(std::min(clipped.mMax(i), bb.mMax(i)), bb.mMin(i));
+	}
+	return true;
+}
+
 void Triangle::prepare()
 {
 	Vector3D n = getFaceNormal();
@@ -204,6 +275,19 @@ const Point3D& Triangle::getVtxPosition(int i) const
 	return mMesh->mVtxP[mVtx[i].p];
 }
 
+#if MESH_COMPACT
+/// Returns the normal of vertex i=[0,1,2], decoded from octahedral mapping.
+Vector3D Triangle::getVtxNormal(int i) const
+{
+	return unpackNormal(mMesh->mPackedVtxN[mVtx[i].n]);
+}
+
+/// Returns the texture coordinate of vertex i=[0,1,2], decoded from half floats.
+UV Triangle::getVtxTexture(int i) const
+{
+	return unpackUV(mMesh->getPacked().mPackedUV[mVtx[i].t]);
+}
+#else
 /// Returns the normal of vertex i=[0,1,2].
 const Vector3D& Triangle::getVtxNormal(int i) const
 {
@@ -213,8 +297,9 @@ const Vector3D& Triangle::getVtxNormal(int i) const
 /// Returns the texture coordinate of vertex i=[0,1,2].
 const UV& Triangle::getVtxTexture(int i) const
 {
-	return mMesh->mVtxUV[mVtx[i].t];
+	return mMesh->mUV[mVtx[i].t];
 }
+#endif // MESH_COMPACT
 
 UV Triangle::calculateTextureDifferential(const Point3D& p, const Vector3D& dp) const
 {	
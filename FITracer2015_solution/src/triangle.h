@@ -47,13 +47,22 @@ public:
 	// Implementation of the Intersectable interface:
 	bool intersect(const Ray& ray) const;
 	bool intersect(const Ray& ray, Intersection& isect) const;
+	// Fill intersection of hit at time t with barycentric coordinates u, v, w.
+	void setHit(const Ray& ray, float t, float u, float v, float w, Intersection& isect) const;
 	void getAABB(AABB& bb) const;
+	bool overlapAABB(const AABB& bb) const;
+	bool clipAABB(const AABB& bb, AABB& clipped) const;
 	UV calculateTextureDifferential(const Point3D& p, const Vector3D& dp) const;
 	Vector3D calculateNormalDifferential(const Point3D& p, const Vector3D& dp, bool isFrontFacing) const;
 
 	const Point3D& getVtxPosition(int i) const;
+#if MESH_COMPACT
+	Vector3D getVtxNormal(int i) const;
+	UV getVtxTexture(int i) const;
+#else
 	const Vector3D& getVtxNormal(int i) const;
 	const UV& getVtxTexture(int i) const;
+#endif // MESH_COMPACT
 	Material *getMaterial() const {return mMaterial;}
 
 	bool isSphere() const { return false; }
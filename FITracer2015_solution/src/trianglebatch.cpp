@@ -0,0 +1,201 @@
+/*
+	Name: trianglebatch.cpp
+	Desc: Watertight ray-triangle intersection of one triangle and of SSE batch.
+	Author: Karel Brezina (xbrezi13)
+*/
+
+#include "trianglebatch.h"
+#include "triangle.h"
+#include <cmath>
+
+WatertightRay::WatertightRay(const Ray& ray)
+{
+	orig = ray.orig;
+
+	kz = 0;
+	if (std::fabs(ray.dir.y) > std::fabs(ray.dir(kz)))
+		kz = 1;
+	if (std::fabs(ray.dir.z) > std::fabs(ray.dir(kz)))
+		kz = 2;
+	kx = (kz + 1) % 3;
+	ky = (kx + 1) % 3;
+	// Keep winding of vertices.
+	if (ray.dir(kz) < 0.0f) {
+		int tmp = kx;
+		kx = ky;
+		ky = tmp;
+	}
+
+	Sx = ray.dir(kx) / ray.dir(kz);
+	Sy = ray.dir(ky) / ray.dir(kz);
+	Sz = 1.0f / ray.dir(kz);
+}
+
+bool intersectWatertight(const WatertightRay& ray, const Point3D& v0, const Point3D& v1,
+	const Point3D& v2, float& t, float& b0, float& b1, float& b2)
+{
+	// Vertices relative to origin of ray.
+	Vector3D A = v0 - ray.orig;
+	Vector3D B = v1 - ray.orig;
+	Vector3D C = v2 - ray.orig;
+
+	// Shear and scale vertices.
+	float ax = A(ray.kx) - ray.Sx * A(ray.kz);
+	float ay = A(ray.ky) - ray.Sy * A(ray.kz);
+	float bx = B(ray.kx) - ray.Sx * B(ray.kz);
+	float by = B(ray.ky) - ray.Sy * B(ray.kz);
+	float cx = C(ray.kx) - ray.Sx * C(ray.kz);
+	float cy = C(ray.ky) - ray.Sy * C(ray.kz);
+
+	// Scaled barycentric coordinates.
+	float U = cx * by - cy * bx;
+	float V = ax * cy - ay * cx;
+	float W = bx * ay - by * ax;
+
+	// Ray through edge or vertex, recompute in double precision.
+	if (U == 0.0f || V == 0.0f || W == 0.0f) {
+		U = (float)((double)cx * (double)by - (double)cy * (double)bx);
+		V = (float)((double)ax * (double)cy - (double)ay * (double)cx);
+		W = (float)((double)bx * (double)ay - (double)by * (double)ax);
+	}
+
+	if ((U < 0.0f || V < 0.0f || W < 0.0f) && (U > 0.0f || V > 0.0f || W > 0.0f))
+		return false;
+
+	float det = U + V + W;
+	if (det == 0.0f)
+		return false;
+
+	float az = ray.Sz * A(ray.kz);
+	float bz = ray.Sz * B(ray.kz);
+	float cz = ray.Sz * C(ray.kz);
+	float T = U * az + V * bz + W * cz;
+
+	float rcpDet = 1.0f / det;
+	t = T * rcpDet;
+	b0 = U * rcpDet;
+	b1 = V * rcpDet;
+	b2 = W * rcpDet;
+	return true;
+}
+
+TriangleBatch::TriangleBatch()
+{
+	size = 0;
+	for (int lane = 0; lane < TRIANGLE_BATCH_SIZE; lane++) {
+		triangles[lane] = NULL;
+		for (int k = 0; k < 3; k++) {
+			for (int i = 0; i < 3; i++)
+				vtx[k][i][lane] = 0.0f;
+		}
+	}
+}
+
+bool TriangleBatch::add(Triangle* triangle)
+{
+	if (size == TRIANGLE_BATCH_SIZE)
+		return false;
+
+	for (int k = 0; k < 3; k++) {
+		const Point3D& p = triangle->getVtxPosition(k);
+		for (int i = 0; i < 3; i++)
+			vtx[k][i][size] = p(i);
+	}
+	triangles[size++] = triangle;
+	return true;
+}
+
+// Same operations as intersectWatertight() on all lanes.
+int TriangleBatch::test(const WatertightRay& wray, const Ray& ray, __m128& t, __m128& b0, __m128& b1, __m128& b2) const
+{
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 Sx = _mm_set1_ps(wray.Sx);
+	const __m128 Sy = _mm_set1_ps(wray.Sy);
+	const __m128 Sz = _mm_set1_ps(wray.Sz);
+	const __m128 ox = _mm_set1_ps(wray.orig(wray.kx));
+	const __m128 oy = _mm_set1_ps(wray.orig(wray.ky));
+	const __m128 oz = _mm_set1_ps(wray.orig(wray.kz));
+
+	__m128 x[3], y[3], z[3];
+	for (int k = 0; k < 3; k++) {
+		__m128 px = _mm_sub_ps(_mm_loadu_ps(vtx[k][wray.kx]), ox);
+		__m128 py = _mm_sub_ps(_mm_loadu_ps(vtx[k][wray.ky]), oy);
+		z[k] = _mm_sub_ps(_mm_loadu_ps(vtx[k][wray.kz]), oz);
+		x[k] = _mm_sub_ps(px, _mm_mul_ps(Sx, z[k]));
+		y[k] = _mm_sub_ps(py, _mm_mul_ps(Sy, z[k]));
+	}
+
+	__m128 U = _mm_sub_ps(_mm_mul_ps(x[2], y[1]), _mm_mul_ps(y[2], x[1]));
+	__m128 V = _mm_sub_ps(_mm_mul_ps(x[0], y[2]), _mm_mul_ps(y[0], x[2]));
+	__m128 W = _mm_sub_ps(_mm_mul_ps(x[1], y[0]), _mm_mul_ps(y[1], x[0]));
+
+	int valid = (1 << size) - 1;
+	// Lanes hitting edge or vertex need double precision, they are tested alone.
+	int edge = _mm_movemask_ps(_mm_or_ps(_mm_cmpeq_ps(U, zero), _mm_or_ps(_mm_cmpeq_ps(V, zero), _mm_cmpeq_ps(W, zero)))) & valid;
+
+	__m128 neg = _mm_or_ps(_mm_cmplt_ps(U, zero), _mm_or_ps(_mm_cmplt_ps(V, zero), _mm_cmplt_ps(W, zero)));
+	__m128 pos = _mm_or_ps(_mm_cmpgt_ps(U, zero), _mm_or_ps(_mm_cmpgt_ps(V, zero), _mm_cmpgt_ps(W, zero)));
+	__m128 det = _mm_add_ps(_mm_add_ps(U, V), W);
+	int hit = ~_mm_movemask_ps(_mm_or_ps(_mm_and_ps(neg, pos), _mm_cmpeq_ps(det, zero))) & valid & ~edge;
+
+	__m128 T = _mm_add_ps(_mm_add_ps(_mm_mul_ps(U, _mm_mul_ps(Sz, z[0])), _mm_mul_ps(V, _mm_mul_ps(Sz, z[1]))),
+		_mm_mul_ps(W, _mm_mul_ps(Sz, z[2])));
+	// Division by zero in missed lanes is masked out.
+	__m128 rcpDet = _mm_div_ps(_mm_set1_ps(1.0f), det);
+	t = _mm_mul_ps(T, rcpDet);
+	b0 = _mm_mul_ps(U, rcpDet);
+	b1 = _mm_mul_ps(V, rcpDet);
+	b2 = _mm_mul_ps(W, rcpDet);
+
+	if (edge) {
+		float at[TRIANGLE_BATCH_SIZE], ab0[TRIANGLE_BATCH_SIZE], ab1[TRIANGLE_BATCH_SIZE], ab2[TRIANGLE_BATCH_SIZE];
+		_mm_storeu_ps(at, t);
+		_mm_storeu_ps(ab0, b0);
+		_mm_storeu_ps(ab1, b1);
+		_mm_storeu_ps(ab2, b2);
+		for (unsigned int lane = 0; lane < size; lane++) {
+			if ((edge & (1 << lane)) && intersectWatertight(wray, triangles[lane]->getVtxPosition(0),
+				triangles[lane]->getVtxPosition(1), triangles[lane]->getVtxPosition(2), at[lane], ab0[lane], ab1[lane], ab2[lane]))
+				hit |= 1 << lane;
+		}
+		t = _mm_loadu_ps(at);
+		b0 = _mm_loadu_ps(ab0);
+		b1 = _mm_loadu_ps(ab1);
+		b2 = _mm_loadu_ps(ab2);
+	}
+
+	// Range of ray.
+	__m128 inRange = _mm_and_ps(_mm_cmpgt_ps(t, _mm_set1_ps(ray.minT)), _mm_cmplt_ps(t, _mm_set1_ps(ray.maxT)));
+	return hit & _mm_movemask_ps(inRange);
+}
+
+bool TriangleBatch::intersect(const WatertightRay& wray, const Ray& ray) const
+{
+	__m128 t, b0, b1, b2;
+	return test(wray, ray, t, b0, b1, b2) != 0;
+}
+
+int TriangleBatch::intersect(const WatertightRay& wray, const Ray& ray, float& t, float& b0, float& b1, float& b2) const
+{
+	__m128 vt, vb0, vb1, vb2;
+	int hit = test(wray, ray, vt, vb0, vb1, vb2);
+	if (!hit)
+		return -1;
+
+	float at[TRIANGLE_BATCH_SIZE], ab0[TRIANGLE_BATCH_SIZE], ab1[TRIANGLE_BATCH_SIZE], ab2[TRIANGLE_BATCH_SIZE];
+	_mm_storeu_ps(at, vt);
+	_mm_storeu_ps(ab0, vb0);
+	_mm_storeu_ps(ab1, vb1);
+	_mm_storeu_ps(ab2, vb2);
+
+	int nearest = -1;
+	for (unsigned int lane = 0; lane < size; lane++) {
+		if ((hit & (1 << lane)) && (nearest < 0 || at[lane] < at[nearest]))
+			nearest = lane;
+	}
+	t = at[nearest];
+	b0 = ab0[nearest];
+	b1 = ab1[nearest];
+	b2 = ab2[nearest];
+	return nearest;
+}
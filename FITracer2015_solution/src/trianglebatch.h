@@ -0,0 +1,60 @@
+/*
+	Name: trianglebatch.h
+	Desc: Watertight ray-triangle intersection of one triangle and of SSE batch.
+	Author: Karel Brezina (xbrezi13)
+*/
+
+#ifndef _TRIANGLE_BATCH_H_
+#define _TRIANGLE_BATCH_H_
+
+#include "ray.h"
+#include <xmmintrin.h>
+
+class Triangle;
+
+// Triangles tested by one SSE instruction.
+#define TRIANGLE_BATCH_SIZE 4
+
+// Ray prepared for watertight test (Woop, Benthin, Wald 2013). Axis kz is
+// largest component of direction and shear moves direction to +z, so edge
+// functions of triangle are computed in 2D. Shared edge gives same value
+// with opposite sign for both triangles, ray can not pass between them.
+struct WatertightRay {
+	Point3D orig;
+	int kx, ky, kz;
+	float Sx, Sy, Sz;
+
+	WatertightRay(const Ray& ray);
+};
+
+// Watertight test of one triangle, range of ray is not checked. Returns distance
+// and barycentric coordinates b0, b1, b2 of vertices v0, v1, v2.
+bool intersectWatertight(const WatertightRay& ray, const Point3D& v0, const Point3D& v1,
+	const Point3D& v2, float& t, float& b0, float& b1, float& b2);
+
+// Vertices of up to TRIANGLE_BATCH_SIZE triangles as structure of arrays,
+// all of them are tested at once by same watertight test.
+class TriangleBatch {
+public:
+	TriangleBatch();
+
+	// Add triangle to next free lane, returns false if batch is full.
+	bool add(Triangle* triangle);
+	unsigned int getSize() const { return size; }
+	Triangle* getTriangle(int lane) const { return triangles[lane]; }
+
+	// Is any triangle hit in range of ray?
+	bool intersect(const WatertightRay& wray, const Ray& ray) const;
+	// Nearest hit in range of ray, returns its lane or -1.
+	int intersect(const WatertightRay& wray, const Ray& ray, float& t, float& b0, float& b1, float& b2) const;
+
+private:
+	// Mask of hit lanes, distances and barycentric coordinates of all lanes.
+	int test(const WatertightRay& wray, const Ray& ray, __m128& t, __m128& b0, __m128& b1, __m128& b2) const;
+
+	float vtx[3][3][TRIANGLE_BATCH_SIZE];	// [vertex][axis][lane]
+	Triangle* triangles[TRIANGLE_BATCH_SIZE];
+	unsigned int size;
+};
+
+#endif // _TRIANGLE_BATCH_H_
@@ -85,7 +85,40 @@ void UniformAccelerator::insertObject(Point3D point_max, Point3D point_min, Inte
 	}
 }
 
-bool UniformAccelerator::intersect(const Ray& ray) 
+// Cells are leafs of one level below box, ray pays traversal of every cell
+// it passes, so cost sums cells weighted by their share of box surface.
+AcceleratorStats UniformAccelerator::getStats()
+{
+	AcceleratorStats stats;
+	int size = GRID_SIZE * GRID_SIZE * GRID_SIZE;
+	stats.nodes = size + 1;
+	stats.leaves = size;
+	stats.maxDepth = 1;
+	stats.avgDepth = 1.0f;
+
+	AABB cell(Point3D(0.0f, 0.0f, 0.0f), cell_size);
+	float area = box.getArea();
+	float p = (area > 0.0f) ? cell.getArea() / area : 0.0f;
+	stats.cost = 1.0f;
+	for (int i = 0; i < size; i++) {
+		unsigned int count = 0;
+		for (UniNode* node = voxels[i]; node != NULL; node = node->getNext())
+			count++;
+		if (count == 0)
+			stats.emptyLeaves++;
+		stats.references += count;
+		stats.maxLeafObjects = std::max(stats.maxLeafObjects, count);
+		stats.cost += p * (1.0f + count);
+	}
+
+	unsigned int filled = stats.leaves - stats.emptyLeaves;
+	stats.avgLeafObjects = filled ? (float)stats.references / filled : 0.0f;
+	stats.duplication = c_objects.empty() ? 0.0f : (float)stats.references / c_objects.size();
+	stats.memory = size * sizeof(UniNode*) + stats.references * sizeof(UniNode);
+	return stats;
+}
+
+bool UniformAccelerator::intersect(const Ray& ray, TraversalCounters* counters)
 {
 	float xAxis, yAxis, zAxis;
 	Vector3D dir = ray.dir;
@@ -133,19 +166,22 @@ bool UniformAccelerator::intersect(const Ray& ray)
 	tDelta.y = cell_size.y;
 	tDelta.z = cell_size.z;
 
+	Mailbox mailbox;
+
 	while ((X < GRID_SIZE) && (X >= 0) &&
 		(Y < GRID_SIZE) && (Y >= 0) &&
 		(Z < GRID_SIZE) && (Z >= 0)) {
 
 		id = int(X + Y * GRID_SIZE + Z * GRID_SIZE * GRID_SIZE);
+		countNode(counters);
 		UniNode* oct = voxels[id];
 		while (oct != NULL) {
-			if (c_objects[oct->getObject()]->rayID == ray.ID) {
+			if (mailbox.check(c_objects[oct->getObject()])) {
 				oct = oct->getNext();
 				continue;
 			}
-			c_objects[oct->getObject()]->rayID = ray.ID;
 
+			countPrimitive(counters);
 			if (c_objects[oct->getObject()]->intersect(ray))
 				return true;
 			oct = oct->getNext();
@@ -180,7 +216,7 @@ bool UniformAccelerator::intersect(const Ray& ray)
 	return false;
 }
 
-bool UniformAccelerator::intersect(const Ray& ray, Intersection& is) 
+bool UniformAccelerator::intersect(const Ray& ray, Intersection& is, TraversalCounters* counters)
 {
 	float xAxis, yAxis, zAxis;
 	Vector3D dir = ray.dir;
@@ -228,21 +264,24 @@ bool UniformAccelerator::intersect(const Ray& ray, Intersection& is)
 	tDelta.y = cell_size.y;
 	tDelta.z = cell_size.z;
 
+	Mailbox mailbox;
+
 	while ((X < GRID_SIZE) && (X >= 0) &&
 		(Y < GRID_SIZE) && (Y >= 0) &&
 		(Z < GRID_SIZE) && (Z >= 0)) {
 
 		id = int(X + Y * GRID_SIZE + Z * GRID_SIZE * GRID_SIZE);
+		countNode(counters);
 		UniNode* oct = voxels[id];
 		Intersection currentIs;
 
 		while (oct != NULL) {
-			if (c_objects[oct->getObject()]->rayID == ray.ID) {
+			if (mailbox.check(c_objects[oct->getObject()])) {
 				oct = oct->getNext();
 				continue;
 			}
-			c_objects[oct->getObject()]->rayID = ray.ID;
 
+			countPrimitive(counters);
 			if (c_objects[oct->getObject()]->intersect(ray, currentIs)) {
 				if (currentIs.mHitTime < is.mHitTime) {
 					is = currentIs;
@@ -8,6 +8,7 @@
 #define _UNIFORM_GRID_H_
 
 #include "rayaccelerator.h"
+#include "mailbox.h"
 #include "matrix.h"
 
 #define GRID_SIZE 120
@@ -27,15 +28,20 @@ private:
 	UniNode* next;
 };
 
+// Grid is not cached unlike trees. It is built by one pass over objects
+// without sorting, and cells are linked lists allocated node by node, which
+// load from cache would have to allocate again, so it would not be faster.
 class UniformAccelerator : public RayAccelerator {
 public:
 	virtual void build(const std::vector<Intersectable*>& objects);
-	virtual bool intersect(const Ray& ray);
-	virtual bool intersect(const Ray& ray, Intersection& is);
+	virtual bool intersect(const Ray& ray, TraversalCounters* counters = NULL);
+	virtual bool intersect(const Ray& ray, Intersection& is, TraversalCounters* counters = NULL);
 
 	void insertObject(Point3D point_max, Point3D point_min, Intersectable* obj, int index);
 
 	virtual std::vector<Intersectable*> getObjects() { return c_objects; }
+	virtual AcceleratorStats getStats();
+	virtual RayAccelerator* createEmpty() const { return new UniformAccelerator(); }
 
 	AABB getBox() { return box; }
 	Point3D getWorldSize() { return world_size; }
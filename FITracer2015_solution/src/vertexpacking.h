@@ -0,0 +1,109 @@
+/*
+	Name: vertexpacking.h
+	Desc: Compact encoding of vertex attributes.
+	Author: Karel Brezina (xbrezi13)
+*/
+
+#ifndef _VERTEX_PACKING_H_
+#define _VERTEX_PACKING_H_
+
+#include "matrix.h"
+#include <cstring>
+#include <cmath>
+
+// Unit vector in octahedral mapping, 16 bits for each of two coordinates.
+static inline unsigned int packNormal(const Vector3D& n)
+{
+	float l1 = std::fabs(n.x) + std::fabs(n.y) + std::fabs(n.z);
+	float u = (l1 > 0.0f) ? n.x / l1 : 0.0f;
+	float v = (l1 > 0.0f) ? n.y / l1 : 0.0f;
+	// Lower hemisphere is folded over diagonals.
+	if (n.z < 0.0f) {
+		float fu = (1.0f - std::fabs(v)) * (u >= 0.0f ? 1.0f : -1.0f);
+		float fv = (1.0f - std::fabs(u)) * (v >= 0.0f ? 1.0f : -1.0f);
+		u = fu;
+		v = fv;
+	}
+	unsigned int pu = (unsigned int)((u * 0.5f + 0.5f) * 65535.0f + 0.5f);
+	unsigned int pv = (unsigned int)((v * 0.5f + 0.5f) * 65535.0f + 0.5f);
+	return pu | (pv << 16);
+}
+
+static inline Vector3D unpackNormal(unsigned int packed)
+{
+	float u = (packed & 0xffff) * (2.0f / 65535.0f) - 1.0f;
+	float v = (packed >> 16) * (2.0f / 65535.0f) - 1.0f;
+	Vector3D n(u, v, 1.0f - std::fabs(u) - std::fabs(v));
+	if (n.z < 0.0f) {
+		n.x = (1.0f - std::fabs(v)) * (u >= 0.0f ? 1.0f : -1.0f);
+		n.y = (1.0f - std::fabs(u)) * (v >= 0.0f ? 1.0f : -1.0f);
+	}
+	return n.normalize();
+}
+
+// IEEE half float, rounded to nearest even.
+static inline unsigned short packHalf(float f)
+{
+	unsigned int x;
+	memcpy(&x, &f, sizeof(x));
+	unsigned int sign = (x >> 16) & 0x8000;
+	unsigned int mantissa = x & 0x7fffff;
+	int exponent = (int)((x >> 23) & 0xff) - 127 + 15;
+
+	// Infinity and NaN.
+	if (((x >> 23) & 0xff) == 0xff)
+		return (unsigned short)(sign | 0x7c00 | (mantissa ? 0x200 : 0));
+	if (exponent >= 31)
+		return (unsigned short)(sign | 0x7c00);
+	// Denormal half or zero.
+	if (exponent <= 0) {
+		if (exponent < -10)
+			return (unsigned short)sign;
+		mantissa |= 0x800000;
+		int shift = 14 - exponent;
+		unsigned int half = mantissa >> shift;
+		unsigned int rest = mantissa & ((1u << shift) - 1);
+		unsigned int halfway = 1u << (shift - 1);
+		if (rest > halfway || (rest == halfway && (half & 1)))
+			half++;
+		return (unsigned short)(sign | half);
+	}
+	// Carry of rounding may go to exponent, which is correct.
+	unsigned int half = (exponent << 10) | (mantissa >> 13);
+	unsigned int rest = mantissa & 0x1fff;
+	if (rest > 0x1000 || (rest == 0x1000 && (half & 1)))
+		half++;
+	return (unsigned short)(sign | half);
+}
+
+static inline float unpackHalf(unsigned short h)
+{
+	unsigned int sign = (h & 0x8000) << 16;
+	unsigned int exponent = (h >> 10) & 0x1f;
+	unsigned int mantissa = h & 0x3ff;
+	unsigned int x;
+	if (exponent == 0) {
+		float f = mantissa * (1.0f / 16777216.0f);
+		return sign ? -f : f;
+	}
+	if (exponent == 31)
+		x = sign | 0x7f800000 | (mantissa << 13);
+	else
+		x = sign | ((exponent + 112) << 23) | (mantissa << 13);
+	float f;
+	memcpy(&f, &x, sizeof(f));
+	return f;
+}
+
+// Texture coordinates as two half floats, u in lower bits.
+static inline unsigned int packUV(const UV& uv)
+{
+	return packHalf(uv.u) | ((unsigned int)packHalf(uv.v) << 16);
+}
+
+static inline UV unpackUV(unsigned int packed)
+{
+	return UV(unpackHalf(packed & 0xffff), unpackHalf(packed >> 16));
+}
+
+#endif // _VERTEX_PACKING_H_